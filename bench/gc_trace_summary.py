@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""
+Summarize a GC trace written by a program run with TINY_GC_TRACE=1.
+
+The trace (see gc.c) is one JSON object per line:
+- init  : pid, sampling interval in bytes, initial threshold
+- gc    : one per collection - pause / mark / sweep time, marked and swept
+          object counts, heap bytes and object counts before and after
+- alloc : sampled allocation - type, size, .tl file/line and the number of
+          allocated bytes the sample stands for (weight)
+- exit  : totals at program exit
+
+The summary reports pause statistics, heap growth, and the .tl lines (and
+object types) responsible for most of the allocated bytes, i.e. the lines
+that drive GC pressure.
+
+Usage:
+    TINY_GC_TRACE=1 TINY_GC_TRACE_FILE=gc.log ./interpreter prog.tl
+    python3 bench/gc_trace_summary.py gc.log [--top 15] [--json out.json]
+"""
+import argparse
+import json
+import sys
+from collections import defaultdict
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return 0.0
+    k = (len(sorted_values) - 1) * pct / 100.0
+    lo = int(k)
+    hi = min(lo + 1, len(sorted_values) - 1)
+    return sorted_values[lo] + (sorted_values[hi] - sorted_values[lo]) * (k - lo)
+
+
+def load(path):
+    events = {"init": None, "exit": None, "gc": [], "alloc": []}
+    with (sys.stdin if path == "-" else open(path)) as f:
+        for lineno, line in enumerate(f, 1):
+            line = line.strip()
+            if not line.startswith("{"):
+                continue  # program output interleaved on stderr
+            try:
+                ev = json.loads(line)
+            except json.JSONDecodeError:
+                print(f"warning: {path}:{lineno}: malformed record", file=sys.stderr)
+                continue
+            kind = ev.get("ev")
+            if kind in ("gc", "alloc"):
+                events[kind].append(ev)
+            elif kind in ("init", "exit"):
+                events[kind] = ev
+    return events
+
+
+def summarize(events, top):
+    gcs = events["gc"]
+    pauses = sorted(g["pause_us"] for g in gcs)
+    end_us = events["exit"]["t_us"] if events["exit"] else (gcs[-1]["t_us"] if gcs else 0)
+    total_pause = sum(pauses)
+
+    summary = {
+        "collections": len(gcs),
+        "runtime_us": end_us,
+        "pause_total_us": total_pause,
+        "pause_share_pct": 100.0 * total_pause / end_us if end_us else 0.0,
+        "pause_mean_us": total_pause / len(pauses) if pauses else 0.0,
+        "pause_p50_us": percentile(pauses, 50),
+        "pause_p99_us": percentile(pauses, 99),
+        "pause_max_us": pauses[-1] if pauses else 0.0,
+        "mark_total_us": sum(g["mark_us"] for g in gcs),
+        "sweep_total_us": sum(g["sweep_us"] for g in gcs),
+        "swept_objects": sum(g["swept"] for g in gcs),
+        "swept_bytes": sum(g["swept_bytes"] for g in gcs),
+        "heap_peak_bytes": max((g["heap_before"] for g in gcs), default=0),
+        "live_after_last_gc_bytes": gcs[-1]["heap_after"] if gcs else 0,
+    }
+
+    sites = defaultdict(lambda: {"bytes": 0, "samples": 0, "types": defaultdict(int)})
+    by_type = defaultdict(int)
+    for a in events["alloc"]:
+        key = (a["file"], a["line"])
+        site = sites[key]
+        site["bytes"] += a["weight"]
+        site["samples"] += 1
+        site["types"][a["type"]] += a["weight"]
+        by_type[a["type"]] += a["weight"]
+    sampled = sum(by_type.values())
+
+    ranked = sorted(sites.items(), key=lambda kv: -kv[1]["bytes"])
+    summary["sampled_bytes"] = sampled
+    summary["alloc_by_type"] = dict(sorted(by_type.items(), key=lambda kv: -kv[1]))
+    summary["alloc_sites"] = [
+        {
+            "file": f,
+            "line": ln,
+            "bytes": s["bytes"],
+            "pct": 100.0 * s["bytes"] / sampled if sampled else 0.0,
+            "samples": s["samples"],
+            "types": dict(sorted(s["types"].items(), key=lambda kv: -kv[1])),
+        }
+        for (f, ln), s in ranked[:top]
+    ]
+    return summary
+
+
+def fmt_bytes(n):
+    for unit in ("B", "KiB", "MiB", "GiB"):
+        if abs(n) < 1024 or unit == "GiB":
+            return f"{n:.0f} {unit}" if unit == "B" else f"{n:.1f} {unit}"
+        n /= 1024.0
+
+
+def print_summary(s, events):
+    init = events["init"] or {}
+    print("=== GC pauses ===")
+    print(f"collections      : {s['collections']}")
+    print(f"run time         : {s['runtime_us'] / 1e6:.3f} s")
+    print(f"total pause      : {s['pause_total_us'] / 1e3:.2f} ms ({s['pause_share_pct']:.1f}% of run time)")
+    print(f"  mark / sweep   : {s['mark_total_us'] / 1e3:.2f} ms / {s['sweep_total_us'] / 1e3:.2f} ms")
+    print(f"pause mean / p50 : {s['pause_mean_us']:.1f} us / {s['pause_p50_us']:.1f} us")
+    print(f"pause p99 / max  : {s['pause_p99_us']:.1f} us / {s['pause_max_us']:.1f} us")
+    print(f"swept            : {s['swept_objects']} objects, {fmt_bytes(s['swept_bytes'])}")
+    print(f"heap peak        : {fmt_bytes(s['heap_peak_bytes'])} (live after last GC: "
+          f"{fmt_bytes(s['live_after_last_gc_bytes'])})")
+    print()
+    rate = init.get("sample_bytes", 0)
+    print(f"=== Allocation by type (sampled every {fmt_bytes(rate)}) ===")
+    for t, b in s["alloc_by_type"].items():
+        pct = 100.0 * b / s["sampled_bytes"] if s["sampled_bytes"] else 0.0
+        print(f"{fmt_bytes(b):>12}  {pct:5.1f}%  {t}")
+    print()
+    print("=== Top allocation sites ===")
+    for site in s["alloc_sites"]:
+        types = ", ".join(f"{t} {100.0 * b / site['bytes']:.0f}%" for t, b in site["types"].items())
+        print(f"{fmt_bytes(site['bytes']):>12}  {site['pct']:5.1f}%  {site['file']}:{site['line']}  ({types})")
+    if not s["alloc_sites"]:
+        print("(no samples - lower TINY_GC_SAMPLE, or build LLVM programs with --instrument)")
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Summarize a TINY_GC_TRACE log")
+    ap.add_argument("trace", help="trace file written via TINY_GC_TRACE_FILE ('-' for stdin)")
+    ap.add_argument("--top", type=int, default=15, help="number of allocation sites to list")
+    ap.add_argument("--json", metavar="PATH", help="also write the summary as JSON")
+    args = ap.parse_args()
+
+    events = load(args.trace)
+    if events["init"] is None and not events["gc"] and not events["alloc"]:
+        print(f"error: no trace records in {args.trace}", file=sys.stderr)
+        return 1
+    summary = summarize(events, args.top)
+    print_summary(summary, events)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(summary, f, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
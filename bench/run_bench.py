@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""
+Benchmark runner for the .tl workloads in bench/.
+
+Each workload is run on every selected backend:
+- interpreter : c_using_llvm/interpreter <file>
+- llvm        : c_using_llvm/codegen_llvm <file> -o <bin>, then <bin>
+- c           : c_using_llvm/c_codegen <file> -o <bin>, then <bin>
+- py          : python3 py/main.py <file>
+
+Compilation is done once per workload/backend and reported separately; only
+the run of the program itself is timed. After `--warmup` untimed runs, each
+program is run `--reps` times and the mean, median, min, stddev and a 95%
+confidence interval are reported, together with peak RSS (from wait4) and the
+number of GC collections (C backends, parsed from a trailing gc_stat()).
+Linux carries the high-water mark of the forking process over exec, so peak
+RSS never reads below the runner's own footprint; that floor is measured with
+/bin/true and recorded as `rss_floor_kb` in the JSON metadata.
+
+Outputs of all backends are compared against the interpreter's, so a backend
+that computes a different result is reported as a mismatch rather than timed
+as if it were correct.
+
+Results can be written as JSON (`--json`) and compared against a stored
+baseline (`--baseline`); a workload is a regression when it is slower than
+the baseline by more than `--threshold` percent and the confidence intervals
+do not overlap. `--save-baseline` writes the current results as the baseline.
+"""
+import argparse
+import json
+import math
+import os
+import platform
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent.parent
+BENCH_DIR = ROOT / "bench"
+C_DIR = ROOT / "c_using_llvm"
+INTERPRETER = C_DIR / "interpreter"
+LLVM_COMPILER = C_DIR / "codegen_llvm"
+C_COMPILER = C_DIR / "c_codegen"
+PY_MAIN = ROOT / "py" / "main.py"
+DEFAULT_BASELINE = BENCH_DIR / "baseline.json"
+
+BACKENDS = ["interpreter", "llvm", "c", "py"]
+
+# Appended to workloads for the C backends so every run reports GC activity.
+GC_PROBE = "\ngc_stat()\n"
+GC_COLLECTIONS_RE = re.compile(r"^Total collections: (\d+)", re.M)
+
+# Two-sided 95% Student t quantiles, indexed by degrees of freedom.
+T95 = {
+    1: 12.706, 2: 4.303, 3: 3.182, 4: 2.776, 5: 2.571, 6: 2.447, 7: 2.365,
+    8: 2.306, 9: 2.262, 10: 2.228, 11: 2.201, 12: 2.179, 13: 2.160,
+    14: 2.145, 15: 2.131, 16: 2.120, 17: 2.110, 18: 2.101, 19: 2.093,
+    20: 2.086, 25: 2.060, 30: 2.042,
+}
+
+
+def t95(df: int) -> float:
+    if df in T95:
+        return T95[df]
+    if df > 30:
+        return 1.96
+    # Nearest tabulated value below df (slightly conservative)
+    return T95[max(k for k in T95 if k < df)]
+
+
+def ensure_built():
+    """Build the C toolchain once before benchmarking."""
+    result = subprocess.run(
+        ["make", "-C", str(C_DIR)],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        text=True,
+    )
+    if result.returncode != 0:
+        print(result.stdout)
+        sys.exit(result.returncode)
+
+
+def normalize_output(out: str) -> str:
+    """Strip GC chatter so outputs of different backends can be compared."""
+    out = out.split("\n=== GC Statistics ===")[0]
+    lines = [l.rstrip() for l in out.splitlines() if not l.startswith("GC: ")]
+    return "\n".join(lines).strip()
+
+
+def run_timed(cmd, cwd, timeout):
+    """Run cmd, return (returncode, stdout, stderr, seconds, peak_rss_kb)."""
+    with tempfile.TemporaryFile() as fout, tempfile.TemporaryFile() as ferr:
+        start = time.perf_counter()
+        proc = subprocess.Popen(cmd, cwd=cwd, stdout=fout, stderr=ferr)
+        timer = threading.Timer(timeout, proc.kill)
+        timer.start()
+        _, status, usage = os.wait4(proc.pid, 0)
+        elapsed = time.perf_counter() - start
+        timed_out = not timer.is_alive()
+        timer.cancel()
+        if timed_out:
+            return None, "", "timeout", elapsed, usage.ru_maxrss
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        fout.seek(0)
+        ferr.seek(0)
+        out = fout.read().decode(errors="replace")
+        err = ferr.read().decode(errors="replace")
+    # ru_maxrss is in kilobytes on Linux
+    return proc.returncode, out, err, elapsed, usage.ru_maxrss
+
+
+def prepare(backend: str, workload: Path, tmpdir: Path):
+    """
+    Compile the workload for backend if needed.
+    Returns (cmd, cwd, compile_seconds, error_message).
+    """
+    src = workload
+    if backend in ("interpreter", "llvm", "c"):
+        src = tmpdir / f"{workload.stem}.{backend}.tl"
+        src.write_text(workload.read_text() + GC_PROBE)
+
+    if backend == "interpreter":
+        return [str(INTERPRETER), str(src)], C_DIR, 0.0, None
+    if backend == "py":
+        return [sys.executable, str(PY_MAIN), str(src)], PY_MAIN.parent, 0.0, None
+
+    compiler = LLVM_COMPILER if backend == "llvm" else C_COMPILER
+    exe = tmpdir / f"{workload.stem}.{backend}.bin"
+    start = time.perf_counter()
+    proc = subprocess.run(
+        [str(compiler), str(src), "-o", str(exe)],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT,
+        text=True,
+        cwd=C_DIR,
+    )
+    compile_s = time.perf_counter() - start
+    if proc.returncode != 0 or not exe.exists():
+        lines = [l.strip() for l in proc.stdout.splitlines() if l.strip()]
+        errors = [l for l in lines if "error" in l.lower()]
+        msg = (errors or lines or [f"exit {proc.returncode}"])[0]
+        return None, None, compile_s, "compile failed: " + msg
+    return [str(exe)], C_DIR, compile_s, None
+
+
+def summarize(times):
+    n = len(times)
+    mean = statistics.fmean(times)
+    stdev = statistics.stdev(times) if n > 1 else 0.0
+    ci = t95(n - 1) * stdev / math.sqrt(n) if n > 1 else 0.0
+    return {
+        "mean": mean,
+        "median": statistics.median(times),
+        "min": min(times),
+        "stdev": stdev,
+        "ci95": ci,
+    }
+
+
+def bench_one(backend, workload, tmpdir, args, reference):
+    result = {"workload": workload.stem, "backend": backend, "status": "ok"}
+    cmd, cwd, compile_s, err = prepare(backend, workload, tmpdir)
+    result["compile_s"] = compile_s
+    if err:
+        result["status"] = "unsupported"
+        result["error"] = err
+        return result
+
+    times, rss, gcs = [], [], []
+    output = None
+    for i in range(args.warmup + args.reps):
+        code, out, err, elapsed, peak = run_timed(cmd, cwd, args.timeout)
+        if code != 0:
+            result["status"] = "timeout" if code is None else "error"
+            result["error"] = (err.strip().splitlines() or [f"exit {code}"])[-1]
+            return result
+        output = normalize_output(out)
+        if i < args.warmup:
+            continue
+        times.append(elapsed)
+        rss.append(peak)
+        m = GC_COLLECTIONS_RE.search(out)
+        if m:
+            gcs.append(int(m.group(1)))
+
+    if reference is not None and output != reference:
+        result["status"] = "mismatch"
+        result["error"] = "output differs from interpreter"
+    result["output"] = output
+    result["times"] = times
+    result.update(summarize(times))
+    result["peak_rss_kb"] = max(rss)
+    result["gc_collections"] = max(gcs) if gcs else None
+    return result
+
+
+def compare(results, baseline, threshold):
+    """Annotate results with the change vs baseline; return regressions."""
+    base = {(r["workload"], r["backend"]): r for r in baseline.get("results", [])}
+    regressions = []
+    for r in results:
+        b = base.get((r["workload"], r["backend"]))
+        if not b or r["status"] != "ok" or b.get("status") != "ok":
+            continue
+        ratio = r["mean"] / b["mean"] if b["mean"] > 0 else 1.0
+        r["baseline_mean"] = b["mean"]
+        r["change_pct"] = (ratio - 1.0) * 100.0
+        slower = r["mean"] - r["ci95"] > b["mean"] + b.get("ci95", 0.0)
+        if r["change_pct"] > threshold and slower:
+            r["regression"] = True
+            regressions.append(r)
+    return regressions
+
+
+def print_table(results):
+    header = f"{'workload':<16} {'backend':<12} {'mean(s)':>9} {'±95%':>8} {'min(s)':>9} {'rss(MB)':>8} {'gc':>6} {'vs base':>9}"
+    print(header)
+    print("-" * len(header))
+    for r in results:
+        name = f"{r['workload']:<16} {r['backend']:<12}"
+        if r["status"] not in ("ok", "mismatch"):
+            print(f"{name} {r['status'].upper()}: {r.get('error', '')}")
+            continue
+        gc = "-" if r["gc_collections"] is None else str(r["gc_collections"])
+        delta = f"{r['change_pct']:+.1f}%" if "change_pct" in r else ""
+        if r.get("regression"):
+            delta += " !"
+        line = (f"{name} {r['mean']:>9.4f} {r['ci95']:>8.4f} {r['min']:>9.4f} "
+                f"{r['peak_rss_kb'] / 1024:>8.1f} {gc:>6} {delta:>9}")
+        if r["status"] == "mismatch":
+            line += "  MISMATCH"
+        print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark .tl workloads across backends.")
+    parser.add_argument("--backend", action="append", choices=BACKENDS,
+                        help="Backend to run (repeatable, default: all)")
+    parser.add_argument("--filter", help="Substring filter for workload filenames", default="")
+    parser.add_argument("--warmup", type=int, default=1, help="Untimed runs before measuring")
+    parser.add_argument("--reps", type=int, default=5, help="Timed runs per workload")
+    parser.add_argument("--timeout", type=float, default=300.0, help="Per-run timeout in seconds")
+    parser.add_argument("--json", help="Write results as JSON to this path")
+    parser.add_argument("--baseline", default=str(DEFAULT_BASELINE), help="Baseline JSON to compare against")
+    parser.add_argument("--save-baseline", action="store_true", help="Write results to the baseline path")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="Slowdown in percent that counts as a regression")
+    args = parser.parse_args()
+
+    if args.reps < 1:
+        parser.error("--reps must be at least 1")
+    backends = args.backend or BACKENDS
+
+    ensure_built()
+
+    workloads = sorted(BENCH_DIR.glob("*.tl"))
+    if args.filter:
+        workloads = [w for w in workloads if args.filter in w.name]
+    if not workloads:
+        print("No workloads found.")
+        return 1
+
+    results = []
+    with tempfile.TemporaryDirectory() as tmp:
+        tmpdir = Path(tmp)
+        for w in workloads:
+            reference = None
+            # The interpreter output is the reference for the other backends
+            order = sorted(backends, key=lambda b: b != "interpreter")
+            for backend in order:
+                print(f"[RUN] {w.name} ({backend})", file=sys.stderr)
+                r = bench_one(backend, w, tmpdir, args, reference)
+                if backend == "interpreter" and r["status"] == "ok":
+                    reference = r["output"]
+                results.append(r)
+
+    for r in results:
+        r.pop("output", None)
+
+    regressions = []
+    baseline_path = Path(args.baseline)
+    if baseline_path.exists() and not args.save_baseline:
+        regressions = compare(results, json.loads(baseline_path.read_text()), args.threshold)
+
+    print_table(results)
+
+    doc = {
+        "meta": {
+            "timestamp": time.strftime("%Y-%m-%dT%H:%M:%S"),
+            "host": platform.node(),
+            "platform": platform.platform(),
+            "python": platform.python_version(),
+            "warmup": args.warmup,
+            "reps": args.reps,
+            "rss_floor_kb": run_timed(["true"], ROOT, args.timeout)[4],
+        },
+        "results": results,
+    }
+    if args.json:
+        Path(args.json).write_text(json.dumps(doc, indent=2) + "\n")
+    if args.save_baseline:
+        baseline_path.write_text(json.dumps(doc, indent=2) + "\n")
+        print(f"\nBaseline saved to {baseline_path}")
+
+    failed = [r for r in results if r["status"] in ("error", "timeout", "mismatch")]
+    if regressions:
+        print(f"\n{len(regressions)} regression(s) over {args.threshold:.0f}% vs {baseline_path}.")
+    if failed:
+        print(f"{len(failed)} run(s) failed or produced different output.")
+    return 1 if regressions or failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
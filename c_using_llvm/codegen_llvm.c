@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include "probes.h"
+#include "runtime.h"
 
 void llvm_codegen_init(LLVMCodeGen *gen, FILE *out) {
     gen->out = out;
@@ -18,6 +21,46 @@ void llvm_codegen_init(LLVMCodeGen *gen, FILE *out) {
     gen->break_label = NULL;
     gen->continue_label = NULL;
     gen->functions = NULL;
+    gen->instrument = 0;
+    gen->debug_info = 0;
+    gen->instr_sites = NULL;
+    gen->instr_count = 0;
+    gen->cur_func = NULL;
+    gen->in_parallel_for = 0;
+    gen->in_generator = 0;
+    gen->pfor_count = 0;
+    gen->outlined = NULL;
+    gen->outlined_buf = NULL;
+    gen->outlined_len = 0;
+    gen->jit = 0;
+    gen->profile_gen = 0;
+    gen->profile = NULL;
+    gen->profile_count = 0;
+    gen->prof_sites = NULL;
+    gen->prof_count = 0;
+    gen->module_init = NULL;
+    gen->externs = NULL;
+    gen->stack_allocs = NULL;
+    gen->stack_count = 0;
+    gen->loop_reads = NULL;
+    gen->classes = NULL;
+    gen->cur_class = NULL;
+    gen->instances = NULL;
+    gen->global_instances = NULL;
+    gen->top_stmt = NULL;
+    gen->static_data = NULL;
+    gen->static_buf = NULL;
+    gen->static_len = 0;
+    gen->static_count = 0;
+}
+
+int llvm_codegen_load_profile(LLVMCodeGen *gen, const char *path) {
+    ProfRecord *records = NULL;
+    int n = prof_read(path, &records);
+    if (n < 0) return -1;
+    gen->profile = records;
+    gen->profile_count = n;
+    return 0;
 }
 
 static void emit_indent(LLVMCodeGen *gen) {
@@ -36,6 +79,9 @@ static char* new_temp(LLVMCodeGen *gen) {
 static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var);
 static void gen_statement(LLVMCodeGen *gen, ASTNode *node);
 static VarMapping* find_var_mapping_current_scope(LLVMCodeGen *gen, const char *original_name);
+static void plan_stack_allocs(LLVMCodeGen *gen, ASTNodeList *body);
+static void plan_dispatch(LLVMCodeGen *gen, ASTNodeList *body, ASTNodeList *params);
+static ClassInfo *find_class(LLVMCodeGen *gen, const char *name);
 static VarMapping* push_scope(LLVMCodeGen *gen, int *saved_depth) {
     if (saved_depth) *saved_depth = gen->scope_depth;
     gen->scope_depth++;
@@ -46,6 +92,7 @@ static void pop_scope(LLVMCodeGen *gen, VarMapping *saved, int saved_depth) {
     gen->scope_depth = saved_depth;
 }
 static const char* create_unique_var_name(LLVMCodeGen *gen, const char *original_name, int is_global);
+static const char* register_string_literal(LLVMCodeGen *gen, const char *str);
 static void codegen_error(ASTNode *node, const char *fmt, ...) {
     va_list ap;
     if (node && node->file) {
@@ -60,13 +107,429 @@ static void codegen_error(ASTNode *node, const char *fmt, ...) {
     exit(1);
 }
 
+// -g: source position markers, consumed by emit_debug_info() after codegen.
+// ";#fn" precedes a define, ";#loc" precedes the code of a statement.
+static void emit_debug_fn(LLVMCodeGen *gen, const char *name, const char *file, int line) {
+    if (!gen->debug_info) return;
+    fprintf(gen->out, ";#fn %d %s %s\n", line, name, file ? file : "<input>");
+}
+
+static void emit_debug_loc(LLVMCodeGen *gen, ASTNode *node) {
+    if (!gen->debug_info) return;
+    fprintf(gen->out, ";#loc %d %s\n", node->line, node->file ? node->file : "<input>");
+}
+
+// --instrument: bump a per-site i64 counter (@__instr_cnt_N)
+static void emit_instr_counter(LLVMCodeGen *gen, ASTNode *node, int is_entry) {
+    if (!gen->instrument) return;
+    InstrSiteInfo *site = malloc(sizeof(InstrSiteInfo));
+    site->func = gen->cur_func ? gen->cur_func : "<main>";
+    site->file = node && node->file ? node->file : "<input>";
+    site->line = node ? node->line : 0;
+    site->is_entry = is_entry;
+    site->next = gen->instr_sites;
+    gen->instr_sites = site;
+    int id = gen->instr_count++;
+
+    if (gen->in_parallel_for) {
+        // Several threads run the body
+        emit_indent(gen);
+        fprintf(gen->out, "atomicrmw add i64* @__instr_cnt_%d, i64 1 monotonic\n", id);
+        return;
+    }
+    char old_val[32], new_val[32];
+    snprintf(old_val, sizeof(old_val), "%%t%d", gen->temp_counter++);
+    snprintf(new_val, sizeof(new_val), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load i64, i64* @__instr_cnt_%d\n", old_val, id);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = add i64 %s, 1\n", new_val, old_val);
+    emit_indent(gen);
+    fprintf(gen->out, "store i64 %s, i64* @__instr_cnt_%d\n", new_val, id);
+}
+
+// --profile-gen / --profile-use: number the next type-feedback site. Sites
+// are told apart by kind, file, line and their order on the line, so a
+// profile stays usable as long as the source it was collected on does.
+static ProfSiteInfo *prof_site(LLVMCodeGen *gen, int kind, ASTNode *node) {
+    if (!gen->profile_gen && !gen->profile) return NULL;
+    ProfSiteInfo *site = malloc(sizeof(ProfSiteInfo));
+    site->kind = kind;
+    site->file = node->file ? node->file : "<input>";
+    site->line = node->line;
+    site->ordinal = 0;
+    for (ProfSiteInfo *s = gen->prof_sites; s != NULL; s = s->next) {
+        if (s->kind == kind && s->line == site->line && strcmp(s->file, site->file) == 0) {
+            site->ordinal = s->ordinal + 1;  // Newest first: s has the highest ordinal so far
+            break;
+        }
+    }
+    site->id = gen->prof_count++;
+    site->next = gen->prof_sites;
+    gen->prof_sites = site;
+    return site;
+}
+
+// --profile-gen: count the operand types reaching the site
+static void emit_prof_count(LLVMCodeGen *gen, ProfSiteInfo *site, const char *a, const char *b) {
+    if (!site || !gen->profile_gen) return;
+    emit_indent(gen);
+    fprintf(gen->out, "call void @%s(i64* getelementptr inbounds ([%d x i64], [%d x i64]* @__prof_cnt_%d, "
+            "i64 0, i64 0), %%Value %s, %%Value %s)\n",
+            site->kind == PROF_SITE_BINOP ? "prof_binop" : "prof_index",
+            PROF_BUCKETS, PROF_BUCKETS, site->id, a, b);
+}
+
+#define PROF_MIN_HITS 16      // Colder sites are left generic
+#define PROF_DOMINANT_PCT 95  // Share of the hits a bucket needs to be specialized
+
+// --profile-use: the bucket (nearly) every execution of the site fell into,
+// or PROF_OTHER when it is cold, polymorphic or missing from the profile
+static int prof_dominant(LLVMCodeGen *gen, ProfSiteInfo *site) {
+    if (!site || !gen->profile) return PROF_OTHER;
+    ProfRecord key = {site->kind, (char*)site->file, site->line, site->ordinal, {0}};
+    ProfRecord *r = bsearch(&key, gen->profile, gen->profile_count, sizeof(ProfRecord), prof_record_cmp);
+    if (!r) return PROF_OTHER;
+    long total = 0;
+    for (int b = 0; b < PROF_BUCKETS; b++) total += r->counts[b];
+    if (total < PROF_MIN_HITS) return PROF_OTHER;
+    for (int b = 0; b < PROF_OTHER; b++) {
+        if (r->counts[b] * 100 >= total * PROF_DOMINANT_PCT) return b;
+    }
+    return PROF_OTHER;
+}
+
+static void prof_temp(LLVMCodeGen *gen, char *buf) {
+    snprintf(buf, 32, "%%t%d", gen->temp_counter++);
+}
+
+// Branch on a guard the profile says holds; llvm.expect marks the other
+// side cold so the optimizer moves the generic call out of line
+static void emit_likely_br(LLVMCodeGen *gen, const char *cond, const char *likely, const char *unlikely) {
+    char hint[32];
+    prof_temp(gen, hint);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call i1 @llvm.expect.i1(i1 %s, i1 true)\n", hint, cond);
+    emit_indent(gen);
+    fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", hint, likely, unlikely);
+}
+
+// A top-level variable used inside a function or a parallel for body: tasks
+// must not see it (task.h), so check task_globals_hidden first. val is the
+// loaded value (functions and classes stay visible), or NULL for a store.
+static void emit_task_global_check(LLVMCodeGen *gen, ASTNode *node, VarMapping *m, const char *val) {
+    if (!m->is_global || gen->module_init || (!gen->cur_func && !gen->in_parallel_for)) return;
+    char hidden[32], visible[32], slow[32], done[32], name_ptr[32], file_ptr[32];
+    prof_temp(gen, hidden);
+    prof_temp(gen, visible);
+    snprintf(slow, sizeof(slow), "label%d", gen->label_counter++);
+    snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load i32, i32* @task_globals_hidden\n", hidden);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp eq i32 %s, 0\n", visible, hidden);
+    emit_likely_br(gen, visible, done, slow);
+
+    fprintf(gen->out, "\n%s:\n", slow);
+    const char *file = node->file ? node->file : "<input>";
+    const char *name_global = register_string_literal(gen, m->original_name);
+    const char *file_global = register_string_literal(gen, file);
+    int nlen = strlen(m->original_name) + 1;
+    int flen = strlen(file) + 1;
+    prof_temp(gen, name_ptr);
+    prof_temp(gen, file_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
+            name_ptr, nlen, nlen, name_global);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
+            file_ptr, flen, flen, file_global);
+    emit_indent(gen);
+    fprintf(gen->out, "call void @task_global_used(i8* %s, %%Value %s, i32 %d, i8* %s)\n",
+            name_ptr, val ? val : "{ i32 7, i64 0 }", node->line, file_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+    fprintf(gen->out, "\n%s:\n", done);
+}
+
+// i1 temp: both operands carry type tag `type`
+static void emit_both_type(LLVMCodeGen *gen, const char *a, const char *b, int type, char *cond) {
+    char ta[32], tb[32], ca[32], cb[32];
+    prof_temp(gen, ta);
+    prof_temp(gen, tb);
+    prof_temp(gen, ca);
+    prof_temp(gen, cb);
+    prof_temp(gen, cond);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", ta, a);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", tb, b);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", ca, ta, type);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", cb, tb, type);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = and i1 %s, %s\n", cond, ca, cb);
+}
+
+// Operand as double: sitofp for ints (as binary_op compares them), bitcast for floats
+static void emit_as_double(LLVMCodeGen *gen, const char *v, int is_float, char *out) {
+    char bits[32];
+    prof_temp(gen, bits);
+    prof_temp(gen, out);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", bits, v);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = %s i64 %s to double\n", out, is_float ? "bitcast" : "sitofp", bits);
+}
+
+// --profile-use: int/int or float/float arithmetic and comparison inline
+// behind a type guard. Everything else, including a zero divisor (which
+// binary_op reports), takes the generic call. Returns 0 if there is no fast
+// path for this operator and bucket.
+static int emit_binop_fast_path(LLVMCodeGen *gen, int bucket, int op_code, const char *left,
+                                const char *right, int line, const char *file_ptr, const char *result_var) {
+    static const char *int_ops[] = {"add", "sub", "mul", "sdiv", "srem"};
+    static const char *float_ops[] = {"fadd", "fsub", "fmul", "fdiv"};
+    static const char *cmp_preds[] = {"oeq", "une", "olt", "ole", "ogt", "oge"};
+    int is_float = bucket == PROF_FLOAT_FLOAT;
+    if (bucket != PROF_INT_INT && !is_float) return 0;
+    if (op_code > 10 || (is_float && op_code == 4)) return 0;
+
+    char fast[32], slow[32], done[32];
+    snprintf(fast, sizeof(fast), "label%d", gen->label_counter++);
+    snprintf(slow, sizeof(slow), "label%d", gen->label_counter++);
+    snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+
+    char guard[32];
+    emit_both_type(gen, left, right, is_float ? 1 : 0, guard);
+    if (op_code == 3 || op_code == 4) {
+        char divisor[32], nonzero[32], both[32];
+        prof_temp(gen, nonzero);
+        prof_temp(gen, both);
+        if (is_float) {
+            emit_as_double(gen, right, 1, divisor);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = fcmp une double %s, 0.0\n", nonzero, divisor);
+        } else {
+            prof_temp(gen, divisor);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", divisor, right);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp ne i64 %s, 0\n", nonzero, divisor);
+        }
+        emit_indent(gen);
+        fprintf(gen->out, "%s = and i1 %s, %s\n", both, guard, nonzero);
+        strcpy(guard, both);
+    }
+    emit_likely_br(gen, guard, fast, slow);
+
+    fprintf(gen->out, "\n%s:\n", fast);
+    char fast_val[32], raw[32];
+    prof_temp(gen, fast_val);
+    prof_temp(gen, raw);
+    if (op_code >= 5) {
+        char l[32], r[32], cmp[32];
+        emit_as_double(gen, left, is_float, l);
+        emit_as_double(gen, right, is_float, r);
+        prof_temp(gen, cmp);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = fcmp %s double %s, %s\n", cmp, cmp_preds[op_code - 5], l, r);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = zext i1 %s to i64\n", raw, cmp);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", fast_val, raw);
+    } else if (is_float) {
+        char l[32], r[32], d[32];
+        emit_as_double(gen, left, 1, l);
+        emit_as_double(gen, right, 1, r);
+        prof_temp(gen, d);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = %s double %s, %s\n", d, float_ops[op_code], l, r);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = bitcast double %s to i64\n", raw, d);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = insertvalue %%Value { i32 1, i64 0 }, i64 %s, 1\n", fast_val, raw);
+    } else {
+        char l[32], r[32];
+        prof_temp(gen, l);
+        prof_temp(gen, r);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", l, left);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", r, right);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = %s i64 %s, %s\n", raw, int_ops[op_code], l, r);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", fast_val, raw);
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    fprintf(gen->out, "\n%s:\n", slow);
+    char slow_val[32];
+    prof_temp(gen, slow_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 %d, %%Value %s, i32 %d, i8* %s)\n",
+            slow_val, left, op_code, right, line, file_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    fprintf(gen->out, "\n%s:\n", done);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = phi %%Value [ %s, %%%s ], [ %s, %%%s ]\n",
+            result_var, fast_val, fast, slow_val, slow);
+    return 1;
+}
+
+// --profile-use: array[int] loads the element inline after a type and
+// bounds check; dict[string] calls dict_get directly. Other buckets (and
+// failed checks) use index_get. Returns 0 if there is no fast path.
+static int emit_index_fast_path(LLVMCodeGen *gen, int bucket, const char *obj, const char *idx,
+                                const char *result_var) {
+    if (bucket != PROF_ARRAY_INT && bucket != PROF_DICT_STR) return 0;
+
+    char fast[32], slow[32], done[32];
+    snprintf(fast, sizeof(fast), "label%d", gen->label_counter++);
+    snprintf(slow, sizeof(slow), "label%d", gen->label_counter++);
+    snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+
+    char ta[32], tb[32], ca[32], cb[32], guard[32], fast_val[32];
+    prof_temp(gen, ta);
+    prof_temp(gen, tb);
+    prof_temp(gen, ca);
+    prof_temp(gen, cb);
+    prof_temp(gen, guard);
+    prof_temp(gen, fast_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", ta, obj);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", tb, idx);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", ca, ta, bucket == PROF_ARRAY_INT ? 3 : 4);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", cb, tb, bucket == PROF_ARRAY_INT ? 0 : 2);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = and i1 %s, %s\n", guard, ca, cb);
+
+    if (bucket == PROF_DICT_STR) {
+        emit_likely_br(gen, guard, fast, slow);
+        fprintf(gen->out, "\n%s:\n", fast);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = call %%Value @dict_get(%%Value %s, %%Value %s)\n", fast_val, obj, idx);
+    } else {
+        // Array layout (runtime.h): { i32 size, i32 capacity, i8* data }
+        char check[32], addr[32], arr[32], size_ptr[32], size[32], size64[32], index[32], in_bounds[32];
+        char data_ptr[32], data[32], elems[32], elem_ptr[32];
+        snprintf(check, sizeof(check), "label%d", gen->label_counter++);
+        emit_likely_br(gen, guard, check, slow);
+
+        fprintf(gen->out, "\n%s:\n", check);
+        prof_temp(gen, addr);
+        prof_temp(gen, arr);
+        prof_temp(gen, size_ptr);
+        prof_temp(gen, size);
+        prof_temp(gen, size64);
+        prof_temp(gen, index);
+        prof_temp(gen, in_bounds);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", addr, obj);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = inttoptr i64 %s to { i32, i32, i8* }*\n", arr, addr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 0\n",
+                size_ptr, arr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = load i32, i32* %s\n", size, size_ptr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = sext i32 %s to i64\n", size64, size);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", index, idx);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = icmp ult i64 %s, %s\n", in_bounds, index, size64);  // Also rejects < 0
+        emit_likely_br(gen, in_bounds, fast, slow);
+
+        fprintf(gen->out, "\n%s:\n", fast);
+        prof_temp(gen, data_ptr);
+        prof_temp(gen, data);
+        prof_temp(gen, elems);
+        prof_temp(gen, elem_ptr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 2\n",
+                data_ptr, arr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = load i8*, i8** %s\n", data, data_ptr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = bitcast i8* %s to %%Value*\n", elems, data);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = getelementptr %%Value, %%Value* %s, i64 %s\n", elem_ptr, elems, index);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = load %%Value, %%Value* %s\n", fast_val, elem_ptr);
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    fprintf(gen->out, "\n%s:\n", slow);
+    char slow_val[32];
+    prof_temp(gen, slow_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @index_get(%%Value %s, %%Value %s)\n", slow_val, obj, idx);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    fprintf(gen->out, "\n%s:\n", done);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = phi %%Value [ %s, %%%s ], [ %s, %%%s ]\n",
+            result_var, fast_val, fast, slow_val, slow);
+    return 1;
+}
+
+// USDT func_entry probe (see probes.h): a nop plus a .note.stapsdt entry
+// whose argument is the function name, so bpftrace can attach to compiled code
+static void emit_probe_func_entry(LLVMCodeGen *gen, const char *name) {
+#ifdef TINY_SDT_ASM
+    static const char tmpl[] = TINY_SDT_ASM(func_entry, "-8@$0");
+    int len = strlen(name) + 1;
+    emit_indent(gen);
+    fprintf(gen->out, "call void asm sideeffect \"");
+    for (const char *p = tmpl; *p; p++) {
+        if (*p == '\n') fprintf(gen->out, "\\0A");
+        else if (*p == '"') fprintf(gen->out, "\\22");
+        else fputc(*p, gen->out);
+    }
+    fprintf(gen->out, "\", \"r\"(i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0))\n",
+            len, len, register_string_literal(gen, name));
+#else
+    (void)gen;
+    (void)name;
+#endif
+}
+
+// --instrument: keep the runtime's source position current so runtime
+// errors and sampled allocations (TINY_GC_TRACE) carry .tl lines
+static void emit_source_ctx(LLVMCodeGen *gen, ASTNode *node) {
+    if (!gen->instrument) return;
+    const char *file = node->file ? node->file : "<input>";
+    int flen = strlen(file) + 1;
+    emit_indent(gen);
+    fprintf(gen->out, "call void @set_source_ctx(i32 %d, i8* getelementptr inbounds "
+            "([%d x i8], [%d x i8]* %s, i64 0, i64 0))\n",
+            node->line, flen, flen, register_string_literal(gen, file));
+}
+
 // Helper to generate field initializer functions
 static void gen_field_init_function(LLVMCodeGen *gen, const char *class_name, ASTNode *member_decl) {
     int saved_depth = 0;
     VarMapping *saved = push_scope(gen, &saved_depth);
     const char *field_name = member_decl->data.var_decl.name;
+    if (gen->debug_info) {
+        char fn_name[256];
+        snprintf(fn_name, sizeof(fn_name), "__field_init_%s_%s", class_name, field_name);
+        emit_debug_fn(gen, fn_name, member_decl->file, member_decl->line);
+    }
     fprintf(gen->out, "define %%Value @__field_init_%s_%s(%%Value %%this) {\n", class_name, field_name);
     gen->indent_level = 1;
+    plan_dispatch(gen, NULL, NULL);
 
     const char *this_unique = create_unique_var_name(gen, "this", 0);
     VarMapping *m_this = find_var_mapping_current_scope(gen, "this");
@@ -95,13 +558,28 @@ static void gen_field_init_function(LLVMCodeGen *gen, const char *class_name, AS
     pop_scope(gen, saved, saved_depth);
 }
 
-// Helper to generate method functions with (this, args, arg_count) signature
+// Helper to generate method functions: @Class__method(this, params...), and
+// @Class__method__args(this, args, arg_count) for the runtime's class table
 static void gen_method_function(LLVMCodeGen *gen, const char *class_name, ASTNode *func_def) {
     int saved_depth = 0;
     VarMapping *saved = push_scope(gen, &saved_depth);
-    fprintf(gen->out, "define %%Value @%s__%s(%%Value %%this, %%Value* %%args, i32 %%arg_count) {\n",
-            class_name, func_def->data.func_def.name);
+    const char *method_name = func_def->data.func_def.name;
+    size_t qlen = strlen(class_name) + strlen(method_name) + 2;
+    char *qualified = malloc(qlen);
+    snprintf(qualified, qlen, "%s.%s", class_name, method_name);
+    gen->cur_func = qualified;
+    gen->cur_class = find_class(gen, class_name);
+    emit_debug_fn(gen, qualified, func_def->file, func_def->line);
+    fprintf(gen->out, "define %%Value @%s__%s(%%Value %%this", class_name, method_name);
+    for (ASTNodeList *param = func_def->data.func_def.params; param; param = param->next) {
+        fprintf(gen->out, ", %%Value %%param_%s", param->node->data.identifier.name);
+    }
+    fprintf(gen->out, ") {\n");
     gen->indent_level = 1;
+    emit_probe_func_entry(gen, qualified);
+    emit_instr_counter(gen, func_def, 1);
+    plan_stack_allocs(gen, func_def->data.func_def.body);
+    plan_dispatch(gen, func_def->data.func_def.body, func_def->data.func_def.params);
 
     const char *this_unique = create_unique_var_name(gen, "this", 0);
     VarMapping *m_this = find_var_mapping_current_scope(gen, "this");
@@ -119,31 +597,17 @@ static void gen_method_function(LLVMCodeGen *gen, const char *class_name, ASTNod
     emit_indent(gen);
     fprintf(gen->out, "store %%Value %%this, %%Value* %%%s\n", self_unique);
 
-    ASTNodeList *param = func_def->data.func_def.params;
-    int param_index = 0;
-    while (param != NULL) {
+    int arity = 0;
+    for (ASTNodeList *param = func_def->data.func_def.params; param; param = param->next) {
         const char *pname = param->node->data.identifier.name;
         const char *unique = create_unique_var_name(gen, pname, 0);
         VarMapping *pm = find_var_mapping_current_scope(gen, pname);
         if (pm) pm->declared = 1;
         emit_indent(gen);
         fprintf(gen->out, "%%%s = alloca %%Value\n", unique);
-
-        char arg_ptr[32];
-        snprintf(arg_ptr, sizeof(arg_ptr), "%%t%d", gen->temp_counter++);
-        emit_indent(gen);
-        fprintf(gen->out, "%s = getelementptr %%Value, %%Value* %%args, i32 %d\n", arg_ptr, param_index);
-
-        char arg_val[32];
-        snprintf(arg_val, sizeof(arg_val), "%%t%d", gen->temp_counter++);
-        emit_indent(gen);
-        fprintf(gen->out, "%s = load %%Value, %%Value* %s\n", arg_val, arg_ptr);
-
         emit_indent(gen);
-        fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", arg_val, unique);
-
-        param_index++;
-        param = param->next;
+        fprintf(gen->out, "store %%Value %%param_%s, %%Value* %%%s\n", pname, unique);
+        arity++;
     }
 
     ASTNodeList *body_stmt = func_def->data.func_def.body;
@@ -156,7 +620,22 @@ static void gen_method_function(LLVMCodeGen *gen, const char *class_name, ASTNod
     fprintf(gen->out, "ret %%Value { i32 0, i64 0 }\n");
     fprintf(gen->out, "}\n\n");
     gen->indent_level = 0;
+    gen->cur_func = NULL;
+    gen->cur_class = NULL;
     pop_scope(gen, saved, saved_depth);
+
+    // method_call has checked arg_count against the arity
+    fprintf(gen->out, "define %%Value @%s__%s__args(%%Value %%this, %%Value* %%args, i32 %%arg_count) {\n",
+            class_name, method_name);
+    for (int i = 0; i < arity; i++) {
+        fprintf(gen->out, "  %%arg%d.ptr = getelementptr %%Value, %%Value* %%args, i32 %d\n", i, i);
+        fprintf(gen->out, "  %%arg%d = load %%Value, %%Value* %%arg%d.ptr\n", i, i);
+    }
+    fprintf(gen->out, "  %%result = tail call %%Value @%s__%s(%%Value %%this", class_name, method_name);
+    for (int i = 0; i < arity; i++) fprintf(gen->out, ", %%Value %%arg%d", i);
+    fprintf(gen->out, ")\n");
+    fprintf(gen->out, "  ret %%Value %%result\n");
+    fprintf(gen->out, "}\n\n");
 }
 
 // Get unique name for an existing variable (lookup only)
@@ -197,6 +676,8 @@ static const char* create_unique_var_name(LLVMCodeGen *gen, const char *original
     new_mapping->is_global = is_global;
     new_mapping->scope_depth = gen->scope_depth;
     new_mapping->declared = 0;
+    new_mapping->captured = 0;
+    new_mapping->external = 0;
     new_mapping->next_global = NULL;
     new_mapping->next = gen->var_mappings;
     gen->var_mappings = new_mapping;
@@ -225,6 +706,8 @@ static void register_function(LLVMCodeGen *gen, const char *name, int arity, con
     FuncInfo *f = malloc(sizeof(FuncInfo));
     f->name = strdup(name);
     f->arity = arity;
+    f->referenced = 0;
+    f->external = 0;
     f->next = gen->functions;
     gen->functions = f;
 }
@@ -286,10 +769,10 @@ static const char* register_string_literal(LLVMCodeGen *gen, const char *str) {
     return new_str->global_name;
 }
 
-// Emit all collected string literals
-static void emit_string_literals(LLVMCodeGen *gen) {
+// Emit collected string literals from the list head up to (excluding) stop
+static void emit_string_range(LLVMCodeGen *gen, StringLiteral *stop) {
     StringLiteral *s = gen->strings;
-    while (s != NULL) {
+    while (s != stop) {
         int len = strlen(s->value) + 1;
         fprintf(gen->out, "%s = private unnamed_addr constant [%d x i8] c\"", s->global_name, len);
 
@@ -314,6 +797,11 @@ static void emit_string_literals(LLVMCodeGen *gen) {
     }
 }
 
+// Emit all collected string literals
+static void emit_string_literals(LLVMCodeGen *gen) {
+    emit_string_range(gen, NULL);
+}
+
 // Pre-pass to collect all string literals
 static void collect_strings_expr(LLVMCodeGen *gen, ASTNode *node);
 static void collect_strings_stmt(LLVMCodeGen *gen, ASTNode *node);
@@ -564,6 +1052,9 @@ static void collect_strings_stmt(LLVMCodeGen *gen, ASTNode *node) {
         case NODE_RETURN:
             collect_strings_expr(gen, node->data.return_stmt.value);
             break;
+        case NODE_YIELD:
+            collect_strings_expr(gen, node->data.yield_stmt.value);
+            break;
         case NODE_FUNC_DEF: {
             ASTNodeList *stmt = node->data.func_def.body;
             while (stmt != NULL) {
@@ -697,34 +1188,42 @@ static void register_functions_stmt(LLVMCodeGen *gen, ASTNode *node) {
     }
 }
 
+// The tag constants here and the make_* helpers in emit_runtime_impl are
+// linkonce_odr: every separately compiled module (--cache-dir) has a copy
 static void emit_runtime_decls(LLVMCodeGen *gen) {
     fprintf(gen->out,
         "; Runtime type definition\n"
-        "%%Value = type { i32, i64 }  ; { type_tag, data }\n\n"
+        "%%Value = type { i32, i64 }  ; { type_tag, data }\n"
+        "; Static tables: StaticObject records (gc.h) and DictEntry\n"
+        "%%StaticArray = type { i32, i32, { i32, i32, i8* } }\n"
+        "%%StaticDict = type { i32, i32, { i8**, i32, i32 } }\n"
+        "%%StaticEntry = type { i8*, i32, %%Value, i8* }\n"
+        "; foreach position (IterState, runtime.h)\n"
+        "%%IterState = type { %%Value, %%Value*, %%Value*, %%Value*, i64, i64, i8*, i8*, i32, i32, i32 }\n\n"
 
         "; Type tags\n"
-        "@TYPE_INT = constant i32 0\n"
-        "@TYPE_FLOAT = constant i32 1\n"
-        "@TYPE_STRING = constant i32 2\n"
-        "@TYPE_ARRAY = constant i32 3\n"
-        "@TYPE_DICT = constant i32 4\n"
-        "@TYPE_CLASS = constant i32 5\n"
-        "@TYPE_INSTANCE = constant i32 6\n"
-        "@TYPE_NULL = constant i32 7\n"
-        "@TYPE_BOOL = constant i32 8\n\n"
+        "@TYPE_INT = linkonce_odr constant i32 0\n"
+        "@TYPE_FLOAT = linkonce_odr constant i32 1\n"
+        "@TYPE_STRING = linkonce_odr constant i32 2\n"
+        "@TYPE_ARRAY = linkonce_odr constant i32 3\n"
+        "@TYPE_DICT = linkonce_odr constant i32 4\n"
+        "@TYPE_CLASS = linkonce_odr constant i32 5\n"
+        "@TYPE_INSTANCE = linkonce_odr constant i32 6\n"
+        "@TYPE_NULL = linkonce_odr constant i32 7\n"
+        "@TYPE_BOOL = linkonce_odr constant i32 8\n\n"
 
         "; Operator tags\n"
-        "@OP_ADD = constant i32 0\n"
-        "@OP_SUB = constant i32 1\n"
-        "@OP_MUL = constant i32 2\n"
-        "@OP_DIV = constant i32 3\n"
-        "@OP_MOD = constant i32 4\n"
-        "@OP_EQ = constant i32 5\n"
-        "@OP_NE = constant i32 6\n"
-        "@OP_LT = constant i32 7\n"
-        "@OP_LE = constant i32 8\n"
-        "@OP_GT = constant i32 9\n"
-        "@OP_GE = constant i32 10\n\n"
+        "@OP_ADD = linkonce_odr constant i32 0\n"
+        "@OP_SUB = linkonce_odr constant i32 1\n"
+        "@OP_MUL = linkonce_odr constant i32 2\n"
+        "@OP_DIV = linkonce_odr constant i32 3\n"
+        "@OP_MOD = linkonce_odr constant i32 4\n"
+        "@OP_EQ = linkonce_odr constant i32 5\n"
+        "@OP_NE = linkonce_odr constant i32 6\n"
+        "@OP_LT = linkonce_odr constant i32 7\n"
+        "@OP_LE = linkonce_odr constant i32 8\n"
+        "@OP_GT = linkonce_odr constant i32 9\n"
+        "@OP_GE = linkonce_odr constant i32 10\n\n"
 
         "; String literals\n"
         "@empty_str = private unnamed_addr constant [1 x i8] c\"\\00\", align 1\n\n"
@@ -745,16 +1244,31 @@ static void emit_runtime_decls(LLVMCodeGen *gen) {
         "declare %%Value @to_string(%%Value)\n"
         "declare %%Value @make_null()\n"
         "declare %%Value @slice_access(%%Value, %%Value, %%Value)\n"
+        "declare %%Value @slice_access_into(%%Value, %%Value, %%Value, i8*)\n"
         "declare %%Value @input(%%Value)\n"
         "declare %%Value @file_read(%%Value)\n"
         "declare %%Value @file_write(%%Value, %%Value)\n"
         "declare %%Value @file_append(%%Value, %%Value)\n"
         "declare %%Value @file_size(%%Value)\n"
         "declare %%Value @file_exist(%%Value)\n"
+        "declare %%Value @to_bytes(%%Value)\n"
+        "declare %%Value @file_read_bytes(%%Value)\n"
+        "declare %%Value @bytes_find(%%Value, %%Value, %%Value)\n"
+        "declare %%Value @bytes_decode(%%Value, %%Value, %%Value)\n"
+        "declare %%Value @bytes_encode(%%Value, %%Value)\n"
+        "declare %%Value @bytes_str(%%Value)\n"
+        "declare %%Value @csv_rows(%%Value, %%Value)\n"
+        "declare %%Value @csv_read(%%Value, %%Value)\n"
+        "declare %%Value @make_generator(void (%%Value*, i8*)*, i8*, %%Value*, i32, i8*, i8*)\n"
+        "declare void @gen_yield(%%Value)\n"
+        "declare void @iter_begin(%%Value, %%IterState*)\n"
+        "declare i32 @iter_next(%%IterState*, %%Value*, %%Value*)\n"
         "declare %%Value @make_dict()\n"
         "declare %%Value @dict_set(%%Value, %%Value, %%Value)\n"
         "declare %%Value @dict_get(%%Value, %%Value)\n"
         "declare %%Value @dict_has(%%Value, %%Value)\n"
+        "declare %%Value @dict_get_h(%%Value, i8*, i32)\n"
+        "declare %%Value @dict_set_h(%%Value, i8*, i32, %%Value)\n"
         "declare %%Value @dict_keys(%%Value)\n"
         "declare %%Value @keys(%%Value)\n"
         "declare %%Value @in_operator(%%Value, %%Value, i32, i8*)\n"
@@ -791,13 +1305,29 @@ static void emit_runtime_decls(LLVMCodeGen *gen) {
         "declare %%Value @cmd_args()\n"
         "declare %%Value @gc_stat()\n"
         "declare %%Value @gc_run()\n"
+        "declare %%Value @runtime_stats()\n"
+        "declare %%Value @task_spawn(%%Value, %%Value*, i32, i8*)\n"
+        "declare %%Value @task_join(%%Value)\n"
+        "declare void @parallel_for(void (i64, i64, %%Value**)*, i64, i64, %%Value**)\n"
+        "@task_globals_hidden = external thread_local global i32\n"
+        "declare void @task_global_used(i8*, %%Value, i32, i8*)\n"
+        "declare %%Value @array_map(%%Value, %%Value)\n"
+        "declare %%Value @array_filter(%%Value, %%Value)\n"
+        "declare %%Value @array_reduce(%%Value, %%Value, %%Value)\n"
+        "declare %%Value @array_pmap(%%Value, %%Value)\n"
+        "declare %%Value @array_pfilter(%%Value, %%Value)\n"
+        "declare %%Value @array_preduce(%%Value, %%Value, %%Value, %%Value)\n"
         "declare %%Value @make_class(i8*)\n"
         "declare void @class_add_field(%%Value, i8*, %%Value (%%Value)*, i32)\n"
         "declare void @class_add_method(%%Value, i8*, %%Value (%%Value, %%Value*, i32)*, i32, i32)\n"
         "declare %%Value @instantiate_class(%%Value, %%Value*, i32)\n"
         "declare %%Value @member_get(%%Value, i8*)\n"
         "declare %%Value @member_set(%%Value, i8*, %%Value)\n"
-        "declare %%Value @method_call(%%Value, i8*, %%Value*, i32)\n\n"
+        "declare %%Value @member_get_h(%%Value, i8*, i32)\n"
+        "declare %%Value @member_set_h(%%Value, i8*, i32, %%Value)\n"
+        "declare %%Value @method_call(%%Value, i8*, %%Value*, i32)\n"
+        "declare void @method_enter(%%Value)\n"
+        "declare void @method_leave()\n\n"
     );
 }
 
@@ -805,27 +1335,27 @@ static void emit_runtime_impl(LLVMCodeGen *gen) {
     fprintf(gen->out,
         "; ===== Runtime Implementation =====\n\n"
 
-        "define %%Value @make_int(i64 %%val) {\n"
+        "define linkonce_odr %%Value @make_int(i64 %%val) {\n"
         "  %%result = insertvalue %%Value { i32 0, i64 0 }, i32 0, 0\n"
         "  %%result2 = insertvalue %%Value %%result, i64 %%val, 1\n"
         "  ret %%Value %%result2\n"
         "}\n\n"
 
-        "define %%Value @make_bool(i1 %%val) {\n"
+        "define linkonce_odr %%Value @make_bool(i1 %%val) {\n"
         "  %%ext = zext i1 %%val to i64\n"
         "  %%result = insertvalue %%Value { i32 8, i64 0 }, i32 8, 0\n"
         "  %%result2 = insertvalue %%Value %%result, i64 %%ext, 1\n"
         "  ret %%Value %%result2\n"
         "}\n\n"
 
-        "define %%Value @make_float(double %%val) {\n"
+        "define linkonce_odr %%Value @make_float(double %%val) {\n"
         "  %%as_int = bitcast double %%val to i64\n"
         "  %%result = insertvalue %%Value { i32 1, i64 0 }, i32 1, 0\n"
         "  %%result2 = insertvalue %%Value %%result, i64 %%as_int, 1\n"
         "  ret %%Value %%result2\n"
         "}\n\n"
 
-        "define %%Value @make_string(i8* %%val) {\n"
+        "define linkonce_odr %%Value @make_string(i8* %%val) {\n"
         "  %%as_int = ptrtoint i8* %%val to i64\n"
         "  %%result = insertvalue %%Value { i32 2, i64 0 }, i32 2, 0\n"
         "  %%result2 = insertvalue %%Value %%result, i64 %%as_int, 1\n"
@@ -849,8 +1379,10 @@ static void emit_runtime_impl(LLVMCodeGen *gen) {
         "check_arr:\n"
         "  %%is_arr = icmp eq i32 %%type, 3\n"
         "  %%is_dict = icmp eq i32 %%type, 4\n"
+        "  %%is_bytes = icmp eq i32 %%type, 12\n"
         "  %%arr_or_dict = or i1 %%is_arr, %%is_dict\n"
-        "  br i1 %%arr_or_dict, label %%len_arr, label %%default_check\n"
+        "  %%has_len = or i1 %%arr_or_dict, %%is_bytes\n"
+        "  br i1 %%has_len, label %%len_arr, label %%default_check\n"
         "len_arr:\n"
         "  %%larr = call %%Value @len(%%Value %%v)\n"
         "  %%asz = extractvalue %%Value %%larr, 1\n"
@@ -871,10 +1403,15 @@ static void emit_runtime_impl(LLVMCodeGen *gen) {
         "declare i64 @strlen(i8*)\n"
         "declare i8* @strcpy(i8*, i8*)\n"
         "declare i8* @strcat(i8*, i8*)\n"
+        "declare i8* @memset(i8*, i32, i64)\n"
         "declare void @print_value(%%Value)\n"
         "declare void @set_cmd_args(i32, i8**)\n"
         "declare void @gc_init()\n"
         "declare void @gc_set_stack_bottom(i8*)\n"
+        "declare i8* @llvm.frameaddress.p0i8(i32)\n"
+        "declare i8* @llvm.stacksave()\n"
+        "declare void @llvm.stackrestore(i8*)\n"
+        "declare i1 @llvm.expect.i1(i1, i1)\n"
         "declare void @gc_push_root(%%Value*)\n\n"
 
         "@.str_newline = private unnamed_addr constant [2 x i8] c\"\\0A\\00\", align 1\n"
@@ -882,79 +1419,1513 @@ static void emit_runtime_impl(LLVMCodeGen *gen) {
     );
 }
 
-static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
-    switch (node->type) {
-        case NODE_INT_LITERAL: {
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @make_int(i64 %d)\n",
-                    result_var, node->data.int_literal.value);
-            break;
-        }
+// ===== Escape analysis =====
+// An array/dict literal or array slice is built in the function's frame
+// when its value provably dies with the call: it is consumed in place (an
+// index, len(), print, a foreach, `in`, a condition) or stored in a local
+// variable that is only ever used that way. Any other use of the variable
+// (returned, passed to a function, stored in a container, a field or
+// another variable, seen by a parallel for body) makes it escape. Names are
+// tracked per function, not per declaration, so shadowing only makes the
+// analysis more conservative; stores into globals are refused at codegen.
+
+#define STACK_ALLOC_BUDGET 4096   // Bytes of stack storage per function
+#define STACK_ARRAY_MAX 64        // Larger array literals stay on the heap
+
+typedef struct EscapeName {
+    const char *name;
+    struct EscapeName *next;
+} EscapeName;
+
+typedef struct EscapeSite {
+    ASTNode *node;
+    const char *var;       // Variable it is stored in, NULL if consumed in place
+    struct EscapeSite *next;
+} EscapeSite;
+
+typedef struct {
+    EscapeName *escaped;
+    EscapeSite *sites;     // Reverse order
+    int in_pfor;           // Inside an outlined parallel for body
+} EscapeCtx;
+
+static void escape_expr(LLVMCodeGen *gen, EscapeCtx *ec, ASTNode *node, int consumed);
+static void escape_stmts(LLVMCodeGen *gen, EscapeCtx *ec, ASTNodeList *list);
+
+static void escape_name(EscapeCtx *ec, const char *name) {
+    for (EscapeName *e = ec->escaped; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) return;
+    }
+    EscapeName *e = malloc(sizeof(EscapeName));
+    e->name = name;
+    e->next = ec->escaped;
+    ec->escaped = e;
+}
 
-        case NODE_FLOAT_LITERAL: {
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @make_float(double %f)\n",
-                    result_var, node->data.float_literal.value);
-            break;
+static int name_escapes(EscapeCtx *ec, const char *name) {
+    for (EscapeName *e = ec->escaped; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+// Builtins that read their arguments without keeping them
+static int consumes_args(LLVMCodeGen *gen, const char *name) {
+    static const char *names[] = {"print", "println", "p", "len", "str", "type",
+                                  "json_encode", "str_join"};
+    if (find_function(gen, name)) return 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+static int assigns_name(ASTNodeList *list, const char *name) {
+    for (; list; list = list->next) {
+        ASTNode *n = list->node;
+        switch (n->type) {
+            case NODE_ASSIGNMENT:
+                if (n->data.assignment.target->type == NODE_IDENTIFIER &&
+                    strcmp(n->data.assignment.target->data.identifier.name, name) == 0) return 1;
+                break;
+            case NODE_IF_STMT:
+                if (assigns_name(n->data.if_stmt.then_block, name) ||
+                    assigns_name(n->data.if_stmt.else_block, name)) return 1;
+                break;
+            case NODE_WHILE_STMT:
+                if (assigns_name(n->data.while_stmt.body, name)) return 1;
+                break;
+            case NODE_FOR_STMT:
+                if (assigns_name(n->data.for_stmt.body, name)) return 1;
+                break;
+            case NODE_FOREACH_STMT:
+                if (assigns_name(n->data.foreach_stmt.body, name)) return 1;
+                break;
+            case NODE_TRY_CATCH:
+                if (assigns_name(n->data.try_catch.try_block, name) ||
+                    assigns_name(n->data.try_catch.catch_block, name)) return 1;
+                break;
+            default:
+                break;
         }
+    }
+    return 0;
+}
 
-        case NODE_BOOL_LITERAL: {
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @make_bool(i1 %d)\n",
-                    result_var, node->data.bool_literal.value ? 1 : 0);
-            break;
+// Walk an aggregate and, with record, note it as a candidate; returns 0
+// (nothing walked) if node is not an aggregate we can build in place
+static int escape_site(LLVMCodeGen *gen, EscapeCtx *ec, ASTNode *node, const char *var, int record) {
+    if (node->type != NODE_ARRAY_LITERAL && node->type != NODE_DICT_LITERAL &&
+        node->type != NODE_SLICE_ACCESS) {
+        return 0;
+    }
+    if (record && !ec->in_pfor) {
+        EscapeSite *site = malloc(sizeof(EscapeSite));
+        site->node = node;
+        site->var = var;
+        site->next = ec->sites;
+        ec->sites = site;
+    }
+    if (node->type == NODE_ARRAY_LITERAL) {
+        for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next) {
+            escape_expr(gen, ec, e->node, 0);
+        }
+    } else if (node->type == NODE_DICT_LITERAL) {
+        for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) {
+            escape_expr(gen, ec, p->node->data.dict_pair.key, 0);
+            escape_expr(gen, ec, p->node->data.dict_pair.value, 0);
         }
+    } else {
+        escape_expr(gen, ec, node->data.slice_access.object, 1);
+        escape_expr(gen, ec, node->data.slice_access.start, 0);
+        escape_expr(gen, ec, node->data.slice_access.end, 0);
+    }
+    return 1;
+}
 
-        case NODE_NULL_LITERAL: {
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @make_null()\n", result_var);
+// consumed: the value of node is used up by its parent, not kept
+static void escape_expr(LLVMCodeGen *gen, EscapeCtx *ec, ASTNode *node, int consumed) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_IDENTIFIER:
+            if (!consumed || ec->in_pfor) escape_name(ec, node->data.identifier.name);
+            break;
+        case NODE_ARRAY_LITERAL:
+        case NODE_DICT_LITERAL:
+        case NODE_SLICE_ACCESS:
+            escape_site(gen, ec, node, NULL, consumed);
+            break;
+        case NODE_INDEX_ACCESS:
+            escape_expr(gen, ec, node->data.index_access.object, 1);
+            escape_expr(gen, ec, node->data.index_access.index, 0);
+            break;
+        case NODE_BINARY_OP: {
+            int in = node->data.binary_op.op == OP_IN || node->data.binary_op.op == OP_NOT_IN;
+            escape_expr(gen, ec, node->data.binary_op.left, in);
+            escape_expr(gen, ec, node->data.binary_op.right, in);
             break;
         }
-
-        case NODE_STRING_LITERAL: {
-            const char *global_name = register_string_literal(gen, node->data.string_literal.value);
-            int len = strlen(node->data.string_literal.value) + 1;
-            char str_ptr[32];
-            snprintf(str_ptr, sizeof(str_ptr), "%%t%d", gen->temp_counter++);
-            emit_indent(gen);
-            fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
-                    str_ptr, len, len, global_name);
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @make_string(i8* %s)\n",
-                    result_var, str_ptr);
+        case NODE_UNARY_OP:
+            escape_expr(gen, ec, node->data.unary_op.operand, 0);
+            break;
+        case NODE_FUNC_CALL: {
+            int consumes = consumes_args(gen, node->data.func_call.name);
+            for (ASTNodeList *a = node->data.func_call.arguments; a; a = a->next) {
+                escape_expr(gen, ec, a->node, consumes);
+            }
             break;
         }
+        case NODE_METHOD_CALL:
+            escape_expr(gen, ec, node->data.method_call.object, 0);
+            for (ASTNodeList *a = node->data.method_call.arguments; a; a = a->next) {
+                escape_expr(gen, ec, a->node, 0);
+            }
+            break;
+        case NODE_MEMBER_ACCESS:
+            escape_expr(gen, ec, node->data.member_access.object, 0);
+            break;
+        case NODE_NEW_EXPR:
+            for (ASTNodeList *a = node->data.new_expr.arguments; a; a = a->next) {
+                escape_expr(gen, ec, a->node, 0);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-        case NODE_IDENTIFIER: {
-            VarMapping *m = find_var_mapping(gen, node->data.identifier.name);
-            if (m == NULL) {
-                codegen_error(node, "Variable '%s' not declared in this scope (codegen)", node->data.identifier.name);
+// `v = <aggregate>` / `var v = <aggregate>`: a candidate tied to v
+static void escape_store(LLVMCodeGen *gen, EscapeCtx *ec, const char *var, ASTNode *value) {
+    if (!escape_site(gen, ec, value, var, 1)) escape_expr(gen, ec, value, 0);
+}
+
+static void escape_stmt(LLVMCodeGen *gen, EscapeCtx *ec, ASTNode *node) {
+    switch (node->type) {
+        case NODE_VAR_DECL:
+            escape_store(gen, ec, node->data.var_decl.name, node->data.var_decl.value);
+            break;
+        case NODE_MULTI_VAR_DECL:
+            escape_stmts(gen, ec, node->data.multi_var_decl.declarations);
+            break;
+        case NODE_ASSIGNMENT: {
+            ASTNode *target = node->data.assignment.target;
+            if (target->type == NODE_IDENTIFIER) {
+                if (ec->in_pfor) escape_name(ec, target->data.identifier.name);
+                escape_store(gen, ec, target->data.identifier.name, node->data.assignment.value);
+                break;
             }
-            emit_indent(gen);
-            if (m->is_global) {
-                fprintf(gen->out, "%s = load %%Value, %%Value* @%s\n", result_var, m->unique_name);
+            if (target->type == NODE_INDEX_ACCESS) {
+                escape_expr(gen, ec, target->data.index_access.object, 1);
+                escape_expr(gen, ec, target->data.index_access.index, 0);
+            } else if (target->type == NODE_MEMBER_ACCESS) {
+                escape_expr(gen, ec, target->data.member_access.object, 0);
+            }
+            escape_expr(gen, ec, node->data.assignment.value, 0);
+            break;
+        }
+        case NODE_FUNC_CALL: {
+            // append(v, x) as a statement grows v in place; its result is dropped
+            ASTNodeList *args = node->data.func_call.arguments;
+            if (strcmp(node->data.func_call.name, "append") == 0 && !find_function(gen, "append") &&
+                args && args->next && !args->next->next) {
+                escape_expr(gen, ec, args->node, 1);
+                escape_expr(gen, ec, args->next->node, 0);
             } else {
-                fprintf(gen->out, "%s = load %%Value, %%Value* %%%s\n", result_var, m->unique_name);
+                escape_expr(gen, ec, node, 1);
             }
             break;
         }
-
-        case NODE_MEMBER_ACCESS: {
-            char obj_temp[32];
-            snprintf(obj_temp, sizeof(obj_temp), "%%t%d", gen->temp_counter++);
-            gen_expr(gen, node->data.member_access.object, obj_temp);
-
-            const char *global_name = register_string_literal(gen, node->data.member_access.member);
-            int len = strlen(node->data.member_access.member) + 1;
-            char str_ptr[32];
-            snprintf(str_ptr, sizeof(str_ptr), "%%t%d", gen->temp_counter++);
-            emit_indent(gen);
-            fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
-                    str_ptr, len, len, global_name);
-
-            emit_indent(gen);
-            fprintf(gen->out, "%s = call %%Value @member_get(%%Value %s, i8* %s)\n",
-                    result_var, obj_temp, str_ptr);
+        case NODE_RETURN:
+            escape_expr(gen, ec, node->data.return_stmt.value, 0);
+            break;
+        case NODE_YIELD:
+            escape_expr(gen, ec, node->data.yield_stmt.value, 0);
+            break;
+        case NODE_RAISE:
+            escape_expr(gen, ec, node->data.raise_stmt.expr, 0);
+            break;
+        case NODE_ASSERT:
+            escape_expr(gen, ec, node->data.assert_stmt.expr, 1);
+            escape_expr(gen, ec, node->data.assert_stmt.msg, 0);
+            break;
+        case NODE_IF_STMT:
+            escape_expr(gen, ec, node->data.if_stmt.condition, 1);
+            escape_stmts(gen, ec, node->data.if_stmt.then_block);
+            escape_stmts(gen, ec, node->data.if_stmt.else_block);
+            break;
+        case NODE_WHILE_STMT:
+            escape_expr(gen, ec, node->data.while_stmt.condition, 1);
+            escape_stmts(gen, ec, node->data.while_stmt.body);
+            break;
+        case NODE_FOR_STMT:
+            escape_expr(gen, ec, node->data.for_stmt.start, 0);
+            escape_expr(gen, ec, node->data.for_stmt.end, 0);
+            if (node->data.for_stmt.is_parallel) ec->in_pfor++;
+            escape_stmts(gen, ec, node->data.for_stmt.body);
+            if (node->data.for_stmt.is_parallel) ec->in_pfor--;
+            break;
+        case NODE_FOREACH_STMT: {
+            // The loop keeps iterating the collection it started with; if the
+            // body reassigns the variable, the site that built it may run again
+            ASTNode *coll = node->data.foreach_stmt.collection;
+            if (coll->type == NODE_IDENTIFIER && assigns_name(node->data.foreach_stmt.body,
+                                                              coll->data.identifier.name)) {
+                escape_name(ec, coll->data.identifier.name);
+            }
+            escape_expr(gen, ec, coll, 1);
+            escape_stmts(gen, ec, node->data.foreach_stmt.body);
+            break;
+        }
+        case NODE_TRY_CATCH:
+            escape_stmts(gen, ec, node->data.try_catch.try_block);
+            escape_stmts(gen, ec, node->data.try_catch.catch_block);
+            break;
+        case NODE_FUNC_DEF:
+        case NODE_CLASS_DEF:
+            break;   // Generated as functions of their own
+        default:
+            escape_expr(gen, ec, node, 1);
+            break;
+    }
+}
+
+static void escape_stmts(LLVMCodeGen *gen, EscapeCtx *ec, ASTNodeList *list) {
+    for (; list; list = list->next) escape_stmt(gen, ec, list->node);
+}
+
+// Run escape analysis over a function body and reserve, in its entry block,
+// storage for the aggregates that do not escape. Called right after the
+// define line; the sites pick their storage up through find_stack_alloc().
+static void plan_stack_allocs(LLVMCodeGen *gen, ASTNodeList *body) {
+    while (gen->stack_allocs) {
+        StackAlloc *next = gen->stack_allocs->next;
+        free(gen->stack_allocs);
+        gen->stack_allocs = next;
+    }
+    EscapeCtx ec = {NULL, NULL, 0};
+    escape_stmts(gen, &ec, body);
+
+    // Sites in source order, so the budget goes to the first ones
+    EscapeSite *sites = NULL;
+    while (ec.sites) {
+        EscapeSite *next = ec.sites->next;
+        ec.sites->next = sites;
+        sites = ec.sites;
+        ec.sites = next;
+    }
+    int budget = STACK_ALLOC_BUDGET;
+    StackAlloc **tail = &gen->stack_allocs;
+    while (sites) {
+        EscapeSite *site = sites;
+        sites = site->next;
+        ASTNode *node = site->node;
+        int slots = 0, bytes;
+        if (node->type == NODE_ARRAY_LITERAL) {
+            for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next) slots++;
+            if (slots > STACK_ARRAY_MAX) slots = -1;
+            if (slots == 0) slots = 1;   // append() doubles the capacity
+            bytes = sizeof(Array) + slots * sizeof(Value);
+        } else if (node->type == NODE_DICT_LITERAL) {
+            bytes = sizeof(Dict) + HASH_SIZE * sizeof(DictEntry*);
+        } else {
+            bytes = sizeof(Array);       // Elements are copied to the heap
+        }
+        if (slots >= 0 && bytes <= budget && !(site->var && name_escapes(&ec, site->var))) {
+            budget -= bytes;
+            StackAlloc *sa = malloc(sizeof(StackAlloc));
+            sa->node = node;
+            sa->id = gen->stack_count++;
+            sa->slots = slots;
+            sa->next = NULL;
+            *tail = sa;
+            tail = &sa->next;
+
+            emit_indent(gen);
+            if (node->type == NODE_DICT_LITERAL) {
+                fprintf(gen->out, "%%stk_%d = alloca { i8**, i32, i32 }\n", sa->id);
+                emit_indent(gen);
+                fprintf(gen->out, "%%stk_%d_buf = alloca [%d x i8*]\n", sa->id, HASH_SIZE);
+            } else {
+                fprintf(gen->out, "%%stk_%d = alloca { i32, i32, i8* }\n", sa->id);
+                if (node->type == NODE_ARRAY_LITERAL) {
+                    emit_indent(gen);
+                    fprintf(gen->out, "%%stk_%d_buf = alloca [%d x %%Value]\n", sa->id, slots);
+                }
+            }
+        }
+        free(site);
+    }
+    while (ec.escaped) {
+        EscapeName *next = ec.escaped->next;
+        free(ec.escaped);
+        ec.escaped = next;
+    }
+}
+
+static StackAlloc *find_stack_alloc(LLVMCodeGen *gen, ASTNode *node) {
+    for (StackAlloc *sa = gen->stack_allocs; sa; sa = sa->next) {
+        if (sa->node == node) return sa;
+    }
+    return NULL;
+}
+
+// The value is about to be stored in a global (or a variable a parallel for
+// body shares): build it on the heap after all
+static void unplan_stack_alloc(LLVMCodeGen *gen, ASTNode *node) {
+    StackAlloc *sa = find_stack_alloc(gen, node);
+    if (sa) sa->node = NULL;
+}
+
+// ===== Array reads in counted loops =====
+// In `for (i = a .. b)`, a read arr[i], arr[i + c] or arr[i - c] (c an int
+// literal) of a variable the body never rebinds touches indices in a known
+// range. One guard before the loop checks that arr holds an array and that
+// the whole range is in bounds; while it holds, each read is a plain load.
+// The body may not call user code (functions, methods, constructors,
+// function-taking builtins) or remove(): arrays can then only grow, so the
+// guard stays true for every iteration.
+
+typedef struct LoopScanRead {
+    const char *array;
+    long offset;
+    struct LoopScanRead *next;
+} LoopScanRead;
+
+typedef struct LoopScanName {
+    const char *name;
+    struct LoopScanName *next;
+} LoopScanName;
+
+typedef struct {
+    const char *index;
+    int calls_out;         // Body may run user code or shrink an array
+    LoopScanRead *reads;
+    LoopScanName *bound;   // Names assigned or declared in the body
+} LoopScan;
+
+// Builtins that neither run user code nor remove array elements
+static int keeps_arrays(LLVMCodeGen *gen, const char *name) {
+    static const char *names[] = {
+        "len", "str", "int", "float", "type", "print", "println", "p", "append",
+        "sqrt", "sin", "cos", "asin", "acos", "log", "exp", "ceil", "floor", "round", "pow",
+        "random", "str_format", "str_join", "str_split", "str_trim", "keys", "dict_keys",
+        "dict_has", "regexp_match", "regexp_find", "regexp_replace", "json_encode"};
+    if (find_function(gen, name)) return 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) return 1;
+    }
+    return 0;
+}
+
+// node is the loop index plus a constant: set *offset
+static int loop_index_offset(ASTNode *node, const char *index, long *offset) {
+    if (node->type == NODE_IDENTIFIER && strcmp(node->data.identifier.name, index) == 0) {
+        *offset = 0;
+        return 1;
+    }
+    if (node->type != NODE_BINARY_OP) return 0;
+    ASTNode *l = node->data.binary_op.left, *r = node->data.binary_op.right;
+    Operator op = node->data.binary_op.op;
+    if (op == OP_ADD && r->type == NODE_INT_LITERAL && loop_index_offset(l, index, offset) && *offset == 0) {
+        *offset = r->data.int_literal.value;
+        return 1;
+    }
+    if (op == OP_ADD && l->type == NODE_INT_LITERAL && loop_index_offset(r, index, offset) && *offset == 0) {
+        *offset = l->data.int_literal.value;
+        return 1;
+    }
+    if (op == OP_SUB && r->type == NODE_INT_LITERAL && loop_index_offset(l, index, offset) && *offset == 0) {
+        *offset = -(long)r->data.int_literal.value;
+        return 1;
+    }
+    return 0;
+}
+
+static void loop_scan_bind(LoopScan *ls, const char *name) {
+    if (!name) return;
+    LoopScanName *n = malloc(sizeof(LoopScanName));
+    n->name = name;
+    n->next = ls->bound;
+    ls->bound = n;
+}
+
+static int loop_scan_is_bound(LoopScan *ls, const char *name) {
+    for (LoopScanName *n = ls->bound; n; n = n->next) {
+        if (strcmp(n->name, name) == 0) return 1;
+    }
+    return 0;
+}
+
+static void loop_scan_stmts(LLVMCodeGen *gen, LoopScan *ls, ASTNodeList *list);
+
+static void loop_scan_expr(LLVMCodeGen *gen, LoopScan *ls, ASTNode *node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_INDEX_ACCESS: {
+            ASTNode *obj = node->data.index_access.object;
+            long offset;
+            if (obj->type == NODE_IDENTIFIER &&
+                loop_index_offset(node->data.index_access.index, ls->index, &offset)) {
+                LoopScanRead *r = ls->reads;
+                while (r && !(strcmp(r->array, obj->data.identifier.name) == 0 && r->offset == offset)) {
+                    r = r->next;
+                }
+                if (!r) {
+                    r = malloc(sizeof(LoopScanRead));
+                    r->array = obj->data.identifier.name;
+                    r->offset = offset;
+                    r->next = ls->reads;
+                    ls->reads = r;
+                }
+            }
+            loop_scan_expr(gen, ls, obj);
+            loop_scan_expr(gen, ls, node->data.index_access.index);
+            break;
+        }
+        case NODE_BINARY_OP:
+            loop_scan_expr(gen, ls, node->data.binary_op.left);
+            loop_scan_expr(gen, ls, node->data.binary_op.right);
+            break;
+        case NODE_UNARY_OP:
+            loop_scan_expr(gen, ls, node->data.unary_op.operand);
+            break;
+        case NODE_ARRAY_LITERAL:
+            for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next) {
+                loop_scan_expr(gen, ls, e->node);
+            }
+            break;
+        case NODE_DICT_LITERAL:
+            for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) {
+                loop_scan_expr(gen, ls, p->node->data.dict_pair.key);
+                loop_scan_expr(gen, ls, p->node->data.dict_pair.value);
+            }
+            break;
+        case NODE_SLICE_ACCESS:
+            loop_scan_expr(gen, ls, node->data.slice_access.object);
+            loop_scan_expr(gen, ls, node->data.slice_access.start);
+            loop_scan_expr(gen, ls, node->data.slice_access.end);
+            break;
+        case NODE_MEMBER_ACCESS:
+            loop_scan_expr(gen, ls, node->data.member_access.object);
+            break;
+        case NODE_FUNC_CALL:
+            if (!keeps_arrays(gen, node->data.func_call.name)) ls->calls_out = 1;
+            for (ASTNodeList *a = node->data.func_call.arguments; a; a = a->next) {
+                loop_scan_expr(gen, ls, a->node);
+            }
+            break;
+        case NODE_METHOD_CALL:
+        case NODE_NEW_EXPR:
+            ls->calls_out = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+static void loop_scan_stmt(LLVMCodeGen *gen, LoopScan *ls, ASTNode *node) {
+    switch (node->type) {
+        case NODE_VAR_DECL:
+            loop_scan_bind(ls, node->data.var_decl.name);
+            loop_scan_expr(gen, ls, node->data.var_decl.value);
+            break;
+        case NODE_MULTI_VAR_DECL:
+            loop_scan_stmts(gen, ls, node->data.multi_var_decl.declarations);
+            break;
+        case NODE_ASSIGNMENT:
+            if (node->data.assignment.target->type == NODE_IDENTIFIER) {
+                loop_scan_bind(ls, node->data.assignment.target->data.identifier.name);
+            } else if (node->data.assignment.target->type == NODE_INDEX_ACCESS) {
+                // A store, not a read: only its operands are scanned
+                loop_scan_expr(gen, ls, node->data.assignment.target->data.index_access.object);
+                loop_scan_expr(gen, ls, node->data.assignment.target->data.index_access.index);
+            } else {
+                loop_scan_expr(gen, ls, node->data.assignment.target);
+            }
+            loop_scan_expr(gen, ls, node->data.assignment.value);
+            break;
+        case NODE_RETURN:
+            loop_scan_expr(gen, ls, node->data.return_stmt.value);
+            break;
+        case NODE_YIELD:
+            // The consumer runs while the generator is suspended
+            ls->calls_out = 1;
+            loop_scan_expr(gen, ls, node->data.yield_stmt.value);
+            break;
+        case NODE_RAISE:
+            loop_scan_expr(gen, ls, node->data.raise_stmt.expr);
+            break;
+        case NODE_ASSERT:
+            loop_scan_expr(gen, ls, node->data.assert_stmt.expr);
+            loop_scan_expr(gen, ls, node->data.assert_stmt.msg);
+            break;
+        case NODE_IF_STMT:
+            loop_scan_expr(gen, ls, node->data.if_stmt.condition);
+            loop_scan_stmts(gen, ls, node->data.if_stmt.then_block);
+            loop_scan_stmts(gen, ls, node->data.if_stmt.else_block);
+            break;
+        case NODE_WHILE_STMT:
+            loop_scan_expr(gen, ls, node->data.while_stmt.condition);
+            loop_scan_stmts(gen, ls, node->data.while_stmt.body);
+            break;
+        case NODE_FOR_STMT:
+            // A parallel for body is generated in a function of its own
+            if (node->data.for_stmt.is_parallel) ls->calls_out = 1;
+            loop_scan_bind(ls, node->data.for_stmt.index_var);
+            loop_scan_expr(gen, ls, node->data.for_stmt.start);
+            loop_scan_expr(gen, ls, node->data.for_stmt.end);
+            loop_scan_stmts(gen, ls, node->data.for_stmt.body);
+            break;
+        case NODE_FOREACH_STMT:
+            // The collection may be a generator running user code
+            ls->calls_out = 1;
+            loop_scan_bind(ls, node->data.foreach_stmt.key_var);
+            loop_scan_bind(ls, node->data.foreach_stmt.value_var);
+            loop_scan_expr(gen, ls, node->data.foreach_stmt.collection);
+            loop_scan_stmts(gen, ls, node->data.foreach_stmt.body);
+            break;
+        case NODE_TRY_CATCH:
+            loop_scan_bind(ls, node->data.try_catch.catch_var);
+            loop_scan_stmts(gen, ls, node->data.try_catch.try_block);
+            loop_scan_stmts(gen, ls, node->data.try_catch.catch_block);
+            break;
+        case NODE_FUNC_DEF:
+        case NODE_CLASS_DEF:
+            ls->calls_out = 1;
+            break;
+        default:
+            loop_scan_expr(gen, ls, node);
+            break;
+    }
+}
+
+static void loop_scan_stmts(LLVMCodeGen *gen, LoopScan *ls, ASTNodeList *list) {
+    for (; list; list = list->next) loop_scan_stmt(gen, ls, list->node);
+}
+
+// Emit the guards of the for loop over `index` (range lo..hi, i64 temps) and
+// push its reads onto gen->loop_reads; returns the previous list head
+static LoopArrayRead *plan_loop_reads(LLVMCodeGen *gen, ASTNode *loop, VarMapping *index,
+                                      const char *lo, const char *hi) {
+    LoopArrayRead *saved = gen->loop_reads;
+    LoopScan ls = {loop->data.for_stmt.index_var, 0, NULL, NULL};
+    loop_scan_stmts(gen, &ls, loop->data.for_stmt.body);
+
+    while (ls.reads) {
+        LoopScanRead *r = ls.reads;
+        ls.reads = r->next;
+        VarMapping *array = find_var_mapping(gen, r->array);
+        if (!ls.calls_out && array && array != index && !loop_scan_is_bound(&ls, r->array) &&
+            !loop_scan_is_bound(&ls, ls.index)) {
+            LoopArrayRead *lr = malloc(sizeof(LoopArrayRead));
+            lr->array = array;
+            lr->index = index;
+            lr->offset = r->offset;
+            snprintf(lr->guard, sizeof(lr->guard), "%%t%d", gen->temp_counter++);
+
+            // The guard: array tag, then lo + offset >= 0 and hi + offset < size
+            char val[32], tag[32], is_array[32], addr[32], arr[32], size_ptr[32], size[32], size64[32];
+            char first[32], last[32], lo_ok[32], hi_ok[32], in_bounds[32];
+            char check[32], done[32], entry[32];
+            snprintf(check, sizeof(check), "label%d", gen->label_counter++);
+            snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+            snprintf(entry, sizeof(entry), "label%d", gen->label_counter++);
+            prof_temp(gen, val);
+            prof_temp(gen, tag);
+            prof_temp(gen, is_array);
+            if (array->is_global) {
+                char visible[32];
+                prof_temp(gen, visible);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = load %%Value, %%Value* @%s\n", visible, array->unique_name);
+                emit_task_global_check(gen, loop, array, visible);
+            }
+            emit_indent(gen);
+            fprintf(gen->out, "br label %%%s\n", entry);
+            fprintf(gen->out, "\n%s:\n", entry);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load %%Value, %%Value* %s%s\n", val, array->is_global ? "@" : "%",
+                    array->unique_name);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", tag, val);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", is_array, tag, TYPE_ARRAY);
+            emit_indent(gen);
+            fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", is_array, check, done);
+
+            fprintf(gen->out, "\n%s:\n", check);
+            prof_temp(gen, addr);
+            prof_temp(gen, arr);
+            prof_temp(gen, size_ptr);
+            prof_temp(gen, size);
+            prof_temp(gen, size64);
+            prof_temp(gen, first);
+            prof_temp(gen, last);
+            prof_temp(gen, lo_ok);
+            prof_temp(gen, hi_ok);
+            prof_temp(gen, in_bounds);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", addr, val);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = inttoptr i64 %s to { i32, i32, i8* }*\n", arr, addr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 0\n",
+                    size_ptr, arr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load i32, i32* %s\n", size, size_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = sext i32 %s to i64\n", size64, size);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = add i64 %s, %ld\n", first, lo, r->offset);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = add i64 %s, %ld\n", last, hi, r->offset);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp sge i64 %s, 0\n", lo_ok, first);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp slt i64 %s, %s\n", hi_ok, last, size64);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = and i1 %s, %s\n", in_bounds, lo_ok, hi_ok);
+            emit_indent(gen);
+            fprintf(gen->out, "br label %%%s\n", done);
+
+            fprintf(gen->out, "\n%s:\n", done);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = phi i1 [ false, %%%s ], [ %s, %%%s ]\n", lr->guard, entry, in_bounds, check);
+
+            lr->next = gen->loop_reads;
+            gen->loop_reads = lr;
+        }
+        free(r);
+    }
+    while (ls.bound) {
+        LoopScanName *next = ls.bound->next;
+        free(ls.bound);
+        ls.bound = next;
+    }
+    return saved;
+}
+
+static void pop_loop_reads(LLVMCodeGen *gen, LoopArrayRead *saved) {
+    while (gen->loop_reads != saved) {
+        LoopArrayRead *next = gen->loop_reads->next;
+        free(gen->loop_reads);
+        gen->loop_reads = next;
+    }
+}
+
+// The hoisted guard of an arr[i + c] read, or NULL
+static const char *loop_read_guard(LLVMCodeGen *gen, ASTNode *node) {
+    ASTNode *obj = node->data.index_access.object;
+    if (!gen->loop_reads || obj->type != NODE_IDENTIFIER) return NULL;
+    VarMapping *array = find_var_mapping(gen, obj->data.identifier.name);
+    for (LoopArrayRead *lr = gen->loop_reads; lr; lr = lr->next) {
+        long offset;
+        if (lr->array == array &&
+            loop_index_offset(node->data.index_access.index, lr->index->original_name, &offset) &&
+            offset == lr->offset && find_var_mapping(gen, lr->index->original_name) == lr->index) {
+            return lr->guard;
+        }
+    }
+    return NULL;
+}
+
+// arr[idx] under a hoisted guard: a direct load while it holds, index_get
+// (and its error) otherwise
+static void emit_guarded_index(LLVMCodeGen *gen, const char *guard, const char *obj, const char *idx,
+                               const char *result_var) {
+    char fast[32], slow[32], done[32];
+    snprintf(fast, sizeof(fast), "label%d", gen->label_counter++);
+    snprintf(slow, sizeof(slow), "label%d", gen->label_counter++);
+    snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+    emit_likely_br(gen, guard, fast, slow);
+
+    char addr[32], arr[32], data_ptr[32], data[32], elems[32], index[32], elem_ptr[32], fast_val[32];
+    prof_temp(gen, addr);
+    prof_temp(gen, arr);
+    prof_temp(gen, data_ptr);
+    prof_temp(gen, data);
+    prof_temp(gen, elems);
+    prof_temp(gen, index);
+    prof_temp(gen, elem_ptr);
+    prof_temp(gen, fast_val);
+    fprintf(gen->out, "\n%s:\n", fast);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", addr, obj);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = inttoptr i64 %s to { i32, i32, i8* }*\n", arr, addr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 2\n",
+            data_ptr, arr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load i8*, i8** %s\n", data, data_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = bitcast i8* %s to %%Value*\n", elems, data);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", index, idx);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr inbounds %%Value, %%Value* %s, i64 %s\n", elem_ptr, elems, index);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load %%Value, %%Value* %s\n", fast_val, elem_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    char slow_val[32];
+    prof_temp(gen, slow_val);
+    fprintf(gen->out, "\n%s:\n", slow);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @index_get(%%Value %s, %%Value %s)\n", slow_val, obj, idx);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", done);
+
+    fprintf(gen->out, "\n%s:\n", done);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = phi %%Value [ %s, %%%s ], [ %s, %%%s ]\n",
+            result_var, fast_val, fast, slow_val, slow);
+}
+
+// ===== Static method dispatch =====
+// obj.m(args) calls @Class__m with the arguments in registers when the class
+// of obj is known at compile time: obj is `new C(...)`, a variable whose
+// every binding in the function (the whole unit for top-level variables) is
+// `new C(...)` of the same top-level class C, or `this`/`self` in a method of
+// C. The method must exist with the call's arity and be public unless called
+// on this; otherwise the call goes through method_call and fails there as
+// before. A class whose methods touch _names keeps this_stack current
+// around the call (method_enter/method_leave) unless it is a call on this
+// from the same thread, where the top already is this.
+
+typedef struct {
+    LLVMCodeGen *gen;
+    KnownInstance *names;
+    int private_access;    // Some member access or method call uses a _name
+    int whole_unit;        // Also walk function and class bodies
+} DispatchScan;
+
+static ClassInfo *find_class(LLVMCodeGen *gen, const char *name) {
+    for (ClassInfo *c = gen->classes; c; c = c->next) {
+        if (strcmp(c->node->data.class_def.name, name) == 0) return c;
+    }
+    return NULL;
+}
+
+static KnownInstance *find_instance(KnownInstance *list, const char *name) {
+    for (; list; list = list->next) {
+        if (strcmp(list->name, name) == 0) return list;
+    }
+    return NULL;
+}
+
+static void free_instances(KnownInstance *list) {
+    while (list) {
+        KnownInstance *next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+static void dispatch_bind(DispatchScan *ds, const char *name, ASTNode *value) {
+    if (!name) return;
+    ClassInfo *cls = NULL;
+    if (value && value->type == NODE_NEW_EXPR) cls = find_class(ds->gen, value->data.new_expr.class_name);
+    KnownInstance *k = find_instance(ds->names, name);
+    if (!k) {
+        k = malloc(sizeof(KnownInstance));
+        k->name = name;
+        k->cls = cls;
+        k->next = ds->names;
+        ds->names = k;
+    } else if (k->cls != cls) {
+        k->cls = NULL;
+    }
+}
+
+static void dispatch_stmts(DispatchScan *ds, ASTNodeList *list);
+
+static void dispatch_exprs(DispatchScan *ds, ASTNodeList *list);
+
+static void dispatch_expr(DispatchScan *ds, ASTNode *node) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_BINARY_OP:
+            dispatch_expr(ds, node->data.binary_op.left);
+            dispatch_expr(ds, node->data.binary_op.right);
+            break;
+        case NODE_UNARY_OP:
+            dispatch_expr(ds, node->data.unary_op.operand);
+            break;
+        case NODE_ARRAY_LITERAL:
+            dispatch_exprs(ds, node->data.array_literal.elements);
+            break;
+        case NODE_DICT_LITERAL:
+            for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) {
+                dispatch_expr(ds, p->node->data.dict_pair.key);
+                dispatch_expr(ds, p->node->data.dict_pair.value);
+            }
+            break;
+        case NODE_INDEX_ACCESS:
+            dispatch_expr(ds, node->data.index_access.object);
+            dispatch_expr(ds, node->data.index_access.index);
+            break;
+        case NODE_SLICE_ACCESS:
+            dispatch_expr(ds, node->data.slice_access.object);
+            dispatch_expr(ds, node->data.slice_access.start);
+            dispatch_expr(ds, node->data.slice_access.end);
+            break;
+        case NODE_MEMBER_ACCESS:
+            if (node->data.member_access.member[0] == '_') ds->private_access = 1;
+            dispatch_expr(ds, node->data.member_access.object);
+            break;
+        case NODE_METHOD_CALL:
+            if (node->data.method_call.method[0] == '_') ds->private_access = 1;
+            dispatch_expr(ds, node->data.method_call.object);
+            dispatch_exprs(ds, node->data.method_call.arguments);
+            break;
+        case NODE_FUNC_CALL:
+            dispatch_exprs(ds, node->data.func_call.arguments);
+            break;
+        case NODE_NEW_EXPR:
+            dispatch_exprs(ds, node->data.new_expr.arguments);
+            break;
+        default:
+            break;
+    }
+}
+
+static void dispatch_exprs(DispatchScan *ds, ASTNodeList *list) {
+    for (; list; list = list->next) dispatch_expr(ds, list->node);
+}
+
+static void dispatch_params(DispatchScan *ds, ASTNodeList *params) {
+    for (; params; params = params->next) dispatch_bind(ds, params->node->data.identifier.name, NULL);
+}
+
+static void dispatch_stmt(DispatchScan *ds, ASTNode *node) {
+    switch (node->type) {
+        case NODE_VAR_DECL:
+            dispatch_bind(ds, node->data.var_decl.name, node->data.var_decl.value);
+            dispatch_expr(ds, node->data.var_decl.value);
+            break;
+        case NODE_MULTI_VAR_DECL:
+            dispatch_stmts(ds, node->data.multi_var_decl.declarations);
+            break;
+        case NODE_ASSIGNMENT:
+            if (node->data.assignment.target->type == NODE_IDENTIFIER) {
+                dispatch_bind(ds, node->data.assignment.target->data.identifier.name,
+                              node->data.assignment.value);
+            } else {
+                dispatch_expr(ds, node->data.assignment.target);
+            }
+            dispatch_expr(ds, node->data.assignment.value);
+            break;
+        case NODE_RETURN:
+            dispatch_expr(ds, node->data.return_stmt.value);
+            break;
+        case NODE_YIELD:
+            dispatch_expr(ds, node->data.yield_stmt.value);
+            break;
+        case NODE_RAISE:
+            dispatch_expr(ds, node->data.raise_stmt.expr);
+            break;
+        case NODE_ASSERT:
+            dispatch_expr(ds, node->data.assert_stmt.expr);
+            dispatch_expr(ds, node->data.assert_stmt.msg);
+            break;
+        case NODE_IF_STMT:
+            dispatch_expr(ds, node->data.if_stmt.condition);
+            dispatch_stmts(ds, node->data.if_stmt.then_block);
+            dispatch_stmts(ds, node->data.if_stmt.else_block);
+            break;
+        case NODE_WHILE_STMT:
+            dispatch_expr(ds, node->data.while_stmt.condition);
+            dispatch_stmts(ds, node->data.while_stmt.body);
+            break;
+        case NODE_FOR_STMT:
+            dispatch_bind(ds, node->data.for_stmt.index_var, NULL);
+            dispatch_expr(ds, node->data.for_stmt.start);
+            dispatch_expr(ds, node->data.for_stmt.end);
+            dispatch_stmts(ds, node->data.for_stmt.body);
+            break;
+        case NODE_FOREACH_STMT:
+            dispatch_bind(ds, node->data.foreach_stmt.key_var, NULL);
+            dispatch_bind(ds, node->data.foreach_stmt.value_var, NULL);
+            dispatch_expr(ds, node->data.foreach_stmt.collection);
+            dispatch_stmts(ds, node->data.foreach_stmt.body);
+            break;
+        case NODE_TRY_CATCH:
+            dispatch_bind(ds, node->data.try_catch.catch_var, NULL);
+            dispatch_stmts(ds, node->data.try_catch.try_block);
+            dispatch_stmts(ds, node->data.try_catch.catch_block);
+            break;
+        case NODE_FUNC_DEF:
+            if (ds->whole_unit) {
+                dispatch_params(ds, node->data.func_def.params);
+                dispatch_stmts(ds, node->data.func_def.body);
+            }
+            break;
+        case NODE_CLASS_DEF:
+            if (ds->whole_unit) {
+                for (ASTNodeList *m = node->data.class_def.members; m; m = m->next) {
+                    dispatch_expr(ds, m->node->data.var_decl.value);
+                }
+                dispatch_stmts(ds, node->data.class_def.methods);
+            }
+            break;
+        default:
+            dispatch_expr(ds, node);
+            break;
+    }
+}
+
+static void dispatch_stmts(DispatchScan *ds, ASTNodeList *list) {
+    for (; list; list = list->next) dispatch_stmt(ds, list->node);
+}
+
+// Record the unit's top-level classes and what its top-level variables hold
+static void plan_classes(LLVMCodeGen *gen, ASTNodeList *stmts) {
+    if (gen->jit) return;  // Classes belong to the interpreter
+    for (ASTNodeList *s = stmts; s; s = s->next) {
+        if (s->node->type != NODE_CLASS_DEF) continue;
+        ClassInfo *c = malloc(sizeof(ClassInfo));
+        c->node = s->node;
+        c->rebound = 0;
+        DispatchScan ds = {gen, NULL, 0, 0};
+        for (ASTNodeList *m = s->node->data.class_def.methods; m; m = m->next) {
+            dispatch_stmts(&ds, m->node->data.func_def.body);
+        }
+        free_instances(ds.names);
+        c->private_access = ds.private_access;
+        c->next = gen->classes;
+        gen->classes = c;
+    }
+    DispatchScan ds = {gen, NULL, 0, 1};
+    dispatch_stmts(&ds, stmts);
+    for (ClassInfo *c = gen->classes; c; c = c->next) {
+        if (find_instance(ds.names, c->node->data.class_def.name)) c->rebound = 1;
+    }
+    gen->global_instances = ds.names;
+}
+
+// What the locals of the function about to be generated hold
+static void plan_dispatch(LLVMCodeGen *gen, ASTNodeList *body, ASTNodeList *params) {
+    free_instances(gen->instances);
+    DispatchScan ds = {gen, NULL, 0, 0};
+    dispatch_params(&ds, params);
+    dispatch_stmts(&ds, body);
+    gen->instances = ds.names;
+}
+
+// Class of the receiver if known; *on_this: the receiver is this/self of the
+// method being generated
+static ClassInfo *receiver_class(LLVMCodeGen *gen, ASTNode *obj, int *on_this) {
+    ClassInfo *cls = NULL;
+    *on_this = 0;
+    if (obj->type == NODE_NEW_EXPR) {
+        cls = find_class(gen, obj->data.new_expr.class_name);
+    } else if (obj->type == NODE_IDENTIFIER) {
+        const char *name = obj->data.identifier.name;
+        VarMapping *m = find_var_mapping(gen, name);
+        if (!m || m->external) return NULL;
+        if (m->is_global) {
+            // Only main's own code runs after the declaration for sure
+            KnownInstance *k = find_instance(gen->global_instances, name);
+            if (k && !gen->cur_func && m->declared) cls = k->cls;
+        } else {
+            KnownInstance *k = find_instance(gen->instances, name);
+            if (k) {
+                cls = k->cls;
+            } else if (gen->cur_class && (strcmp(name, "this") == 0 || strcmp(name, "self") == 0)) {
+                cls = gen->cur_class;
+                *on_this = 1;
+            }
+        }
+    }
+    return cls && !cls->rebound ? cls : NULL;
+}
+
+// Direct call for NODE_METHOD_CALL; returns 0 (nothing emitted) if the
+// call has to go through method_call
+static int emit_direct_method_call(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
+    int on_this;
+    ClassInfo *cls = receiver_class(gen, node->data.method_call.object, &on_this);
+    if (!cls) return 0;
+    const char *method = node->data.method_call.method;
+    ASTNode *def = NULL;
+    for (ASTNodeList *m = cls->node->data.class_def.methods; m && !def; m = m->next) {
+        if (strcmp(m->node->data.func_def.name, method) == 0) def = m->node;
+    }
+    if (!def) return 0;
+    int arity = 0, arg_count = 0;
+    for (ASTNodeList *p = def->data.func_def.params; p; p = p->next) arity++;
+    for (ASTNodeList *a = node->data.method_call.arguments; a; a = a->next) arg_count++;
+    if (arity != arg_count) return 0;
+    // On another thread (a parallel for body) this_stack does not hold this
+    int inside = on_this && !gen->in_parallel_for;
+    if (method[0] == '_' && !inside) return 0;
+
+    char obj_temp[32];
+    prof_temp(gen, obj_temp);
+    gen_expr(gen, node->data.method_call.object, obj_temp);
+    char (*arg_temps)[32] = malloc((arg_count > 0 ? arg_count : 1) * sizeof(*arg_temps));
+    ASTNodeList *arg = node->data.method_call.arguments;
+    for (int i = 0; i < arg_count; i++, arg = arg->next) {
+        prof_temp(gen, arg_temps[i]);
+        gen_expr(gen, arg->node, arg_temps[i]);
+    }
+
+    int keep_this = cls->private_access && !inside;
+    if (keep_this) {
+        emit_indent(gen);
+        fprintf(gen->out, "call void @method_enter(%%Value %s)\n", obj_temp);
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @%s__%s(%%Value %s", result_var,
+            cls->node->data.class_def.name, method, obj_temp);
+    for (int i = 0; i < arg_count; i++) fprintf(gen->out, ", %%Value %s", arg_temps[i]);
+    fprintf(gen->out, ")\n");
+    if (keep_this) {
+        emit_indent(gen);
+        fprintf(gen->out, "call void @method_leave()\n");
+    }
+    free(arg_temps);
+    return 1;
+}
+
+// i8* to the global holding string literal str
+static void emit_string_ptr(LLVMCodeGen *gen, const char *str, char *ptr) {
+    const char *global_name = register_string_literal(gen, str);
+    int len = strlen(str) + 1;
+    prof_temp(gen, ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
+            ptr, len, len, global_name);
+}
+
+// dict[key] = val for a dict literal's pair. A string literal key is not
+// evaluated (key_temp unused): its parse-time hash goes to dict_set_h.
+static void emit_dict_pair_set(LLVMCodeGen *gen, const char *dict, ASTNode *key, const char *key_temp,
+                               const char *val) {
+    if (key->type == NODE_STRING_LITERAL) {
+        char key_ptr[32];
+        emit_string_ptr(gen, key->data.string_literal.value, key_ptr);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = call %%Value @dict_set_h(%%Value %s, i8* %s, i32 %d, %%Value %s)\n",
+                new_temp(gen), dict, key_ptr, (int)key->data.string_literal.hash, val);
+        return;
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @dict_set(%%Value %s, %%Value %s, %%Value %s)\n",
+            new_temp(gen), dict, key_temp, val);
+}
+
+// Array literal built in its %stk_<id> storage. All elements are evaluated
+// first: they may read the array this site built on the previous iteration.
+static void emit_stack_array(LLVMCodeGen *gen, ASTNode *node, StackAlloc *sa, char *result_var) {
+    int count = 0;
+    for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next) count++;
+    char (*elems)[32] = malloc((count + 1) * sizeof(*elems));
+    int i = 0;
+    for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next, i++) {
+        snprintf(elems[i], sizeof(elems[i]), "%%t%d", gen->temp_counter++);
+        gen_expr(gen, e->node, elems[i]);
+    }
+    for (i = 0; i < count; i++) {
+        char slot[32];
+        snprintf(slot, sizeof(slot), "%%t%d", gen->temp_counter++);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = getelementptr [%d x %%Value], [%d x %%Value]* %%stk_%d_buf, i64 0, i64 %d\n",
+                slot, sa->slots, sa->slots, sa->id, i);
+        emit_indent(gen);
+        fprintf(gen->out, "store %%Value %s, %%Value* %s\n", elems[i], slot);
+    }
+    free(elems);
+
+    char size_ptr[32], cap_ptr[32], data_ptr[32], buf[32], addr[32];
+    snprintf(size_ptr, sizeof(size_ptr), "%%t%d", gen->temp_counter++);
+    snprintf(cap_ptr, sizeof(cap_ptr), "%%t%d", gen->temp_counter++);
+    snprintf(data_ptr, sizeof(data_ptr), "%%t%d", gen->temp_counter++);
+    snprintf(buf, sizeof(buf), "%%t%d", gen->temp_counter++);
+    snprintf(addr, sizeof(addr), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %%stk_%d, i32 0, i32 0\n",
+            size_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i32 %d, i32* %s\n", count, size_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %%stk_%d, i32 0, i32 1\n",
+            cap_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i32 %d, i32* %s\n", sa->slots, cap_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %%stk_%d, i32 0, i32 2\n",
+            data_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = bitcast [%d x %%Value]* %%stk_%d_buf to i8*\n", buf, sa->slots, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i8* %s, i8** %s\n", buf, data_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = ptrtoint { i32, i32, i8* }* %%stk_%d to i64\n", addr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = insertvalue %%Value { i32 %d, i64 0 }, i64 %s, 1\n", result_var, TYPE_ARRAY, addr);
+}
+
+// Dict literal in its %stk_<id> storage (header + cleared bucket table);
+// the entries themselves still come from dict_set
+static void emit_stack_dict(LLVMCodeGen *gen, ASTNode *node, StackAlloc *sa, char *result_var) {
+    int count = 0;
+    for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) count++;
+    char (*keys)[32] = malloc((count + 1) * sizeof(*keys));
+    char (*vals)[32] = malloc((count + 1) * sizeof(*vals));
+    int i = 0;
+    for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next, i++) {
+        snprintf(keys[i], sizeof(keys[i]), "%%t%d", gen->temp_counter++);
+        snprintf(vals[i], sizeof(vals[i]), "%%t%d", gen->temp_counter++);
+        if (p->node->data.dict_pair.key->type != NODE_STRING_LITERAL) {
+            gen_expr(gen, p->node->data.dict_pair.key, keys[i]);
+        }
+        gen_expr(gen, p->node->data.dict_pair.value, vals[i]);
+    }
+
+    char raw[32], buckets[32], buckets_ptr[32], size_ptr[32], changes_ptr[32], addr[32];
+    snprintf(raw, sizeof(raw), "%%t%d", gen->temp_counter++);
+    snprintf(buckets, sizeof(buckets), "%%t%d", gen->temp_counter++);
+    snprintf(buckets_ptr, sizeof(buckets_ptr), "%%t%d", gen->temp_counter++);
+    snprintf(size_ptr, sizeof(size_ptr), "%%t%d", gen->temp_counter++);
+    snprintf(addr, sizeof(addr), "%%t%d", gen->temp_counter++);
+    snprintf(changes_ptr, sizeof(changes_ptr), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = bitcast [%d x i8*]* %%stk_%d_buf to i8*\n", raw, HASH_SIZE, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "call i8* @memset(i8* %s, i32 0, i64 %d)\n", raw, (int)(HASH_SIZE * sizeof(DictEntry*)));
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr [%d x i8*], [%d x i8*]* %%stk_%d_buf, i64 0, i64 0\n",
+            buckets, HASH_SIZE, HASH_SIZE, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i8**, i32, i32 }, { i8**, i32, i32 }* %%stk_%d, i32 0, i32 0\n",
+            buckets_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i8** %s, i8*** %s\n", buckets, buckets_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i8**, i32, i32 }, { i8**, i32, i32 }* %%stk_%d, i32 0, i32 1\n",
+            size_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i32 0, i32* %s\n", size_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = getelementptr { i8**, i32, i32 }, { i8**, i32, i32 }* %%stk_%d, i32 0, i32 2\n",
+            changes_ptr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "store i32 0, i32* %s\n", changes_ptr);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = ptrtoint { i8**, i32, i32 }* %%stk_%d to i64\n", addr, sa->id);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = insertvalue %%Value { i32 %d, i64 0 }, i64 %s, 1\n", result_var, TYPE_DICT, addr);
+    i = 0;
+    for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next, i++) {
+        emit_dict_pair_set(gen, result_var, p->node->data.dict_pair.key, keys[i], vals[i]);
+    }
+    free(keys);
+    free(vals);
+}
+
+// ===== Static tables =====
+// A top-level `var t = <literal>` whose elements are all constants (numbers,
+// strings, booleans, null and nested constant literals) is emitted as
+// initialized data instead of make_array/append (make_dict/dict_set) calls
+// run at startup. Every array and dict is a StaticObject record in the
+// tl_static section (gc.h), which the collector marks like a heap object;
+// elements, buckets and entries are writable data in tl_static_data, so the
+// program updates the table in place and the pages it never writes stay
+// shared with the executable file. An array that grows moves its elements
+// to the heap like any other.
+
+static int is_static_literal(ASTNode *node) {
+    switch (node->type) {
+        case NODE_INT_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_BOOL_LITERAL:
+        case NODE_NULL_LITERAL:
+        case NODE_STRING_LITERAL:
+            return 1;
+        case NODE_UNARY_OP: {
+            ASTNode *operand = node->data.unary_op.operand;
+            return node->data.unary_op.op == OP_NEG &&
+                   (operand->type == NODE_INT_LITERAL || operand->type == NODE_FLOAT_LITERAL);
+        }
+        case NODE_ARRAY_LITERAL:
+            // append doubles the capacity, which must not start at 0
+            if (!node->data.array_literal.elements) return 0;
+            for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next) {
+                if (!is_static_literal(e->node)) return 0;
+            }
+            return 1;
+        case NODE_DICT_LITERAL:
+            for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) {
+                if (p->node->data.dict_pair.key->type != NODE_STRING_LITERAL ||
+                    !is_static_literal(p->node->data.dict_pair.value)) return 0;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void static_value(LLVMCodeGen *gen, ASTNode *node, FILE *out);
+
+// Record of an array literal; returns its id (@__static_<id>)
+static int emit_static_array(LLVMCodeGen *gen, ASTNode *node) {
+    int id = gen->static_count++;
+    int n = 0;
+    char *elems = NULL;
+    size_t elems_len = 0;
+    FILE *list = open_memstream(&elems, &elems_len);
+    for (ASTNodeList *e = node->data.array_literal.elements; e; e = e->next, n++) {
+        fprintf(list, "%s\n  ", n > 0 ? "," : "");
+        static_value(gen, e->node, list);
+    }
+    fclose(list);
+    FILE *f = gen->static_data;
+    fprintf(f, "@__static_%d_data = internal global [%d x %%Value] [%s\n], section \"tl_static_data\", align 8\n",
+            id, n, elems);
+    fprintf(f, "@__static_%d = internal global %%StaticArray { i32 %d, i32 0, { i32, i32, i8* } "
+            "{ i32 %d, i32 %d, i8* bitcast ([%d x %%Value]* @__static_%d_data to i8*) } }, "
+            "section \"tl_static\", align 8\n\n", id, TYPE_ARRAY, n, n, n, id);
+    free(elems);
+    return id;
+}
+
+// Record of a dict literal, its bucket table and one global per entry. The
+// chains are linked as dict_set would have built them: the key set last
+// heads its bucket, a repeated key keeps its first position.
+static int emit_static_dict(LLVMCodeGen *gen, ASTNode *node) {
+    int id = gen->static_count++;
+    int count = 0;
+    for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) count++;
+    ASTNode **pairs = malloc((count + 1) * sizeof(ASTNode*));
+    int *head = malloc(HASH_SIZE * sizeof(int));
+    int *next = malloc((count + 1) * sizeof(int));
+    for (int b = 0; b < HASH_SIZE; b++) head[b] = -1;
+    int n = 0;
+    for (ASTNodeList *p = node->data.dict_literal.pairs; p; p = p->next) {
+        ASTNode *key = p->node->data.dict_pair.key;
+        unsigned int b = key->data.string_literal.hash % HASH_SIZE;
+        int e = head[b];
+        while (e >= 0 && strcmp(pairs[e]->data.dict_pair.key->data.string_literal.value,
+                                key->data.string_literal.value) != 0) {
+            e = next[e];
+        }
+        if (e >= 0) {
+            pairs[e] = p->node;
+            continue;
+        }
+        pairs[n] = p->node;
+        next[n] = head[b];
+        head[b] = n++;
+    }
+
+    for (int e = 0; e < n; e++) {
+        ASTNode *key = pairs[e]->data.dict_pair.key;
+        const char *global_name = register_string_literal(gen, key->data.string_literal.value);
+        int len = strlen(key->data.string_literal.value) + 1;
+        char *val = NULL;
+        size_t val_len = 0;
+        FILE *vf = open_memstream(&val, &val_len);
+        static_value(gen, pairs[e]->data.dict_pair.value, vf);
+        fclose(vf);
+        FILE *f = gen->static_data;
+        fprintf(f, "@__static_%d_e%d = internal global %%StaticEntry { "
+                "i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0), i32 %d, %s, ",
+                id, e, len, len, global_name, (int)key->data.string_literal.hash, val);
+        if (next[e] >= 0) {
+            fprintf(f, "i8* bitcast (%%StaticEntry* @__static_%d_e%d to i8*)", id, next[e]);
+        } else {
+            fprintf(f, "i8* null");
+        }
+        fprintf(f, " }, section \"tl_static_data\", align 8\n");
+        free(val);
+    }
+
+    FILE *f = gen->static_data;
+    fprintf(f, "@__static_%d_buckets = internal global [%d x i8*] [", id, HASH_SIZE);
+    for (int b = 0; b < HASH_SIZE; b++) {
+        fprintf(f, "%s", b > 0 ? ", " : "");
+        if (b % 8 == 0) fprintf(f, "\n  ");
+        if (head[b] >= 0) {
+            fprintf(f, "i8* bitcast (%%StaticEntry* @__static_%d_e%d to i8*)", id, head[b]);
+        } else {
+            fprintf(f, "i8* null");
+        }
+    }
+    fprintf(f, "\n], section \"tl_static_data\", align 8\n");
+    fprintf(f, "@__static_%d = internal global %%StaticDict { i32 %d, i32 0, { i8**, i32, i32 } "
+            "{ i8** getelementptr inbounds ([%d x i8*], [%d x i8*]* @__static_%d_buckets, i64 0, i64 0), i32 %d, i32 0 } }, "
+            "section \"tl_static\", align 8\n\n", id, TYPE_DICT, HASH_SIZE, HASH_SIZE, id, n);
+    free(pairs);
+    free(head);
+    free(next);
+    return id;
+}
+
+// Write the address of an array/dict literal's Array/Dict, as an i64
+// constant, to out
+static void static_address(LLVMCodeGen *gen, ASTNode *node, FILE *out) {
+    if (node->type == NODE_ARRAY_LITERAL) {
+        fprintf(out, "i64 ptrtoint ({ i32, i32, i8* }* getelementptr inbounds "
+                "(%%StaticArray, %%StaticArray* @__static_%d, i32 0, i32 2) to i64)",
+                emit_static_array(gen, node));
+    } else {
+        fprintf(out, "i64 ptrtoint ({ i8**, i32, i32 }* getelementptr inbounds "
+                "(%%StaticDict, %%StaticDict* @__static_%d, i32 0, i32 2) to i64)",
+                emit_static_dict(gen, node));
+    }
+}
+
+// Write the %Value constant of a static literal to out
+static void static_value(LLVMCodeGen *gen, ASTNode *node, FILE *out) {
+    switch (node->type) {
+        case NODE_INT_LITERAL:
+            fprintf(out, "%%Value { i32 %d, i64 %d }", TYPE_INT, node->data.int_literal.value);
+            break;
+        case NODE_FLOAT_LITERAL:
+        case NODE_UNARY_OP: {
+            ASTNode *lit = node->type == NODE_UNARY_OP ? node->data.unary_op.operand : node;
+            int neg = node->type == NODE_UNARY_OP;
+            if (lit->type == NODE_INT_LITERAL) {
+                fprintf(out, "%%Value { i32 %d, i64 %ld }", TYPE_INT,
+                        neg ? -(long)lit->data.int_literal.value : (long)lit->data.int_literal.value);
+                break;
+            }
+            double d = neg ? -lit->data.float_literal.value : lit->data.float_literal.value;
+            long bits;
+            memcpy(&bits, &d, sizeof(bits));
+            fprintf(out, "%%Value { i32 %d, i64 %ld }", TYPE_FLOAT, bits);
+            break;
+        }
+        case NODE_BOOL_LITERAL:
+            fprintf(out, "%%Value { i32 %d, i64 %d }", TYPE_BOOL, node->data.bool_literal.value ? 1 : 0);
+            break;
+        case NODE_NULL_LITERAL:
+            fprintf(out, "%%Value { i32 %d, i64 0 }", TYPE_NULL);
+            break;
+        case NODE_STRING_LITERAL: {
+            const char *global_name = register_string_literal(gen, node->data.string_literal.value);
+            int len = strlen(node->data.string_literal.value) + 1;
+            fprintf(out, "%%Value { i32 %d, i64 ptrtoint ([%d x i8]* %s to i64) }", TYPE_STRING,
+                    len, global_name);
+            break;
+        }
+        case NODE_ARRAY_LITERAL:
+        case NODE_DICT_LITERAL:
+            fprintf(out, "%%Value { i32 %d, ", node->type == NODE_ARRAY_LITERAL ? TYPE_ARRAY : TYPE_DICT);
+            static_address(gen, node, out);
+            fprintf(out, " }");
+            break;
+        default:
+            codegen_error(node, "Not a constant literal (codegen)");
+    }
+}
+
+// The value of a top-level declaration's constant literal, as static data.
+// Not for the JIT: the collector finds the records through the section
+// bounds of the linked executable.
+static int gen_static_table(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
+    if (gen->jit || (node->type != NODE_ARRAY_LITERAL && node->type != NODE_DICT_LITERAL) ||
+        !is_static_literal(node)) {
+        return 0;
+    }
+    if (!gen->static_data) {
+        gen->static_data = open_memstream(&gen->static_buf, &gen->static_len);
+    }
+    char *addr = NULL;
+    size_t addr_len = 0;
+    FILE *af = open_memstream(&addr, &addr_len);
+    static_address(gen, node, af);
+    fclose(af);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = insertvalue %%Value { i32 %d, i64 undef }, %s, 1\n", result_var,
+            node->type == NODE_ARRAY_LITERAL ? TYPE_ARRAY : TYPE_DICT, addr);
+    free(addr);
+    return 1;
+}
+
+static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
+    switch (node->type) {
+        case NODE_INT_LITERAL: {
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @make_int(i64 %d)\n",
+                    result_var, node->data.int_literal.value);
+            break;
+        }
+
+        case NODE_FLOAT_LITERAL: {
+            // Hex form: the exact bits, so output matches the interpreter
+            double d = node->data.float_literal.value;
+            unsigned long bits;
+            memcpy(&bits, &d, sizeof(bits));
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @make_float(double 0x%016lX)\n", result_var, bits);
+            break;
+        }
+
+        case NODE_BOOL_LITERAL: {
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @make_bool(i1 %d)\n",
+                    result_var, node->data.bool_literal.value ? 1 : 0);
+            break;
+        }
+
+        case NODE_NULL_LITERAL: {
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @make_null()\n", result_var);
+            break;
+        }
+
+        case NODE_STRING_LITERAL: {
+            const char *global_name = register_string_literal(gen, node->data.string_literal.value);
+            int len = strlen(node->data.string_literal.value) + 1;
+            char str_ptr[32];
+            snprintf(str_ptr, sizeof(str_ptr), "%%t%d", gen->temp_counter++);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
+                    str_ptr, len, len, global_name);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @make_string(i8* %s)\n",
+                    result_var, str_ptr);
+            break;
+        }
+
+        case NODE_IDENTIFIER: {
+            VarMapping *m = find_var_mapping(gen, node->data.identifier.name);
+            FuncInfo *fi = m == NULL ? find_function(gen, node->data.identifier.name) : NULL;
+            if (fi) {
+                // Function used as a value (e.g. spawn(f, ...)): a FuncRef
+                fi->referenced = 1;
+                emit_indent(gen);
+                fprintf(gen->out, "%s = insertvalue %%Value { i32 9, i64 undef }, "
+                        "i64 ptrtoint (%%FuncRef* @__fn_%s to i64), 1\n", result_var, fi->name);
+                break;
+            }
+            if (m == NULL) {
+                codegen_error(node, "Variable '%s' not declared in this scope (codegen)", node->data.identifier.name);
+            }
+            emit_indent(gen);
+            if (m->is_global) {
+                fprintf(gen->out, "%s = load %%Value, %%Value* @%s\n", result_var, m->unique_name);
+                emit_task_global_check(gen, node, m, result_var);
+            } else {
+                fprintf(gen->out, "%s = load %%Value, %%Value* %%%s\n", result_var, m->unique_name);
+            }
+            break;
+        }
+
+        case NODE_MEMBER_ACCESS: {
+            char obj_temp[32];
+            snprintf(obj_temp, sizeof(obj_temp), "%%t%d", gen->temp_counter++);
+            gen_expr(gen, node->data.member_access.object, obj_temp);
+
+            char str_ptr[32];
+            emit_string_ptr(gen, node->data.member_access.member, str_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call %%Value @member_get_h(%%Value %s, i8* %s, i32 %d)\n",
+                    result_var, obj_temp, str_ptr, (int)node->data.member_access.hash);
             break;
         }
 
@@ -1022,6 +2993,13 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                 default: op_code = 0; break;
             }
 
+            ProfSiteInfo *site = op_code <= 10 ? prof_site(gen, PROF_SITE_BINOP, node) : NULL;
+            emit_prof_count(gen, site, left_temp, right_temp);
+            if (emit_binop_fast_path(gen, prof_dominant(gen, site), op_code, left_temp, right_temp,
+                                     node->line, file_ptr, result_var)) {
+                break;
+            }
+
             emit_indent(gen);
             fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 %d, %%Value %s, i32 %d, i8* %s)\n",
                     result_var, left_temp, op_code, right_temp, node->line, file_ptr);
@@ -1029,6 +3007,16 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
         }
 
         case NODE_UNARY_OP: {
+            ASTNode *operand = node->data.unary_op.operand;
+            if (node->data.unary_op.op == OP_NEG && operand->type == NODE_FLOAT_LITERAL) {
+                // Negated in the constant, so -0.0 keeps its sign
+                double d = -operand->data.float_literal.value;
+                unsigned long bits;
+                memcpy(&bits, &d, sizeof(bits));
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @make_float(double 0x%016lX)\n", result_var, bits);
+                break;
+            }
             char operand_temp[32];
             snprintf(operand_temp, sizeof(operand_temp), "%%t%d", gen->temp_counter++);
             gen_expr(gen, node->data.unary_op.operand, operand_temp);
@@ -1053,13 +3041,58 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                 emit_indent(gen);
                 fprintf(gen->out, "%s = insertvalue %%Value %s, i64 %s, 1\n", result_var, base_val, bool_int);
             } else if (node->data.unary_op.op == OP_NEG) {
+                // Floats flip the sign bit like the interpreter, so -0.0 stays
+                // negative; everything else is 0 - x through binary_op
+                char type_tag[32], is_float[32], bits[32], flipped[32], float_val[32], other_val[32];
+                char flt[32], other[32], done[32];
+                snprintf(type_tag, sizeof(type_tag), "%%t%d", gen->temp_counter++);
+                snprintf(is_float, sizeof(is_float), "%%t%d", gen->temp_counter++);
+                snprintf(bits, sizeof(bits), "%%t%d", gen->temp_counter++);
+                snprintf(flipped, sizeof(flipped), "%%t%d", gen->temp_counter++);
+                snprintf(float_val, sizeof(float_val), "%%t%d", gen->temp_counter++);
+                snprintf(other_val, sizeof(other_val), "%%t%d", gen->temp_counter++);
+                snprintf(flt, sizeof(flt), "label%d", gen->label_counter++);
+                snprintf(other, sizeof(other), "label%d", gen->label_counter++);
+                snprintf(done, sizeof(done), "label%d", gen->label_counter++);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", type_tag, operand_temp);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = icmp eq i32 %s, %d\n", is_float, type_tag, TYPE_FLOAT);
+                emit_indent(gen);
+                fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", is_float, flt, other);
+
+                fprintf(gen->out, "\n%s:\n", flt);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", bits, operand_temp);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = xor i64 %s, -9223372036854775808\n", flipped, bits);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = insertvalue %%Value %s, i64 %s, 1\n", float_val, operand_temp, flipped);
+                emit_indent(gen);
+                fprintf(gen->out, "br label %%%s\n", done);
+
+                fprintf(gen->out, "\n%s:\n", other);
                 char zero[32];
                 snprintf(zero, sizeof(zero), "%%t%d", gen->temp_counter++);
                 emit_indent(gen);
                 fprintf(gen->out, "%s = call %%Value @make_int(i64 0)\n", zero);
+                const char *file_global = register_string_literal(gen, node->file ? node->file : "<input>");
+                int flen = strlen(node->file ? node->file : "<input>") + 1;
+                char file_ptr[32];
+                snprintf(file_ptr, sizeof(file_ptr), "%%t%d", gen->temp_counter++);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
+                        file_ptr, flen, flen, file_global);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 1, %%Value %s, i32 %d, i8* %s)\n",
+                        other_val, zero, operand_temp, node->line, file_ptr); // OP_SUB
+                emit_indent(gen);
+                fprintf(gen->out, "br label %%%s\n", done);
+
+                fprintf(gen->out, "\n%s:\n", done);
                 emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 1, %%Value %s)\n",
-                        result_var, zero, operand_temp); // OP_SUB
+                fprintf(gen->out, "%s = phi %%Value [ %s, %%%s ], [ %s, %%%s ]\n",
+                        result_var, float_val, flt, other_val, other);
             }
             break;
         }
@@ -1071,6 +3104,12 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
             // 3. Append each element
             // 4. Load final array value into result_var
 
+            StackAlloc *sa = find_stack_alloc(gen, node);
+            if (sa) {
+                emit_stack_array(gen, node, sa, result_var);
+                break;
+            }
+
             char temp_var[32];
             snprintf(temp_var, sizeof(temp_var), "%%arr_lit_%d", gen->temp_counter++);
 
@@ -1126,6 +3165,12 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
             // 3. Set each key-value pair
             // 4. Load final dict value into result_var
 
+            StackAlloc *sa = find_stack_alloc(gen, node);
+            if (sa) {
+                emit_stack_dict(gen, node, sa, result_var);
+                break;
+            }
+
             char temp_var[32];
             snprintf(temp_var, sizeof(temp_var), "%%dict_lit_%d", gen->temp_counter++);
 
@@ -1148,26 +3193,24 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
             while (pair != NULL) {
                 ASTNode *pair_node = pair->node;
 
-                char key_temp[32], val_temp[32], dict_load[32], set_result[32];
+                char key_temp[32], val_temp[32], dict_load[32];
                 snprintf(key_temp, sizeof(key_temp), "%%t%d", gen->temp_counter++);
                 snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
                 snprintf(dict_load, sizeof(dict_load), "%%t%d", gen->temp_counter++);
-                snprintf(set_result, sizeof(set_result), "%%t%d", gen->temp_counter++);
 
                 // Load current dict value
                 emit_indent(gen);
                 fprintf(gen->out, "%s = load %%Value, %%Value* %s\n", dict_load, temp_var);
 
-                // Generate key expression
-                gen_expr(gen, pair_node->data.dict_pair.key, key_temp);
+                // Generate key expression (a string literal key needs none)
+                if (pair_node->data.dict_pair.key->type != NODE_STRING_LITERAL) {
+                    gen_expr(gen, pair_node->data.dict_pair.key, key_temp);
+                }
 
                 // Generate value expression
                 gen_expr(gen, pair_node->data.dict_pair.value, val_temp);
 
-                // Call dict_set
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @dict_set(%%Value %s, %%Value %s, %%Value %s)\n",
-                        set_result, dict_load, key_temp, val_temp);
+                emit_dict_pair_set(gen, dict_load, pair_node->data.dict_pair.key, key_temp, val_temp);
 
                 pair = pair->next;
             }
@@ -1185,7 +3228,28 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
             snprintf(idx_temp, sizeof(idx_temp), "%%t%d", gen->temp_counter++);
 
             gen_expr(gen, node->data.index_access.object, obj_temp);
-            gen_expr(gen, node->data.index_access.index, idx_temp);
+            ASTNode *key = node->data.index_access.index;
+            if (key->type == NODE_STRING_LITERAL) {
+                // Constant key: no string is built, the hash is the parser's
+                char key_ptr[32];
+                emit_string_ptr(gen, key->data.string_literal.value, key_ptr);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @dict_get_h(%%Value %s, i8* %s, i32 %d)\n",
+                        result_var, obj_temp, key_ptr, (int)key->data.string_literal.hash);
+                break;
+            }
+            gen_expr(gen, key, idx_temp);
+
+            ProfSiteInfo *site = prof_site(gen, PROF_SITE_INDEX, node);
+            emit_prof_count(gen, site, obj_temp, idx_temp);
+            const char *guard = loop_read_guard(gen, node);
+            if (guard) {
+                emit_guarded_index(gen, guard, obj_temp, idx_temp, result_var);
+                break;
+            }
+            if (emit_index_fast_path(gen, prof_dominant(gen, site), obj_temp, idx_temp, result_var)) {
+                break;
+            }
 
             emit_indent(gen);
             // Use generic index_get which handles array, dict, and string
@@ -1206,6 +3270,18 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
             gen_expr(gen, node->data.slice_access.start, start_temp);
             gen_expr(gen, node->data.slice_access.end, end_temp);
 
+            StackAlloc *sa = find_stack_alloc(gen, node);
+            if (sa) {
+                // Array header in the frame, elements on the heap
+                char hdr[32];
+                snprintf(hdr, sizeof(hdr), "%%t%d", gen->temp_counter++);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = bitcast { i32, i32, i8* }* %%stk_%d to i8*\n", hdr, sa->id);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @slice_access_into(%%Value %s, %%Value %s, %%Value %s, i8* %s)\n",
+                        result_var, obj_temp, start_temp, end_temp, hdr);
+                break;
+            }
             emit_indent(gen);
             fprintf(gen->out, "%s = call %%Value @slice_access(%%Value %s, %%Value %s, %%Value %s)\n",
                     result_var, obj_temp, start_temp, end_temp);
@@ -1297,6 +3373,34 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                 emit_indent(gen);
                 fprintf(gen->out, "%s = call %%Value @json_decode_ctx(%%Value %s, i32 %d, i8* %s)\n",
                         result_var, arg_temps[0], node->line, file_ptr);
+            } else if (strcmp(node->data.func_call.name, "spawn") == 0) {
+                if (arg_count < 1) { codegen_error(node, "spawn() requires a function"); }
+                int task_args = arg_count - 1;
+                int slots = task_args > 0 ? task_args : 1;
+                char args_alloca[32];
+                snprintf(args_alloca, sizeof(args_alloca), "%%t%d", gen->temp_counter++);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = alloca [%d x %%Value]\n", args_alloca, slots);
+                for (int i = 0; i < task_args; i++) {
+                    char arg_ptr[32];
+                    snprintf(arg_ptr, sizeof(arg_ptr), "%%t%d", gen->temp_counter++);
+                    emit_indent(gen);
+                    fprintf(gen->out, "%s = getelementptr [%d x %%Value], [%d x %%Value]* %s, i32 0, i32 %d\n",
+                            arg_ptr, slots, slots, args_alloca, i);
+                    emit_indent(gen);
+                    fprintf(gen->out, "store %%Value %s, %%Value* %s\n", arg_temps[i+1], arg_ptr);
+                }
+                char args_base[32];
+                snprintf(args_base, sizeof(args_base), "%%t%d", gen->temp_counter++);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = getelementptr [%d x %%Value], [%d x %%Value]* %s, i32 0, i32 0\n",
+                        args_base, slots, slots, args_alloca);
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @task_spawn(%%Value %s, %%Value* %s, i32 %d, i8* null)\n",
+                        result_var, arg_temps[0], args_base, task_args);
+            } else if (strcmp(node->data.func_call.name, "join") == 0 && arg_count == 1) {
+                emit_indent(gen);
+                fprintf(gen->out, "%s = call %%Value @task_join(%%Value %s)\n", result_var, arg_temps[0]);
             } else if (strcmp(node->data.func_call.name, "str_format") == 0) {
                 if (arg_count < 1) { codegen_error(node, "str_format requires at least format"); }
                 int fmt_args = arg_count - 1;
@@ -1431,13 +3535,14 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                 if (fi && arg_count != fi->arity) {
                     codegen_error(node, "Function '%s' expects %d args but got %d (codegen)", fname, fi->arity, arg_count);
                 }
-
                 // Map builtin function names to runtime function names
                 const char *runtime_name = node->data.func_call.name;
                 if (strcmp(node->data.func_call.name, "int") == 0) {
                     runtime_name = "to_int";
                 } else if (strcmp(node->data.func_call.name, "float") == 0) {
                     runtime_name = "to_float";
+                } else if (strcmp(node->data.func_call.name, "bytes") == 0) {
+                    runtime_name = "to_bytes";
                 }
                 else if (strcmp(runtime_name, "read") == 0) runtime_name = "file_read";
                 else if (strcmp(runtime_name, "write") == 0) runtime_name = "file_write";
@@ -1449,6 +3554,21 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                 else if (strcmp(runtime_name, "str_trim") == 0) runtime_name = "str_trim";
                 else if (strcmp(runtime_name, "random") == 0) runtime_name = "math_random_val";
 
+                if (!fi) {
+                    // map/filter/reduce and the parallel p* variants (task.c)
+                    static const char *apply_names[] = {"map", "filter", "reduce", "pmap", "pfilter", "preduce"};
+                    for (int i = 0; i < 6; i++) {
+                        if (strcmp(fname, apply_names[i]) != 0) continue;
+                        int want = i % 3 == 2 ? 3 : 2;
+                        if (arg_count != want && !(i == 5 && arg_count == 4)) {
+                            codegen_error(node, "%s requires %d arguments (codegen)", fname, want);
+                        }
+                        static const char *apply_runtime[] = {"array_map", "array_filter", "array_reduce",
+                                                              "array_pmap", "array_pfilter", "array_preduce"};
+                        runtime_name = apply_runtime[i];
+                    }
+                }
+
                 // User function call
                 char rnd_zero1[32] = {0}, rnd_zero2[32] = {0};
                 if (strcmp(runtime_name, "math_random_val") == 0 && arg_count == 0) {
@@ -1460,6 +3580,40 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
                     fprintf(gen->out, "%s = call %%Value @make_int(i64 0)\n", rnd_zero2);
                 }
 
+                if (strcmp(runtime_name, "bytes_find") == 0 && arg_count == 2) {
+                    // Search from the start
+                    char defval[32];
+                    snprintf(defval, sizeof(defval), "%%t%d", gen->temp_counter++);
+                    emit_indent(gen);
+                    fprintf(gen->out, "%s = call %%Value @make_int(i64 0)\n", defval);
+                    arg_temps = realloc(arg_temps, 3 * sizeof(char*));
+                    arg_temps[2] = strdup(defval);
+                    arg_count = 3;
+                }
+
+                if ((strcmp(runtime_name, "csv_rows") == 0 || strcmp(runtime_name, "csv_read") == 0) &&
+                    arg_count == 1) {
+                    // No options
+                    char defval[32];
+                    snprintf(defval, sizeof(defval), "%%t%d", gen->temp_counter++);
+                    emit_indent(gen);
+                    fprintf(gen->out, "%s = call %%Value @make_null()\n", defval);
+                    arg_temps = realloc(arg_temps, 2 * sizeof(char*));
+                    arg_temps[1] = strdup(defval);
+                    arg_count = 2;
+                }
+
+                if (strcmp(runtime_name, "array_preduce") == 0 && arg_count == 3) {
+                    // No combine function: the chunk results are folded with fun
+                    char defval[32];
+                    snprintf(defval, sizeof(defval), "%%t%d", gen->temp_counter++);
+                    emit_indent(gen);
+                    fprintf(gen->out, "%s = call %%Value @make_null()\n", defval);
+                    arg_temps = realloc(arg_temps, 4 * sizeof(char*));
+                    arg_temps[3] = strdup(defval);
+                    arg_count = 4;
+                }
+
                 if (strcmp(runtime_name, "str_trim") == 0 && arg_count == 1) {
                     char defptr[32], defval[32];
                     snprintf(defptr, sizeof(defptr), "%%t%d", gen->temp_counter++);
@@ -1497,6 +3651,7 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
         }
 
         case NODE_METHOD_CALL: {
+            if (emit_direct_method_call(gen, node, result_var)) break;
             char obj_temp[32];
             snprintf(obj_temp, sizeof(obj_temp), "%%t%d", gen->temp_counter++);
             gen_expr(gen, node->data.method_call.object, obj_temp);
@@ -1609,7 +3764,208 @@ static void gen_expr(LLVMCodeGen *gen, ASTNode *node, char *result_var) {
     }
 }
 
+// Does the IR text mention %name (as a whole identifier)?
+static int ir_mentions(const char *ir, const char *name) {
+    size_t len = strlen(name);
+    for (const char *p = strchr(ir, '%'); p; p = strchr(p + 1, '%')) {
+        if (strncmp(p + 1, name, len) == 0) {
+            char c = p[1 + len];
+            if (!(c == '_' || c == '.' || (c >= '0' && c <= '9') ||
+                  (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// parallel for: the body is outlined into @__pfor_body_N(lo, hi, env) and
+// run by the runtime's parallel_for (task.h) over chunks of start..end.
+// Local variables of the enclosing function that the body uses are passed
+// by address in env and rebound under their usual names, so the body is
+// generated like any other code. They are read-only inside the body: each
+// iteration writes its result into an array indexed by the loop variable.
+static void gen_parallel_for(LLVMCodeGen *gen, ASTNode *node) {
+    char start_val[32], end_val[32], start_int[32], end_int[32], start_i64[32], end_i64[32];
+    snprintf(start_val, sizeof(start_val), "%%t%d", gen->temp_counter++);
+    snprintf(end_val, sizeof(end_val), "%%t%d", gen->temp_counter++);
+    snprintf(start_int, sizeof(start_int), "%%t%d", gen->temp_counter++);
+    snprintf(end_int, sizeof(end_int), "%%t%d", gen->temp_counter++);
+    snprintf(start_i64, sizeof(start_i64), "%%t%d", gen->temp_counter++);
+    snprintf(end_i64, sizeof(end_i64), "%%t%d", gen->temp_counter++);
+    gen_expr(gen, node->data.for_stmt.start, start_val);
+    gen_expr(gen, node->data.for_stmt.end, end_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @to_int(%%Value %s)\n", start_int, start_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @to_int(%%Value %s)\n", end_int, end_val);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", start_i64, start_int);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", end_i64, end_int);
+
+    // Candidates for capture: visible locals (globals are reachable directly)
+    int ncand = 0;
+    for (VarMapping *m = gen->var_mappings; m != NULL; m = m->next) ncand++;
+    VarMapping **cand = malloc((ncand + 1) * sizeof(VarMapping*));
+    int *was_captured = malloc((ncand + 1) * sizeof(int));
+    ncand = 0;
+    for (VarMapping *m = gen->var_mappings; m != NULL; m = m->next) {
+        if (m->is_global || find_var_mapping(gen, m->original_name) != m) continue;
+        was_captured[ncand] = m->captured;
+        m->captured = 1;
+        cand[ncand++] = m;
+    }
+
+    // Generate the body into its own buffer
+    int id = gen->pfor_count++;
+    FILE *saved_out = gen->out;
+    int saved_indent = gen->indent_level;
+    int saved_in_pfor = gen->in_parallel_for;
+    char *prev_break = gen->break_label;
+    char *prev_continue = gen->continue_label;
+    char *body_buf = NULL;
+    size_t body_len = 0;
+    gen->out = open_memstream(&body_buf, &body_len);
+    gen->indent_level = 1;
+    gen->in_parallel_for = 1;
+
+    int saved_for_depth = 0;
+    VarMapping *for_scope = push_scope(gen, &saved_for_depth);
+    const char *idx_unique = create_unique_var_name(gen, node->data.for_stmt.index_var, 0);
+    VarMapping *idx_map = find_var_mapping_current_scope(gen, node->data.for_stmt.index_var);
+    if (idx_map) idx_map->declared = 1;
+    emit_indent(gen);
+    fprintf(gen->out, "%%%s = alloca %%Value\n", idx_unique);
+    char init_val[32];
+    snprintf(init_val, sizeof(init_val), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @make_int(i64 %%lo)\n", init_val);
+    emit_indent(gen);
+    fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", init_val, idx_unique);
+
+    char cond_label[32], body_label[32], incr_label[32], end_label[32];
+    snprintf(cond_label, sizeof(cond_label), "label%d", gen->label_counter++);
+    snprintf(body_label, sizeof(body_label), "label%d", gen->label_counter++);
+    snprintf(incr_label, sizeof(incr_label), "label%d", gen->label_counter++);
+    snprintf(end_label, sizeof(end_label), "label%d", gen->label_counter++);
+    gen->break_label = NULL;
+    gen->continue_label = strdup(incr_label);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", cond_label);
+
+    fprintf(gen->out, "\n%s:\n", cond_label);
+    char idx_load[32], idx_i64[32], cmp[32];
+    snprintf(idx_load, sizeof(idx_load), "%%t%d", gen->temp_counter++);
+    snprintf(idx_i64, sizeof(idx_i64), "%%t%d", gen->temp_counter++);
+    snprintf(cmp, sizeof(cmp), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load %%Value, %%Value* %%%s\n", idx_load, idx_unique);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", idx_i64, idx_load);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = icmp sle i64 %s, %%hi\n", cmp, idx_i64);
+    emit_indent(gen);
+    fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", cmp, body_label, end_label);
+
+    fprintf(gen->out, "\n%s:\n", body_label);
+    {
+        int saved_body_depth = 0;
+        VarMapping *body_scope = push_scope(gen, &saved_body_depth);
+        for (ASTNodeList *stmt = node->data.for_stmt.body; stmt != NULL; stmt = stmt->next) {
+            gen_statement(gen, stmt->node);
+        }
+        pop_scope(gen, body_scope, saved_body_depth);
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", incr_label);
+
+    fprintf(gen->out, "\n%s:\n", incr_label);
+    char idx_load2[32], idx_i64_2[32], next_i64[32], next_val[32];
+    snprintf(idx_load2, sizeof(idx_load2), "%%t%d", gen->temp_counter++);
+    snprintf(idx_i64_2, sizeof(idx_i64_2), "%%t%d", gen->temp_counter++);
+    snprintf(next_i64, sizeof(next_i64), "%%t%d", gen->temp_counter++);
+    snprintf(next_val, sizeof(next_val), "%%t%d", gen->temp_counter++);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = load %%Value, %%Value* %%%s\n", idx_load2, idx_unique);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", idx_i64_2, idx_load2);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = add i64 %s, 1\n", next_i64, idx_i64_2);
+    emit_indent(gen);
+    fprintf(gen->out, "%s = call %%Value @make_int(i64 %s)\n", next_val, next_i64);
+    emit_indent(gen);
+    fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", next_val, idx_unique);
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%%s\n", cond_label);
+
+    fprintf(gen->out, "\n%s:\n", end_label);
+    emit_indent(gen);
+    fprintf(gen->out, "ret void\n}\n\n");
+    fclose(gen->out);
+    pop_scope(gen, for_scope, saved_for_depth);
+
+    gen->out = saved_out;
+    gen->indent_level = saved_indent;
+    gen->in_parallel_for = saved_in_pfor;
+    gen->break_label = prev_break;
+    gen->continue_label = prev_continue;
+    for (int i = 0; i < ncand; i++) cand[i]->captured = was_captured[i];
+
+    // Keep only the variables the body mentions
+    int ncap = 0;
+    for (int i = 0; i < ncand; i++) {
+        if (ir_mentions(body_buf, cand[i]->unique_name)) cand[ncap++] = cand[i];
+    }
+
+    // Header and env prologue, then the body
+    if (!gen->outlined) gen->outlined = open_memstream(&gen->outlined_buf, &gen->outlined_len);
+    FILE *fn = gen->outlined;
+    if (gen->debug_info) {
+        fprintf(fn, ";#fn %d __pfor_body_%d %s\n", node->line, id, node->file ? node->file : "<input>");
+    }
+    fprintf(fn, "define internal void @__pfor_body_%d(i64 %%lo, i64 %%hi, %%Value** %%env) {\n", id);
+    for (int i = 0; i < ncap; i++) {
+        fprintf(fn, "  %%env%d = getelementptr %%Value*, %%Value** %%env, i64 %d\n", i, i);
+        fprintf(fn, "  %%%s = load %%Value*, %%Value** %%env%d\n", cand[i]->unique_name, i);
+    }
+    fwrite(body_buf, 1, body_len, fn);
+    free(body_buf);
+
+    // Call site: fill env with the variables' addresses
+    char env_arr[32], env_ptr[32];
+    snprintf(env_arr, sizeof(env_arr), "%%t%d", gen->temp_counter++);
+    snprintf(env_ptr, sizeof(env_ptr), "%%t%d", gen->temp_counter++);
+    if (ncap > 0) {
+        emit_indent(gen);
+        fprintf(gen->out, "%s = alloca [%d x %%Value*]\n", env_arr, ncap);
+        emit_indent(gen);
+        fprintf(gen->out, "%s = getelementptr [%d x %%Value*], [%d x %%Value*]* %s, i64 0, i64 0\n",
+                env_ptr, ncap, ncap, env_arr);
+        for (int i = 0; i < ncap; i++) {
+            char slot[32];
+            snprintf(slot, sizeof(slot), "%%t%d", gen->temp_counter++);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%Value*, %%Value** %s, i64 %d\n", slot, env_ptr, i);
+            emit_indent(gen);
+            fprintf(gen->out, "store %%Value* %%%s, %%Value** %s\n", cand[i]->unique_name, slot);
+        }
+    } else {
+        snprintf(env_ptr, sizeof(env_ptr), "null");
+    }
+    emit_indent(gen);
+    fprintf(gen->out, "call void @parallel_for(void (i64, i64, %%Value**)* @__pfor_body_%d, "
+            "i64 %s, i64 %s, %%Value** %s)\n", id, start_i64, end_i64, env_ptr);
+    free(cand);
+    free(was_captured);
+}
+
 static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
+    if (node->type != NODE_FUNC_DEF && node->type != NODE_MULTI_VAR_DECL) {
+        emit_debug_loc(gen, node);
+        emit_instr_counter(gen, node, 0);
+        emit_source_ctx(gen, node);
+    }
     switch (node->type) {
         case NODE_VAR_DECL: {
             VarMapping *m_current = find_var_mapping_current_scope(gen, node->data.var_decl.name);
@@ -1617,10 +3973,17 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
             if (m_current && m_current->declared) {
                 codegen_error(node, "Redefinition of '%s' in the same scope (codegen)", node->data.var_decl.name);
             }
-            // Evaluate initial value
+            // Frame storage dies with the call; a global outlives it
+            if (m_current ? m_current->is_global : gen->scope_depth == 0) {
+                unplan_stack_alloc(gen, node->data.var_decl.value);
+            }
+            // Evaluate initial value; a constant table declared by a
+            // top-level statement (run once) is static data
             char val_temp[32];
             snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
-            gen_expr(gen, node->data.var_decl.value, val_temp);
+            if (gen->top_stmt != node || !gen_static_table(gen, node->data.var_decl.value, val_temp)) {
+                gen_expr(gen, node->data.var_decl.value, val_temp);
+            }
 
             if (!m_current) {
                 int is_global_decl = (gen->scope_depth == 0);
@@ -1645,7 +4008,9 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         case NODE_MULTI_VAR_DECL: {
             /* Generate code for each declaration in the list */
             ASTNodeList *decl_list = node->data.multi_var_decl.declarations;
+            int top = gen->top_stmt == node;
             while (decl_list != NULL) {
+                if (top) gen->top_stmt = decl_list->node;
                 gen_statement(gen, decl_list->node);
                 decl_list = decl_list->next;
             }
@@ -1653,6 +4018,12 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         }
 
         case NODE_ASSIGNMENT: {
+            if (node->data.assignment.target->type == NODE_IDENTIFIER) {
+                VarMapping *tm = find_var_mapping(gen, node->data.assignment.target->data.identifier.name);
+                if (!tm || tm->is_global || tm->captured) {
+                    unplan_stack_alloc(gen, node->data.assignment.value);
+                }
+            }
             // Evaluate value
             char val_temp[32];
             snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
@@ -1665,6 +4036,12 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                     codegen_error(node, "Variable '%s' not declared in this scope (codegen)",
                                   node->data.assignment.target->data.identifier.name);
                 }
+                if (gen->in_parallel_for && (m->is_global || m->captured)) {
+                    codegen_error(node, "Cannot assign to '%s' inside parallel for: iterations run "
+                                  "concurrently; store results into an array indexed by the loop variable",
+                                  node->data.assignment.target->data.identifier.name);
+                }
+                emit_task_global_check(gen, node, m, NULL);
                 emit_indent(gen);
                 if (m && m->is_global) {
                     fprintf(gen->out, "store %%Value %s, %%Value* @%s\n", val_temp, m->unique_name);
@@ -1679,10 +4056,19 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                 snprintf(idx_temp, sizeof(idx_temp), "%%t%d", gen->temp_counter++);
 
                 gen_expr(gen, node->data.assignment.target->data.index_access.object, obj_temp);
-                gen_expr(gen, node->data.assignment.target->data.index_access.index, idx_temp);
-
+                ASTNode *key = node->data.assignment.target->data.index_access.index;
                 char result_temp[32];
                 snprintf(result_temp, sizeof(result_temp), "%%t%d", gen->temp_counter++);
+                if (key->type == NODE_STRING_LITERAL) {
+                    char key_ptr[32];
+                    emit_string_ptr(gen, key->data.string_literal.value, key_ptr);
+                    emit_indent(gen);
+                    fprintf(gen->out, "%s = call %%Value @dict_set_h(%%Value %s, i8* %s, i32 %d, %%Value %s)\n",
+                            result_temp, obj_temp, key_ptr, (int)key->data.string_literal.hash, val_temp);
+                    break;
+                }
+                gen_expr(gen, key, idx_temp);
+
                 emit_indent(gen);
                 fprintf(gen->out, "%s = call %%Value @index_set(%%Value %s, %%Value %s, %%Value %s)\n",
                         result_temp, obj_temp, idx_temp, val_temp);
@@ -1691,19 +4077,14 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                 snprintf(obj_temp, sizeof(obj_temp), "%%t%d", gen->temp_counter++);
                 gen_expr(gen, node->data.assignment.target->data.member_access.object, obj_temp);
 
-                const char *global_name = register_string_literal(gen, node->data.assignment.target->data.member_access.member);
-                int len = strlen(node->data.assignment.target->data.member_access.member) + 1;
+                ASTNode *target = node->data.assignment.target;
                 char str_ptr[32];
-                snprintf(str_ptr, sizeof(str_ptr), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = getelementptr inbounds [%d x i8], [%d x i8]* %s, i64 0, i64 0\n",
-                        str_ptr, len, len, global_name);
-
+                emit_string_ptr(gen, target->data.member_access.member, str_ptr);
                 char result_temp[32];
                 snprintf(result_temp, sizeof(result_temp), "%%t%d", gen->temp_counter++);
                 emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @member_set(%%Value %s, i8* %s, %%Value %s)\n",
-                        result_temp, obj_temp, str_ptr, val_temp);
+                fprintf(gen->out, "%s = call %%Value @member_set_h(%%Value %s, i8* %s, i32 %d, %%Value %s)\n",
+                        result_temp, obj_temp, str_ptr, (int)target->data.member_access.hash, val_temp);
             }
             break;
         }
@@ -1795,7 +4176,7 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                 fprintf(gen->out, "%s = load %%Value, %%Value* %s%s\n", cls_load2, is_global ? "@" : "%", unique_name);
 
                 emit_indent(gen);
-                fprintf(gen->out, "call void @class_add_method(%%Value %s, i8* %s, %%Value (%%Value, %%Value*, i32)* @%s__%s, i32 %d, i32 %d)\n",
+                fprintf(gen->out, "call void @class_add_method(%%Value %s, i8* %s, %%Value (%%Value, %%Value*, i32)* @%s__%s__args, i32 %d, i32 %d)\n",
                         cls_load2, method_ptr, node->data.class_def.name, method_name, arity, is_private);
 
                 meth = meth->next;
@@ -1804,7 +4185,8 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
             break;
         }
 
-        case NODE_FUNC_CALL: {
+        case NODE_FUNC_CALL:
+        case NODE_METHOD_CALL: {
             char temp[32];
             snprintf(temp, sizeof(temp), "%%t%d", gen->temp_counter++);
             gen_expr(gen, node, temp);
@@ -1930,6 +4312,9 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         }
 
         case NODE_BREAK: {
+            if (!gen->break_label && gen->in_parallel_for) {
+                codegen_error(node, "break cannot leave a parallel for (codegen)");
+            }
             if (!gen->break_label) {
                 codegen_error(node, "break used outside of loop (codegen)");
             }
@@ -1948,6 +4333,10 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         }
 
         case NODE_FOR_STMT: {
+            if (node->data.for_stmt.is_parallel) {
+                gen_parallel_for(gen, node);
+                break;
+            }
             int saved_for_depth = 0;
             VarMapping *for_scope = push_scope(gen, &saved_for_depth);
 
@@ -1991,6 +4380,15 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
             emit_indent(gen);
             fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", init_val, idx_unique);
 
+            char range_lo[32], range_hi[32];
+            snprintf(range_lo, sizeof(range_lo), "%%t%d", gen->temp_counter++);
+            snprintf(range_hi, sizeof(range_hi), "%%t%d", gen->temp_counter++);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = select i1 %s, i64 %s, i64 %s\n", range_lo, step_pos, start_i64, end_i64);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = select i1 %s, i64 %s, i64 %s\n", range_hi, step_pos, end_i64, start_i64);
+            LoopArrayRead *saved_reads = plan_loop_reads(gen, node, idx_map, range_lo, range_hi);
+
             char cond_label[32], body_label[32], incr_label[32], end_label[32];
             snprintf(cond_label, sizeof(cond_label), "label%d", gen->label_counter++);
             snprintf(body_label, sizeof(body_label), "label%d", gen->label_counter++);
@@ -2068,6 +4466,7 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
             gen->indent_level--;
 
             fprintf(gen->out, "\n%s:\n", end_label);
+            pop_loop_reads(gen, saved_reads);
             pop_scope(gen, for_scope, saved_for_depth);
             gen->break_label = prev_break;
             gen->continue_label = prev_continue;
@@ -2077,284 +4476,198 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         case NODE_FOREACH_STMT: {
             int saved_foreach_depth = 0;
             VarMapping *saved_foreach_scope = push_scope(gen, &saved_foreach_depth);
-            // Generate foreach loop for arrays and dicts
-            char collection_temp[32], type_temp[32], type_field_temp[32];
+            // One loop for arrays, dicts, strings and iterators: the runtime
+            // keeps the position (IterState), and array elements are read
+            // here by pointer while the array's storage stays put
+            char collection_temp[32];
             snprintf(collection_temp, sizeof(collection_temp), "%%t%d", gen->temp_counter++);
-            snprintf(type_temp, sizeof(type_temp), "%%t%d", gen->temp_counter++);
-            snprintf(type_field_temp, sizeof(type_field_temp), "%%t%d", gen->temp_counter++);
-
             gen_expr(gen, node->data.foreach_stmt.collection, collection_temp);
 
-            // Get type field
+            // The loop's slots are released when it ends: a foreach inside
+            // another loop would otherwise grow the stack on every pass (and
+            // keep each pass's iterator visible to the collector)
+            char stack_mark[32], state[32];
+            snprintf(stack_mark, sizeof(stack_mark), "%%t%d", gen->temp_counter++);
+            snprintf(state, sizeof(state), "%%t%d", gen->temp_counter++);
             emit_indent(gen);
-            fprintf(gen->out, "%s = extractvalue %%Value %s, 0\n", type_field_temp, collection_temp);
-
-            // Check if array (type == 3)
+            fprintf(gen->out, "%s = call i8* @llvm.stacksave()\n", stack_mark);
             emit_indent(gen);
-            fprintf(gen->out, "%s = icmp eq i32 %s, 3\n", type_temp, type_field_temp);
-
-            char array_label[32], dict_label[32], end_label[32];
-            snprintf(array_label, sizeof(array_label), "label%d", gen->label_counter++);
-            snprintf(dict_label, sizeof(dict_label), "label%d", gen->label_counter++);
-            snprintf(end_label, sizeof(end_label), "label%d", gen->label_counter++);
-
+            fprintf(gen->out, "%s = alloca %%IterState\n", state);
             emit_indent(gen);
-            fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", type_temp, array_label, dict_label);
-
-            // Array foreach
-            fprintf(gen->out, "\n%s:\n", array_label);
-            gen->indent_level++;
-            {
-                char *prev_break = gen->break_label;
-                char *prev_continue = gen->continue_label;
-                char len_temp[32], i_ptr[32];
-                snprintf(len_temp, sizeof(len_temp), "%%t%d", gen->temp_counter++);
-                snprintf(i_ptr, sizeof(i_ptr), "%%t%d", gen->temp_counter++);
-
-                // Get array length
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @len(%%Value %s)\n", len_temp, collection_temp);
-
-                // Allocate loop variables with unique names (these are new declarations)
-                const char *key_var = create_unique_var_name(gen, node->data.foreach_stmt.key_var, 0);
-                const char *value_var = create_unique_var_name(gen, node->data.foreach_stmt.value_var, 0);
-                VarMapping *kvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.key_var);
-                VarMapping *vvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.value_var);
-                if (kvm) kvm->declared = 1;
-                if (vvm) vvm->declared = 1;
-
-                emit_indent(gen);
-                fprintf(gen->out, "%%%s = alloca %%Value\n", key_var);
-                emit_indent(gen);
-                fprintf(gen->out, "%%%s = alloca %%Value\n", value_var);
-
-                // Allocate loop counter
-                emit_indent(gen);
-                fprintf(gen->out, "%s = alloca i64\n", i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "store i64 0, i64* %s\n", i_ptr);
-
-                char loop_cond[32], loop_body[32], loop_incr[32], loop_end[32];
-                snprintf(loop_cond, sizeof(loop_cond), "label%d", gen->label_counter++);
-                snprintf(loop_body, sizeof(loop_body), "label%d", gen->label_counter++);
-                snprintf(loop_incr, sizeof(loop_incr), "label%d", gen->label_counter++);
-                snprintf(loop_end, sizeof(loop_end), "label%d", gen->label_counter++);
-
-                gen->break_label = strdup(end_label);
-                gen->continue_label = strdup(loop_incr);
-
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_cond);
-
-                // Loop condition
-                fprintf(gen->out, "\n%s:\n", loop_cond);
-                gen->indent_level++;
-
-                char i_val[32], len_val[32], cmp_result[32];
-                snprintf(i_val, sizeof(i_val), "%%t%d", gen->temp_counter++);
-                snprintf(len_val, sizeof(len_val), "%%t%d", gen->temp_counter++);
-                snprintf(cmp_result, sizeof(cmp_result), "%%t%d", gen->temp_counter++);
-
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", i_val, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", len_val, len_temp);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = icmp slt i64 %s, %s\n", cmp_result, i_val, len_val);
-                emit_indent(gen);
-                fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", cmp_result, loop_body, loop_end);
-                gen->indent_level--;
-
-                // Loop body
-                fprintf(gen->out, "\n%s:\n", loop_body);
-                gen->indent_level++;
-
-                // Set key_var = i
-                char key_val_temp[32], value_val_temp[32], idx_val_temp[32];
-                snprintf(key_val_temp, sizeof(key_val_temp), "%%t%d", gen->temp_counter++);
-                snprintf(idx_val_temp, sizeof(idx_val_temp), "%%t%d", gen->temp_counter++);
-                snprintf(value_val_temp, sizeof(value_val_temp), "%%t%d", gen->temp_counter++);
-
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", idx_val_temp, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", key_val_temp, idx_val_temp);
-
-                // Store key_var
-                emit_indent(gen);
-                fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", key_val_temp, key_var);
-
-                // Get value using array_get
-                char array_get_idx[32];
-                snprintf(array_get_idx, sizeof(array_get_idx), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", array_get_idx, idx_val_temp);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @index_get(%%Value %s, %%Value %s)\n",
-                        value_val_temp, collection_temp, array_get_idx);
-
-                // Store value_var
-                emit_indent(gen);
-                fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", value_val_temp, value_var);
-
-                // Execute body statements
-                ASTNodeList *stmt = node->data.foreach_stmt.body;
-                while (stmt != NULL) {
-                    gen_statement(gen, stmt->node);
-                    stmt = stmt->next;
-                }
-
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_incr);
-                gen->indent_level--;
-
-                // Loop increment
-                fprintf(gen->out, "\n%s:\n", loop_incr);
-                gen->indent_level++;
-                char i_next[32], i_curr[32];
-                snprintf(i_curr, sizeof(i_curr), "%%t%d", gen->temp_counter++);
-                snprintf(i_next, sizeof(i_next), "%%t%d", gen->temp_counter++);
-
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", i_curr, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = add i64 %s, 1\n", i_next, i_curr);
-                emit_indent(gen);
-                fprintf(gen->out, "store i64 %s, i64* %s\n", i_next, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_cond);
-                gen->indent_level--;
-
-                fprintf(gen->out, "\n%s:\n", loop_end);
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", end_label);
-                gen->break_label = prev_break;
-                gen->continue_label = prev_continue;
-            }
-            gen->indent_level--;
-
-            // Dict foreach
-            fprintf(gen->out, "\n%s:\n", dict_label);
-            gen->indent_level++;
-            {
-                char *prev_break = gen->break_label;
-                char *prev_continue = gen->continue_label;
-                // keys_arr = keys(collection)
-                char keys_val[32];
-                snprintf(keys_val, sizeof(keys_val), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @keys(%%Value %s)\n", keys_val, collection_temp);
-
-                // len(keys_arr)
-                char len_temp[32];
-                snprintf(len_temp, sizeof(len_temp), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @len(%%Value %s)\n", len_temp, keys_val);
-
-                const char *key_var = create_unique_var_name(gen, node->data.foreach_stmt.key_var, 0);
-                const char *value_var = create_unique_var_name(gen, node->data.foreach_stmt.value_var, 0);
-                VarMapping *kvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.key_var);
-                VarMapping *vvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.value_var);
-                if (kvm) kvm->declared = 1;
-                if (vvm) vvm->declared = 1;
-                emit_indent(gen);
-                fprintf(gen->out, "%%%s = alloca %%Value\n", key_var);
-                emit_indent(gen);
-                fprintf(gen->out, "%%%s = alloca %%Value\n", value_var);
-
-                char i_ptr[32];
-                snprintf(i_ptr, sizeof(i_ptr), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = alloca i64\n", i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "store i64 0, i64* %s\n", i_ptr);
-
-                char loop_cond[32], loop_body[32], loop_incr[32], loop_end[32];
-                snprintf(loop_cond, sizeof(loop_cond), "label%d", gen->label_counter++);
-                snprintf(loop_body, sizeof(loop_body), "label%d", gen->label_counter++);
-                snprintf(loop_incr, sizeof(loop_incr), "label%d", gen->label_counter++);
-                snprintf(loop_end, sizeof(loop_end), "label%d", gen->label_counter++);
-
-                gen->break_label = strdup(end_label);
-                gen->continue_label = strdup(loop_incr);
+            fprintf(gen->out, "call void @iter_begin(%%Value %s, %%IterState* %s)\n", collection_temp, state);
+
+            const char *key_var = create_unique_var_name(gen, node->data.foreach_stmt.key_var, 0);
+            const char *value_var = create_unique_var_name(gen, node->data.foreach_stmt.value_var, 0);
+            VarMapping *kvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.key_var);
+            VarMapping *vvm = find_var_mapping_current_scope(gen, node->data.foreach_stmt.value_var);
+            if (kvm) kvm->declared = 1;
+            if (vvm) vvm->declared = 1;
+            emit_indent(gen);
+            fprintf(gen->out, "%%%s = alloca %%Value\n", key_var);
+            emit_indent(gen);
+            fprintf(gen->out, "%%%s = alloca %%Value\n", value_var);
 
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_cond);
+            char pos_ptr[32], end_ptr[32], base_ptr[32];
+            prof_temp(gen, pos_ptr);
+            prof_temp(gen, end_ptr);
+            prof_temp(gen, base_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%IterState, %%IterState* %s, i32 0, i32 1\n", pos_ptr, state);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%IterState, %%IterState* %s, i32 0, i32 2\n", end_ptr, state);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%IterState, %%IterState* %s, i32 0, i32 3\n", base_ptr, state);
 
-                // condition
-                fprintf(gen->out, "\n%s:\n", loop_cond);
-                gen->indent_level++;
-                char i_val[32], len_val[32], cmp_res[32];
-                snprintf(i_val, sizeof(i_val), "%%t%d", gen->temp_counter++);
-                snprintf(len_val, sizeof(len_val), "%%t%d", gen->temp_counter++);
-                snprintf(cmp_res, sizeof(cmp_res), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", i_val, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", len_val, len_temp);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = icmp slt i64 %s, %s\n", cmp_res, i_val, len_val);
-                emit_indent(gen);
-                fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", cmp_res, loop_body, loop_end);
-                gen->indent_level--;
+            char loop_cond[32], loop_check[32], loop_fast[32], loop_slow[32], loop_body[32], loop_end[32];
+            snprintf(loop_cond, sizeof(loop_cond), "label%d", gen->label_counter++);
+            snprintf(loop_check, sizeof(loop_check), "label%d", gen->label_counter++);
+            snprintf(loop_fast, sizeof(loop_fast), "label%d", gen->label_counter++);
+            snprintf(loop_slow, sizeof(loop_slow), "label%d", gen->label_counter++);
+            snprintf(loop_body, sizeof(loop_body), "label%d", gen->label_counter++);
+            snprintf(loop_end, sizeof(loop_end), "label%d", gen->label_counter++);
 
-                // body
-                fprintf(gen->out, "\n%s:\n", loop_body);
-                gen->indent_level++;
-                char key_idx_val[32], key_elem[32], key_idx_value[32], dict_val_temp[32];
-                snprintf(key_idx_val, sizeof(key_idx_val), "%%t%d", gen->temp_counter++);
-                snprintf(key_idx_value, sizeof(key_idx_value), "%%t%d", gen->temp_counter++);
-                snprintf(key_elem, sizeof(key_elem), "%%t%d", gen->temp_counter++);
-                snprintf(dict_val_temp, sizeof(dict_val_temp), "%%t%d", gen->temp_counter++);
+            char *prev_break = gen->break_label;
+            char *prev_continue = gen->continue_label;
+            gen->break_label = strdup(loop_end);
+            gen->continue_label = strdup(loop_cond);
 
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", key_idx_val, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", key_idx_value, key_idx_val);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @index_get(%%Value %s, %%Value %s)\n", key_elem, keys_val, key_idx_value);
-                emit_indent(gen);
-                fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", key_elem, key_var);
+            emit_indent(gen);
+            fprintf(gen->out, "br label %%%s\n", loop_cond);
+
+            // pos < end only for an array with elements left
+            char pos[32], end[32], in_range[32];
+            prof_temp(gen, pos);
+            prof_temp(gen, end);
+            prof_temp(gen, in_range);
+            fprintf(gen->out, "\n%s:\n", loop_cond);
+            gen->indent_level++;
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load %%Value*, %%Value** %s\n", pos, pos_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load %%Value*, %%Value** %s\n", end, end_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp ult %%Value* %s, %s\n", in_range, pos, end);
+            emit_indent(gen);
+            fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", in_range, loop_check, loop_slow);
+            gen->indent_level--;
 
-                emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @dict_get(%%Value %s, %%Value %s)\n", dict_val_temp, collection_temp, key_elem);
-                emit_indent(gen);
-                fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", dict_val_temp, value_var);
+            // The body may have moved the elements (append) or dropped
+            // some (remove); iter_next picks the walk up from there.
+            // Array layout (runtime.h): { i32 size, i32 capacity, i8* data }
+            char addr[32], arr[32], size_ptr[32], size[32], size64[32], data_ptr[32], data[32];
+            char elems[32], base[32], limit[32], same[32], below[32], valid[32];
+            prof_temp(gen, addr);
+            prof_temp(gen, arr);
+            prof_temp(gen, size_ptr);
+            prof_temp(gen, size);
+            prof_temp(gen, size64);
+            prof_temp(gen, data_ptr);
+            prof_temp(gen, data);
+            prof_temp(gen, elems);
+            prof_temp(gen, base);
+            prof_temp(gen, limit);
+            prof_temp(gen, same);
+            prof_temp(gen, below);
+            prof_temp(gen, valid);
+            fprintf(gen->out, "\n%s:\n", loop_check);
+            gen->indent_level++;
+            emit_indent(gen);
+            fprintf(gen->out, "%s = extractvalue %%Value %s, 1\n", addr, collection_temp);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = inttoptr i64 %s to { i32, i32, i8* }*\n", arr, addr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 0\n",
+                    size_ptr, arr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load i32, i32* %s\n", size, size_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = sext i32 %s to i64\n", size64, size);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr { i32, i32, i8* }, { i32, i32, i8* }* %s, i32 0, i32 2\n",
+                    data_ptr, arr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load i8*, i8** %s\n", data, data_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = bitcast i8* %s to %%Value*\n", elems, data);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load %%Value*, %%Value** %s\n", base, base_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%Value, %%Value* %s, i64 %s\n", limit, elems, size64);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp eq %%Value* %s, %s\n", same, elems, base);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp ult %%Value* %s, %s\n", below, pos, limit);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = and i1 %s, %s\n", valid, same, below);
+            emit_likely_br(gen, valid, loop_fast, loop_slow);
+            gen->indent_level--;
 
-                ASTNodeList *stmt = node->data.foreach_stmt.body;
-                while (stmt != NULL) {
-                    gen_statement(gen, stmt->node);
-                    stmt = stmt->next;
-                }
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_incr);
-                gen->indent_level--;
+            // key = position, value = *pos++
+            char pos_int[32], base_int[32], offset[32], index[32], key_val[32], elem[32], next[32];
+            prof_temp(gen, pos_int);
+            prof_temp(gen, base_int);
+            prof_temp(gen, offset);
+            prof_temp(gen, index);
+            prof_temp(gen, key_val);
+            prof_temp(gen, elem);
+            prof_temp(gen, next);
+            fprintf(gen->out, "\n%s:\n", loop_fast);
+            gen->indent_level++;
+            emit_indent(gen);
+            fprintf(gen->out, "%s = ptrtoint %%Value* %s to i64\n", pos_int, pos);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = ptrtoint %%Value* %s to i64\n", base_int, base);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = sub i64 %s, %s\n", offset, pos_int, base_int);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = lshr exact i64 %s, 4\n", index, offset);  // sizeof(Value) == 16
+            emit_indent(gen);
+            fprintf(gen->out, "%s = insertvalue %%Value { i32 0, i64 0 }, i64 %s, 1\n", key_val, index);
+            emit_indent(gen);
+            fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", key_val, key_var);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = load %%Value, %%Value* %s\n", elem, pos);
+            emit_indent(gen);
+            fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", elem, value_var);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = getelementptr %%Value, %%Value* %s, i64 1\n", next, pos);
+            emit_indent(gen);
+            fprintf(gen->out, "store %%Value* %s, %%Value** %s\n", next, pos_ptr);
+            emit_indent(gen);
+            fprintf(gen->out, "br label %%%s\n", loop_body);
+            gen->indent_level--;
 
-                // incr
-                fprintf(gen->out, "\n%s:\n", loop_incr);
-                gen->indent_level++;
-                char i_curr[32], i_next[32];
-                snprintf(i_curr, sizeof(i_curr), "%%t%d", gen->temp_counter++);
-                snprintf(i_next, sizeof(i_next), "%%t%d", gen->temp_counter++);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = load i64, i64* %s\n", i_curr, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "%s = add i64 %s, 1\n", i_next, i_curr);
-                emit_indent(gen);
-                fprintf(gen->out, "store i64 %s, i64* %s\n", i_next, i_ptr);
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", loop_cond);
-                gen->indent_level--;
+            // Dicts, strings, iterators and the array's slow cases
+            char more[32], more_bit[32];
+            prof_temp(gen, more);
+            prof_temp(gen, more_bit);
+            fprintf(gen->out, "\n%s:\n", loop_slow);
+            gen->indent_level++;
+            emit_indent(gen);
+            fprintf(gen->out, "%s = call i32 @iter_next(%%IterState* %s, %%Value* %%%s, %%Value* %%%s)\n",
+                    more, state, key_var, value_var);
+            emit_indent(gen);
+            fprintf(gen->out, "%s = icmp ne i32 %s, 0\n", more_bit, more);
+            emit_indent(gen);
+            fprintf(gen->out, "br i1 %s, label %%%s, label %%%s\n", more_bit, loop_body, loop_end);
+            gen->indent_level--;
 
-                fprintf(gen->out, "\n%s:\n", loop_end);
-                emit_indent(gen);
-                fprintf(gen->out, "br label %%%s\n", end_label);
-                gen->break_label = prev_break;
-                gen->continue_label = prev_continue;
+            fprintf(gen->out, "\n%s:\n", loop_body);
+            gen->indent_level++;
+            ASTNodeList *stmt = node->data.foreach_stmt.body;
+            while (stmt != NULL) {
+                gen_statement(gen, stmt->node);
+                stmt = stmt->next;
             }
+            emit_indent(gen);
+            fprintf(gen->out, "br label %%%s\n", loop_cond);
             gen->indent_level--;
 
-            fprintf(gen->out, "\n%s:\n", end_label);
+            fprintf(gen->out, "\n%s:\n", loop_end);
+            emit_indent(gen);
+            fprintf(gen->out, "call void @llvm.stackrestore(i8* %s)\n", stack_mark);
+            gen->break_label = prev_break;
+            gen->continue_label = prev_continue;
             pop_scope(gen, saved_foreach_scope, saved_foreach_depth);
             break;
         }
@@ -2437,7 +4750,7 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                 char pref_file[32];
                 snprintf(pref_file, sizeof(pref_file), "%%t%d", gen->temp_counter++);
                 emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s)\n", pref_file, pref_val, file_val);
+                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s, i32 %d, i8* %s)\n", pref_file, pref_val, file_val, node->line, file_ptr);
 
                 // add colon/line and closing bracket
                 char line_buf[64];
@@ -2456,12 +4769,12 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
                 char prefix_full[32];
                 snprintf(prefix_full, sizeof(prefix_full), "%%t%d", gen->temp_counter++);
                 emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s)\n", prefix_full, pref_file, line_val);
+                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s, i32 %d, i8* %s)\n", prefix_full, pref_file, line_val, node->line, file_ptr);
 
                 char combined[32];
                 snprintf(combined, sizeof(combined), "%%t%d", gen->temp_counter++);
                 emit_indent(gen);
-                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s)\n", combined, prefix_full, exc_tmp);
+                fprintf(gen->out, "%s = call %%Value @binary_op(%%Value %s, i32 0, %%Value %s, i32 %d, i8* %s)\n", combined, prefix_full, exc_tmp, node->line, file_ptr);
 
                 emit_indent(gen);
                 fprintf(gen->out, "store %%Value %s, %%Value* %%%s\n", combined, catch_var);
@@ -2561,7 +4874,19 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
         }
 
         case NODE_RETURN: {
-            if (node->data.return_stmt.value) {
+            if (gen->in_parallel_for) {
+                codegen_error(node, "return cannot leave a parallel for (codegen)");
+            }
+            if (gen->in_generator) {
+                // Ends the iteration; the value is evaluated and dropped
+                if (node->data.return_stmt.value) {
+                    char val_temp[32];
+                    snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
+                    gen_expr(gen, node->data.return_stmt.value, val_temp);
+                }
+                emit_indent(gen);
+                fprintf(gen->out, "ret void\n");
+            } else if (node->data.return_stmt.value) {
                 char val_temp[32];
                 snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
                 gen_expr(gen, node->data.return_stmt.value, val_temp);
@@ -2579,6 +4904,18 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
             break;
         }
 
+        case NODE_YIELD: {
+            if (gen->in_parallel_for) {
+                codegen_error(node, "yield cannot leave a parallel for (codegen)");
+            }
+            char val_temp[32];
+            snprintf(val_temp, sizeof(val_temp), "%%t%d", gen->temp_counter++);
+            gen_expr(gen, node->data.yield_stmt.value, val_temp);
+            emit_indent(gen);
+            fprintf(gen->out, "call void @gen_yield(%%Value %s)\n", val_temp);
+            break;
+        }
+
         case NODE_FUNC_DEF:
             // Functions are handled separately
             break;
@@ -2588,12 +4925,435 @@ static void gen_statement(LLVMCodeGen *gen, ASTNode *node) {
     }
 }
 
+// A generator function returns an iterator at once; its body (@NAME.body)
+// starts running on the first iter_next (make_generator in runtime.c)
+static void emit_generator_wrapper(LLVMCodeGen *gen, ASTNode *func) {
+    const char *name = func->data.func_def.name;
+    int nparams = 0;
+    fprintf(gen->out, "define %%Value @%s(", name);
+    for (ASTNodeList *p = func->data.func_def.params; p != NULL; p = p->next, nparams++) {
+        fprintf(gen->out, "%s%%Value %%param_%s", nparams > 0 ? ", " : "", p->node->data.identifier.name);
+    }
+    fprintf(gen->out, ") {\n");
+    const char *args = "null";
+    if (nparams > 0) {
+        fprintf(gen->out, "  %%args = alloca [%d x %%Value]\n", nparams);
+        int i = 0;
+        for (ASTNodeList *p = func->data.func_def.params; p != NULL; p = p->next, i++) {
+            fprintf(gen->out, "  %%arg%d = getelementptr [%d x %%Value], [%d x %%Value]* %%args, i32 0, i32 %d\n",
+                    i, nparams, nparams, i);
+            fprintf(gen->out, "  store %%Value %%param_%s, %%Value* %%arg%d\n", p->node->data.identifier.name, i);
+        }
+        args = "%arg0";
+    }
+    fprintf(gen->out, "  %%r = call %%Value @make_generator(void (%%Value*, i8*)* @%s.body, i8* null, "
+            "%%Value* %s, i32 %d, i8* null, i8* null)\n", name, args, nparams);
+    fprintf(gen->out, "  ret %%Value %%r\n}\n\n");
+}
+
+// Functions used as values: a FuncRef descriptor (see runtime.h) and a thunk
+// that unpacks the argument vector for the runtime (task_call)
+static void emit_func_refs(LLVMCodeGen *gen) {
+    int header = 0;
+    for (FuncInfo *f = gen->functions; f != NULL; f = f->next) {
+        if (!f->referenced) continue;
+        if (!header) {
+            fprintf(gen->out, "\n; ===== Function references =====\n\n");
+            fprintf(gen->out, "%%FuncRef = type { %%Value (%%Value*, i32)*, i32, i8* }\n\n");
+            header = 1;
+        }
+        const char *name_global = register_string_literal(gen, f->name);
+        int len = strlen(f->name) + 1;
+        fprintf(gen->out, "@__fn_%s = %sconstant %%FuncRef { %%Value (%%Value*, i32)* @__thunk_%s, "
+                "i32 %d, i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0) }\n",
+                f->name, gen->jit ? "" : "internal ", f->name, f->arity, len, len, name_global);
+        fprintf(gen->out, "define internal %%Value @__thunk_%s(%%Value* %%args, i32 %%arg_count) {\n", f->name);
+        for (int i = 0; i < f->arity; i++) {
+            fprintf(gen->out, "  %%p%d = getelementptr %%Value, %%Value* %%args, i32 %d\n", i, i);
+            fprintf(gen->out, "  %%a%d = load %%Value, %%Value* %%p%d\n", i, i);
+        }
+        fprintf(gen->out, "  %%r = call %%Value @%s(", f->name);
+        for (int i = 0; i < f->arity; i++) {
+            fprintf(gen->out, "%s%%Value %%a%d", i > 0 ? ", " : "", i);
+        }
+        fprintf(gen->out, ")\n  ret %%Value %%r\n}\n\n");
+    }
+}
+
+// --instrument: counter storage, the site table and a constructor that hands
+// both to the runtime (instr_register), which prints the hotness report at exit
+static void emit_instr_tables(LLVMCodeGen *gen) {
+    if (!gen->instrument) return;
+    int n = gen->instr_count;
+    InstrSiteInfo **sites = malloc(sizeof(InstrSiteInfo*) * (n > 0 ? n : 1));
+    InstrSiteInfo *it = gen->instr_sites;
+    for (int i = n - 1; it != NULL; i--, it = it->next) {
+        sites[i] = it;
+    }
+
+    // Site names/files go through the string table like any literal and are
+    // written out with the other late strings
+    for (int i = 0; i < n; i++) {
+        register_string_literal(gen, sites[i]->func);
+        register_string_literal(gen, sites[i]->file);
+    }
+
+    fprintf(gen->out, "\n; ===== Instrumentation =====\n\n");
+    fprintf(gen->out, "%%InstrSite = type { i8*, i8*, i32, i32, i64* }\n");
+    fprintf(gen->out, "declare void @instr_register(%%InstrSite*, i32)\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(gen->out, "@__instr_cnt_%d = internal global i64 0\n", i);
+    }
+
+    fprintf(gen->out, "@__instr_sites = internal global [%d x %%InstrSite] ", n);
+    if (n == 0) {
+        fprintf(gen->out, "zeroinitializer\n");
+    } else {
+        fprintf(gen->out, "[\n");
+        for (int i = 0; i < n; i++) {
+            int flen = strlen(sites[i]->func) + 1;
+            int plen = strlen(sites[i]->file) + 1;
+            fprintf(gen->out,
+                    "  %%InstrSite { i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0), "
+                    "i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0), "
+                    "i32 %d, i32 %d, i64* @__instr_cnt_%d }%s\n",
+                    flen, flen, register_string_literal(gen, sites[i]->func),
+                    plen, plen, register_string_literal(gen, sites[i]->file),
+                    sites[i]->line, sites[i]->is_entry, i, i + 1 < n ? "," : "");
+        }
+        fprintf(gen->out, "]\n");
+    }
+
+    fprintf(gen->out, "\ndefine internal void @__instr_init() {\n");
+    fprintf(gen->out, "  call void @instr_register(%%InstrSite* getelementptr inbounds "
+            "([%d x %%InstrSite], [%d x %%InstrSite]* @__instr_sites, i64 0, i64 0), i32 %d)\n", n, n, n);
+    fprintf(gen->out, "  ret void\n}\n");
+    free(sites);
+}
+
+// --profile-gen: per-site counters and the site table, registered with the
+// runtime (prof_register), which adds the counts to the profile at exit.
+static void emit_prof_tables(LLVMCodeGen *gen) {
+    if (!gen->profile_gen) return;
+    int n = gen->prof_count;
+    ProfSiteInfo **sites = malloc(sizeof(ProfSiteInfo*) * (n > 0 ? n : 1));
+    ProfSiteInfo *it = gen->prof_sites;
+    for (int i = n - 1; it != NULL; i--, it = it->next) {
+        sites[i] = it;
+    }
+    for (int i = 0; i < n; i++) {
+        register_string_literal(gen, sites[i]->file);
+    }
+
+    fprintf(gen->out, "\n; ===== Type profile =====\n\n");
+    fprintf(gen->out, "%%ProfSite = type { i32, i8*, i32, i32, i64* }\n");
+    fprintf(gen->out, "declare void @prof_register(%%ProfSite*, i32)\n");
+    fprintf(gen->out, "declare void @prof_binop(i64*, %%Value, %%Value)\n");
+    fprintf(gen->out, "declare void @prof_index(i64*, %%Value, %%Value)\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(gen->out, "@__prof_cnt_%d = internal global [%d x i64] zeroinitializer\n", i, PROF_BUCKETS);
+    }
+
+    fprintf(gen->out, "@__prof_sites = internal global [%d x %%ProfSite] ", n);
+    if (n == 0) {
+        fprintf(gen->out, "zeroinitializer\n");
+    } else {
+        fprintf(gen->out, "[\n");
+        for (int i = 0; i < n; i++) {
+            int plen = strlen(sites[i]->file) + 1;
+            fprintf(gen->out,
+                    "  %%ProfSite { i32 %d, i8* getelementptr inbounds ([%d x i8], [%d x i8]* %s, i64 0, i64 0), "
+                    "i32 %d, i32 %d, i64* getelementptr inbounds ([%d x i64], [%d x i64]* @__prof_cnt_%d, "
+                    "i64 0, i64 0) }%s\n",
+                    sites[i]->kind, plen, plen, register_string_literal(gen, sites[i]->file),
+                    sites[i]->line, sites[i]->ordinal, PROF_BUCKETS, PROF_BUCKETS, i,
+                    i + 1 < n ? "," : "");
+        }
+        fprintf(gen->out, "]\n");
+    }
+
+    fprintf(gen->out, "\ndefine internal void @__prof_init() {\n");
+    fprintf(gen->out, "  call void @prof_register(%%ProfSite* getelementptr inbounds "
+            "([%d x %%ProfSite], [%d x %%ProfSite]* @__prof_sites, i64 0, i64 0), i32 %d)\n", n, n, n);
+    fprintf(gen->out, "  ret void\n}\n");
+    free(sites);
+}
+
+// One llvm.global_ctors for the constructors the options above emitted
+static void emit_module_ctors(LLVMCodeGen *gen) {
+    const char *ctors[2];
+    int n = 0;
+    if (gen->instrument) ctors[n++] = "__instr_init";
+    if (gen->profile_gen) ctors[n++] = "__prof_init";
+    if (n == 0) return;
+    fprintf(gen->out, "\n@llvm.global_ctors = appending global [%d x { i32, void ()*, i8* }] [", n);
+    for (int i = 0; i < n; i++) {
+        fprintf(gen->out, "%s{ i32, void ()*, i8* } { i32 65535, void ()* @%s, i8* null }",
+                i > 0 ? ", " : "", ctors[i]);
+    }
+    fprintf(gen->out, "]\n");
+}
+
+// -g support: DIFile/scope bookkeeping for emit_debug_info()
+typedef struct {
+    char **names;
+    int *ids;
+    int count;
+    int cap;
+} DebugFileTable;
+
+static void emit_md_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\' || *p < 32 || *p > 126) {
+            fprintf(out, "\\%02X", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static int debug_file_id(DebugFileTable *files, FILE *md, int *next_id, const char *name) {
+    for (int i = 0; i < files->count; i++) {
+        if (strcmp(files->names[i], name) == 0) return files->ids[i];
+    }
+    if (files->count == files->cap) {
+        files->cap = files->cap ? files->cap * 2 : 8;
+        files->names = realloc(files->names, sizeof(char*) * files->cap);
+        files->ids = realloc(files->ids, sizeof(int) * files->cap);
+    }
+    int id = (*next_id)++;
+    files->names[files->count] = strdup(name);
+    files->ids[files->count] = id;
+    files->count++;
+
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) strcpy(cwd, ".");
+    fprintf(md, "!%d = !DIFile(filename: ", id);
+    emit_md_string(md, name);
+    fprintf(md, ", directory: ");
+    emit_md_string(md, cwd);
+    fprintf(md, ")\n");
+    return id;
+}
+
+// -g: copy the buffered IR to gen->out, attaching !dbg to each marked define
+// and to every instruction in it using the nearest preceding ";#loc" marker,
+// then append the debug metadata. Statement granularity: one line per stmt.
+static void emit_debug_info(LLVMCodeGen *gen, const char *ir) {
+    char *meta = NULL;
+    size_t meta_len = 0;
+    FILE *md = open_memstream(&meta, &meta_len);
+    DebugFileTable files = {0};
+    int next_id = 4;  // !0 compile unit, !1-!2 module flags, !3 subroutine type
+    int main_file = -1;
+    int sp = -1, sp_file = -1, pending_define = 0, in_fn = 0;
+    int cur_line = 0, cur_scope = -1, cur_loc = -1, loc_line = -1, loc_scope = -1;
+    // Lexical block files for statements included from another file
+    int block_file = -1, block_scope = -1;
+    char name[256], path[4096];
+
+    const char *line = ir;
+    while (*line) {
+        const char *eol = strchr(line, '\n');
+        int len = eol ? (int)(eol - line) : (int)strlen(line);
+        int ln = 0, consumed = 0;
+
+        if (strncmp(line, ";#fn ", 5) == 0 &&
+            sscanf(line + 5, "%d %255s %n", &ln, name, &consumed) == 2) {
+            int plen = len - 5 - consumed;
+            snprintf(path, sizeof(path), "%.*s", plen, line + 5 + consumed);
+            sp_file = debug_file_id(&files, md, &next_id, path);
+            if (main_file < 0 && strcmp(name, "main") == 0) main_file = sp_file;
+            sp = next_id++;
+            fprintf(md, "!%d = distinct !DISubprogram(name: ", sp);
+            emit_md_string(md, name);
+            fprintf(md, ", scope: !%d, file: !%d, line: %d, type: !3, scopeLine: %d, "
+                    "spFlags: DISPFlagDefinition, unit: !0)\n", sp_file, sp_file, ln, ln);
+            cur_line = ln;
+            cur_scope = sp;
+            cur_loc = -1;
+            block_file = -1;
+            pending_define = 1;
+        } else if (strncmp(line, ";#loc ", 6) == 0 &&
+                   sscanf(line + 6, "%d %n", &ln, &consumed) == 1) {
+            int plen = len - 6 - consumed;
+            snprintf(path, sizeof(path), "%.*s", plen, line + 6 + consumed);
+            int fid = debug_file_id(&files, md, &next_id, path);
+            if (fid == sp_file) {
+                cur_scope = sp;
+            } else {
+                if (fid != block_file) {
+                    block_file = fid;
+                    block_scope = next_id++;
+                    fprintf(md, "!%d = !DILexicalBlockFile(scope: !%d, file: !%d, discriminator: 0)\n",
+                            block_scope, sp, fid);
+                }
+                cur_scope = block_scope;
+            }
+            cur_line = ln;
+        } else if (pending_define && strncmp(line, "define ", 7) == 0) {
+            int brace = len;
+            while (brace > 0 && line[brace - 1] != '{') brace--;
+            fprintf(gen->out, "%.*s!dbg !%d {\n", brace - 1, line, sp);
+            pending_define = 0;
+            in_fn = 1;
+            cur_loc = -1;
+        } else if (in_fn && line[0] == '}') {
+            fprintf(gen->out, "%.*s\n", len, line);
+            in_fn = 0;
+        } else if (in_fn && line[0] == ' ') {
+            const char *p = line;
+            while (*p == ' ') p++;
+            if (p - line >= len || *p == ';') {
+                fprintf(gen->out, "%.*s\n", len, line);
+            } else {
+                if (cur_loc < 0 || loc_line != cur_line || loc_scope != cur_scope) {
+                    cur_loc = next_id++;
+                    loc_line = cur_line;
+                    loc_scope = cur_scope;
+                    fprintf(md, "!%d = !DILocation(line: %d, column: 1, scope: !%d)\n",
+                            cur_loc, cur_line, cur_scope);
+                }
+                fprintf(gen->out, "%.*s, !dbg !%d\n", len, line, cur_loc);
+            }
+        } else {
+            fprintf(gen->out, "%.*s\n", len, line);
+        }
+        line = eol ? eol + 1 : line + len;
+    }
+    if (main_file < 0) main_file = debug_file_id(&files, md, &next_id, "<input>");
+    fclose(md);
+
+    fprintf(gen->out, "\n!llvm.dbg.cu = !{!0}\n");
+    fprintf(gen->out, "!llvm.module.flags = !{!1, !2}\n");
+    fprintf(gen->out, "!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !%d, "
+            "producer: \"tiny codegen_llvm\", isOptimized: false, runtimeVersion: 0, "
+            "emissionKind: FullDebug)\n", main_file);
+    fprintf(gen->out, "!1 = !{i32 7, !\"Dwarf Version\", i32 4}\n");
+    fprintf(gen->out, "!2 = !{i32 2, !\"Debug Info Version\", i32 3}\n");
+    fprintf(gen->out, "!3 = !DISubroutineType(types: !{})\n");
+    fwrite(meta, 1, meta_len, gen->out);
+    free(meta);
+    for (int i = 0; i < files.count; i++) free(files.names[i]);
+    free(files.names);
+    free(files.ids);
+}
+
+static void emit_main_function(LLVMCodeGen *gen, ASTNode *root) {
+    fprintf(gen->out, "; ===== Main Function =====\n\n");
+    emit_debug_fn(gen, "main", root->file, 1);
+    fprintf(gen->out, "define i32 @main(i32 %%argc, i8** %%argv) {\n");
+    gen->indent_level = 1;
+
+    // Initialize GC
+    emit_indent(gen);
+    fprintf(gen->out, "call void @gc_init()\n");
+
+    // Set stack bottom for conservative scanning: main's frame address lies
+    // above all of its stack slots (an alloca of its own could be placed below
+    // the others, leaving values kept in main's frame unscanned)
+    emit_indent(gen);
+    fprintf(gen->out, "%%stack_bottom_ptr = call i8* @llvm.frameaddress.p0i8(i32 0)\n");
+    emit_indent(gen);
+    fprintf(gen->out, "call void @gc_set_stack_bottom(i8* %%stack_bottom_ptr)\n\n");
+
+    // Call set_cmd_args to store command line arguments
+    // Skip argv[0] (executable name) so cmd_args() only returns program arguments
+    emit_indent(gen);
+    fprintf(gen->out, "%%argc_adjusted = sub i32 %%argc, 1\n");
+    emit_indent(gen);
+    fprintf(gen->out, "%%argv_adjusted = getelementptr i8*, i8** %%argv, i32 1\n");
+    emit_indent(gen);
+    fprintf(gen->out, "call void @set_cmd_args(i32 %%argc_adjusted, i8** %%argv_adjusted)\n\n");
+    plan_stack_allocs(gen, root->data.program.statements);
+    plan_dispatch(gen, root->data.program.statements, NULL);
+
+    // Register global variables as GC roots
+    VarMapping *global_var = gen->var_mappings;
+    while (global_var != NULL) {
+        if (global_var->is_global && !global_var->external) {
+            emit_indent(gen);
+            fprintf(gen->out, "call void @gc_push_root(%%Value* @%s)\n", global_var->unique_name);
+        }
+        global_var = global_var->next;
+    }
+    if (gen->var_mappings) {
+        fprintf(gen->out, "\n");
+    }
+
+    ASTNodeList *stmt = root->data.program.statements;
+    while (stmt != NULL) {
+        if (stmt->node->type != NODE_FUNC_DEF) {
+            gen->top_stmt = stmt->node;
+            gen_statement(gen, stmt->node);
+        }
+        stmt = stmt->next;
+    }
+    gen->top_stmt = NULL;
+
+    emit_indent(gen);
+    fprintf(gen->out, "ret i32 0\n");
+    fprintf(gen->out, "}\n");
+}
+
+// Module mode (--cache-dir): the top-level code of an include file (class
+// definitions, init calls of the modules it includes) runs once, from the
+// first init call, instead of in main
+static void emit_module_init(LLVMCodeGen *gen, ASTNode *root) {
+    fprintf(gen->out, "; ===== Module Init =====\n\n");
+    fprintf(gen->out, "@__module_done = internal global i1 false\n\n");
+    gen->cur_func = gen->module_init;
+    emit_debug_fn(gen, gen->module_init, root->file, 1);
+    fprintf(gen->out, "define %%Value @%s() {\n", gen->module_init);
+    gen->indent_level = 1;
+    plan_stack_allocs(gen, NULL);
+    plan_dispatch(gen, NULL, NULL);
+    emit_indent(gen);
+    fprintf(gen->out, "%%done = load i1, i1* @__module_done\n");
+    emit_indent(gen);
+    fprintf(gen->out, "br i1 %%done, label %%init_done, label %%init_run\n");
+    fprintf(gen->out, "\ninit_run:\n");
+    emit_indent(gen);
+    fprintf(gen->out, "store i1 true, i1* @__module_done\n");
+    for (VarMapping *m = gen->var_mappings; m != NULL; m = m->next) {
+        if (m->is_global && !m->external) {
+            emit_indent(gen);
+            fprintf(gen->out, "call void @gc_push_root(%%Value* @%s)\n", m->unique_name);
+        }
+    }
+    for (ASTNodeList *stmt = root->data.program.statements; stmt != NULL; stmt = stmt->next) {
+        if (stmt->node->type != NODE_FUNC_DEF) {
+            gen->top_stmt = stmt->node;
+            gen_statement(gen, stmt->node);
+        }
+    }
+    gen->top_stmt = NULL;
+    emit_indent(gen);
+    fprintf(gen->out, "br label %%init_done\n");
+    fprintf(gen->out, "\ninit_done:\n");
+    emit_indent(gen);
+    fprintf(gen->out, "ret %%Value { i32 0, i64 0 }\n");
+    fprintf(gen->out, "}\n");
+    gen->indent_level = 0;
+    gen->cur_func = NULL;
+}
+
 void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
     if (root->type != NODE_PROGRAM) {
         fprintf(stderr, "Error: Expected program node\n");
         return;
     }
 
+    // With -g the IR is buffered and annotated by emit_debug_info()
+    FILE *final_out = gen->out;
+    char *ir_buf = NULL;
+    size_t ir_len = 0;
+    if (gen->debug_info) {
+        gen->out = open_memstream(&ir_buf, &ir_len);
+    }
+
     // Pre-pass: collect all string literals
     ASTNodeList *s = root->data.program.statements;
     while (s != NULL) {
@@ -2607,24 +5367,52 @@ void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
         s = s->next;
     }
 
+    // Functions of separately compiled modules come first, so a definition
+    // here with the same name is reported as a redefinition
+    for (ModuleSymbol *sym = gen->externs; sym != NULL; sym = sym->next) {
+        if (sym->is_class) continue;
+        register_function(gen, sym->name, sym->arity, NULL, 0);
+        gen->functions->external = 1;
+    }
+
     // Pre-pass: register function signatures for arity checks
     s = root->data.program.statements;
     while (s != NULL) {
         register_functions_stmt(gen, s->node);
         s = s->next;
     }
+    if (gen->jit) {
+        for (FuncInfo *f = gen->functions; f != NULL; f = f->next) f->referenced = 1;
+    }
 
     // Emit string literals
     fprintf(gen->out, "; String literals\n");
     emit_string_literals(gen);
     fprintf(gen->out, "\n");
+    StringLiteral *emitted_strings = gen->strings;
 
     // Emit declarations
     emit_runtime_decls(gen);
+    for (FuncInfo *f = gen->functions; f != NULL; f = f->next) {
+        if (!f->external) continue;
+        fprintf(gen->out, "declare %%Value @%s(", f->name);
+        for (int i = 0; i < f->arity; i++) fprintf(gen->out, "%s%%Value", i > 0 ? ", " : "");
+        fprintf(gen->out, ")\n");
+    }
+
+    // Classes of other modules live in their module's global
+    for (ModuleSymbol *sym = gen->externs; sym != NULL; sym = sym->next) {
+        if (!sym->is_class) continue;
+        create_unique_var_name(gen, sym->name, 1);
+        VarMapping *m = find_var_mapping_current_scope(gen, sym->name);
+        m->external = 1;
+        m->declared = 1;
+    }
 
     // Pre-register global variable mappings so functions can reference them
     ASTNodeList *stmt = root->data.program.statements;
     preregister_globals_in_list(gen, stmt, 1);
+    plan_classes(gen, stmt);
 
     // Emit runtime implementation
     emit_runtime_impl(gen);
@@ -2633,7 +5421,9 @@ void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
     fprintf(gen->out, "; Global variable storage\n");
     VarMapping *gm = gen->var_mappings;
     while (gm != NULL) {
-        if (gm->is_global) {
+        if (gm->is_global && gm->external) {
+            fprintf(gen->out, "@%s = external global %%Value\n", gm->unique_name);
+        } else if (gm->is_global) {
             fprintf(gen->out, "@%s = global %%Value { i32 0, i64 0 }\n", gm->unique_name);
         }
         gm = gm->next;
@@ -2647,19 +5437,38 @@ void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
         if (stmt->node->type == NODE_FUNC_DEF) {
             int saved_depth = 0;
             VarMapping *saved_scope = push_scope(gen, &saved_depth);
-            fprintf(gen->out, "define %%Value @%s(", stmt->node->data.func_def.name);
+            gen->cur_func = stmt->node->data.func_def.name;
+            gen->in_generator = stmt->node->data.func_def.is_generator;
+            if (gen->in_generator) emit_generator_wrapper(gen, stmt->node);
+            emit_debug_fn(gen, gen->cur_func, stmt->node->file, stmt->node->line);
 
             ASTNodeList *param = stmt->node->data.func_def.params;
-            int first = 1;
-            while (param != NULL) {
-                if (!first) fprintf(gen->out, ", ");
-                fprintf(gen->out, "%%Value %%param_%s", param->node->data.identifier.name);
-                first = 0;
-                param = param->next;
+            if (gen->in_generator) {
+                // Runs on the generator's own stack, arguments in an array
+                fprintf(gen->out, "define internal void @%s.body(%%Value* %%args, i8* %%ctx) {\n",
+                        stmt->node->data.func_def.name);
+                for (int i = 0; param != NULL; param = param->next, i++) {
+                    fprintf(gen->out, "  %%param_%s.ptr = getelementptr %%Value, %%Value* %%args, i32 %d\n",
+                            param->node->data.identifier.name, i);
+                    fprintf(gen->out, "  %%param_%s = load %%Value, %%Value* %%param_%s.ptr\n",
+                            param->node->data.identifier.name, param->node->data.identifier.name);
+                }
+            } else {
+                fprintf(gen->out, "define %%Value @%s(", stmt->node->data.func_def.name);
+                int first = 1;
+                while (param != NULL) {
+                    if (!first) fprintf(gen->out, ", ");
+                    fprintf(gen->out, "%%Value %%param_%s", param->node->data.identifier.name);
+                    first = 0;
+                    param = param->next;
+                }
+                fprintf(gen->out, ") {\n");
             }
-
-            fprintf(gen->out, ") {\n");
             gen->indent_level = 1;
+            emit_probe_func_entry(gen, gen->cur_func);
+            emit_instr_counter(gen, stmt->node, 1);
+            plan_stack_allocs(gen, stmt->node->data.func_def.body);
+            plan_dispatch(gen, stmt->node->data.func_def.body, stmt->node->data.func_def.params);
 
             // Register parameters in current scope
             param = stmt->node->data.func_def.params;
@@ -2693,10 +5502,16 @@ void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
 
             // Default return if no explicit return
             emit_indent(gen);
-            fprintf(gen->out, "ret %%Value { i32 0, i64 0 }\n");
+            if (gen->in_generator) {
+                fprintf(gen->out, "ret void\n");
+            } else {
+                fprintf(gen->out, "ret %%Value { i32 0, i64 0 }\n");
+            }
 
             fprintf(gen->out, "}\n\n");
             gen->indent_level = 0;
+            gen->cur_func = NULL;
+            gen->in_generator = 0;
             pop_scope(gen, saved_scope, saved_depth);
         } else if (stmt->node->type == NODE_CLASS_DEF) {
             // Field init functions
@@ -2715,54 +5530,48 @@ void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root) {
         stmt = stmt->next;
     }
 
-    // Generate main function
-    fprintf(gen->out, "; ===== Main Function =====\n\n");
-    fprintf(gen->out, "define i32 @main(i32 %%argc, i8** %%argv) {\n");
-    gen->indent_level = 1;
-
-    // Initialize GC
-    emit_indent(gen);
-    fprintf(gen->out, "call void @gc_init()\n");
-
-    // Set stack bottom for conservative scanning
-    emit_indent(gen);
-    fprintf(gen->out, "%%stack_anchor = alloca i8\n");
-    emit_indent(gen);
-    fprintf(gen->out, "%%stack_bottom_ptr = bitcast i8* %%stack_anchor to i8*\n");
-    emit_indent(gen);
-    fprintf(gen->out, "call void @gc_set_stack_bottom(i8* %%stack_bottom_ptr)\n\n");
+    if (gen->jit) {
+        emit_func_refs(gen);
+        if (gen->strings != emitted_strings) {
+            fprintf(gen->out, "\n");
+            emit_string_range(gen, emitted_strings);
+        }
+        return;
+    }
 
-    // Call set_cmd_args to store command line arguments
-    // Skip argv[0] (executable name) so cmd_args() only returns program arguments
-    emit_indent(gen);
-    fprintf(gen->out, "%%argc_adjusted = sub i32 %%argc, 1\n");
-    emit_indent(gen);
-    fprintf(gen->out, "%%argv_adjusted = getelementptr i8*, i8** %%argv, i32 1\n");
-    emit_indent(gen);
-    fprintf(gen->out, "call void @set_cmd_args(i32 %%argc_adjusted, i8** %%argv_adjusted)\n\n");
+    if (gen->module_init) {
+        emit_module_init(gen, root);
+    } else {
+        emit_main_function(gen, root);
+    }
 
-    // Register global variables as GC roots
-    VarMapping *global_var = gen->var_mappings;
-    while (global_var != NULL) {
-        if (global_var->is_global) {
-            emit_indent(gen);
-            fprintf(gen->out, "call void @gc_push_root(%%Value* @%s)\n", global_var->unique_name);
-        }
-        global_var = global_var->next;
+    if (gen->outlined) {
+        fclose(gen->outlined);
+        fprintf(gen->out, "\n; ===== parallel for bodies =====\n\n");
+        fwrite(gen->outlined_buf, 1, gen->outlined_len, gen->out);
+        free(gen->outlined_buf);
     }
-    if (gen->var_mappings) {
-        fprintf(gen->out, "\n");
+    if (gen->static_data) {
+        fclose(gen->static_data);
+        fprintf(gen->out, "\n; ===== Static tables =====\n\n");
+        fwrite(gen->static_buf, 1, gen->static_len, gen->out);
+        free(gen->static_buf);
     }
+    emit_func_refs(gen);
+    emit_instr_tables(gen);
+    emit_prof_tables(gen);
+    emit_module_ctors(gen);
 
-    stmt = root->data.program.statements;
-    while (stmt != NULL) {
-        if (stmt->node->type != NODE_FUNC_DEF) {
-            gen_statement(gen, stmt->node);
-        }
-        stmt = stmt->next;
+    // Strings registered during code generation (probe and site names)
+    if (gen->strings != emitted_strings) {
+        fprintf(gen->out, "\n");
+        emit_string_range(gen, emitted_strings);
     }
 
-    emit_indent(gen);
-    fprintf(gen->out, "ret i32 0\n");
-    fprintf(gen->out, "}\n");
+    if (gen->debug_info) {
+        fclose(gen->out);
+        gen->out = final_out;
+        emit_debug_info(gen, ir_buf);
+        free(ir_buf);
+    }
 }
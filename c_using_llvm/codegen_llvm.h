@@ -18,10 +18,80 @@ typedef struct VarMapping {
     int is_global;
     int scope_depth;
     int declared; // whether a var decl/param has already occupied this name in the scope
+    int captured; // outer variable seen through the env of a parallel for body
+    int external; // class defined by another module (declared, not defined here)
     struct VarMapping *next;
     struct VarMapping *next_global;
 } VarMapping;
 
+// Counter site recorded by --instrument (function entry or statement)
+typedef struct InstrSiteInfo {
+    const char *func;      // enclosing function ("Class.method", "<main>")
+    const char *file;
+    int line;
+    int is_entry;          // 1 = function entry counter, 0 = statement counter
+    struct InstrSiteInfo *next;
+} InstrSiteInfo;
+
+// Type-feedback site (binary_op / index_get), numbered for --profile-gen
+// and matched by kind, file, line and ordinal against a --profile-use file
+typedef struct ProfSiteInfo {
+    int kind;              // PROF_SITE_* (runtime.h)
+    const char *file;
+    int line;
+    int ordinal;           // Among the sites of this kind on the line
+    int id;                // @__prof_cnt_<id>
+    struct ProfSiteInfo *next;
+} ProfSiteInfo;
+
+// A function or class exported by a separately compiled module
+// (codegen_llvm --cache-dir); init functions are listed as functions
+typedef struct ModuleSymbol {
+    int is_class;
+    char *name;
+    int arity;
+    struct ModuleSymbol *next;
+} ModuleSymbol;
+
+// Array/dict literal or array slice whose value escape analysis proved
+// never outlives the call: it is built in storage reserved in the
+// function's entry block instead of on the GC heap (plan_stack_allocs)
+typedef struct StackAlloc {
+    ASTNode *node;
+    int id;                // %stk_<id> (header), %stk_<id>_buf (elements/buckets)
+    int slots;             // Element slots of an array literal
+    struct StackAlloc *next;
+} StackAlloc;
+
+// a[i + offset] read in a counted for loop over i: the type and bounds
+// checks for the whole index range are hoisted into one guard before the
+// loop, and the read loads the element directly while the guard holds
+typedef struct LoopArrayRead {
+    VarMapping *array;
+    VarMapping *index;     // The loop variable
+    long offset;
+    char guard[32];        // i1 temp computed before the loop
+    struct LoopArrayRead *next;
+} LoopArrayRead;
+
+// A class defined at the top level of the unit being compiled: a method
+// call on a value known to be one of its instances calls the method's
+// function directly instead of going through method_call
+typedef struct ClassInfo {
+    ASTNode *node;
+    int private_access;    // Its methods use _names (need this_stack kept)
+    int rebound;           // Its name is bound to something else somewhere
+    struct ClassInfo *next;
+} ClassInfo;
+
+// A variable and the class of every value bound to it, NULL if some binding
+// is not `new C(...)` of that one class (plan_dispatch)
+typedef struct KnownInstance {
+    const char *name;
+    ClassInfo *cls;
+    struct KnownInstance *next;
+} KnownInstance;
+
 typedef struct {
     FILE *out;
     int indent_level;
@@ -36,15 +106,51 @@ typedef struct {
     char *break_label;
     char *continue_label;
     struct FuncInfo *functions;
+    int instrument;        // --instrument: emit call/line hit counters
+    int debug_info;        // -g: emit DWARF line tables (DILocation)
+    InstrSiteInfo *instr_sites; // Reverse order; index = instr_count - 1 at head
+    int instr_count;
+    const char *cur_func;  // Function being generated (for instrumentation)
+    int in_parallel_for;   // Generating an outlined parallel for body
+    int in_generator;      // Generating a generator body (returns void)
+    int pfor_count;
+    FILE *outlined;        // Outlined bodies, emitted after main
+    char *outlined_buf;
+    size_t outlined_len;
+    int jit;               // Module for the interpreter's JIT: functions only,
+                           // each exported as @__fn_NAME (no main)
+    int profile_gen;       // --profile-gen: count operand types per site
+    struct ProfRecord *profile; // --profile-use: sites read from the profile
+    int profile_count;
+    ProfSiteInfo *prof_sites;  // Reverse order, like instr_sites
+    int prof_count;
+    const char *module_init; // Compiling an include file as a module: its
+                             // top-level code goes in this function (no main)
+    ModuleSymbol *externs;   // Defined by other modules, declared here
+    StackAlloc *stack_allocs; // Of the function being generated
+    int stack_count;
+    LoopArrayRead *loop_reads; // Of the enclosing for loops
+    ClassInfo *classes;
+    ClassInfo *cur_class;  // Class of the method being generated
+    KnownInstance *instances;        // Locals of the function being generated
+    KnownInstance *global_instances; // Top-level variables, whole unit
+    ASTNode *top_stmt;     // Top-level statement being generated (runs once)
+    FILE *static_data;     // Static tables, emitted after main
+    char *static_buf;
+    size_t static_len;
+    int static_count;
 } LLVMCodeGen;
 
 typedef struct FuncInfo {
     char *name;
     int arity;
+    int referenced;        // Used as a value: emit its FuncRef and thunk
+    int external;          // Defined by another module
     struct FuncInfo *next;
 } FuncInfo;
 
 void llvm_codegen_init(LLVMCodeGen *gen, FILE *out);
 void llvm_codegen_program(LLVMCodeGen *gen, ASTNode *root);
+int llvm_codegen_load_profile(LLVMCodeGen *gen, const char *path);  // --profile-use; -1 if unreadable
 
 #endif /* CODEGEN_LLVM_H */
@@ -0,0 +1,260 @@
+#include "codegen_llvm_emit.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <llvm-c/Analysis.h>
+#include <llvm-c/Core.h>
+#include <llvm-c/IRReader.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+typedef struct {
+    const char *ir;
+    size_t ir_len;
+    int part;              // Partition this thread compiles
+    int parts;
+    int opt_level;
+    char obj_path[256];
+    char *error;           // Set on failure (malloc'ed)
+} EmitJob;
+
+static int instruction_count(LLVMValueRef fn) {
+    int n = 0;
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(fn); bb; bb = LLVMGetNextBasicBlock(bb)) {
+        for (LLVMValueRef in = LLVMGetFirstInstruction(bb); in; in = LLVMGetNextInstruction(in)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+// Turn a definition into a declaration: no value may be used once its
+// instruction is erased, so every result is replaced by undef first
+static void drop_body(LLVMValueRef fn) {
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(fn); bb; bb = LLVMGetNextBasicBlock(bb)) {
+        for (LLVMValueRef in = LLVMGetFirstInstruction(bb); in; in = LLVMGetNextInstruction(in)) {
+            LLVMTypeRef ty = LLVMTypeOf(in);
+            if (LLVMGetTypeKind(ty) != LLVMVoidTypeKind) {
+                LLVMReplaceAllUsesWith(in, LLVMGetUndef(ty));
+            }
+        }
+    }
+    for (LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(fn); bb; bb = LLVMGetNextBasicBlock(bb)) {
+        LLVMValueRef in = LLVMGetFirstInstruction(bb);
+        while (in) {
+            LLVMValueRef next = LLVMGetNextInstruction(in);
+            LLVMInstructionEraseFromParent(in);
+            in = next;
+        }
+    }
+    LLVMBasicBlockRef bb = LLVMGetFirstBasicBlock(fn);
+    while (bb) {
+        LLVMBasicBlockRef next = LLVMGetNextBasicBlock(bb);
+        LLVMDeleteBasicBlock(bb);
+        bb = next;
+    }
+    LLVMGlobalClearMetadata(fn);
+    LLVMSetPersonalityFn(fn, NULL);
+}
+
+// Internal symbols referenced from another partition must be visible to the
+// linker; hidden keeps them out of the executable's dynamic symbol table
+static void make_linkable(LLVMValueRef global) {
+    LLVMLinkage linkage = LLVMGetLinkage(global);
+    if (linkage == LLVMInternalLinkage || linkage == LLVMPrivateLinkage) {
+        LLVMSetLinkage(global, LLVMExternalLinkage);
+        LLVMSetVisibility(global, LLVMHiddenVisibility);
+    }
+}
+
+// Keep only this job's share of the module. Function definitions are dealt
+// out by size (largest first, to the lightest partition); every partition
+// computes the same assignment from its own copy of the module. Private
+// string constants are duplicated, all other globals live in partition 0.
+static void split_module(LLVMModuleRef mod, int part, int parts) {
+    int count = 0;
+    for (LLVMValueRef fn = LLVMGetFirstFunction(mod); fn; fn = LLVMGetNextFunction(fn)) {
+        if (!LLVMIsDeclaration(fn)) count++;
+    }
+    LLVMValueRef *fns = malloc(count * sizeof(LLVMValueRef));
+    int *sizes = malloc(count * sizeof(int));
+    int *owner = malloc(count * sizeof(int));
+    long *load = calloc(parts, sizeof(long));
+    int n = 0;
+    for (LLVMValueRef fn = LLVMGetFirstFunction(mod); fn; fn = LLVMGetNextFunction(fn)) {
+        if (LLVMIsDeclaration(fn)) continue;
+        fns[n] = fn;
+        sizes[n] = instruction_count(fn);
+        owner[n] = -1;
+        n++;
+    }
+    for (int done = 0; done < count; done++) {
+        int big = -1;
+        for (int i = 0; i < count; i++) {
+            if (owner[i] < 0 && (big < 0 || sizes[i] > sizes[big])) big = i;
+        }
+        int light = 0;
+        for (int p = 1; p < parts; p++) {
+            if (load[p] < load[light]) light = p;
+        }
+        owner[big] = light;
+        load[light] += sizes[big];
+    }
+
+    for (int i = 0; i < count; i++) {
+        make_linkable(fns[i]);
+        if (owner[i] != part) {
+            drop_body(fns[i]);
+            LLVMSetLinkage(fns[i], LLVMExternalLinkage);  // linkonce_odr helpers
+        } else if (LLVMGetLinkage(fns[i]) == LLVMLinkOnceODRLinkage) {
+            // The other partitions call it: it must not be discarded as unused
+            LLVMSetLinkage(fns[i], LLVMWeakODRLinkage);
+        }
+    }
+
+    LLVMValueRef g = LLVMGetFirstGlobal(mod);
+    while (g) {
+        LLVMValueRef next = LLVMGetNextGlobal(g);
+        const char *name = LLVMGetValueName(g);
+        if (strncmp(name, "llvm.", 5) == 0) {
+            // llvm.global_ctors: the constructors run once, from partition 0
+            if (part != 0) LLVMDeleteGlobal(g);
+        } else if (LLVMGetLinkage(g) == LLVMPrivateLinkage && LLVMIsGlobalConstant(g)) {
+            // String literal: each partition keeps its own copy
+        } else if (!LLVMIsDeclaration(g)) {
+            make_linkable(g);
+            if (part != 0) {
+                LLVMSetInitializer(g, NULL);
+                LLVMSetLinkage(g, LLVMExternalLinkage);
+            }
+        }
+        g = next;
+    }
+    free(fns);
+    free(sizes);
+    free(owner);
+    free(load);
+}
+
+static LLVMTargetMachineRef create_target_machine(int opt_level, char **error) {
+    char *triple = LLVMGetDefaultTargetTriple();
+    LLVMTargetRef target;
+    if (LLVMGetTargetFromTriple(triple, &target, error) != 0) {
+        LLVMDisposeMessage(triple);
+        return NULL;
+    }
+    LLVMCodeGenOptLevel level = opt_level == 0 ? LLVMCodeGenLevelNone
+                              : opt_level == 1 ? LLVMCodeGenLevelLess
+                              : opt_level == 2 ? LLVMCodeGenLevelDefault
+                              : LLVMCodeGenLevelAggressive;
+    // PIC: the object is linked into a position-independent executable
+    LLVMTargetMachineRef tm = LLVMCreateTargetMachine(target, triple, "", "", level,
+                                                      LLVMRelocPIC, LLVMCodeModelDefault);
+    LLVMDisposeMessage(triple);
+    if (!tm) *error = strdup("cannot create target machine");
+    return tm;
+}
+
+static void *emit_main(void *arg) {
+    EmitJob *job = arg;
+    LLVMContextRef ctx = LLVMContextCreate();
+    LLVMModuleRef mod = NULL;
+    LLVMTargetMachineRef tm = NULL;
+    char *error = NULL;
+
+    LLVMMemoryBufferRef buf = LLVMCreateMemoryBufferWithMemoryRangeCopy(job->ir, job->ir_len, "tiny");
+    if (LLVMParseIRInContext(ctx, buf, &mod, &error) != 0) goto out;
+    if (job->parts > 1) split_module(mod, job->part, job->parts);
+    if (LLVMVerifyModule(mod, LLVMReturnStatusAction, &error) != 0) goto out;
+    LLVMDisposeMessage(error);
+    error = NULL;
+
+    tm = create_target_machine(job->opt_level, &error);
+    if (!tm) goto out;
+    char *triple = LLVMGetTargetMachineTriple(tm);
+    LLVMSetTarget(mod, triple);
+    LLVMDisposeMessage(triple);
+    LLVMTargetDataRef layout = LLVMCreateTargetDataLayout(tm);
+    LLVMSetModuleDataLayout(mod, layout);
+    LLVMDisposeTargetData(layout);
+
+    char passes[32];
+    snprintf(passes, sizeof(passes), "default<O%d>", job->opt_level);
+    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef err = LLVMRunPasses(mod, passes, tm, opts);
+    LLVMDisposePassBuilderOptions(opts);
+    if (err) {
+        char *msg = LLVMGetErrorMessage(err);
+        error = strdup(msg);
+        LLVMDisposeErrorMessage(msg);
+        goto out;
+    }
+    LLVMTargetMachineEmitToFile(tm, mod, job->obj_path, LLVMObjectFile, &error);
+
+out:
+    if (error) job->error = error;
+    if (tm) LLVMDisposeTargetMachine(tm);
+    if (mod) LLVMDisposeModule(mod);
+    LLVMContextDispose(ctx);
+    return NULL;
+}
+
+int llvm_emit_objects(const char *ir, size_t ir_len, int opt_level, int jobs,
+                      const char *obj_base, char ***obj_paths) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+    LLVMInitializeNativeAsmParser();  // Inline asm (USDT probe notes)
+
+    // More partitions than function definitions would only leave some empty
+    int defs = 0;
+    for (const char *p = ir; (p = strstr(p, "\ndefine ")) != NULL; p++) defs++;
+    if (jobs > defs) jobs = defs;
+    if (jobs < 1) jobs = 1;
+
+    EmitJob *job = calloc(jobs, sizeof(EmitJob));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    int *started = calloc(jobs, sizeof(int));
+    for (int i = 0; i < jobs; i++) {
+        job[i].ir = ir;
+        job[i].ir_len = ir_len;
+        job[i].part = i;
+        job[i].parts = jobs;
+        job[i].opt_level = opt_level;
+        snprintf(job[i].obj_path, sizeof(job[i].obj_path), "%s_%d.o", obj_base, i);
+    }
+    // Partition 0 runs on this thread
+    for (int i = 1; i < jobs; i++) {
+        started[i] = pthread_create(&threads[i], NULL, emit_main, &job[i]) == 0;
+        if (!started[i]) emit_main(&job[i]);
+    }
+    emit_main(&job[0]);
+    for (int i = 1; i < jobs; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+
+    int failed = 0;
+    *obj_paths = malloc(jobs * sizeof(char*));
+    for (int i = 0; i < jobs; i++) {
+        (*obj_paths)[i] = strdup(job[i].obj_path);
+        if (job[i].error && !failed) {
+            fprintf(stderr, "Error: LLVM: %s\n", job[i].error);
+            failed = 1;
+        }
+        free(job[i].error);
+    }
+    free(job);
+    free(threads);
+    free(started);
+    if (failed) {
+        for (int i = 0; i < jobs; i++) {
+            remove((*obj_paths)[i]);
+            free((*obj_paths)[i]);
+        }
+        free(*obj_paths);
+        *obj_paths = NULL;
+        return -1;
+    }
+    return jobs;
+}
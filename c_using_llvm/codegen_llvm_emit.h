@@ -0,0 +1,21 @@
+#ifndef CODEGEN_LLVM_EMIT_H
+#define CODEGEN_LLVM_EMIT_H
+
+#include <stddef.h>
+
+// In-process backend for codegen_llvm (built when llvm-config is found, see
+// the Makefile; without it the driver hands the .ll file to clang).
+//
+// The module text produced by llvm_codegen_program is parsed with the LLVM
+// C API, verified, optimized with the new pass manager (default<O<n>>) and
+// written as object files, without a temporary .ll or a compiler process.
+// With jobs > 1 the function definitions are split across that many
+// partitions, each parsed, optimized and emitted on its own thread and
+// LLVMContext; the objects are linked together with the runtime.
+//
+// Writes <obj_base>_<i>.o and returns how many (their paths in *obj_paths),
+// or prints the LLVM error and returns -1.
+int llvm_emit_objects(const char *ir, size_t ir_len, int opt_level, int jobs,
+                      const char *obj_base, char ***obj_paths);
+
+#endif /* CODEGEN_LLVM_EMIT_H */
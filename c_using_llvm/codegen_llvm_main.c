@@ -4,7 +4,11 @@
 #include <unistd.h>
 #include "ast.h"
 #include "codegen_llvm.h"
+#include "codegen_llvm_module.h"
 #include "core/preprocess.h"
+#ifdef TINY_LLVM_API
+#include "codegen_llvm_emit.h"
+#endif
 
 extern int yyparse();
 extern FILE *yyin;
@@ -15,20 +19,22 @@ typedef void* YY_BUFFER_STATE;
 extern YY_BUFFER_STATE yy_scan_string(const char *yy_str);
 extern void yy_delete_buffer(YY_BUFFER_STATE b);
 
-static void compile_to_llvm_ir(const char *output_file) {
-    FILE *out = fopen(output_file, "w");
-    if (!out) {
-        fprintf(stderr, "Error: Cannot create LLVM IR file %s\n", output_file);
-        exit(1);
-    }
-
+static void compile_to_llvm_ir(FILE *out, int instrument, int debug_info,
+                               int profile_gen, const char *profile_use, ModuleSymbol *externs) {
     LLVMCodeGen gen;
     llvm_codegen_init(&gen, out);
+    gen.externs = externs;
+    gen.instrument = instrument;
+    gen.debug_info = debug_info;
+    gen.profile_gen = profile_gen;
+    if (profile_use && llvm_codegen_load_profile(&gen, profile_use) != 0) {
+        fprintf(stderr, "Error: Cannot read profile %s\n", profile_use);
+        exit(1);
+    }
     llvm_codegen_program(&gen, root);
-
-    fclose(out);
 }
 
+#ifndef TINY_LLVM_API
 static void run_command(const char *cmd) {
     printf("Running: %s\n", cmd);
     int ret = system(cmd);
@@ -37,16 +43,25 @@ static void run_command(const char *cmd) {
         exit(1);
     }
 }
+#endif
 
 int main(int argc, char **argv) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <source.tl> [-o output] [--emit-llvm]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <source.tl> [-o output] [--emit-llvm] [--instrument] [-g] "
+                "[--profile-gen | --profile-use=profile.data] [-O0..-O3] [-j threads] [--cache-dir=DIR]\n", argv[0]);
         return 1;
     }
 
     const char *input_file = argv[1];
     char *output_file = "a.out";
     int emit_llvm_only = 0;
+    int instrument = 0;
+    int debug_info = 0;
+    int profile_gen = 0;
+    const char *profile_use = NULL;
+    int opt_level = 2;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *cache_dir = NULL;
 
     // Parse arguments
     for (int i = 2; i < argc; i++) {
@@ -55,14 +70,48 @@ int main(int argc, char **argv) {
             i++;
         } else if (strcmp(argv[i], "--emit-llvm") == 0) {
             emit_llvm_only = 1;
+        } else if (strcmp(argv[i], "--instrument") == 0) {
+            instrument = 1;
+        } else if (strcmp(argv[i], "-g") == 0) {
+            debug_info = 1;
+        } else if (strcmp(argv[i], "--profile-gen") == 0) {
+            profile_gen = 1;
+        } else if (strncmp(argv[i], "--profile-use=", 14) == 0 && argv[i][14] != '\0') {
+            profile_use = argv[i] + 14;
+        } else if (argv[i][0] == '-' && argv[i][1] == 'O' && argv[i][2] >= '0' && argv[i][2] <= '3' &&
+                   argv[i][3] == '\0') {
+            opt_level = argv[i][2] - '0';
+        } else if (strncmp(argv[i], "--cache-dir=", 12) == 0 && argv[i][12] != '\0') {
+            cache_dir = argv[i] + 12;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atol(argv[i + 1]);
+            i++;
+        }
+    }
+    if (profile_gen && profile_use) {
+        fprintf(stderr, "Error: --profile-gen and --profile-use cannot be combined\n");
+        return 1;
+    }
+
+    // With a cache directory, qualifying includes are compiled (or reused)
+    // as separate modules while the program is preprocessed
+    ModuleCache *modules = NULL;
+    if (cache_dir) {
+        modules = module_cache_create(cache_dir, opt_level, instrument, debug_info, profile_gen, profile_use);
+        if (!modules) {
+            fprintf(stderr, "Error: Cannot create cache directory %s\n", cache_dir);
+            return 1;
         }
     }
 
     // Open input file
     PreprocessResult res;
-    if (preprocess_file(input_file, &res) != 0) {
+    if (preprocess_file_modules(input_file, &res, modules ? module_include_hook : NULL, modules) != 0) {
         return 1;
     }
+    ModuleSymbol *externs = modules ? module_cache_symbols(modules) : NULL;
+    const char **module_objs = NULL;
+    int module_count = modules ? module_cache_objects(modules, &module_objs) : 0;
     g_pp_result = res;
 
     printf("Parsing %s...\n", input_file);
@@ -77,29 +126,85 @@ int main(int argc, char **argv) {
     yy_delete_buffer(buf);
 
     // Generate LLVM IR
-    char ll_file[256];
     if (emit_llvm_only) {
-        snprintf(ll_file, sizeof(ll_file), "%s", output_file);
-    } else {
-        snprintf(ll_file, sizeof(ll_file), "/tmp/tiny_%d.ll", getpid());
+        printf("Generating LLVM IR: %s...\n", output_file);
+        FILE *out = fopen(output_file, "w");
+        if (!out) {
+            fprintf(stderr, "Error: Cannot create LLVM IR file %s\n", output_file);
+            return 1;
+        }
+        compile_to_llvm_ir(out, instrument, debug_info, profile_gen, profile_use, externs);
+        fclose(out);
+        free_preprocess_result(&res);
+        printf("LLVM IR saved to: %s\n", output_file);
+        return 0;
     }
 
-    printf("Generating LLVM IR: %s...\n", ll_file);
-    compile_to_llvm_ir(ll_file);
+#ifdef TINY_LLVM_API
+    // Keep the module in memory; LLVM parses, optimizes and emits it here
+    char *ir = NULL;
+    size_t ir_len = 0;
+    FILE *out = open_memstream(&ir, &ir_len);
+    printf("Generating LLVM IR...\n");
+    compile_to_llvm_ir(out, instrument, debug_info, profile_gen, profile_use, externs);
+    fclose(out);
     free_preprocess_result(&res);
 
-    if (emit_llvm_only) {
-        printf("LLVM IR saved to: %s\n", ll_file);
-        return 0;
+    char obj_base[64];
+    snprintf(obj_base, sizeof(obj_base), "/tmp/tiny_%d", getpid());
+    char **objs = NULL;
+    printf("Emitting object code (-O%d)...\n", opt_level);
+    int obj_count = llvm_emit_objects(ir, ir_len, opt_level, jobs, obj_base, &objs);
+    free(ir);
+    if (obj_count < 0) return 1;
+
+    size_t cmd_len = 256 + strlen(output_file);
+    for (int i = 0; i < obj_count; i++) cmd_len += strlen(objs[i]) + 1;
+    for (int i = 0; i < module_count; i++) cmd_len += strlen(module_objs[i]) + 1;
+    char *cmd = malloc(cmd_len);
+    int n = snprintf(cmd, cmd_len, "cc");
+    for (int i = 0; i < obj_count; i++) n += snprintf(cmd + n, cmd_len - n, " %s", objs[i]);
+    for (int i = 0; i < module_count; i++) n += snprintf(cmd + n, cmd_len - n, " %s", module_objs[i]);
+    snprintf(cmd + n, cmd_len - n, " runtime.o gc.o task.o numfmt.o -lpthread -lm -o %s", output_file);
+    int ret = system(cmd);
+    for (int i = 0; i < obj_count; i++) {
+        unlink(objs[i]);
+        free(objs[i]);
+    }
+    free(objs);
+    if (ret != 0) {
+        fprintf(stderr, "Error: Command failed with code %d: %s\n", ret, cmd);
+        return 1;
+    }
+    free(cmd);
+#else
+    (void)jobs;  // clang splits nothing
+    char ll_file[256];
+    snprintf(ll_file, sizeof(ll_file), "/tmp/tiny_%d.ll", getpid());
+    printf("Generating LLVM IR: %s...\n", ll_file);
+    FILE *out = fopen(ll_file, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Cannot create LLVM IR file %s\n", ll_file);
+        return 1;
     }
+    compile_to_llvm_ir(out, instrument, debug_info, profile_gen, profile_use, externs);
+    fclose(out);
+    free_preprocess_result(&res);
 
     // Compile LLVM IR to executable using system clang with runtime library
-    char cmd[1024];
-    snprintf(cmd, sizeof(cmd), "clang -Wno-override-module %s runtime.o gc.o -o %s", ll_file, output_file);
+    size_t cmd_len = 1024;
+    for (int i = 0; i < module_count; i++) cmd_len += strlen(module_objs[i]) + 1;
+    char *cmd = malloc(cmd_len);
+    int n = snprintf(cmd, cmd_len, "clang -Wno-override-module -O%d%s %s",
+                     opt_level, debug_info ? " -g" : "", ll_file);
+    for (int i = 0; i < module_count; i++) n += snprintf(cmd + n, cmd_len - n, " %s", module_objs[i]);
+    snprintf(cmd + n, cmd_len - n, " runtime.o gc.o task.o numfmt.o -lpthread -o %s", output_file);
     run_command(cmd);
+    free(cmd);
 
     // Cleanup
     unlink(ll_file);
+#endif
 
     printf("Successfully compiled to: %s\n", output_file);
     printf("\nRun with: ./%s\n", output_file);
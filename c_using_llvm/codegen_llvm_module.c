@@ -0,0 +1,439 @@
+#include "codegen_llvm_module.h"
+#include "core/preprocess.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef TINY_LLVM_API
+#include "codegen_llvm_emit.h"
+#endif
+
+extern int yyparse();
+extern ASTNode *root;
+extern PreprocessResult g_pp_result;
+extern int yylineno;
+typedef void* YY_BUFFER_STATE;
+extern YY_BUFFER_STATE yy_scan_string(const char *yy_str);
+extern void yy_delete_buffer(YY_BUFFER_STATE b);
+
+#define MODULE_BUSY 0       // Being preprocessed (an include of it is a cycle)
+#define MODULE_COMPILED 1   // obj_path and syms are set
+#define MODULE_TEXTUAL 2    // Spliced into its includer
+
+typedef struct {
+    char *path;
+    int state;
+    char init[256];
+    char *sym_text;         // Contents of the .sym file
+    ModuleSymbol *syms;
+    char *obj_path;
+    int *deps;              // Modules included by this one
+    int dep_count;
+} Module;
+
+struct ModuleCache {
+    char *dir;
+    char options[96];
+    int opt_level;
+    int instrument;
+    int debug_info;
+    int profile_gen;
+    const char *profile_use;
+    Module *modules;
+    int count;
+    int cap;
+    int current;            // Module being preprocessed, -1 for the program
+};
+
+// FNV-1a, 64 bit
+static uint64_t hash_bytes(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static uint64_t hash_str(uint64_t h, const char *s) {
+    return hash_bytes(h, s, strlen(s) + 1);
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+static uint64_t hash_file(const char *path) {
+    uint64_t h = HASH_INIT;
+    FILE *f = fopen(path, "rb");
+    if (!f) return h;
+    char buf[8192];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) h = hash_bytes(h, buf, n);
+    fclose(f);
+    return h;
+}
+
+ModuleCache *module_cache_create(const char *dir, int opt_level, int instrument, int debug_info,
+                                 int profile_gen, const char *profile_use) {
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST) return NULL;
+    ModuleCache *mc = calloc(1, sizeof(ModuleCache));
+    mc->dir = strdup(dir);
+    mc->opt_level = opt_level;
+    mc->instrument = instrument;
+    mc->debug_info = debug_info;
+    mc->profile_gen = profile_gen;
+    mc->profile_use = profile_use;
+    mc->current = -1;
+    snprintf(mc->options, sizeof(mc->options), "O%d g%d instr%d pgen%d puse%016llx",
+             opt_level, debug_info, instrument, profile_gen,
+             profile_use ? (unsigned long long)hash_file(profile_use) : 0ULL);
+    return mc;
+}
+
+static int find_module(ModuleCache *mc, const char *path) {
+    for (int i = 0; i < mc->count; i++) {
+        if (strcmp(mc->modules[i].path, path) == 0) return i;
+    }
+    return -1;
+}
+
+static void add_dep(Module *m, int dep) {
+    for (int i = 0; i < m->dep_count; i++) {
+        if (m->deps[i] == dep) return;
+    }
+    m->deps = realloc(m->deps, (m->dep_count + 1) * sizeof(int));
+    m->deps[m->dep_count++] = dep;
+}
+
+// Modules reachable from idx (not idx itself), in first-visit order
+static void collect_deps(ModuleCache *mc, int idx, char *seen, int *out, int *n) {
+    Module *m = &mc->modules[idx];
+    for (int i = 0; i < m->dep_count; i++) {
+        int d = m->deps[i];
+        if (seen[d]) continue;
+        seen[d] = 1;
+        out[(*n)++] = d;
+        collect_deps(mc, d, seen, out, n);
+    }
+}
+
+static ModuleSymbol *copy_symbols(ModuleSymbol *list, ModuleSymbol *syms) {
+    for (ModuleSymbol *s = syms; s != NULL; s = s->next) {
+        ModuleSymbol *c = malloc(sizeof(ModuleSymbol));
+        *c = *s;
+        c->next = list;
+        list = c;
+    }
+    return list;
+}
+
+// Parse .sym text; returns 0 for a module that is spliced ("textual")
+static int parse_symbols(Module *m, const char *text) {
+    if (strncmp(text, "textual", 7) == 0) return 0;
+    m->syms = NULL;
+    const char *p = text;
+    while (*p) {
+        char kind[16], name[256];
+        int arity = 0;
+        int n = sscanf(p, "%15s %255s %d", kind, name, &arity);
+        if (n >= 2) {
+            if (strcmp(kind, "init") == 0) {
+                snprintf(m->init, sizeof(m->init), "%s", name);
+            }
+            ModuleSymbol *s = malloc(sizeof(ModuleSymbol));
+            s->is_class = strcmp(kind, "class") == 0;
+            s->name = strdup(name);
+            s->arity = strcmp(kind, "fun") == 0 ? arity : 0;
+            s->next = m->syms;
+            m->syms = s;
+        }
+        const char *nl = strchr(p, '\n');
+        if (!nl) break;
+        p = nl + 1;
+    }
+    return 1;
+}
+
+static char *read_text(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    size_t n = fread(text, 1, size, f);
+    text[n] = '\0';
+    fclose(f);
+    return text;
+}
+
+// Write through a temporary file, so concurrent builds never see half a file
+static void write_text(const char *path, const char *text) {
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fputs(text, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+// Only definitions, and init calls of the modules it includes
+static int module_qualifies(ModuleCache *mc, Module *m, ASTNode *prog) {
+    for (ASTNodeList *s = prog->data.program.statements; s != NULL; s = s->next) {
+        ASTNode *n = s->node;
+        if (n->type == NODE_FUNC_DEF || n->type == NODE_CLASS_DEF) continue;
+        if (n->type != NODE_FUNC_CALL || n->data.func_call.arguments != NULL) return 0;
+        int is_init = 0;
+        for (int i = 0; i < m->dep_count; i++) {
+            if (strcmp(n->data.func_call.name, mc->modules[m->deps[i]].init) == 0) is_init = 1;
+        }
+        if (!is_init) return 0;
+    }
+    return 1;
+}
+
+static char *module_symbol_text(Module *m, ASTNode *prog) {
+    size_t cap = 256, len = 0;
+    char *text = malloc(cap);
+    len += snprintf(text, cap, "init %s\n", m->init);
+    for (ASTNodeList *s = prog->data.program.statements; s != NULL; s = s->next) {
+        ASTNode *n = s->node;
+        char line[320];
+        if (n->type == NODE_FUNC_DEF) {
+            int arity = 0;
+            for (ASTNodeList *p = n->data.func_def.params; p != NULL; p = p->next) arity++;
+            snprintf(line, sizeof(line), "fun %s %d\n", n->data.func_def.name, arity);
+        } else if (n->type == NODE_CLASS_DEF) {
+            snprintf(line, sizeof(line), "class %s\n", n->data.class_def.name);
+        } else {
+            continue;
+        }
+        size_t l = strlen(line);
+        if (len + l + 1 > cap) {
+            cap = (cap + l) * 2;
+            text = realloc(text, cap);
+        }
+        memcpy(text + len, line, l + 1);
+        len += l;
+    }
+    return text;
+}
+
+// Registered in the child, so exit() never flushes the stdio streams it
+// shares with the parent: the includer's FILE is still open, and flushing
+// it would move the shared file offset back and read the rest twice
+static void module_child_exit(void) {
+    _exit(1);
+}
+
+// Child process: generate the module and write its object to obj_path.
+// codegen_llvm reports code it cannot compile by exiting, which here only
+// means the module is spliced into its includer instead.
+static int module_compile(ModuleCache *mc, Module *m, ModuleSymbol *externs, ASTNode *prog,
+                          const char *obj_path) {
+    LLVMCodeGen gen;
+#ifdef TINY_LLVM_API
+    char *ir = NULL;
+    size_t ir_len = 0;
+    FILE *out = open_memstream(&ir, &ir_len);
+#else
+    char ll_path[PATH_MAX + 16];
+    snprintf(ll_path, sizeof(ll_path), "%s.ll", obj_path);
+    FILE *out = fopen(ll_path, "w");
+    if (!out) return 1;
+#endif
+    llvm_codegen_init(&gen, out);
+    gen.instrument = mc->instrument;
+    gen.debug_info = mc->debug_info;
+    gen.profile_gen = mc->profile_gen;
+    if (mc->profile_use && llvm_codegen_load_profile(&gen, mc->profile_use) != 0) return 1;
+    gen.module_init = m->init;
+    gen.externs = externs;
+    llvm_codegen_program(&gen, prog);
+    if (fclose(out) != 0) return 1;
+
+#ifdef TINY_LLVM_API
+    char **objs = NULL;
+    if (llvm_emit_objects(ir, ir_len, mc->opt_level, 1, obj_path, &objs) != 1) return 1;
+    return rename(objs[0], obj_path) != 0;
+#else
+    char cmd[3 * PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "clang -c -fPIC -Wno-override-module -O%d%s %s -o %s",
+             mc->opt_level, mc->debug_info ? " -g" : "", ll_path, obj_path);
+    int ret = system(cmd);
+    unlink(ll_path);
+    return ret != 0;
+#endif
+}
+
+static int module_build(ModuleCache *mc, int idx) {
+    PreprocessResult res;
+    if (preprocess_file_modules(mc->modules[idx].path, &res, module_include_hook, mc) != 0) {
+        return -1;
+    }
+    Module *m = &mc->modules[idx];
+
+    int *deps = malloc((mc->count + 1) * sizeof(int));
+    char *seen = calloc(mc->count, 1);
+    int ndeps = 0;
+    seen[idx] = 1;
+    collect_deps(mc, idx, seen, deps, &ndeps);
+    free(seen);
+
+    // Everything the generated code depends on
+    uint64_t h = hash_str(HASH_INIT, "tiny module 1 " __DATE__ " " __TIME__);
+    h = hash_str(h, mc->options);
+    h = hash_str(h, m->path);
+    h = hash_str(h, res.combined_source);
+    for (size_t i = 0; i < res.mapping_count; i++) {
+        h = hash_str(h, res.mappings[i].file);
+        h = hash_bytes(h, &res.mappings[i].start_combined_line, sizeof(int));
+        h = hash_bytes(h, &res.mappings[i].start_file_line, sizeof(int));
+    }
+    for (int i = 0; i < ndeps; i++) {
+        h = hash_str(h, mc->modules[deps[i]].sym_text);
+    }
+
+    const char *base = strrchr(m->path, '/');
+    base = base ? base + 1 : m->path;
+    char stem[64];
+    int sl = 0;
+    for (const char *p = base; *p && *p != '.' && sl < (int)sizeof(stem) - 1; p++) {
+        stem[sl++] = (isalnum((unsigned char)*p) || *p == '_') ? *p : '_';
+    }
+    stem[sl] = '\0';
+    snprintf(m->init, sizeof(m->init), "__init_%s_%08llx", stem,
+             (unsigned long long)(hash_str(HASH_INIT, m->path) & 0xffffffffULL));
+
+    char sym_path[PATH_MAX + 128], obj_path[PATH_MAX + 128];
+    snprintf(sym_path, sizeof(sym_path), "%s/%s-%016llx.sym", mc->dir, stem, (unsigned long long)h);
+    snprintf(obj_path, sizeof(obj_path), "%s/%s-%016llx.o", mc->dir, stem, (unsigned long long)h);
+
+    char *cached = read_text(sym_path);
+    if (cached && (strncmp(cached, "textual", 7) == 0 || access(obj_path, R_OK) == 0)) {
+        if (parse_symbols(m, cached)) {
+            m->state = MODULE_COMPILED;
+            m->sym_text = cached;
+            m->obj_path = strdup(obj_path);
+            printf("Module %s: up to date\n", m->path);
+        } else {
+            m->state = MODULE_TEXTUAL;
+            free(cached);
+        }
+        free(deps);
+        free_preprocess_result(&res);
+        return 0;
+    }
+    free(cached);
+
+    PreprocessResult saved = g_pp_result;
+    g_pp_result = res;
+    yylineno = 1;
+    root = NULL;
+    YY_BUFFER_STATE buf = yy_scan_string(res.combined_source);
+    int parsed = yyparse() == 0 && root != NULL;
+    yy_delete_buffer(buf);
+    g_pp_result = saved;
+
+    int compiled = 0;
+    if (parsed && module_qualifies(mc, m, root)) {
+        ASTNode *prog = root;
+        ModuleSymbol *externs = NULL;
+        for (int i = 0; i < ndeps; i++) externs = copy_symbols(externs, mc->modules[deps[i]].syms);
+
+        char tmp_path[PATH_MAX + 160];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", obj_path, (int)getpid());
+        printf("Module %s: compiling\n", m->path);
+        fflush(stdout);
+        fflush(stderr);
+        int status = -1;
+        pid_t pid = fork();
+        if (pid == 0) {
+            atexit(module_child_exit);
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) {
+                dup2(devnull, STDOUT_FILENO);
+                dup2(devnull, STDERR_FILENO);
+            }
+            _exit(module_compile(mc, m, externs, prog, tmp_path));
+        } else if (pid > 0) {
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+            }
+        }
+        compiled = pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+                   rename(tmp_path, obj_path) == 0;
+        if (!compiled) unlink(tmp_path);
+        while (externs) {
+            ModuleSymbol *next = externs->next;
+            free(externs);
+            externs = next;
+        }
+    }
+
+    if (compiled) {
+        char *text = module_symbol_text(m, root);
+        parse_symbols(m, text);
+        write_text(sym_path, text);
+        m->state = MODULE_COMPILED;
+        m->sym_text = text;
+        m->obj_path = strdup(obj_path);
+    } else {
+        write_text(sym_path, "textual\n");
+        m->state = MODULE_TEXTUAL;
+    }
+    free(deps);
+    free_preprocess_result(&res);
+    return 0;
+}
+
+int module_include_hook(const char *path, char *stmt, size_t stmt_size, void *ctx) {
+    ModuleCache *mc = ctx;
+    int idx = find_module(mc, path);
+    if (idx < 0) {
+        if (mc->count == mc->cap) {
+            mc->cap = mc->cap ? mc->cap * 2 : 8;
+            mc->modules = realloc(mc->modules, mc->cap * sizeof(Module));
+        }
+        idx = mc->count++;
+        memset(&mc->modules[idx], 0, sizeof(Module));
+        mc->modules[idx].path = strdup(path);
+        mc->modules[idx].state = MODULE_BUSY;
+
+        int parent = mc->current;
+        mc->current = idx;
+        int ret = module_build(mc, idx);
+        mc->current = parent;
+        if (ret != 0) return -1;
+    } else if (mc->modules[idx].state == MODULE_BUSY) {
+        fprintf(stderr, "Include cycle detected at %s\n", path);
+        return -1;
+    }
+
+    Module *m = &mc->modules[idx];
+    if (m->state == MODULE_TEXTUAL) return 0;
+    if (mc->current >= 0) add_dep(&mc->modules[mc->current], idx);
+    snprintf(stmt, stmt_size, "%s();", m->init);
+    return 1;
+}
+
+ModuleSymbol *module_cache_symbols(ModuleCache *mc) {
+    ModuleSymbol *list = NULL;
+    for (int i = 0; i < mc->count; i++) {
+        if (mc->modules[i].state == MODULE_COMPILED) list = copy_symbols(list, mc->modules[i].syms);
+    }
+    return list;
+}
+
+int module_cache_objects(ModuleCache *mc, const char ***paths) {
+    int n = 0;
+    *paths = malloc((mc->count + 1) * sizeof(char*));
+    for (int i = 0; i < mc->count; i++) {
+        if (mc->modules[i].state == MODULE_COMPILED) (*paths)[n++] = mc->modules[i].obj_path;
+    }
+    return n;
+}
@@ -0,0 +1,40 @@
+#ifndef CODEGEN_LLVM_MODULE_H
+#define CODEGEN_LLVM_MODULE_H
+
+#include <stddef.h>
+#include "codegen_llvm.h"
+
+// Separate compilation for codegen_llvm --cache-dir=DIR.
+//
+// An include outside of any braces whose file holds only function and class
+// definitions (and includes of such files) is compiled on its own into
+// DIR/<name>-<hash>.o, next to DIR/<name>-<hash>.sym with what it exports:
+//
+//     init __init_<name>_<pathhash>
+//     fun <name> <arity>
+//     class <name>
+//
+// The include line turns into a call of the init function, which defines the
+// classes (once, however many files include the module). The hash covers the
+// module's source, the .sym of every module it includes and the code
+// generation options, so a program only recompiles modules whose content
+// changed; the rest are linked from the cache. A file that does not qualify
+// (top-level statements, uses of the includer's variables or functions) is
+// spliced in as before, and that is cached too.
+typedef struct ModuleCache ModuleCache;
+
+// The code generation options are part of every module's hash. Returns NULL
+// if dir cannot be created.
+ModuleCache *module_cache_create(const char *dir, int opt_level, int instrument, int debug_info,
+                                 int profile_gen, const char *profile_use);
+
+// PreprocessModuleHook for preprocess_file_modules; ctx is the ModuleCache
+int module_include_hook(const char *path, char *stmt, size_t stmt_size, void *ctx);
+
+// Everything the compiled modules export, for the including program
+ModuleSymbol *module_cache_symbols(ModuleCache *mc);
+
+// Object files of the compiled modules; returns their number
+int module_cache_objects(ModuleCache *mc, const char ***paths);
+
+#endif /* CODEGEN_LLVM_MODULE_H */
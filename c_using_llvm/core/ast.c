@@ -43,6 +43,7 @@ ASTNode *create_float_literal(double value) {
 ASTNode *create_string_literal(char *value) {
     ASTNode *node = create_node(NODE_STRING_LITERAL);
     node->data.string_literal.value = strdup(value);
+    node->data.string_literal.hash = ast_string_hash(value);
     return node;
 }
 
@@ -164,6 +165,7 @@ ASTNode *create_func_def(char *name, ASTNodeList *params, ASTNodeList *body) {
     node->data.func_def.name = strdup(name);
     node->data.func_def.params = params;
     node->data.func_def.body = body;
+    node->data.func_def.is_generator = find_yield(body) != NULL;
     return node;
 }
 
@@ -180,6 +182,12 @@ ASTNode *create_return(ASTNode *value) {
     return node;
 }
 
+ASTNode *create_yield(ASTNode *value) {
+    ASTNode *node = create_node(NODE_YIELD);
+    node->data.yield_stmt.value = value;
+    return node;
+}
+
 ASTNode *create_if_stmt(ASTNode *condition, ASTNodeList *then_block, ASTNodeList *else_block) {
     ASTNode *node = create_node(NODE_IF_STMT);
     node->data.if_stmt.condition = condition;
@@ -201,6 +209,7 @@ ASTNode *create_for_stmt(char *index_var, ASTNode *start, ASTNode *end, ASTNodeL
     node->data.for_stmt.start = start;
     node->data.for_stmt.end = end;
     node->data.for_stmt.body = body;
+    node->data.for_stmt.is_parallel = 0;
     return node;
 }
 
@@ -267,6 +276,7 @@ ASTNode *create_member_access(ASTNode *object, char *member) {
     ASTNode *node = create_node(NODE_MEMBER_ACCESS);
     node->data.member_access.object = object;
     node->data.member_access.member = strdup(member);
+    node->data.member_access.hash = ast_string_hash(member);
     return node;
 }
 
@@ -305,3 +315,34 @@ ASTNodeList *append_node_list(ASTNodeList *list, ASTNode *node) {
     current->next = create_node_list(node);
     return list;
 }
+
+ASTNode *find_yield(ASTNodeList *stmts) {
+    for (; stmts; stmts = stmts->next) {
+        ASTNode *node = stmts->node, *found = NULL;
+        switch (node->type) {
+            case NODE_YIELD:
+                return node;
+            case NODE_IF_STMT:
+                found = find_yield(node->data.if_stmt.then_block);
+                if (!found) found = find_yield(node->data.if_stmt.else_block);
+                break;
+            case NODE_WHILE_STMT:
+                found = find_yield(node->data.while_stmt.body);
+                break;
+            case NODE_FOR_STMT:
+                found = find_yield(node->data.for_stmt.body);
+                break;
+            case NODE_FOREACH_STMT:
+                found = find_yield(node->data.foreach_stmt.body);
+                break;
+            case NODE_TRY_CATCH:
+                found = find_yield(node->data.try_catch.try_block);
+                if (!found) found = find_yield(node->data.try_catch.catch_block);
+                break;
+            default:
+                break;
+        }
+        if (found) return found;
+    }
+    return NULL;
+}
@@ -34,7 +34,8 @@ typedef enum {
     NODE_CLASS_DEF,
     NODE_MEMBER_ACCESS,
     NODE_METHOD_CALL,
-    NODE_NEW_EXPR
+    NODE_NEW_EXPR,
+    NODE_YIELD
 } NodeType;
 
 typedef enum {
@@ -70,6 +71,7 @@ struct ASTNode {
 
         struct {
             char *value;
+            unsigned int hash;      // ast_string_hash(value)
         } string_literal;
 
         struct {
@@ -109,6 +111,7 @@ struct ASTNode {
             char *name;
             ASTNodeList *params;
             ASTNodeList *body;
+            int is_generator;       // Body contains yield: calls return an iterator
         } func_def;
 
         struct {
@@ -120,6 +123,10 @@ struct ASTNode {
             ASTNode *value;
         } return_stmt;
 
+        struct {
+            ASTNode *value;
+        } yield_stmt;
+
         struct {
             ASTNode *condition;
             ASTNodeList *then_block;
@@ -136,6 +143,7 @@ struct ASTNode {
             ASTNode *start;
             ASTNode *end;
             ASTNodeList *body;
+            int is_parallel;        // parallel for: iterations are independent
         } for_stmt;
 
         struct {
@@ -193,6 +201,7 @@ struct ASTNode {
         struct {
             ASTNode *object;
             char *member;
+            unsigned int hash;      // ast_string_hash(member)
         } member_access;
 
         struct {
@@ -208,6 +217,17 @@ struct ASTNode {
     } data;
 };
 
+/* Hash of a string literal or member name, computed when the node is built:
+   the runtime's dict hash (dict_hash in runtime.h), so constant keys and
+   member names are looked up without hashing them again */
+static inline unsigned int ast_string_hash(const char *s) {
+    unsigned int h = 0;
+    while (*s) {
+        h = h * 31 + *s++;
+    }
+    return h;
+}
+
 /* AST construction functions */
 ASTNode *create_program(ASTNodeList *statements);
 ASTNode *create_int_literal(int value);
@@ -228,6 +248,7 @@ ASTNode *clone_ast_node(ASTNode *node);  // Clone AST node for compound assignme
 ASTNode *create_func_def(char *name, ASTNodeList *params, ASTNodeList *body);
 ASTNode *create_func_call(char *name, ASTNodeList *arguments);
 ASTNode *create_return(ASTNode *value);
+ASTNode *create_yield(ASTNode *value);
 ASTNode *create_if_stmt(ASTNode *condition, ASTNodeList *then_block, ASTNodeList *else_block);
 ASTNode *create_while_stmt(ASTNode *condition, ASTNodeList *body);
 ASTNode *create_for_stmt(char *index_var, ASTNode *start, ASTNode *end, ASTNodeList *body);
@@ -248,6 +269,10 @@ ASTNode *create_new_expression(char *class_name, ASTNodeList *arguments);
 ASTNodeList *create_node_list(ASTNode *node);
 ASTNodeList *append_node_list(ASTNodeList *list, ASTNode *node);
 
+/* First yield statement of stmts, not counting those of nested function
+   and class definitions (NULL if there is none) */
+ASTNode *find_yield(ASTNodeList *stmts);
+
 /* Interpreter */
 void interpret(ASTNode *root);
 
@@ -75,7 +75,29 @@ static void append_line(char **buf, size_t *cap, size_t *len, const char *line)
     *len += 1;
 }
 
-static int preprocess_internal(const char *path, PreprocessResult *res, StringVec *once_set, StringVec *stack, char **buf, size_t *cap, size_t *len, int *combined_line) {
+// Brace depth after a line, skipping string literals and # comments. An
+// include counts as top level when the depth before its line is 0.
+static int brace_depth_after(const char *line, int depth) {
+    for (const char *p = line; *p; p++) {
+        if (*p == '#') break;
+        if (*p == '"' || *p == '\'') {
+            char quote = *p++;
+            while (*p && *p != quote) {
+                if (*p == '\\' && p[1]) p++;
+                p++;
+            }
+            if (!*p) break;
+        } else if (*p == '{') {
+            depth++;
+        } else if (*p == '}' && depth > 0) {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+static int preprocess_internal(const char *path, PreprocessResult *res, StringVec *once_set, StringVec *stack, char **buf, size_t *cap, size_t *len, int *combined_line,
+                               PreprocessModuleHook hook, void *hook_ctx) {
     FILE *f = fopen(path, "r");
     if (!f) {
         fprintf(stderr, "Failed to open include file: %s\n", path);
@@ -91,7 +113,10 @@ static int preprocess_internal(const char *path, PreprocessResult *res, StringVe
     add_mapping(res, *combined_line, path, 1);
 
     char linebuf[4096];
+    int file_line = 0;
+    int depth = 0;
     while (fgets(linebuf, sizeof(linebuf), f) != NULL) {
+        file_line++;
         // strip trailing newline for processing
         size_t ll = strlen(linebuf);
         if (ll > 0 && linebuf[ll-1] == '\n') linebuf[ll-1] = '\0';
@@ -128,16 +153,31 @@ static int preprocess_internal(const char *path, PreprocessResult *res, StringVe
             char *full = resolve_path(path, fname);
             if (!(is_once && sv_contains(once_set, full))) {
                 if (is_once) sv_push(once_set, full);
-                if (preprocess_internal(full, res, once_set, stack, buf, cap, len, combined_line) != 0) {
+                char stmt[512];
+                int as_module = hook && depth == 0 && hook(full, stmt, sizeof(stmt), hook_ctx);
+                if (as_module < 0) {
                     free(full);
                     fclose(f);
                     return -1;
                 }
+                if (as_module) {
+                    // The include line becomes the module's init call
+                    append_line(buf, cap, len, stmt);
+                    (*combined_line)++;
+                } else if (preprocess_internal(full, res, once_set, stack, buf, cap, len, combined_line,
+                                               hook, hook_ctx) != 0) {
+                    free(full);
+                    fclose(f);
+                    return -1;
+                }
+                // Lines after the include belong to this file again
+                add_mapping(res, *combined_line, path, file_line + 1);
             }
             free(full);
             continue; // do not count this line itself
         }
 
+        depth = brace_depth_after(linebuf, depth);
         append_line(buf, cap, len, linebuf);
         (*combined_line)++;
     }
@@ -148,6 +188,10 @@ static int preprocess_internal(const char *path, PreprocessResult *res, StringVe
 }
 
 int preprocess_file(const char *path, PreprocessResult *result) {
+    return preprocess_file_modules(path, result, NULL, NULL);
+}
+
+int preprocess_file_modules(const char *path, PreprocessResult *result, PreprocessModuleHook hook, void *ctx) {
     memset(result, 0, sizeof(*result));
     StringVec once_set, stack;
     sv_init(&once_set);
@@ -156,7 +200,8 @@ int preprocess_file(const char *path, PreprocessResult *result) {
     result->combined_source = malloc(cap);
     result->combined_source[0] = '\0';
     int combined_line = 1;
-    int ret = preprocess_internal(path, result, &once_set, &stack, &result->combined_source, &cap, &len, &combined_line);
+    int ret = preprocess_internal(path, result, &once_set, &stack, &result->combined_source, &cap, &len, &combined_line,
+                                  hook, ctx);
     sv_free(&once_set);
     sv_free(&stack);
     if (ret != 0) {
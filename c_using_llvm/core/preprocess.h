@@ -18,6 +18,14 @@ typedef struct {
 // Returns 0 on success, non-zero on error.
 int preprocess_file(const char *path, PreprocessResult *result);
 
+// Separate compilation (codegen_llvm --cache-dir): the hook is offered every
+// include that appears outside of any braces. It returns 1 to keep the file
+// out of the combined source, with `stmt` set to the line that replaces the
+// include (a call to the module's init function), 0 to splice the file in as
+// usual, or -1 to fail preprocessing.
+typedef int (*PreprocessModuleHook)(const char *path, char *stmt, size_t stmt_size, void *ctx);
+int preprocess_file_modules(const char *path, PreprocessResult *result, PreprocessModuleHook hook, void *ctx);
+
 // Map a combined line number to original file and line.
 void map_line(const PreprocessResult *res, int combined_line, const char **file, int *line);
 
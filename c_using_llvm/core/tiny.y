@@ -24,8 +24,8 @@ PreprocessResult g_pp_result;
 %token <bval> TRUE FALSE
 %token NULL_LITERAL
 
-%token VAR FUN RETURN IF ELSE WHILE FOR IN NOT_IN BREAK CONTINUE CLASS NEW
-%token TRY CATCH RAISE ASSERT
+%token VAR FUN RETURN YIELD IF ELSE WHILE FOR IN NOT_IN BREAK CONTINUE CLASS NEW
+%token TRY CATCH RAISE ASSERT PARALLEL
 %token AND OR NOT
 %token PLUS MINUS MULTIPLY DIVIDE MODULO
 %token EQ NE LT LE GT GE
@@ -64,6 +64,11 @@ PreprocessResult g_pp_result;
 
 program:
     statement_list {
+        ASTNode *yield = find_yield($1);
+        if (yield) {
+            fprintf(stderr, "Parse error at %s:%d: yield outside a function\n", yield->file, yield->line);
+            YYABORT;
+        }
         root = create_program($1);
     }
     ;
@@ -81,6 +86,9 @@ statement:
     var_decl opt_semicolon
     | func_def
     | return_stmt opt_semicolon
+    | YIELD expression opt_semicolon {
+        $$ = create_yield($2);
+    }
     | if_stmt
     | while_stmt
     | for_stmt
@@ -171,6 +179,12 @@ class_member_list:
         $$.methods = $1.methods;
     }
     | class_member_list func_def {
+        if ($2->data.func_def.is_generator) {
+            ASTNode *yield = find_yield($2->data.func_def.body);
+            fprintf(stderr, "Parse error at %s:%d: yield in method '%s' (only functions can be generators)\n",
+                    yield->file, yield->line, $2->data.func_def.name);
+            YYABORT;
+        }
         $$.members = $1.members;
         $$.methods = append_node_list($1.methods, $2);
     }
@@ -225,6 +239,11 @@ for_stmt:
         /* Range loop: for (idx = start..end) */
         $$ = create_for_stmt($3, $5, $7, $10);
     }
+    | PARALLEL FOR LPAREN IDENTIFIER ASSIGN expression range_op expression RPAREN LBRACE statement_list RBRACE {
+        /* Parallel range loop: iterations may run concurrently (LLVM backend) */
+        $$ = create_for_stmt($4, $6, $8, $11);
+        $$->data.for_stmt.is_parallel = 1;
+    }
     ;
 
 range_op:
@@ -1,14 +1,17 @@
 #include "gc.h"
+#include "probes.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sched.h>
 
-// Global GC instance
-GC gc;
-
-// Forward declarations
-static void mark_value(Value *v);
+// Per-thread GC instance
+__thread GC gc;
 
 // Weak symbol for interpreter roots marking (defined in interpreter.c if linked)
 // Provide default empty implementation for when interpreter is not linked
@@ -18,8 +21,158 @@ void gc_mark_interpreter_roots(void) {
     // This will be overridden by interpreter.c if linked
 }
 
-// Initialize GC
-void gc_init(void) {
+// Bounds of the StaticObject sections, defined by the linker when the
+// program has static tables (undefined weak symbols are NULL otherwise)
+extern StaticObject __start_tl_static[] __attribute__((weak));
+extern StaticObject __stop_tl_static[] __attribute__((weak));
+extern char __start_tl_static_data[] __attribute__((weak));
+extern char __stop_tl_static_data[] __attribute__((weak));
+
+// Number of the main heap's current collection (StaticObject.epoch)
+static int static_epoch = 0;
+
+// ===== TINY_GC_TRACE event log =====
+// One JSON object per line: an "init" record, a "gc" record per collection,
+// sampled "alloc" records and a final "exit" record. The log goes to
+// $TINY_GC_TRACE_FILE or stderr; bench/gc_trace_summary.py summarizes it.
+#define GC_TRACE_DEFAULT_SAMPLE (64 * 1024)
+
+// Shared by all threads; fprintf keeps each record line intact
+static FILE *trace_out = NULL;
+static long trace_sample_interval = 0;  // Sample one allocation per this many bytes
+static double trace_epoch_us = 0;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static const char *gc_type_name(int type) {
+    switch (type) {
+        case TYPE_STRING: return "string";
+        case TYPE_ARRAY: return "array";
+        case TYPE_DICT: return "dict";
+        case TYPE_CLASS: return "class";
+        case TYPE_INSTANCE: return "instance";
+        case TYPE_ITERATOR: return "iterator";
+        case TYPE_BYTES: return "bytes";
+        case GC_TYPE_BUFFER: return "buffer";
+        default: return "other";
+    }
+}
+
+static void trace_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; s && *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 32) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+// Totals are those of the main thread's heap (atexit runs there)
+static void trace_exit(void) {
+    if (!trace_out) return;
+    fprintf(trace_out, "{\"ev\":\"exit\",\"t_us\":%.0f,\"collections\":%d,"
+            "\"objects_freed\":%d,\"bytes_freed\":%zu,\"objects\":%d,\"heap\":%zu}\n",
+            now_us() - trace_epoch_us, gc.total_collections, gc.total_objects_freed,
+            gc.total_bytes_freed, gc.num_objects, gc.heap_size);
+    FILE *out = trace_out;
+    trace_out = NULL;
+    if (out != stderr) fclose(out);
+    else fflush(out);
+}
+
+static void trace_init(void) {
+    const char *flag = getenv("TINY_GC_TRACE");
+    if (!flag || !*flag || strcmp(flag, "0") == 0) return;
+
+    const char *path = getenv("TINY_GC_TRACE_FILE");
+    FILE *out = stderr;
+    if (path && *path) {
+        out = fopen(path, "w");
+        if (!out) {
+            fprintf(stderr, "GC: cannot open trace file %s\n", path);
+            return;
+        }
+    }
+    const char *rate = getenv("TINY_GC_SAMPLE");
+    trace_sample_interval = rate && *rate ? atol(rate) : GC_TRACE_DEFAULT_SAMPLE;
+    gc.sample_countdown = trace_sample_interval;
+    trace_epoch_us = now_us();
+    trace_out = out;
+    fprintf(trace_out, "{\"ev\":\"init\",\"pid\":%d,\"sample_bytes\":%ld,\"threshold\":%d}\n",
+            (int)getpid(), trace_sample_interval, gc.max_objects);
+    atexit(trace_exit);
+}
+
+// Byte-based sampling: each record stands for sample_interval bytes
+static void trace_alloc(int type, size_t size) {
+    gc.sample_countdown -= (long)size;
+    if (gc.sample_countdown > 0) return;
+    // A large allocation may cross several sampling points at once
+    long weight = 0;
+    while (gc.sample_countdown <= 0) {
+        gc.sample_countdown += trace_sample_interval;
+        weight += trace_sample_interval;
+    }
+
+    int line = 0;
+    const char *file = NULL;
+    gc_alloc_site(&line, &file);
+    fprintf(trace_out, "{\"ev\":\"alloc\",\"type\":\"%s\",\"size\":%zu,\"weight\":%ld,\"file\":",
+            gc_type_name(type), size, weight);
+    trace_json_string(trace_out, file ? file : "?");
+    fprintf(trace_out, ",\"line\":%d}\n", line);
+}
+
+// ===== Object hash table =====
+
+// Convert GC object header to user pointer
+static void* gcobject_to_ptr(GCObject *obj) {
+    return (void*)(obj + 1);
+}
+
+// Hash function for pointer addresses: malloc'd headers are 16-byte
+// aligned, and the higher bits are folded in so neighbours spread out
+static inline size_t hash_ptr(GC *h, void *ptr) {
+    uintptr_t addr = (uintptr_t)ptr >> 4;
+    return (addr ^ (addr >> 12)) & (h->hash_size - 1);
+}
+
+static void hash_insert(GC *h, GCObject *obj) {
+    size_t hash = hash_ptr(h, gcobject_to_ptr(obj));
+    obj->hash_next = h->hash_table[hash];
+    h->hash_table[hash] = obj;
+}
+
+// Keep chains short: lookups during marking walk a chain per pointer
+static void hash_maybe_grow(GC *h) {
+    if ((size_t)h->num_objects <= h->hash_size * 2) return;
+    GCObject **old = h->hash_table;
+    size_t old_size = h->hash_size;
+    while ((size_t)h->num_objects > h->hash_size * 2) h->hash_size *= 2;
+    h->hash_table = calloc(h->hash_size, sizeof(GCObject*));
+    if (!h->hash_table) {
+        fprintf(stderr, "GC: Fatal - out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_size; i++) {
+        GCObject *obj = old[i];
+        while (obj) {
+            GCObject *next = obj->hash_next;
+            hash_insert(h, obj);
+            obj = next;
+        }
+    }
+    free(old);
+}
+
+// Reset the calling thread's heap state
+static void gc_reset(void) {
     gc.root_count = 0;
     gc.all_objects = NULL;
     gc.num_objects = 0;
@@ -27,168 +180,359 @@ void gc_init(void) {
     gc.heap_size = 0;
     gc.max_heap_size = 1024 * 1024;  // 1MB initial
     gc.stack_bottom = NULL;
+    gc.suspended = NULL;
     gc.heap_start = (void*)~(size_t)0;  // Max address
     gc.heap_end = NULL;                  // Min address
     gc.total_collections = 0;
     gc.total_objects_freed = 0;
     gc.total_bytes_freed = 0;
+    gc.total_pause_us = 0;
+    gc.max_pause_us = 0;
+    gc.sample_countdown = trace_sample_interval;
+    gc.owns_static = 0;
+    runtime_stats_register_thread();
 
     // Initialize hash table
-    for (int i = 0; i < GC_HASH_SIZE; i++) {
-        gc.hash_table[i] = NULL;
-    }
+    gc.hash_size = GC_HASH_SIZE;
+    gc.hash_table = calloc(gc.hash_size, sizeof(GCObject*));
+}
+
+// Initialize GC
+void gc_init(void) {
+    gc_reset();
+    gc.owns_static = 1;
+    trace_init();
 
     printf("GC: Initialized (threshold: %d objects)\n", gc.max_objects);
 }
 
+// Give a new thread (task worker) its own empty heap
+void gc_thread_init(void *stack_bottom) {
+    gc_reset();
+    gc.stack_bottom = stack_bottom;
+}
+
+void gc_heap_push(GC *saved) {
+    *saved = gc;
+    gc_reset();
+    gc.stack_bottom = saved->stack_bottom;
+    gc.suspended = saved->suspended;
+    gc.sample_countdown = saved->sample_countdown;
+}
+
+void gc_heap_merge(GC *saved) {
+    // The tables may differ in size, so the inner heap's objects are
+    // rehashed into the saved one
+    GCObject *last = NULL;
+    for (GCObject *obj = gc.all_objects; obj; obj = obj->next) {
+        hash_insert(saved, obj);
+        last = obj;
+    }
+    if (last) {
+        last->next = saved->all_objects;
+        saved->all_objects = gc.all_objects;
+    }
+    free(gc.hash_table);
+    saved->num_objects += gc.num_objects;
+    hash_maybe_grow(saved);
+    saved->heap_size += gc.heap_size;
+    if (gc.heap_start < saved->heap_start) saved->heap_start = gc.heap_start;
+    if (gc.heap_end > saved->heap_end) saved->heap_end = gc.heap_end;
+    saved->total_collections += gc.total_collections;
+    saved->total_objects_freed += gc.total_objects_freed;
+    saved->total_bytes_freed += gc.total_bytes_freed;
+    saved->total_pause_us += gc.total_pause_us;
+    if (gc.max_pause_us > saved->max_pause_us) saved->max_pause_us = gc.max_pause_us;
+    saved->sample_countdown = gc.sample_countdown;
+    gc = *saved;
+}
+
 // Set stack bottom for conservative scanning
 void gc_set_stack_bottom(void *bottom) {
     gc.stack_bottom = bottom;
 }
 
-// Convert user pointer to GC object header
-static GCObject* ptr_to_gcobject(void *ptr) {
-    return ((GCObject*)ptr) - 1;
+void gc_stack_switch(GCStackLink *link, void *bottom) {
+    link->low = __builtin_frame_address(0);
+    link->high = gc.stack_bottom;
+    link->prev = gc.suspended;
+    gc.suspended = link;
+    gc.stack_bottom = bottom;
 }
 
-// Convert GC object header to user pointer
-static void* gcobject_to_ptr(GCObject *obj) {
-    return (void*)(obj + 1);
+void gc_stack_return(GCStackLink *link) {
+    gc.stack_bottom = link->high;
+    gc.suspended = link->prev;
 }
 
-// Forward declarations
-static void mark_value(Value *v);
-static GCObject* find_gc_object(void *ptr);
+// Check if a pointer points to an object of heap h (optimized with hash table)
+static GCObject* find_gc_object_in(GC *h, void *ptr) {
+    size_t hash = hash_ptr(h, ptr);
 
-// Mark an array's elements
-static void mark_array(Array *a) {
-    if (!a) return;
-
-    // Mark the data buffer itself (it's also a GC object)
-    if (a->data) {
-        // Validate that a->data points to a valid GC object
-        GCObject *data_obj = find_gc_object(a->data);
-        if (data_obj && !data_obj->marked) {
-            data_obj->marked = 1;
+    // Search in hash bucket
+    for (GCObject *obj = h->hash_table[hash]; obj; obj = obj->hash_next) {
+        void *obj_start = gcobject_to_ptr(obj);
+        void *obj_end = (char*)obj_start + obj->size;
 
-            // Mark the element values
-            Value *elements = (Value*)a->data;
-            for (int i = 0; i < a->size; i++) {
-                mark_value(&elements[i]);
-            }
+        // Check if ptr points to this object (or interior pointer)
+        if (ptr >= obj_start && ptr < obj_end) {
+            return obj;
         }
     }
+    return NULL;
 }
 
-// Mark a dict's values
-static void mark_dict(Dict *d) {
-    if (!d) return;
+static GCObject* find_gc_object(void *ptr) {
+    return find_gc_object_in(&gc, ptr);
+}
 
-    // Mark the buckets array itself (allocated with gc_alloc)
-    if (d->buckets) {
-        GCObject *buckets_obj = find_gc_object(d->buckets);
-        if (buckets_obj && !buckets_obj->marked) {
-            buckets_obj->marked = 1;
-        }
-    }
+int gc_owns(void *ptr) {
+    if (ptr < gc.heap_start || ptr >= gc.heap_end) return 0;
+    return find_gc_object(ptr) != NULL;
+}
 
-    // Mark values in dictionary entries
-    if (d->buckets) {
-        for (int i = 0; i < 256; i++) {  // HASH_SIZE = 256
-            DictEntry *entry = d->buckets[i];
-            while (entry) {
-                mark_value(&entry->value);
-                entry = entry->next;
-            }
-        }
-    }
+// The record whose Array/Dict starts at ptr, or NULL
+static StaticObject *static_object(void *ptr) {
+    if (ptr < (void*)__start_tl_static || ptr >= (void*)__stop_tl_static) return NULL;
+    size_t offset = (char*)ptr - (char*)__start_tl_static;
+    if (offset % sizeof(StaticObject) != offsetof(StaticObject, obj)) return NULL;
+    return (StaticObject*)((char*)ptr - offsetof(StaticObject, obj));
+}
+
+int gc_is_static(void *ptr) {
+    return (ptr >= (void*)__start_tl_static && ptr < (void*)__stop_tl_static) ||
+           (ptr >= (void*)__start_tl_static_data && ptr < (void*)__stop_tl_static_data);
+}
+
+int gc_on_stack(void *ptr) {
+    return gc.stack_bottom && ptr >= __builtin_frame_address(0) && ptr < gc.stack_bottom;
 }
 
-// Mark a class instance's fields
-static void mark_instance(Instance *inst) {
-    if (!inst) return;
+// ===== Mark phase =====
+// Marking is iterative: a reachable object is marked when it is first seen
+// and pushed on its marker's gray stack, and popping it pushes its children.
+// Large heaps are marked by several threads at once (see "Parallel
+// collection" below); mark bits are then claimed with an atomic exchange so
+// every object is scanned by exactly one marker.
+
+// Gray entries published for idle markers to steal
+#define MARK_BATCH 64
+
+typedef struct Marker {
+    GC *heap;               // Heap being collected (the collecting thread's)
+    int parallel;           // One of par.markers in a parallel collection
+    Value *stack;           // Gray stack, owned by this marker
+    int count;
+    int cap;
+
+    // Published work: only the owner fills it, any marker may empty it
+    pthread_mutex_t lock;
+    Value spare[MARK_BATCH];
+    int spare_count;
+
+    // Sweep results
+    GCObject *live;         // Surviving objects, linked through next
+    GCObject *live_tail;
+    int freed;
+    size_t freed_bytes;
+} Marker;
+
+// The marker gc_mark_value() feeds while roots are being marked
+static __thread Marker *root_marker = NULL;
+
+static int mark_take_work(Marker *m);
+static void mark_publish(Marker *m);
+
+// Claim an object for this collection; 0 if someone already has
+static int mark_claim(GCObject *obj) {
+    if (__atomic_load_n(&obj->marked, __ATOMIC_RELAXED)) return 0;
+    return !__atomic_exchange_n(&obj->marked, 1, __ATOMIC_RELAXED);
+}
 
-    // Mark the fields dict
-    mark_value(&inst->fields);
+static void mark_push(Marker *m, Value v) {
+    if (m->count == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 1024;
+        m->stack = realloc(m->stack, m->cap * sizeof(Value));
+        if (!m->stack) {
+            fprintf(stderr, "GC: Fatal - out of memory for the mark stack\n");
+            exit(1);
+        }
+    }
+    m->stack[m->count++] = v;
 }
 
-// Recursively mark a Value and its children
-static void mark_value(Value *v) {
-    if (!v) return;
+// Claim a static object for the main heap's current collection
+static int static_claim(StaticObject *s) {
+    if (__atomic_load_n(&s->epoch, __ATOMIC_RELAXED) == static_epoch) return 0;
+    return __atomic_exchange_n(&s->epoch, static_epoch, __ATOMIC_RELAXED) != static_epoch;
+}
 
+// Mark a Value and queue its children
+static void mark_value(Marker *m, Value v) {
     // Only heap-allocated types need marking
-    if (v->type != TYPE_ARRAY && v->type != TYPE_DICT &&
-        v->type != TYPE_STRING && v->type != TYPE_INSTANCE &&
-        v->type != TYPE_CLASS) {
+    if (v.type != TYPE_ARRAY && v.type != TYPE_DICT &&
+        v.type != TYPE_STRING && v.type != TYPE_INSTANCE &&
+        v.type != TYPE_CLASS && v.type != TYPE_ITERATOR && v.type != TYPE_BYTES) {
         return;  // Primitives (int, float, bool, null) - no marking needed
     }
 
-    if (!v->data) return;  // Null pointer
+    if (!v.data) return;  // Null pointer
 
     // Validate pointer looks reasonable (not corrupted)
-    // Valid heap pointers should be in a reasonable range
     // Note: Conservative stack scanning may find false positives (random stack
     // values that happen to fall in heap range). These are safely ignored here.
-    uintptr_t addr = (uintptr_t)v->data;
+    uintptr_t addr = (uintptr_t)v.data;
     if (addr < 4096 || addr == (uintptr_t)-1) {
         // Invalid pointer - likely false positive from conservative scanning
         return;
     }
 
-    // Find the GC object header
-    GCObject *obj = ptr_to_gcobject((void*)v->data);
+    // Find the GC object header. Strings and arrays built by some runtime
+    // helpers are plain malloc/calloc memory, so only touch the mark bit of
+    // pointers that really start a GC object.
+    GCObject *obj = find_gc_object_in(m->heap, (void*)v.data);
+    StaticObject *s;
+    if (obj && gcobject_to_ptr(obj) == (void*)v.data) {
+        // Already marked? Its children are queued already
+        if (!mark_claim(obj)) return;
+    } else if ((s = static_object((void*)v.data)) != NULL) {
+        // Other heaps cannot store into static tables (check_shared_write)
+        if (!m->heap->owns_static || !static_claim(s)) return;
+    } else if (v.type == TYPE_STRING || v.type == TYPE_CLASS) {
+        return;  // Not GC-managed and no children
+    }
+
+    // Strings have no children, iterators only through a roots hook;
+    // classes are static
+    if (v.type == TYPE_STRING || v.type == TYPE_CLASS) return;
+    if (v.type == TYPE_ITERATOR && !((Iterator*)v.data)->roots) return;
+    mark_push(m, v);
+}
+
+// Conservatively scan a memory region for pointers to GC objects
+static void scan_region(Marker *m, void *start, void *end) {
+    GC *h = m->heap;
+    // Scan with 8-byte alignment (word-aligned)
+    // More efficient than byte-by-byte scanning while still conservative
+    size_t word_size = sizeof(void*);
+
+    // Align start pointer to word boundary
+    char *aligned_start = (char*)((((uintptr_t)start + word_size - 1) / word_size) * word_size);
+
+    for (char *p = aligned_start; p + word_size <= (char*)end; p += word_size) {
+        void *potential_ptr = *(void**)p;
+
+        // Skip null pointers
+        if (!potential_ptr) continue;
+
+        StaticObject *s = static_object(potential_ptr);
+        if (s) {
+            mark_value(m, (Value){s->type, (long)potential_ptr});
+            continue;
+        }
+
+        // Fast filter: check if pointer is in heap address range
+        if (potential_ptr < h->heap_start || potential_ptr >= h->heap_end) {
+            continue;
+        }
+
+        // Check if this looks like a heap pointer
+        GCObject *obj = find_gc_object_in(h, potential_ptr);
+        if (!obj || __atomic_load_n(&obj->marked, __ATOMIC_RELAXED)) continue;
+        if (obj->type == GC_TYPE_BUFFER) {
+            // Raw buffer (e.g. an argument vector): no header to follow,
+            // so queue it to be scanned the same way as the stack
+            if (mark_claim(obj)) mark_push(m, (Value){GC_TYPE_BUFFER, (long)obj});
+            continue;
+        }
+        // Mark from the object start, not potential_ptr (which might be an
+        // interior pointer)
+        mark_value(m, (Value){obj->type, (long)gcobject_to_ptr(obj)});
+    }
+}
+
+// RootVisitor for an iterator's roots hook
+typedef struct {
+    RootVisitor visitor;
+    Marker *m;
+} MarkVisitor;
 
-    // Already marked? Avoid infinite recursion
-    if (obj->marked) return;
+static void visit_scan(RootVisitor *v, void *start, void *end) {
+    scan_region(((MarkVisitor*)v)->m, start, end);
+}
 
-    obj->marked = 1;
+static void visit_mark(RootVisitor *v, Value val) {
+    mark_value(((MarkVisitor*)v)->m, val);
+}
 
-    // Recursively mark children based on type
-    switch (v->type) {
-        case TYPE_ARRAY:
-            mark_array((Array*)v->data);
+// Queue the children of a gray entry
+static void mark_children(Marker *m, Value v) {
+    switch (v.type) {
+        case GC_TYPE_BUFFER: {
+            GCObject *obj = (GCObject*)v.data;
+            void *data = gcobject_to_ptr(obj);
+            scan_region(m, data, (char*)data + obj->size);
             break;
-        case TYPE_DICT:
-            mark_dict((Dict*)v->data);
+        }
+        case TYPE_ARRAY: {
+            Array *a = (Array*)v.data;
+            // The data buffer is a GC object too; its elements are only
+            // scanned the first time it is claimed. A static array (claimed
+            // once already) keeps them in static data until it grows.
+            if (!a->data) break;
+            GCObject *data_obj = find_gc_object_in(m->heap, a->data);
+            if (data_obj ? mark_claim(data_obj) : static_object(a) != NULL) {
+                Value *elements = (Value*)a->data;
+                for (int i = 0; i < a->size; i++) {
+                    mark_value(m, elements[i]);
+                }
+            }
+            break;
+        }
+        case TYPE_DICT: {
+            Dict *d = (Dict*)v.data;
+            if (!d->buckets) break;
+            // Mark the buckets array itself (allocated with gc_alloc)
+            GCObject *buckets_obj = find_gc_object_in(m->heap, d->buckets);
+            if (buckets_obj) mark_claim(buckets_obj);
+            for (int i = 0; i < HASH_SIZE; i++) {
+                for (DictEntry *entry = d->buckets[i]; entry; entry = entry->next) {
+                    mark_value(m, entry->value);
+                }
+            }
             break;
+        }
         case TYPE_INSTANCE:
-            mark_instance((Instance*)v->data);
+            mark_value(m, ((Instance*)v.data)->fields);
             break;
-        case TYPE_STRING:
-            // Strings have no children
+        case TYPE_BYTES: {
+            // A slice keeps the bytes it points into alive
+            Bytes *b = (Bytes*)v.data;
+            if (b->owner) mark_value(m, (Value){TYPE_BYTES, (long)b->owner});
             break;
-        case TYPE_CLASS:
-            // Classes are static, no children to mark
+        }
+        case TYPE_ITERATOR: {
+            Iterator *it = (Iterator*)v.data;
+            MarkVisitor mv = {{visit_scan, visit_mark}, m};
+            if (it->roots) it->roots(it, &mv.visitor);
             break;
+        }
     }
 }
 
-// Hash function for pointer addresses
-static inline size_t hash_ptr(void *ptr) {
-    uintptr_t addr = (uintptr_t)ptr;
-    // Simple hash: use middle bits of address
-    return (addr >> 3) % GC_HASH_SIZE;
-}
-
-// Check if a pointer points to a GC object (optimized with hash table)
-static GCObject* find_gc_object(void *ptr) {
-    size_t hash = hash_ptr(ptr);
-
-    // Search in hash bucket
-    for (GCObject *obj = gc.hash_table[hash]; obj; obj = obj->hash_next) {
-        void *obj_start = gcobject_to_ptr(obj);
-        void *obj_end = (char*)obj_start + obj->size;
-
-        // Check if ptr points to this object (or interior pointer)
-        if (ptr >= obj_start && ptr < obj_end) {
-            return obj;
+// Mark everything reachable from the gray stack; with several markers, also
+// what can be stolen from the others, until all of them run dry
+static void mark_drain(Marker *m) {
+    do {
+        while (m->count > 0) {
+            mark_children(m, m->stack[--m->count]);
+            if (m->parallel && m->count >= 2 * MARK_BATCH) mark_publish(m);
         }
-    }
-    return NULL;
+    } while (mark_take_work(m));
 }
 
-// Conservative stack scanning
-static void scan_stack(void) {
+// Conservative stack scanning (like Boehm GC)
+static void scan_stack(Marker *m) {
     if (!gc.stack_bottom) {
         // Stack bottom not set, skip scanning
         return;
@@ -209,101 +553,287 @@ static void scan_stack(void) {
         end = tmp;
     }
 
-    // Scan stack with 8-byte alignment (word-aligned)
-    // More efficient than byte-by-byte scanning while still conservative
-    size_t word_size = sizeof(void*);
+    scan_region(m, start, end);
 
-    // Align start pointer to word boundary
-    char *aligned_start = (char*)((((uintptr_t)start + word_size - 1) / word_size) * word_size);
-
-    for (char *p = aligned_start; p + word_size <= (char*)end; p += word_size) {
-        void *potential_ptr = *(void**)p;
-
-        // Skip null pointers
-        if (!potential_ptr) continue;
-
-        // Fast filter: check if pointer is in heap address range
-        if (potential_ptr < gc.heap_start || potential_ptr >= gc.heap_end) {
-            continue;
-        }
-
-        // Check if this looks like a heap pointer
-        GCObject *obj = find_gc_object(potential_ptr);
-        if (obj && !obj->marked) {
-            // Recursively mark based on object type
-            // IMPORTANT: Use the correct object start pointer, not potential_ptr
-            // (which might be an interior pointer)
-            // DON'T set marked=1 here - let mark_value() do it!
-            Value v;
-            v.data = (long)gcobject_to_ptr(obj);
-            v.type = obj->type;
-            mark_value(&v);
-        }
+    // Stacks left for a generator's, down to the frame that switched
+    for (GCStackLink *link = gc.suspended; link; link = link->prev) {
+        if (link->high) scan_region(m, link->low, link->high);
     }
 }
 
-// Mark phase: mark all reachable objects from roots
-static void mark_from_roots(void) {
-    // Conservative stack scanning (like Boehm GC)
-    scan_stack();
+// Mark the roots of the calling thread's heap; their children are left on
+// m's gray stack
+static void mark_roots(Marker *m) {
+    // Spill callee-saved registers so pointers held only in registers are
+    // seen by the stack scan
+    jmp_buf regs;
+    setjmp(regs);
+
+    root_marker = m;
+    scan_stack(m);
 
     // Also mark from explicit roots (if any)
     for (int i = 0; i < gc.root_count; i++) {
         if (gc.roots[i]) {
-            mark_value(gc.roots[i]);
+            mark_value(m, *gc.roots[i]);
         }
     }
 
     // Mark interpreter-specific roots (if linked with interpreter)
     // The weak symbol will be overridden if interpreter.o is linked
     gc_mark_interpreter_roots();
+    root_marker = NULL;
 }
 
-// Sweep phase: free unmarked objects
-static void sweep(void) {
-    GCObject **obj_ptr = &gc.all_objects;
+// ===== Sweep phase =====
+// Sweeping walks the hash table rather than all_objects, so buckets can be
+// split into independent ranges: dead objects are unlinked from their chain
+// and freed, survivors have their mark cleared and are collected into the
+// marker's live list, which becomes all_objects again.
+
+static void sweep_buckets(Marker *m, size_t lo, size_t hi) {
+    for (size_t i = lo; i < hi; i++) {
+        GCObject **link = &m->heap->hash_table[i];
+        while (*link) {
+            GCObject *obj = *link;
+            if (!obj->marked) {
+                *link = obj->hash_next;
+                m->freed++;
+                m->freed_bytes += obj->size;
+                // An iterator dropped before its end releases its state
+                if (obj->type == TYPE_ITERATOR) iterator_close(gcobject_to_ptr(obj));
+                free(obj);
+                continue;
+            }
+            obj->marked = 0;
+            obj->next = m->live;
+            if (!m->live) m->live_tail = obj;
+            m->live = obj;
+            link = &obj->hash_next;
+        }
+    }
+}
 
-    while (*obj_ptr) {
-        GCObject *obj = *obj_ptr;
+// Make the markers' sweep results the heap's object list and counts
+static void sweep_finish(Marker *markers, int n) {
+    gc.all_objects = NULL;
+    for (int i = 0; i < n; i++) {
+        Marker *m = &markers[i];
+        if (m->live) {
+            m->live_tail->next = gc.all_objects;
+            gc.all_objects = m->live;
+        }
+        gc.num_objects -= m->freed;
+        gc.heap_size -= m->freed_bytes;
+    }
+}
 
-        if (!obj->marked) {
-            // Unmarked - remove from list and free
-            *obj_ptr = obj->next;
+static void marker_reset(Marker *m, int parallel) {
+    m->heap = &gc;
+    m->parallel = parallel;
+    m->count = 0;
+    m->spare_count = 0;
+    m->live = m->live_tail = NULL;
+    m->freed = 0;
+    m->freed_bytes = 0;
+}
 
-            // Remove from hash table
-            void *ptr = gcobject_to_ptr(obj);
-            size_t hash = hash_ptr(ptr);
-            GCObject **hash_ptr = &gc.hash_table[hash];
-            while (*hash_ptr) {
-                if (*hash_ptr == obj) {
-                    *hash_ptr = obj->hash_next;
-                    break;
-                }
-                hash_ptr = &(*hash_ptr)->hash_next;
-            }
+// ===== Parallel collection =====
+// A heap of at least GC_PARALLEL_MIN objects is collected with the help of
+// TINY_GC_THREADS - 1 helper threads (default: one per core, at most
+// GC_MAX_THREADS in total). The collecting thread marks its roots, then it
+// and the helpers drain the gray stacks, stealing published batches from
+// each other, and finally sweep bucket ranges. The helpers serve one
+// collection at a time; a thread that finds them busy collects on its own.
+#define GC_PARALLEL_MIN 50000
+#define GC_MAX_THREADS 8
+#define SWEEP_RANGES 16         // Sweep work items per thread
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start;       // A new collection for the helpers
+    pthread_cond_t done;        // The last helper finished
+    int nthreads;               // Markers including the collecting thread
+    Marker *markers;            // markers[0] is the collecting thread's
+    long generation;            // Collections handed to the helpers
+    int running;                // Helpers still working on the current one
+    int busy;                   // Some thread's collection owns the helpers
+    int active;                 // Markers that have or may take gray entries
+    int next_range;             // Next sweep range to claim
+    size_t range_size;          // Buckets per sweep range
+} par = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static pthread_once_t par_once = PTHREAD_ONCE_INIT;
+
+// Hand a batch from the top of the gray stack to idle markers
+static void mark_publish(Marker *m) {
+    if (__atomic_load_n(&m->spare_count, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&par.active, __ATOMIC_RELAXED) == par.nthreads) {
+        return;
+    }
+    pthread_mutex_lock(&m->lock);
+    if (m->spare_count == 0) {
+        m->count -= MARK_BATCH;
+        memcpy(m->spare, m->stack + m->count, sizeof(m->spare));
+        __atomic_store_n(&m->spare_count, MARK_BATCH, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+static int mark_steal(Marker *m, Marker *victim) {
+    if (!__atomic_load_n(&victim->spare_count, __ATOMIC_RELAXED)) return 0;
+    pthread_mutex_lock(&victim->lock);
+    int n = victim->spare_count;
+    for (int i = 0; i < n; i++) mark_push(m, victim->spare[i]);
+    __atomic_store_n(&victim->spare_count, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&victim->lock);
+    return n > 0;
+}
 
-            gc.heap_size -= obj->size;
-            gc.num_objects--;
+// Own batch first, then the other markers'
+static int mark_steal_any(Marker *m) {
+    int self = (int)(m - par.markers);
+    for (int i = 0; i < par.nthreads; i++) {
+        if (mark_steal(m, &par.markers[(self + i) % par.nthreads])) return 1;
+    }
+    return 0;
+}
 
-            free(obj);
-        } else {
-            // Marked - clear mark for next GC cycle
-            obj->marked = 0;
-            obj_ptr = &obj->next;
+// Refill an empty gray stack. Marking is over once every marker is idle:
+// only active markers publish, and a marker goes idle only after finding
+// every batch (its own included) empty, so then none is left.
+static int mark_take_work(Marker *m) {
+    if (!m->parallel) return 0;
+    if (mark_steal_any(m)) return 1;
+    __atomic_sub_fetch(&par.active, 1, __ATOMIC_ACQ_REL);
+    for (;;) {
+        for (int i = 0; i < par.nthreads; i++) {
+            if (__atomic_load_n(&par.markers[i].spare_count, __ATOMIC_RELAXED)) {
+                __atomic_add_fetch(&par.active, 1, __ATOMIC_ACQ_REL);
+                if (mark_steal_any(m)) return 1;
+                __atomic_sub_fetch(&par.active, 1, __ATOMIC_ACQ_REL);
+                break;
+            }
         }
+        if (__atomic_load_n(&par.active, __ATOMIC_ACQUIRE) == 0) return 0;
+        sched_yield();
+    }
+}
+
+// What every thread of a parallel collection does after the roots are marked
+static void par_collect(Marker *m, double *t_marked) {
+    mark_drain(m);
+    if (t_marked) *t_marked = now_us();
+    for (;;) {
+        size_t lo = __atomic_fetch_add(&par.next_range, 1, __ATOMIC_RELAXED) * par.range_size;
+        if (lo >= m->heap->hash_size) break;
+        size_t hi = lo + par.range_size;
+        sweep_buckets(m, lo, hi < m->heap->hash_size ? hi : m->heap->hash_size);
     }
 }
 
+static void *gc_helper_main(void *arg) {
+    Marker *m = &par.markers[(intptr_t)arg];
+    long seen = 0;
+    pthread_mutex_lock(&par.lock);
+    for (;;) {
+        while (par.generation == seen) pthread_cond_wait(&par.start, &par.lock);
+        seen = par.generation;
+        pthread_mutex_unlock(&par.lock);
+
+        par_collect(m, NULL);
+
+        pthread_mutex_lock(&par.lock);
+        if (--par.running == 0) pthread_cond_signal(&par.done);
+    }
+    return NULL;
+}
+
+static void par_init(void) {
+    const char *env = getenv("TINY_GC_THREADS");
+    long n = env && *env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (!env || !*env) n = n > GC_MAX_THREADS ? GC_MAX_THREADS : n;
+    if (n < 1) n = 1;
+    par.markers = calloc(n, sizeof(Marker));
+    for (int i = 0; i < n; i++) pthread_mutex_init(&par.markers[i].lock, NULL);
+    par.nthreads = 1;
+    for (int i = 1; i < n; i++) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, gc_helper_main, (void*)(intptr_t)i) != 0) break;
+        pthread_detach(th);
+        par.nthreads++;
+    }
+}
+
+// Collect the calling thread's heap with the helpers; 0 if they can't be used
+static int par_collect_heap(double *t_marked) {
+    pthread_once(&par_once, par_init);
+    if (par.nthreads <= 1) return 0;
+    pthread_mutex_lock(&par.lock);
+    if (par.busy) {
+        pthread_mutex_unlock(&par.lock);
+        return 0;
+    }
+    par.busy = 1;
+    pthread_mutex_unlock(&par.lock);
+
+    for (int i = 0; i < par.nthreads; i++) marker_reset(&par.markers[i], 1);
+    Marker *m = &par.markers[0];
+    mark_roots(m);
+
+    pthread_mutex_lock(&par.lock);
+    par.active = par.nthreads;
+    par.next_range = 0;
+    par.range_size = gc.hash_size / (par.nthreads * SWEEP_RANGES);
+    if (par.range_size == 0) par.range_size = 1;
+    par.running = par.nthreads - 1;
+    par.generation++;
+    pthread_cond_broadcast(&par.start);
+    pthread_mutex_unlock(&par.lock);
+
+    par_collect(m, t_marked);
+
+    pthread_mutex_lock(&par.lock);
+    while (par.running > 0) pthread_cond_wait(&par.done, &par.lock);
+    pthread_mutex_unlock(&par.lock);
+
+    sweep_finish(par.markers, par.nthreads);
+
+    pthread_mutex_lock(&par.lock);
+    par.busy = 0;
+    pthread_mutex_unlock(&par.lock);
+    return 1;
+}
+
+// Single-threaded collection of the calling thread's heap
+static __thread Marker local_marker;
+
+static void collect_heap(double *t_marked) {
+    Marker *m = &local_marker;
+    marker_reset(m, 0);
+    mark_roots(m);
+    mark_drain(m);
+    *t_marked = now_us();
+    sweep_buckets(m, 0, gc.hash_size);
+    sweep_finish(m, 1);
+}
+
 // Main GC collection function
 void gc_collect(void) {
     int before = gc.num_objects;
     size_t before_size = gc.heap_size;
-
-    // Mark phase
-    mark_from_roots();
-
-    // Sweep phase
-    sweep();
+    double t_start = now_us();
+    TINY_PROBE2(gc_start, before, before_size);
+    if (gc.owns_static) static_epoch++;
+
+    // Mark and sweep, with the helper threads for a large heap
+    double t_marked;
+    int threads = 1;
+    if (gc.num_objects >= GC_PARALLEL_MIN && par_collect_heap(&t_marked)) {
+        threads = par.nthreads;
+    } else {
+        collect_heap(&t_marked);
+    }
 
     int after = gc.num_objects;
     size_t after_size = gc.heap_size;
@@ -322,10 +852,20 @@ void gc_collect(void) {
         gc.max_objects = 100;  // Minimum threshold
     }
 
-    // Uncomment for debugging:
-    // printf("GC: Collected %d objects (%zu bytes), %d objects (%zu bytes) remain, next threshold: %d\n",
-    //        freed_objects, freed_bytes,
-    //        after, after_size, gc.max_objects);
+    double t_end = now_us();
+    TINY_PROBE2(gc_end, freed_objects, (long)((t_end - t_start) * 1000));
+    gc.total_pause_us += t_end - t_start;
+    if (t_end - t_start > gc.max_pause_us) gc.max_pause_us = t_end - t_start;
+
+    if (trace_out) {
+        fprintf(trace_out, "{\"ev\":\"gc\",\"n\":%d,\"t_us\":%.0f,\"pause_us\":%.1f,"
+                "\"mark_us\":%.1f,\"sweep_us\":%.1f,\"marked\":%d,\"swept\":%d,"
+                "\"swept_bytes\":%zu,\"heap_before\":%zu,\"heap_after\":%zu,"
+                "\"objects_before\":%d,\"objects_after\":%d,\"threshold\":%d,\"threads\":%d}\n",
+                gc.total_collections, t_start - trace_epoch_us, t_end - t_start,
+                t_marked - t_start, t_end - t_marked, after, freed_objects, freed_bytes,
+                before_size, after_size, before, after, gc.max_objects, threads);
+    }
 }
 
 // Reallocate GC-managed memory (like realloc but for GC)
@@ -355,6 +895,9 @@ void* gc_alloc(int type, size_t size) {
     if (gc.num_objects >= gc.max_objects) {
         gc_collect();
     }
+    if (size >= GC_LARGE_OBJECT) {
+        TINY_PROBE2(gc_alloc_large, type, size);
+    }
 
     // Allocate object with header
     GCObject *obj = (GCObject*)malloc(sizeof(GCObject) + size);
@@ -382,11 +925,10 @@ void* gc_alloc(int type, size_t size) {
 
     // Add to hash table for fast lookup
     void *ptr = gcobject_to_ptr(obj);
-    size_t hash = hash_ptr(ptr);
-    obj->hash_next = gc.hash_table[hash];
-    gc.hash_table[hash] = obj;
+    hash_insert(&gc, obj);
 
     gc.num_objects++;
+    hash_maybe_grow(&gc);
     gc.heap_size += size;
 
     // Update heap address range for fast filtering in stack scan
@@ -398,6 +940,13 @@ void* gc_alloc(int type, size_t size) {
     // Zero-initialize the memory
     memset(ptr, 0, size);
 
+    RT_STAT_INC(alloc_count[RT_STAT_INDEX(type)]);
+    RT_STAT_ADD(alloc_bytes[RT_STAT_INDEX(type)], (long)size);
+
+    if (trace_out && trace_sample_interval > 0) {
+        trace_alloc(type, size);
+    }
+
     return ptr;
 }
 
@@ -421,9 +970,9 @@ void gc_pop_root(void) {
     gc.root_count--;
 }
 
-// Manually mark a value (for global variables)
+// Manually mark a value (for global variables), from the roots callback
 void gc_mark_value(Value *v) {
-    mark_value(v);
+    if (v && root_marker) mark_value(root_marker, *v);
 }
 
 // Print GC statistics
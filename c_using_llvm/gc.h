@@ -13,12 +13,44 @@ typedef struct GCObject {
     struct GCObject *hash_next; // Linked list in hash bucket
 } GCObject;
 
+// Object type for raw GC buffers (array storage, dict buckets, argument
+// vectors). They are not Values themselves, so the marker never interprets
+// them as an Array/Dict header; when found on the stack they are scanned
+// conservatively word by word instead.
+#define GC_TYPE_BUFFER (-1)
+
+// Array or dict that codegen_llvm emits as static data (a constant literal
+// assigned by a top-level declaration). The records fill the tl_static
+// section back to back; their elements, buckets and entries are in
+// tl_static_data. They belong to the main thread's heap: its collections
+// mark them (epoch = the collection's number) and what they reference.
+typedef struct StaticObject {
+    int type;                   // TYPE_ARRAY or TYPE_DICT
+    int epoch;                  // Last collection that marked it
+    union {
+        Array array;
+        Dict dict;
+    } obj;
+} StaticObject;
+
+// Allocations at least this large fire the gc_alloc_large probe
+#define GC_LARGE_OBJECT (64 * 1024)
+
 // Root stack for tracking Value* on stack
 #define MAX_ROOTS 1024
 
-// Hash table for fast object lookup
+// Hash table for fast object lookup: initial bucket count, doubled whenever
+// the heap holds more than two objects per bucket
 #define GC_HASH_SIZE 1024
 
+// A stack the thread has switched away from to run a generator (see
+// gc_stack_switch): still live, so collections scan [low, high) too
+typedef struct GCStackLink {
+    void *low;
+    void *high;
+    struct GCStackLink *prev;
+} GCStackLink;
+
 typedef struct {
     Value *roots[MAX_ROOTS];    // Stack of pointers to Value structs
     int root_count;             // Current number of roots
@@ -31,30 +63,64 @@ typedef struct {
     size_t max_heap_size;       // Heap size threshold
 
     void *stack_bottom;         // Bottom of stack for conservative scanning
+    GCStackLink *suspended;     // Stacks below the current one (innermost first)
 
     // Heap address range for fast filtering
     void *heap_start;           // Lowest heap address seen
     void *heap_end;             // Highest heap address seen
 
     // Hash table for O(1) object lookup during stack scanning
-    GCObject *hash_table[GC_HASH_SIZE];
+    GCObject **hash_table;
+    size_t hash_size;           // Buckets (a power of two)
 
     // Cumulative statistics
     int total_collections;      // Total number of GC runs
     int total_objects_freed;    // Total objects freed across all collections
     size_t total_bytes_freed;   // Total bytes freed across all collections
+    double total_pause_us;      // Time spent in gc_collect
+    double max_pause_us;        // Longest single collection
+
+    int owns_static;            // Main thread's heap: marks StaticObjects
+
+    // TINY_GC_TRACE allocation sampling
+    long sample_countdown;      // Bytes left until the next sample
 } GC;
 
-// Global GC instance
-extern GC gc;
+// Per-thread GC instance: every thread allocates from and collects its own
+// heap, scanning only its own stack. Objects must not be shared between
+// threads; task.c deep-copies values that cross over.
+extern __thread GC gc;
 
 // GC API
-void gc_init(void);
+void gc_init(void);                      // Main thread: heap + tracing setup
+void gc_thread_init(void *stack_bottom); // Additional (worker) threads
 void gc_set_stack_bottom(void *bottom);  // Set stack bottom for scanning
+
+// Switching to another stack (a generator's, whose highest address is
+// bottom) and back: the stack being left is recorded in *link and keeps
+// being scanned until gc_stack_return(link), called back on it
+void gc_stack_switch(GCStackLink *link, void *bottom);
+void gc_stack_return(GCStackLink *link);
 void* gc_alloc(int type, size_t size);
 void* gc_realloc(void *old_ptr, int type, size_t old_size, size_t new_size);
 void gc_collect(void);
 
+// Does ptr point into an object of the calling thread's heap?
+int gc_owns(void *ptr);
+
+// Does ptr point into the calling thread's stack? (arrays and dicts that
+// codegen_llvm builds in a function's frame)
+int gc_on_stack(void *ptr);
+
+// Does ptr point into a static table (a StaticObject or its data)?
+int gc_is_static(void *ptr);
+
+// Park the calling thread's heap in *saved and continue with an empty one;
+// gc_heap_merge() moves everything allocated meanwhile into the parked heap
+// and makes it current again (used by parallel_for, see task.h)
+void gc_heap_push(GC *saved);
+void gc_heap_merge(GC *saved);
+
 // Root management - called by generated code
 void gc_push_root(Value *v);
 void gc_pop_root(void);
@@ -65,4 +131,9 @@ void gc_mark_value(Value *v);
 // Statistics
 void gc_print_stats(void);
 
+// Current .tl source position, used to attribute sampled allocations in the
+// trace. runtime.c provides a weak default (compiled code); the interpreter
+// overrides it with its own error context.
+void gc_alloc_site(int *line, const char **file);
+
 #endif // GC_H
@@ -15,47 +15,125 @@
 #include <setjmp.h>
 #include <stdarg.h>
 #include <math.h>
+#include <signal.h>
+#include <sys/time.h>
 #include "interpreter.h"
 #include "ast.h"
 #include "runtime.h"
 #include "gc.h"
+#include "task.h"
+#include "jit.h"
+#include "probes.h"
 
 // ============================================================================
 // Global state
 // ============================================================================
+// Evaluation state is per thread: spawn() runs functions on task workers
+// (task.h), each with its own heap, exception stack and environments.
 
 // Custom interpreter-only types (not in runtime.h)
 #define TYPE_FUNC 100  // User-defined functions
+#define TYPE_TASK_HIDDEN 101  // Global variable as seen from a task (not visible)
 
-// Control flow
-static jmp_buf break_jmp;
-static jmp_buf continue_jmp;
-static int has_returned;
-static Value return_value;
+// Control flow. Each loop keeps its jmp_bufs in its own frame and points
+// these at them while it runs.
+static __thread jmp_buf *break_jmp;
+static __thread jmp_buf *continue_jmp;
+static __thread int has_returned;
+static __thread Value return_value;
 
 // Exception handling
-static jmp_buf exception_stack[256];
-static int exception_top = 0;
-static Value exception_value;
+static __thread jmp_buf exception_stack[256];
+static __thread int exception_top = 0;
+static __thread Value exception_value;
 
-// Environment
-static Environment *global_env;
-static Environment *current_env;
+// Environment. global_env is root_env on the main thread; a task sees a
+// snapshot holding only the program's functions and classes.
+static Environment *root_env;
+static __thread Environment *global_env;
+static __thread Environment *current_env;
 
 // Loop and class context
-static Environment *loop_env_stack[256];
-static int loop_env_top = 0;
-static Instance *this_stack[256];
-static int this_stack_top = 0;
+static __thread Environment *loop_env_stack[256];
+static __thread int loop_env_top = 0;
+static __thread Instance *this_stack[256];
+static __thread int this_stack_top = 0;
+
+// Generators: a call of a function whose body contains yield returns a
+// runtime generator (make_generator) that runs the body on a stack of its
+// own. On every switch between the body and its consumer, one side's
+// evaluation state is saved in its InterpGen and the other's installed.
+typedef struct {
+    Environment *env;
+    jmp_buf *break_jmp;
+    jmp_buf *continue_jmp;
+    InterpreterFunction *jit_func;
+} EvalState;
+
+typedef struct InterpGen {
+    InterpreterFunction *func;
+    EvalState body;                // The body's state while it is suspended
+    EvalState consumer;            // The consumer's while the body runs
+    Environment **loops;           // The body's loop_env_stack entries and
+    int loop_count, loop_cap;      // exception_stack handlers, likewise
+    jmp_buf *handlers;
+    int handler_count, handler_cap;
+    int loop_base, handler_base;   // The consumer's tops while the body runs
+    int running;
+    struct InterpGen *outer;       // Next running body further out
+} InterpGen;
+
+static __thread InterpGen *running_gens = NULL;  // Innermost first
+
+// Tiered execution (--jit): call/back-edge count that triggers compilation
+// (0 = off), and the function whose body is running on this thread
+static long jit_threshold = 0;
+static int jit_wait = 0;  // --jit-sync: calls wait for the compilation they trigger
+static __thread InterpreterFunction *jit_func = NULL;
 
 // Error context
-static int err_line = -1;
-static const char *err_file = NULL;
+static __thread int err_line = -1;
+static __thread const char *err_file = NULL;
 
 // Interactive mode flag
-static int is_interactive_mode = 0;
+static __thread int is_interactive_mode = 0;
 static jmp_buf interactive_error_jmp;
 
+// ============================================================================
+// Sampling profiler (interpreter --profile=out.folded)
+// ============================================================================
+// call_function / call_method_internal keep a shadow stack of .tl frames.
+// A SIGPROF timer samples it together with err_line/err_file (the position
+// set_error_ctx already tracks). Samples are aggregated inside the handler
+// into a table allocated up front (no malloc in signal context) and written
+// at exit as folded stacks: "frame;frame;frame count", one stack per line.
+
+#define PROF_MAX_DEPTH 64        // Deeper frames are counted in their caller
+#define PROF_TABLE_SIZE 2048     // Distinct stacks kept; extra samples dropped
+#define PROF_INTERVAL_US 1000    // 1ms of CPU time between samples
+
+typedef struct {
+    const char *cls;             // Class name for methods, NULL for functions
+    const char *name;            // Function/method name, "<main>" at top level
+    const char *file;            // Current position in this frame (for callers:
+    int line;                    // the call site, filled in when a call is made)
+} ProfFrame;
+
+typedef struct {
+    unsigned long hash;
+    int depth;                   // 0 = empty slot
+    long count;
+    ProfFrame frames[PROF_MAX_DEPTH];
+} ProfStack;
+
+static const char *prof_path = NULL;
+static __thread int prof_enabled = 0;  // Main thread only; workers are not sampled
+static ProfFrame prof_frames[PROF_MAX_DEPTH];
+static volatile sig_atomic_t prof_depth = 0;
+static ProfStack *prof_table = NULL;
+static long prof_samples = 0;
+static long prof_dropped = 0;
+
 // ============================================================================
 // Forward declarations
 // ============================================================================
@@ -114,6 +192,11 @@ void gc_mark_interpreter_roots(void) {
     if (exception_top > 0) {
         gc_mark_value(&exception_value);
     }
+
+    // Consumers of the generator bodies that are running
+    for (InterpGen *ig = running_gens; ig; ig = ig->outer) {
+        mark_environment(ig->consumer.env);
+    }
 }
 
 // ============================================================================
@@ -125,6 +208,177 @@ static void set_error_ctx(int line, const char *file) {
     err_file = file ? file : "<input>";
 }
 
+// Overrides the runtime's weak default so GC trace samples carry .tl lines
+void gc_alloc_site(int *line, const char **file) {
+    *line = err_line;
+    *file = err_file;
+}
+
+static inline void prof_push(const char *cls, const char *name) {
+    if (!prof_enabled) return;
+    int d = prof_depth;
+    if (d > 0 && d <= PROF_MAX_DEPTH) {
+        // Remember where the caller is while the callee runs
+        prof_frames[d - 1].line = err_line;
+        prof_frames[d - 1].file = err_file;
+    }
+    if (d < PROF_MAX_DEPTH) {
+        prof_frames[d].cls = cls;
+        prof_frames[d].name = name;
+    }
+    // The handler reads frames below prof_depth: they must be written first
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    prof_depth = d + 1;
+}
+
+// Leaves err_line/err_file alone, so a runtime error reports the same
+// position with or without --profile. The caller's next statement moves
+// them back; samples before that go to the callee's last line.
+static inline void prof_pop(void) {
+    if (!prof_enabled) return;
+    prof_depth = prof_depth - 1;
+}
+
+static void prof_on_sigprof(int sig) {
+    (void)sig;
+    if (!prof_enabled) return;  // Delivered to a task worker
+    int depth = prof_depth;
+    if (depth <= 0) return;
+    if (depth > PROF_MAX_DEPTH) depth = PROF_MAX_DEPTH;
+
+    ProfFrame snap[PROF_MAX_DEPTH];
+    memcpy(snap, prof_frames, depth * sizeof(ProfFrame));
+    if (prof_depth <= PROF_MAX_DEPTH) {
+        snap[depth - 1].line = err_line;
+        snap[depth - 1].file = err_file;
+    }
+
+    // FNV-1a over the frame identities
+    unsigned long h = 1469598103934665603UL;
+    for (int i = 0; i < depth; i++) {
+        h = (h ^ (unsigned long)snap[i].name) * 1099511628211UL;
+        h = (h ^ (unsigned long)snap[i].cls) * 1099511628211UL;
+        h = (h ^ (unsigned long)snap[i].file) * 1099511628211UL;
+        h = (h ^ (unsigned long)snap[i].line) * 1099511628211UL;
+    }
+
+    prof_samples++;
+    for (int probe = 0; probe < PROF_TABLE_SIZE; probe++) {
+        ProfStack *e = &prof_table[(h + probe) % PROF_TABLE_SIZE];
+        if (e->depth == 0) {
+            e->hash = h;
+            memcpy(e->frames, snap, depth * sizeof(ProfFrame));
+            e->count = 1;
+            e->depth = depth;
+            return;
+        }
+        if (e->hash == h && e->depth == depth &&
+            memcmp(e->frames, snap, depth * sizeof(ProfFrame)) == 0) {
+            e->count++;
+            return;
+        }
+    }
+    prof_dropped++;
+}
+
+static void prof_write_frame(FILE *f, const ProfFrame *fr) {
+    const char *file = fr->file ? fr->file : "<input>";
+    const char *base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+    if (fr->cls) {
+        fprintf(f, "%s.%s (%s:%d)", fr->cls, fr->name, base, fr->line);
+    } else {
+        fprintf(f, "%s (%s:%d)", fr->name, base, fr->line);
+    }
+}
+
+typedef struct {
+    char *stack;
+    long count;
+} ProfLine;
+
+static int prof_line_cmp(const void *a, const void *b) {
+    return strcmp(((const ProfLine*)a)->stack, ((const ProfLine*)b)->stack);
+}
+
+// Stop sampling and write the folded profile (registered with atexit, so it
+// also runs when the script ends through exit())
+static void prof_finish(void) {
+    if (!prof_enabled) return;
+
+    struct itimerval off = {{0, 0}, {0, 0}};
+    setitimer(ITIMER_PROF, &off, NULL);
+    signal(SIGPROF, SIG_IGN);
+    prof_enabled = 0;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);  // No handler writes to the table past here
+
+    // Render each stack; AST nodes own their file name strings, so the same
+    // source position can show up under different pointers and is merged here
+    ProfLine *lines = malloc(PROF_TABLE_SIZE * sizeof(ProfLine));
+    int n = 0;
+    for (int i = 0; i < PROF_TABLE_SIZE; i++) {
+        ProfStack *e = &prof_table[i];
+        if (e->depth == 0) continue;
+        size_t len = 0;
+        FILE *mf = open_memstream(&lines[n].stack, &len);
+        for (int j = 0; j < e->depth; j++) {
+            if (j > 0) fputc(';', mf);
+            prof_write_frame(mf, &e->frames[j]);
+        }
+        fclose(mf);
+        lines[n].count = e->count;
+        n++;
+    }
+    qsort(lines, n, sizeof(ProfLine), prof_line_cmp);
+
+    FILE *f = fopen(prof_path, "w");
+    if (!f) {
+        fprintf(stderr, "profile: cannot write '%s'\n", prof_path);
+    }
+    for (int i = 0; i < n; i++) {
+        long count = lines[i].count;
+        while (i + 1 < n && strcmp(lines[i].stack, lines[i + 1].stack) == 0) {
+            free(lines[i].stack);
+            count += lines[++i].count;
+        }
+        if (f) fprintf(f, "%s %ld\n", lines[i].stack, count);
+        free(lines[i].stack);
+    }
+    free(lines);
+    if (f) fclose(f);
+
+    if (prof_dropped > 0) {
+        fprintf(stderr, "profile: %ld of %ld samples dropped (more than %d distinct stacks)\n",
+                prof_dropped, prof_samples, PROF_TABLE_SIZE);
+    }
+}
+
+static void prof_start(void) {
+    prof_table = calloc(PROF_TABLE_SIZE, sizeof(ProfStack));
+    if (!prof_table) {
+        fprintf(stderr, "profile: out of memory\n");
+        return;
+    }
+    prof_frames[0].cls = NULL;
+    prof_frames[0].name = "<main>";
+    prof_depth = 1;
+    prof_enabled = 1;
+    atexit(prof_finish);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = prof_on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval tv;
+    tv.it_interval.tv_sec = 0;
+    tv.it_interval.tv_usec = PROF_INTERVAL_US;
+    tv.it_value = tv.it_interval;
+    setitimer(ITIMER_PROF, &tv, NULL);
+}
+
 static __attribute__((noreturn)) void runtime_error(const char *fmt, ...) {
     fprintf(stderr, "Error at %s:%d: ", err_file ? err_file : "<input>", err_line >= 0 ? err_line : 0);
     va_list ap;
@@ -134,7 +388,8 @@ static __attribute__((noreturn)) void runtime_error(const char *fmt, ...) {
     fprintf(stderr, "\n");
 
     // In interactive mode, jump back to the REPL loop instead of exiting
-    if (is_interactive_mode) {
+    // (not from a generator's body: the REPL cannot unwind its stack)
+    if (is_interactive_mode && !running_gens) {
         longjmp(interactive_error_jmp, 1);
     }
 
@@ -193,10 +448,15 @@ int env_exists(Environment *env, char *name) {
     return 0;
 }
 
+static __attribute__((noreturn)) void hidden_global_error(const char *name) {
+    runtime_error("Global variable '%s' is not visible inside a task; pass it as an argument", name);
+}
+
 Value env_get(Environment *env, char *name) {
     unsigned int idx = hash_string(name);
     for (EnvEntry *e = env->buckets[idx]; e != NULL; e = e->next) {
         if (strcmp(e->name, name) == 0) {
+            if (e->value.type == TYPE_TASK_HIDDEN) hidden_global_error(name);
             return e->value;
         }
     }
@@ -210,6 +470,7 @@ void env_set(Environment *env, char *name, Value val) {
     unsigned int idx = hash_string(name);
     for (EnvEntry *e = env->buckets[idx]; e != NULL; e = e->next) {
         if (strcmp(e->name, name) == 0) {
+            if (e->value.type == TYPE_TASK_HIDDEN) hidden_global_error(name);
             e->value = val;
             return;
         }
@@ -279,8 +540,16 @@ static Value eval_dict_literal(ASTNode *node) {
     while (pair) {
         ASTNode *pair_node = pair->node;
 
+        ASTNode *key_node = pair_node->data.dict_pair.key;
+        if (key_node->type == NODE_STRING_LITERAL) {
+            Value val = eval_expression(pair_node->data.dict_pair.value);
+            dict = dict_set_h(dict, key_node->data.string_literal.value, key_node->data.string_literal.hash, val);
+            pair = pair->next;
+            continue;
+        }
+
         // Evaluate key (must be string)
-        Value key = eval_expression(pair_node->data.dict_pair.key);
+        Value key = eval_expression(key_node);
         if (key.type != TYPE_STRING) {
             runtime_error("Dictionary key must be a string");
         }
@@ -321,6 +590,9 @@ static int is_truthy(Value v) {
         Dict *dict = (Dict*)v.data;
         return dict && dict->size > 0;
     }
+    if (v.type == TYPE_BYTES) {
+        return ((Bytes*)v.data)->len > 0;
+    }
     return 1;
 }
 
@@ -396,7 +668,12 @@ static Value eval_index_access(ASTNode *node) {
     set_error_ctx(node->line, node->file);
 
     Value obj = eval_expression(node->data.index_access.object);
-    Value index = eval_expression(node->data.index_access.index);
+    ASTNode *key = node->data.index_access.index;
+    if (key->type == NODE_STRING_LITERAL) {
+        // Hashed at parse time
+        return dict_get_h(obj, key->data.string_literal.value, key->data.string_literal.hash);
+    }
+    Value index = eval_expression(key);
 
     // Use runtime.c's index_get
     return index_get(obj, index);
@@ -423,15 +700,198 @@ static Value eval_member_access(ASTNode *node) {
     }
 
     Instance *inst = (Instance*)obj.data;
-    char *member_name = node->data.member_access.member;
 
-    // Create a string Value for the field name
-    char *field_key = gc_alloc(TYPE_STRING, strlen(member_name) + 1);
-    strcpy(field_key, member_name);
-    Value field_name = {TYPE_STRING, (long)field_key};
+    // Look the field up with the name's parse-time hash
+    return dict_get_h(inst->fields, node->data.member_access.member, node->data.member_access.hash);
+}
+
+// ============================================================================
+// Tasks: spawn(fun, args...) / join(task)
+// ============================================================================
+
+// Throw an already formatted exception message ("file:line: msg")
+static void throw_message(const char *msg) {
+    char *full = gc_alloc(TYPE_STRING, strlen(msg) + 1);
+    strcpy(full, msg);
+    exception_value = (Value){TYPE_STRING, (long)full};
 
-    // Use index_get on the fields dict
-    return index_get(inst->fields, field_name);
+    if (exception_top > 0) {
+        longjmp(exception_stack[exception_top - 1], 1);
+    } else {
+        // No try-catch handler - unhandled exception
+        printf("Uncaught exception: %s\n", full);
+        exit(1);
+    }
+}
+
+// The global environment a task runs against: the program's functions and
+// classes. Global variables are entered as hidden, so using one inside a task
+// fails with a clear error instead of racing with the spawning thread. The
+// snapshot is read-only and reused until a new global is defined.
+static __thread Environment *task_snapshot = NULL;
+static __thread int task_snapshot_size = -1;
+
+static Environment *task_globals(void) {
+    if (task_snapshot && task_snapshot_size == global_env->size) {
+        return task_snapshot;
+    }
+    Environment *snap = create_environment(NULL);
+    for (int i = 0; i < HASH_SIZE; i++) {
+        for (EnvEntry *e = global_env->buckets[i]; e != NULL; e = e->next) {
+            Value v = e->value;
+            if (v.type != TYPE_FUNC && v.type != TYPE_CLASS) {
+                v = (Value){TYPE_TASK_HIDDEN, 0};
+            }
+            env_define(snap, e->name, v);
+        }
+    }
+    task_snapshot = snap;
+    task_snapshot_size = global_env->size;
+    return snap;
+}
+
+static Value spawn_task(Value *args, int arg_count) {
+    if (arg_count < 1 || args[0].type != TYPE_FUNC) {
+        runtime_error("spawn requires a function as its first argument");
+    }
+    InterpreterFunction *func = (InterpreterFunction*)args[0].data;
+    if (func->env != root_env) {
+        runtime_error("spawn: only top-level functions can run as tasks");
+    }
+    int param_count = 0;
+    for (ASTNodeList *p = func->params; p; p = p->next) param_count++;
+    if (param_count != arg_count - 1) {
+        runtime_error("spawn: function '%s' expects %d arguments, got %d",
+                      func->name, param_count, arg_count - 1);
+    }
+    return task_spawn(args[0], args + 1, arg_count - 1, task_globals());
+}
+
+static Value join_task(Value task) {
+    if (task.type != TYPE_TASK) {
+        runtime_error("join requires a task returned by spawn");
+    }
+    Value result;
+    const char *error;
+    if (task_join_result(task, &result, &error) != 0) {
+        throw_message(error);
+    }
+    return result;
+}
+
+// map/filter/reduce(arr, fun[, init]) call fun on this thread; the p*
+// variants split arr into chunks on the task pool, so like spawn() they take
+// top-level functions only and see global variables as hidden. preduce also
+// takes an optional function that combines the chunk results (task.h).
+static Value apply_function(const char *name, int op, Value *args, int arg_count) {
+    int kind = op & ~APPLY_PARALLEL;
+    int arity = kind == APPLY_REDUCE ? 2 : 1;
+    int has_combine = op == (APPLY_REDUCE | APPLY_PARALLEL) && arg_count == 4;
+    if (arg_count != arity + 1 && !has_combine) {
+        runtime_error("%s requires %d arguments", name, arity + 1);
+    }
+    if (args[0].type != TYPE_ARRAY) {
+        runtime_error("%s requires an array as its first argument", name);
+    }
+    if (args[1].type != TYPE_FUNC) {
+        runtime_error("%s requires a function as its second argument", name);
+    }
+    if (has_combine && args[3].type != TYPE_FUNC) {
+        runtime_error("%s requires a function as its fourth argument", name);
+    }
+    for (int i = 1; i <= 1 + has_combine; i++) {
+        InterpreterFunction *f = (InterpreterFunction*)args[i == 1 ? 1 : 3].data;
+        int param_count = 0;
+        for (ASTNodeList *p = f->params; p; p = p->next) param_count++;
+        if (param_count != arity) {
+            runtime_error("%s: function '%s' must take %d argument%s",
+                          name, f->name, arity, arity == 1 ? "" : "s");
+        }
+        if ((op & APPLY_PARALLEL) && f->env != root_env) {
+            runtime_error("%s: only top-level functions can run in parallel", name);
+        }
+    }
+    InterpreterFunction *func = (InterpreterFunction*)args[1].data;
+
+    if (op & APPLY_PARALLEL) {
+        Value init = kind == APPLY_REDUCE ? args[2] : make_null();
+        Value combine = has_combine ? args[3] : make_null();
+        Value result;
+        char *error;
+        if (array_apply(op, args[0], args[1], init, combine, task_globals(), &result, &error) != 0) {
+            char msg[strlen(error) + 1];
+            strcpy(msg, error);
+            free(error);
+            throw_message(msg);
+        }
+        return result;
+    }
+
+    // Sequential: a plain call, so exceptions propagate unchanged
+    Array *arr = (Array*)args[0].data;
+    Value out = kind == APPLY_REDUCE ? args[2] : make_array();
+    Value call_args[2];
+    for (int i = 0; i < arr->size; i++) {
+        Value item = ((Value*)arr->data)[i];
+        if (kind == APPLY_REDUCE) {
+            call_args[0] = out;
+            call_args[1] = item;
+            out = call_function(func, call_args, 2);
+            continue;
+        }
+        call_args[0] = item;
+        Value r = call_function(func, call_args, 1);
+        if (kind == APPLY_MAP) {
+            append(out, r);
+        } else if (is_truthy_rt(r)) {
+            append(out, item);
+        }
+    }
+    return out;
+}
+
+// Run a spawned function on this thread (overrides the runtime's version for
+// compiled code). ctx is the task's snapshot from task_globals().
+int task_call(Value fn, Value *args, int arg_count, void *ctx, Value *result, char **error) {
+    InterpreterFunction *func = (InterpreterFunction*)fn.data;
+    Environment *saved_global = global_env;
+    Environment *saved_env = current_env;
+    int saved_exception_top = exception_top;
+    int saved_loop_top = loop_env_top;
+    int saved_this_top = this_stack_top;
+    InterpreterFunction *saved_jit_func = jit_func;
+    volatile int failed = 0;
+
+    global_env = (Environment*)ctx;
+    current_env = global_env;
+
+    // Same two handlers as try/catch: raise, and runtime exceptions
+    void *runtime_buf = __try_push_buf();
+    if (setjmp(exception_stack[exception_top++]) == 0) {
+        if (setjmp(*(jmp_buf*)runtime_buf) == 0) {
+            *result = call_function(func, args, arg_count);
+        } else {
+            failed = 1;
+            exception_value = __get_exception();
+        }
+    } else {
+        failed = 1;
+    }
+    __try_pop();
+    exception_top = saved_exception_top;
+    loop_env_top = saved_loop_top;
+    this_stack_top = saved_this_top;
+    jit_func = saved_jit_func;
+    has_returned = 0;
+    global_env = saved_global;
+    current_env = saved_env;
+
+    if (failed) {
+        Value msg = exception_value.type == TYPE_STRING ? exception_value : to_string(exception_value);
+        *error = strdup((char*)msg.data);
+        return 1;
+    }
+    return 0;
 }
 
 static Value eval_function_call(ASTNode *node) {
@@ -450,7 +910,7 @@ static Value eval_function_call(ASTNode *node) {
     // Evaluate arguments
     Value *args = NULL;
     if (arg_count > 0) {
-        args = gc_alloc(TYPE_ARRAY, arg_count * sizeof(Value));
+        args = gc_alloc(GC_TYPE_BUFFER, arg_count * sizeof(Value));
         arg_node = node->data.func_call.arguments;
         for (int i = 0; i < arg_count; i++) {
             args[i] = eval_expression(arg_node->node);
@@ -506,6 +966,10 @@ static Value eval_function_call(ASTNode *node) {
     BUILTIN2("remove", remove_entry)
     BUILTIN2("split", str_split)
     BUILTIN2("str_split", str_split)
+    // join(task) waits for a spawned task; join(arr, sep) joins strings
+    if (strcmp(func_name, "join") == 0 && arg_count == 1) {
+        return join_task(args[0]);
+    }
     BUILTIN2("join", str_join)
     BUILTIN2("str_join", str_join)
     BUILTIN1("keys", keys)
@@ -537,6 +1001,33 @@ static Value eval_function_call(ASTNode *node) {
     BUILTIN1("file_size", file_size)
     BUILTIN1("file_exist", file_exist)
 
+    // Bytes
+    BUILTIN1("bytes", to_bytes)
+    BUILTIN1("file_read_bytes", file_read_bytes)
+    BUILTIN3("bytes_decode", bytes_decode)
+    BUILTIN2("bytes_encode", bytes_encode)
+    BUILTIN1("bytes_str", bytes_str)
+    if (strcmp(func_name, "bytes_find") == 0) {
+        if (arg_count == 2) {
+            return bytes_find(args[0], args[1], (Value){TYPE_INT, 0});
+        } else if (arg_count == 3) {
+            return bytes_find(args[0], args[1], args[2]);
+        } else {
+            runtime_error("bytes_find requires 2 or 3 arguments");
+        }
+    }
+
+    // CSV (path, optional options dict)
+    if (strcmp(func_name, "csv_rows") == 0 || strcmp(func_name, "csv_read") == 0) {
+        Value opts = make_null();
+        if (arg_count == 2) {
+            opts = args[1];
+        } else if (arg_count != 1) {
+            runtime_error("%s requires 1 or 2 arguments", func_name);
+        }
+        return strcmp(func_name, "csv_rows") == 0 ? csv_rows(args[0], opts) : csv_read(args[0], opts);
+    }
+
     // Math (1 arg)
     BUILTIN1("sin", math_sin)
     BUILTIN1("cos", math_cos)
@@ -600,6 +1091,31 @@ static Value eval_function_call(ASTNode *node) {
         gc_print_stats();
         return make_null();
     }
+    if (strcmp(func_name, "runtime_stats") == 0) {
+        if (arg_count != 0) runtime_error("runtime_stats requires 0 arguments");
+        return runtime_stats();
+    }
+
+    // Tasks
+    if (strcmp(func_name, "spawn") == 0) {
+        return spawn_task(args, arg_count);
+    }
+
+    // map/filter/reduce and their parallel variants (a user function of the
+    // same name takes precedence)
+    if (!env_exists(current_env, func_name)) {
+        static const struct { const char *name; int op; } apply_ops[] = {
+            {"map", APPLY_MAP}, {"filter", APPLY_FILTER}, {"reduce", APPLY_REDUCE},
+            {"pmap", APPLY_MAP | APPLY_PARALLEL},
+            {"pfilter", APPLY_FILTER | APPLY_PARALLEL},
+            {"preduce", APPLY_REDUCE | APPLY_PARALLEL},
+        };
+        for (size_t i = 0; i < sizeof(apply_ops) / sizeof(apply_ops[0]); i++) {
+            if (strcmp(func_name, apply_ops[i].name) == 0) {
+                return apply_function(func_name, apply_ops[i].op, args, arg_count);
+            }
+        }
+    }
 
     // Command line arguments
     if (strcmp(func_name, "cmd_args") == 0) {
@@ -618,12 +1134,361 @@ static Value eval_function_call(ASTNode *node) {
 
         // It's a user function stored in the environment
         InterpreterFunction *func = (InterpreterFunction*)func_val.data;
+        set_error_ctx(node->line, node->file);  // Arguments may have moved it
         return call_function(func, args, arg_count);
     }
 
     runtime_error("Undefined function: %s", func_name);
 }
 
+// ============================================================================
+// Tiered execution (interpreter --jit, see jit.h)
+// ============================================================================
+// Calls and loop back-edges are counted per function on the main thread.
+// Past jit_threshold the function and everything it calls are checked for
+// constructs compiled code handles the same way; if they all qualify, they
+// are compiled in the background and later calls run the native code.
+
+void interpret_enable_jit(long threshold, int wait) {
+    jit_threshold = threshold;
+    jit_wait = wait;
+}
+
+typedef struct {
+    InterpreterFunction **funcs;  // funcs[0] is the hot function
+    int count, cap;
+    char **locals;                // Parameters and variables of the one being scanned
+    int local_count, local_cap;
+} JitScan;
+
+static void jit_add_local(JitScan *s, char *name) {
+    if (s->local_count == s->local_cap) {
+        s->local_cap = s->local_cap ? s->local_cap * 2 : 16;
+        s->locals = realloc(s->locals, s->local_cap * sizeof(char*));
+    }
+    s->locals[s->local_count++] = name;
+}
+
+static int jit_is_local(JitScan *s, const char *name) {
+    for (int i = 0; i < s->local_count; i++) {
+        if (strcmp(s->locals[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+static void jit_add_func(JitScan *s, InterpreterFunction *func) {
+    for (int i = 0; i < s->count; i++) {
+        if (s->funcs[i] == func) return;
+    }
+    if (s->count == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 8;
+        s->funcs = realloc(s->funcs, s->cap * sizeof(InterpreterFunction*));
+    }
+    s->funcs[s->count++] = func;
+}
+
+static int jit_scan(JitScan *s, ASTNode *node);
+
+static int jit_scan_list(JitScan *s, ASTNodeList *list) {
+    for (; list; list = list->next) {
+        if (!jit_scan(s, list->node)) return 0;
+    }
+    return 1;
+}
+
+// 1 if compiled code behaves like the interpreter here: no globals, classes,
+// closures or function values, and no builtins that take interpreted functions
+static int jit_scan(JitScan *s, ASTNode *node) {
+    if (!node) return 1;
+    switch (node->type) {
+        case NODE_INT_LITERAL:
+        case NODE_FLOAT_LITERAL:
+        case NODE_STRING_LITERAL:
+        case NODE_BOOL_LITERAL:
+        case NODE_NULL_LITERAL:
+        case NODE_BREAK:
+        case NODE_CONTINUE:
+            return 1;
+        case NODE_IDENTIFIER:
+            return jit_is_local(s, node->data.identifier.name);
+        case NODE_BINARY_OP:
+            return jit_scan(s, node->data.binary_op.left) && jit_scan(s, node->data.binary_op.right);
+        case NODE_UNARY_OP:
+            return jit_scan(s, node->data.unary_op.operand);
+        case NODE_VAR_DECL:
+            if (!jit_scan(s, node->data.var_decl.value)) return 0;
+            jit_add_local(s, node->data.var_decl.name);
+            return 1;
+        case NODE_MULTI_VAR_DECL:
+            return jit_scan_list(s, node->data.multi_var_decl.declarations);
+        case NODE_ASSIGNMENT:
+            return jit_scan(s, node->data.assignment.target) && jit_scan(s, node->data.assignment.value);
+        case NODE_FUNC_CALL: {
+            static const char *blocked[] = {
+                "spawn", "join", "map", "filter", "reduce", "pmap", "pfilter", "preduce", NULL
+            };
+            char *name = node->data.func_call.name;
+            for (int i = 0; blocked[i]; i++) {
+                if (strcmp(name, blocked[i]) == 0) return 0;
+            }
+            if (jit_is_local(s, name)) return 0;
+            if (env_exists(root_env, name)) {
+                Value v = env_get(root_env, name);
+                if (v.type != TYPE_FUNC) return 0;
+                jit_add_func(s, (InterpreterFunction*)v.data);
+            }
+            return jit_scan_list(s, node->data.func_call.arguments);
+        }
+        case NODE_RETURN:
+            return jit_scan(s, node->data.return_stmt.value);
+        case NODE_IF_STMT:
+            return jit_scan(s, node->data.if_stmt.condition) &&
+                   jit_scan_list(s, node->data.if_stmt.then_block) &&
+                   jit_scan_list(s, node->data.if_stmt.else_block);
+        case NODE_WHILE_STMT:
+            return jit_scan(s, node->data.while_stmt.condition) &&
+                   jit_scan_list(s, node->data.while_stmt.body);
+        case NODE_FOR_STMT:
+            if (node->data.for_stmt.is_parallel) return 0;
+            if (!jit_scan(s, node->data.for_stmt.start) || !jit_scan(s, node->data.for_stmt.end)) return 0;
+            jit_add_local(s, node->data.for_stmt.index_var);
+            return jit_scan_list(s, node->data.for_stmt.body);
+        case NODE_FOREACH_STMT:
+            if (!jit_scan(s, node->data.foreach_stmt.collection)) return 0;
+            jit_add_local(s, node->data.foreach_stmt.key_var);
+            jit_add_local(s, node->data.foreach_stmt.value_var);
+            return jit_scan_list(s, node->data.foreach_stmt.body);
+        case NODE_ARRAY_LITERAL:
+            return jit_scan_list(s, node->data.array_literal.elements);
+        case NODE_DICT_LITERAL:
+            return jit_scan_list(s, node->data.dict_literal.pairs);
+        case NODE_DICT_PAIR:
+            return jit_scan(s, node->data.dict_pair.key) && jit_scan(s, node->data.dict_pair.value);
+        case NODE_INDEX_ACCESS:
+            return jit_scan(s, node->data.index_access.object) && jit_scan(s, node->data.index_access.index);
+        case NODE_SLICE_ACCESS:
+            return jit_scan(s, node->data.slice_access.object) &&
+                   jit_scan(s, node->data.slice_access.start) &&
+                   jit_scan(s, node->data.slice_access.end);
+        case NODE_TRY_CATCH:
+            if (!jit_scan_list(s, node->data.try_catch.try_block)) return 0;
+            if (node->data.try_catch.catch_var) jit_add_local(s, node->data.try_catch.catch_var);
+            return jit_scan_list(s, node->data.try_catch.catch_block);
+        case NODE_RAISE:
+            return jit_scan(s, node->data.raise_stmt.expr);
+        case NODE_ASSERT:
+            return jit_scan(s, node->data.assert_stmt.expr) && jit_scan(s, node->data.assert_stmt.msg);
+        default:
+            return 0;
+    }
+}
+
+// Check func and (transitively) its callees, then hand them to jit_submit
+static void jit_compile(InterpreterFunction *func) {
+    JitScan s = {0};
+    jit_add_func(&s, func);
+    int ok = 1;
+    for (int i = 0; ok && i < s.count; i++) {
+        InterpreterFunction *f = s.funcs[i];
+        if (!f->def || f->env != root_env) {
+            ok = 0;
+            break;
+        }
+        s.local_count = 0;
+        for (ASTNodeList *p = f->params; p; p = p->next) {
+            jit_add_local(&s, p->node->data.identifier.name);
+        }
+        ok = jit_scan_list(&s, f->body);
+    }
+
+    if (!ok) {
+        __atomic_store_n(&func->jit_state, JIT_FAILED, __ATOMIC_RELEASE);
+    } else {
+        __atomic_store_n(&func->jit_state, JIT_QUEUED, __ATOMIC_RELEASE);
+        if (!jit_submit(s.funcs, s.count, jit_wait)) {
+            // Another compilation is running: try again after another round
+            __atomic_store_n(&func->jit_state, JIT_NONE, __ATOMIC_RELEASE);
+            func->hotness = 0;
+        }
+    }
+    free(s.funcs);
+    free(s.locals);
+}
+
+static void jit_tick(InterpreterFunction *func) {
+    if (global_env != root_env) return;  // Counted on the main thread only
+    if (++func->hotness < jit_threshold) return;
+    if (__atomic_load_n(&func->jit_state, __ATOMIC_ACQUIRE) != JIT_NONE) return;
+    jit_compile(func);
+}
+
+static inline void jit_back_edge(void) {
+    if (jit_threshold > 0 && jit_func) jit_tick(jit_func);
+}
+
+// Run compiled code. A raise in it (or in a runtime function it calls) is
+// caught here and continues as an interpreter exception.
+static Value jit_call(FuncRef *native, Value *args, int arg_count) {
+    void *buf = __try_push_buf();
+    if (setjmp(*(jmp_buf*)buf) == 0) {
+        Value result = native->call(args, arg_count);
+        __try_pop();
+        return result;
+    }
+    __try_pop();
+    Value exc = __get_exception();
+    throw_message(exc.type == TYPE_STRING ? (char*)exc.data : "exception");
+    return make_null();
+}
+
+// ============================================================================
+// Generators
+// ============================================================================
+
+static void visit_environment(RootVisitor *v, Environment *env) {
+    for (; env; env = env->parent) {
+        for (int i = 0; i < HASH_SIZE; i++) {
+            for (EnvEntry *e = env->buckets[i]; e != NULL; e = e->next) {
+                v->mark(v, e->value);
+            }
+        }
+    }
+}
+
+static void save_eval_state(EvalState *st) {
+    st->env = current_env;
+    st->break_jmp = break_jmp;
+    st->continue_jmp = continue_jmp;
+    st->jit_func = jit_func;
+}
+
+static void load_eval_state(EvalState *st) {
+    current_env = st->env;
+    break_jmp = st->break_jmp;
+    continue_jmp = st->continue_jmp;
+    jit_func = st->jit_func;
+}
+
+// Switch from the consumer to the body: called on the body's stack when it
+// starts and whenever it is resumed
+static void interp_gen_enter(InterpGen *ig) {
+    save_eval_state(&ig->consumer);
+    if (loop_env_top + ig->loop_count > 256 || exception_top + ig->handler_count > 256) {
+        runtime_error("Generator '%s' resumed inside too many loops or try blocks", ig->func->name);
+    }
+    ig->loop_base = loop_env_top;
+    memcpy(&loop_env_stack[loop_env_top], ig->loops, ig->loop_count * sizeof(Environment*));
+    loop_env_top += ig->loop_count;
+    ig->handler_base = exception_top;
+    memcpy(&exception_stack[exception_top], ig->handlers, ig->handler_count * sizeof(jmp_buf));
+    exception_top += ig->handler_count;
+    load_eval_state(&ig->body);
+    ig->running = 1;
+    ig->outer = running_gens;
+    running_gens = ig;
+    prof_push(NULL, ig->func->name);
+}
+
+// And back, at a yield (suspend) or when the body has finished
+static void interp_gen_leave(InterpGen *ig, int suspend) {
+    prof_pop();
+    if (suspend) {
+        save_eval_state(&ig->body);
+        ig->loop_count = loop_env_top - ig->loop_base;
+        if (ig->loop_count > ig->loop_cap) {
+            ig->loop_cap = ig->loop_count;
+            ig->loops = realloc(ig->loops, ig->loop_cap * sizeof(Environment*));
+        }
+        memcpy(ig->loops, &loop_env_stack[ig->loop_base], ig->loop_count * sizeof(Environment*));
+        ig->handler_count = exception_top - ig->handler_base;
+        if (ig->handler_count > ig->handler_cap) {
+            ig->handler_cap = ig->handler_count;
+            ig->handlers = realloc(ig->handlers, ig->handler_cap * sizeof(jmp_buf));
+        }
+        memcpy(ig->handlers, &exception_stack[ig->handler_base], ig->handler_count * sizeof(jmp_buf));
+    }
+    loop_env_top = ig->loop_base;
+    exception_top = ig->handler_base;
+    load_eval_state(&ig->consumer);
+    ig->running = 0;
+    running_gens = ig->outer;
+}
+
+static void interp_gen_body(Value *args, void *ctx) {
+    (void)args;
+    InterpGen *ig = (InterpGen*)ctx;
+    interp_gen_enter(ig);
+    int saved_this_top = this_stack_top;
+    int saved_prof_depth = prof_depth;
+    volatile int failed = 0;
+
+    // Same two handlers as try/catch: a raise leaves the body as a runtime
+    // exception, which the generator raises again in the consumer
+    void *runtime_buf = __try_push_buf();
+    if (setjmp(exception_stack[exception_top++]) == 0) {
+        if (setjmp(*(jmp_buf*)runtime_buf) == 0) {
+            has_returned = 0;
+            execute_block(ig->func->body);
+        } else {
+            failed = 1;
+            exception_value = __get_exception();
+        }
+    } else {
+        failed = 1;
+    }
+    __try_pop();
+    this_stack_top = saved_this_top;
+    prof_depth = saved_prof_depth;
+    has_returned = 0;  // A return only ends the body
+    interp_gen_leave(ig, 0);
+
+    if (failed) {
+        Value msg = exception_value.type == TYPE_STRING ? exception_value : to_string(exception_value);
+        __raise_message((char*)msg.data);
+    }
+}
+
+static void eval_yield(ASTNode *node) {
+    set_error_ctx(node->line, node->file);
+
+    Value v = eval_expression(node->data.yield_stmt.value);
+    InterpGen *ig = running_gens;  // Calls made by the body have returned
+    interp_gen_leave(ig, 1);
+    gen_yield(v);
+    interp_gen_enter(ig);
+}
+
+static void interp_gen_roots(void *ctx, RootVisitor *v) {
+    InterpGen *ig = (InterpGen*)ctx;
+    if (ig->running) return;  // Its state is the thread's
+    visit_environment(v, ig->body.env);
+    for (int i = 0; i < ig->loop_count; i++) {
+        visit_environment(v, ig->loops[i]);
+    }
+}
+
+static void interp_gen_free(void *ctx) {
+    InterpGen *ig = (InterpGen*)ctx;
+    free(ig->loops);
+    free(ig->handlers);
+    free(ig);
+}
+
+// The parameters are bound right away, in the environment the body will
+// run in
+static Value make_interp_generator(InterpreterFunction *func, Value *args, int arg_count) {
+    InterpGen *ig = calloc(1, sizeof(InterpGen));
+    ig->func = func;
+    ig->body.env = create_environment(func->env == root_env ? global_env : func->env);
+    ig->body.jit_func = func;
+    ASTNodeList *param = func->params;
+    for (int i = 0; i < arg_count; i++) {
+        env_define(ig->body.env, param->node->data.identifier.name, args[i]);
+        param = param->next;
+    }
+    return make_generator(interp_gen_body, ig, NULL, 0, interp_gen_roots, interp_gen_free);
+}
+
 static Value call_function(InterpreterFunction *func, Value *args, int arg_count) {
     // Count expected parameters
     int param_count = 0;
@@ -638,8 +1503,24 @@ static Value call_function(InterpreterFunction *func, Value *args, int arg_count
                      func->name, param_count, arg_count);
     }
 
-    // Create new environment for function
-    Environment *func_env = create_environment(func->env);
+    if (func->def && func->def->data.func_def.is_generator) {
+        return make_interp_generator(func, args, arg_count);
+    }
+
+    if (jit_threshold > 0) {
+        FuncRef *native = __atomic_load_n(&func->native, __ATOMIC_ACQUIRE);
+        int native_args = native != NULL;
+        for (int i = 0; native_args && i < arg_count; i++) {
+            // Interpreted functions and classes have no compiled counterpart
+            if (args[i].type == TYPE_FUNC || args[i].type == TYPE_CLASS) native_args = 0;
+        }
+        if (native_args) return jit_call(native, args, arg_count);
+        jit_tick(func);
+    }
+
+    // Create new environment for function (inside a task, top-level
+    // functions resolve globals through the task's snapshot)
+    Environment *func_env = create_environment(func->env == root_env ? global_env : func->env);
     Environment *saved_env = current_env;
     current_env = func_env;
 
@@ -651,8 +1532,16 @@ static Value call_function(InterpreterFunction *func, Value *args, int arg_count
     }
 
     // Execute function body
+    RT_STAT_INC(calls);
+    TINY_PROBE3(call_entry, func->name, err_file, err_line);
+    prof_push(NULL, func->name);
+    InterpreterFunction *saved_jit_func = jit_func;
+    jit_func = func;
     has_returned = 0;
     execute_block(func->body);
+    jit_func = saved_jit_func;
+    prof_pop();
+    TINY_PROBE1(call_return, func->name);
 
     Value result = has_returned ? return_value : make_null();
     has_returned = 0;
@@ -678,7 +1567,7 @@ static Value eval_method_call(ASTNode *node) {
 
     Value *args = NULL;
     if (arg_count > 0) {
-        args = gc_alloc(TYPE_ARRAY, arg_count * sizeof(Value));
+        args = gc_alloc(GC_TYPE_BUFFER, arg_count * sizeof(Value));
         arg_node = node->data.method_call.arguments;
         for (int i = 0; i < arg_count; i++) {
             args[i] = eval_expression(arg_node->node);
@@ -686,6 +1575,7 @@ static Value eval_method_call(ASTNode *node) {
         }
     }
 
+    set_error_ctx(node->line, node->file);  // Arguments may have moved it
     return call_method_internal(obj, method_name, args, arg_count);
 }
 
@@ -707,7 +1597,8 @@ static Value call_method_internal(Value instance_val, const char *method_name, V
                 func.name = method->node->data.func_def.name;
                 func.params = method->node->data.func_def.params;
                 func.body = method->node->data.func_def.body;
-                func.env = cls->env;
+                func.env = cls->env == root_env ? global_env : cls->env;
+                func.def = NULL;
 
                 // Push 'this' context
                 this_stack[this_stack_top++] = inst;
@@ -734,8 +1625,16 @@ static Value call_method_internal(Value instance_val, const char *method_name, V
                 }
 
                 // Execute method
+                RT_STAT_INC(calls);
+                TINY_PROBE3(call_entry, method_name, err_file, err_line);
+                prof_push(cls->name, method_name);
+                InterpreterFunction *saved_jit_func = jit_func;
+                jit_func = NULL;  // Methods are not compiled
                 has_returned = 0;
                 execute_block(func.body);
+                jit_func = saved_jit_func;
+                prof_pop();
+                TINY_PROBE1(call_return, method_name);
 
                 Value result = has_returned ? return_value : make_null();
                 has_returned = 0;
@@ -801,7 +1700,7 @@ static Value eval_new_expr(ASTNode *node) {
 
     Value *args = NULL;
     if (arg_count > 0) {
-        args = gc_alloc(TYPE_ARRAY, arg_count * sizeof(Value));
+        args = gc_alloc(GC_TYPE_BUFFER, arg_count * sizeof(Value));
         arg_node = node->data.new_expr.arguments;
         for (int i = 0; i < arg_count; i++) {
             args[i] = eval_expression(arg_node->node);
@@ -814,6 +1713,7 @@ static Value eval_new_expr(ASTNode *node) {
     while (method) {
         if (method->node->type == NODE_FUNC_DEF) {
             if (strcmp(method->node->data.func_def.name, "init") == 0) {
+                set_error_ctx(node->line, node->file);
                 call_method_internal(instance_val, "init", args, arg_count);
                 break;
             }
@@ -903,7 +1803,12 @@ static void eval_assignment(ASTNode *node) {
     else if (target->type == NODE_INDEX_ACCESS) {
         // Array/dict element assignment
         Value obj = eval_expression(target->data.index_access.object);
-        Value index = eval_expression(target->data.index_access.index);
+        ASTNode *key = target->data.index_access.index;
+        if (key->type == NODE_STRING_LITERAL) {
+            dict_set_h(obj, key->data.string_literal.value, key->data.string_literal.hash, val);
+            return;
+        }
+        Value index = eval_expression(key);
         index_set(obj, index, val);
     }
     else if (target->type == NODE_MEMBER_ACCESS) {
@@ -913,8 +1818,7 @@ static void eval_assignment(ASTNode *node) {
             runtime_error("Member assignment requires an instance");
         }
         Instance *inst = (Instance*)obj.data;
-        Value field_name = {TYPE_STRING, (long)target->data.member_access.member};
-        index_set(inst->fields, field_name, val);
+        dict_set_h(inst->fields, target->data.member_access.member, target->data.member_access.hash, val);
     }
     else {
         runtime_error("Invalid assignment target");
@@ -946,26 +1850,34 @@ static void eval_if_stmt(ASTNode *node) {
 static void eval_while_stmt(ASTNode *node) {
     set_error_ctx(node->line, node->file);
 
+    Environment *saved_env = current_env;
     loop_env_stack[loop_env_top++] = current_env;
+    jmp_buf on_break, on_continue;
+    jmp_buf *saved_break = break_jmp, *saved_continue = continue_jmp;
+    break_jmp = &on_break;
+    continue_jmp = &on_continue;
 
-    if (setjmp(break_jmp) == 0) {
+    if (setjmp(on_break) == 0) {
         while (1) {
             Value cond = eval_expression(node->data.while_stmt.condition);
             if (!is_truthy(cond)) break;
 
             // Create new scope for each iteration
-            Environment *iter_env = create_environment(current_env);
-            Environment *saved_env = current_env;
-            current_env = iter_env;
+            current_env = create_environment(saved_env);
 
-            if (setjmp(continue_jmp) == 0) {
+            if (setjmp(on_continue) == 0) {
                 execute_block(node->data.while_stmt.body);
             }
 
             current_env = saved_env;
+            if (has_returned) break;
+            jit_back_edge();
         }
     }
 
+    current_env = saved_env;
+    break_jmp = saved_break;
+    continue_jmp = saved_continue;
     loop_env_top--;
 }
 
@@ -988,30 +1900,40 @@ static void eval_for_stmt(ASTNode *node) {
     Environment *saved_env = current_env;
     current_env = loop_env;
     loop_env_stack[loop_env_top++] = loop_env;
+    jmp_buf on_break, on_continue;
+    jmp_buf *saved_break = break_jmp, *saved_continue = continue_jmp;
+    break_jmp = &on_break;
+    continue_jmp = &on_continue;
 
     // Define the loop variable once
     env_define(loop_env, var_name, (Value){TYPE_INT, start_val});
 
-    if (setjmp(break_jmp) == 0) {
+    if (setjmp(on_break) == 0) {
         if (start_val <= end_val) {
             for (long i = start_val; i <= end_val; i++) {
                 env_set(loop_env, var_name, (Value){TYPE_INT, i});
 
-                if (setjmp(continue_jmp) == 0) {
+                if (setjmp(on_continue) == 0) {
                     execute_block(node->data.for_stmt.body);
                 }
+                if (has_returned) break;
+                jit_back_edge();
             }
         } else {
             for (long i = start_val; i >= end_val; i--) {
                 env_set(loop_env, var_name, (Value){TYPE_INT, i});
 
-                if (setjmp(continue_jmp) == 0) {
+                if (setjmp(on_continue) == 0) {
                     execute_block(node->data.for_stmt.body);
                 }
+                if (has_returned) break;
+                jit_back_edge();
             }
         }
     }
 
+    break_jmp = saved_break;
+    continue_jmp = saved_continue;
     loop_env_top--;
     current_env = saved_env;
 }
@@ -1028,60 +1950,54 @@ static void eval_foreach_stmt(ASTNode *node) {
     Environment *saved_env = current_env;
     current_env = loop_env;
     loop_env_stack[loop_env_top++] = loop_env;
+    jmp_buf on_break, on_continue;
+    jmp_buf *saved_break = break_jmp, *saved_continue = continue_jmp;
+    break_jmp = &on_break;
+    continue_jmp = &on_continue;
 
     // Define loop variables once
     env_define(loop_env, key_var, make_null());
     env_define(loop_env, value_var, make_null());
 
-    if (collection.type == TYPE_ARRAY) {
-        Array *arr = (Array*)collection.data;
-        Value *elements = (Value*)arr->data;
+    if (collection.type != TYPE_ARRAY && collection.type != TYPE_DICT &&
+        collection.type != TYPE_STRING && collection.type != TYPE_ITERATOR) {
+        runtime_error("foreach requires an array, dict, string or iterator");
+    }
 
-        if (setjmp(break_jmp) == 0) {
-            for (int i = 0; i < arr->size; i++) {
-                env_set(loop_env, key_var, (Value){TYPE_INT, i});
-                env_set(loop_env, value_var, elements[i]);
+    // The runtime's walk (shared with compiled code) copes with the body
+    // appending to the array or removing dict entries
+    IterState st;
+    iter_begin(collection, &st);
+    if (setjmp(on_break) == 0) {
+        Value key, item;
+        while (iter_next(&st, &key, &item)) {
+            env_set(loop_env, key_var, key);
+            env_set(loop_env, value_var, item);
 
-                if (setjmp(continue_jmp) == 0) {
-                    execute_block(node->data.foreach_stmt.body);
-                }
+            if (setjmp(on_continue) == 0) {
+                execute_block(node->data.foreach_stmt.body);
             }
+            if (has_returned) break;
+            jit_back_edge();
         }
-    } else if (collection.type == TYPE_DICT) {
-        Dict *dict = (Dict*)collection.data;
-
-        if (setjmp(break_jmp) == 0) {
-            for (int i = 0; i < HASH_SIZE; i++) {
-                DictEntry *entry = dict->buckets[i];
-                while (entry) {
-                    Value key_val = {TYPE_STRING, (long)entry->key};
-                    env_set(loop_env, key_var, key_val);
-                    env_set(loop_env, value_var, entry->value);
-
-                    if (setjmp(continue_jmp) == 0) {
-                        execute_block(node->data.foreach_stmt.body);
-                    }
-
-                    entry = entry->next;
-                }
-            }
-        }
-    } else {
-        runtime_error("foreach requires an array or dict");
     }
 
+    break_jmp = saved_break;
+    continue_jmp = saved_continue;
     loop_env_top--;
     current_env = saved_env;
 }
 
 static void eval_break(ASTNode *node) {
     set_error_ctx(node->line, node->file);
-    longjmp(break_jmp, 1);
+    if (!break_jmp) runtime_error("break outside a loop");
+    longjmp(*break_jmp, 1);
 }
 
 static void eval_continue(ASTNode *node) {
     set_error_ctx(node->line, node->file);
-    longjmp(continue_jmp, 1);
+    if (!continue_jmp) runtime_error("continue outside a loop");
+    longjmp(*continue_jmp, 1);
 }
 
 static void eval_return(ASTNode *node) {
@@ -1101,6 +2017,10 @@ static void eval_func_def(ASTNode *node) {
     func->params = node->data.func_def.params;
     func->body = node->data.func_def.body;
     func->env = current_env;
+    func->def = node;
+    func->hotness = 0;
+    func->jit_state = JIT_NONE;
+    func->native = NULL;
 
     Value func_val = {TYPE_FUNC, (long)func};
     env_define(current_env, func->name, func_val);
@@ -1150,6 +2070,10 @@ static void eval_try_catch(ASTNode *node) {
     void *runtime_buf = __try_push_buf();  // Register handler in runtime's try_stack
     int caught_exception = 0;  // 0 = no exception, 1 = interpreter, 2 = runtime
     Environment *saved_env = current_env;  // Save env (longjmp doesn't restore locals)
+    int saved_prof_depth = prof_depth;     // Frames unwound by longjmp
+    InterpreterFunction *saved_jit_func = jit_func;
+    jmp_buf *saved_break = break_jmp, *saved_continue = continue_jmp;  // Loops unwound
+    int saved_loop_top = loop_env_top;
 
     // Nested setjmp: outer catches interpreter exceptions, inner catches runtime exceptions
     if (setjmp(exception_stack[exception_top++]) == 0) {
@@ -1175,6 +2099,11 @@ static void eval_try_catch(ASTNode *node) {
 
     // Restore environment (longjmp may have left it in inconsistent state)
     current_env = saved_env;
+    prof_depth = saved_prof_depth;
+    jit_func = saved_jit_func;
+    break_jmp = saved_break;
+    continue_jmp = saved_continue;
+    loop_env_top = saved_loop_top;
 
     // If exception was caught, execute catch block
     if (caught_exception) {
@@ -1234,18 +2163,10 @@ static void eval_raise(ASTNode *node) {
     }
 
     snprintf(buf, sizeof(buf), "%s:%d: %s", node->file, node->line, msg_str);
-    char *full = gc_alloc(TYPE_STRING, strlen(buf) + 1);
-    strcpy(full, buf);
-    exception_value = (Value){TYPE_STRING, (long)full};
+    TINY_PROBE3(raise, msg_str, node->line, node->file);
 
     // Throw exception on interpreter's exception_stack
-    if (exception_top > 0) {
-        longjmp(exception_stack[exception_top - 1], 1);
-    } else {
-        // No try-catch handler - unhandled exception
-        printf("Uncaught exception: %s\n", full);
-        exit(1);
-    }
+    throw_message(buf);
 }
 
 static void eval_assert(ASTNode *node) {
@@ -1331,6 +2252,10 @@ static void eval_statement(ASTNode *node) {
             eval_return(node);
             break;
 
+        case NODE_YIELD:
+            eval_yield(node);
+            break;
+
         case NODE_FUNC_DEF:
             eval_func_def(node);
             break;
@@ -1396,8 +2321,13 @@ void interpret(ASTNode *root) {
 
     // Create global environment
     global_env = create_environment(NULL);
+    root_env = global_env;
     current_env = global_env;
 
+    if (prof_path) {
+        prof_start();
+    }
+
     // Execute program statements
     ASTNodeList *stmt = root->data.program.statements;
     while (stmt) {
@@ -1409,6 +2339,7 @@ void interpret(ASTNode *root) {
 // Initialize interpreter for interactive mode (call once at startup)
 void interpret_init(void) {
     global_env = create_environment(NULL);
+    root_env = global_env;
     current_env = global_env;
     is_interactive_mode = 1;  // Enable interactive mode error handling
 }
@@ -1438,6 +2369,11 @@ void interpret_interactive(ASTNode *root) {
     }
 }
 
+// Sample the program run by interpret() and write a folded profile to path
+void interpret_enable_profile(const char *path) {
+    prof_path = path;
+}
+
 // Get pointer to interactive error jmpbuf for setjmp in main
 void* get_interactive_error_jmpbuf(void) {
     return &interactive_error_jmp;
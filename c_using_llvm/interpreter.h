@@ -16,6 +16,10 @@ typedef struct InterpreterFunction {
     ASTNodeList *params;
     ASTNodeList *body;
     struct Environment *env;  // Closure environment
+    ASTNode *def;             // NODE_FUNC_DEF (NULL for methods), for the JIT
+    long hotness;             // Calls + loop back-edges, counted under --jit
+    int jit_state;            // JIT_* (jit.h)
+    struct FuncRef *native;   // Compiled code once jit_state is JIT_READY
 } InterpreterFunction;
 
 // ClassValue represents a class definition
@@ -57,5 +61,7 @@ void interpret(ASTNode *root);
 void interpret_init(void);
 void interpret_interactive(ASTNode *root);
 void* get_interactive_error_jmpbuf(void);  // Get setjmp buffer for interactive mode error handling
+void interpret_enable_profile(const char *path);  // Write a folded-stack CPU profile of interpret() to path
+void interpret_enable_jit(long threshold, int wait);  // Compile functions hotter than threshold to native code
 
 #endif /* INTERPRETER_H */
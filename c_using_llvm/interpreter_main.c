@@ -7,6 +7,7 @@
 #include <readline/history.h>
 #include "ast.h"
 #include "interpreter.h"
+#include "jit.h"
 #include "core/preprocess.h"
 #include "gc.h"
 #include "runtime.h"
@@ -43,11 +44,13 @@ void run_batch_mode(const char *filename) {
 
     yylineno = 1;
     YY_BUFFER_STATE buf = yy_scan_string(res.combined_source);
-    if (yyparse() == 0 && root != NULL) {
+    int parsed = yyparse() == 0 && root != NULL;
+    if (parsed) {
         interpret(root);
     }
     yy_delete_buffer(buf);
     free_preprocess_result(&res);
+    if (!parsed) exit(1);
 }
 
 void run_interactive_mode() {
@@ -199,17 +202,40 @@ int main(int argc, char **argv) {
     int stack_anchor;
     gc_set_stack_bottom(&stack_anchor);
 
-    if (argc < 2) {
+    // Interpreter options come before the script path
+    int argi = 1;
+    long jit_threshold = 0;
+    int jit_sync = 0;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strncmp(argv[argi], "--profile=", 10) == 0 && argv[argi][10] != '\0') {
+            interpret_enable_profile(argv[argi] + 10);
+        } else if (strcmp(argv[argi], "--jit") == 0) {
+            jit_threshold = JIT_DEFAULT_THRESHOLD;
+        } else if (strncmp(argv[argi], "--jit=", 6) == 0 && atol(argv[argi] + 6) > 0) {
+            jit_threshold = atol(argv[argi] + 6);
+        } else if (strcmp(argv[argi], "--jit-sync") == 0) {
+            jit_sync = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[argi]);
+            fprintf(stderr, "Usage: %s [--profile=out.folded] [--jit[=N]] [--jit-sync] [program.tl [args...]]\n", argv[0]);
+            return 1;
+        }
+        argi++;
+    }
+    if (jit_sync && jit_threshold == 0) jit_threshold = JIT_DEFAULT_THRESHOLD;
+    if (jit_threshold > 0) interpret_enable_jit(jit_threshold, jit_sync);
+
+    if (argi >= argc) {
         // No file provided - run in interactive mode
         // In interactive mode, pass all args (though there are none)
-        set_cmd_args(argc - 1, argv + 1);
+        set_cmd_args(0, argv + argc);
         run_interactive_mode();
     } else {
         // File provided - run in batch mode
-        // Skip executable (argv[0]) and script file (argv[1])
-        // Only pass the script arguments (argv[2] onwards)
-        set_cmd_args(argc - 2, argv + 2);
-        run_batch_mode(argv[1]);
+        // Skip executable, options and script file
+        // Only pass the script arguments (the ones after the script file)
+        set_cmd_args(argc - argi - 1, argv + argi + 1);
+        run_batch_mode(argv[argi]);
     }
 
     return 0;
@@ -0,0 +1,144 @@
+#include "jit.h"
+#include "codegen_llvm.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+typedef struct {
+    InterpreterFunction **funcs;
+    int count;
+} JitJob;
+
+// One compilation at a time; its files and compiler process group are
+// recorded so an exit in the middle does not leave them behind
+static int jit_busy = 0;
+static int jit_jobs = 0;
+static volatile pid_t jit_child = 0;
+static char jit_ll_path[64];
+static char jit_so_path[64];
+
+static void jit_cleanup(void) {
+    pid_t child = jit_child;
+    if (child > 0) {
+        kill(-child, SIGKILL);
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+    }
+    if (__atomic_load_n(&jit_busy, __ATOMIC_ACQUIRE)) {
+        unlink(jit_ll_path);
+        unlink(jit_so_path);
+    }
+}
+
+// Registered last in the child, so it runs before (and instead of) the
+// interpreter's own exit handlers (profile, GC trace)
+static void jit_child_exit(void) {
+    _exit(1);
+}
+
+// Child process: write the module and exec clang. codegen_llvm reports
+// unsupported code by exiting, which here only fails this compilation.
+static void jit_build(JitJob *job, const char *ll_path, const char *so_path) {
+    atexit(jit_child_exit);
+    setpgid(0, 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) {
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+    }
+
+    ASTNodeList *defs = NULL;
+    for (int i = 0; i < job->count; i++) {
+        defs = append_node_list(defs, job->funcs[i]->def);
+    }
+    FILE *out = fopen(ll_path, "w");
+    if (!out) _exit(1);
+    LLVMCodeGen gen;
+    llvm_codegen_init(&gen, out);
+    gen.jit = 1;
+    llvm_codegen_program(&gen, create_program(defs));
+    if (fclose(out) != 0) _exit(1);
+
+    // -Bsymbolic: calls between the module's functions stay inside it even
+    // when the executable exports a symbol of the same name
+    execlp("clang", "clang", "-O2", "-shared", "-fPIC", "-Wno-override-module",
+           "-Wl,-Bsymbolic", ll_path, "-o", so_path, (char*)NULL);
+    _exit(127);
+}
+
+static void *jit_main(void *arg) {
+    JitJob *job = arg;
+    InterpreterFunction *hot = job->funcs[0];
+    const char *ll_path = jit_ll_path;
+    const char *so_path = jit_so_path;
+
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        jit_build(job, ll_path, so_path);
+    } else if (pid > 0) {
+        jit_child = pid;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+        }
+        jit_child = 0;
+    }
+    unlink(ll_path);
+
+    void *lib = NULL;
+    if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        lib = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    }
+    unlink(so_path);
+
+    int ok = lib != NULL;
+    FuncRef *natives[job->count];
+    for (int i = 0; ok && i < job->count; i++) {
+        char sym[256];
+        snprintf(sym, sizeof(sym), "__fn_%s", job->funcs[i]->name);
+        natives[i] = dlsym(lib, sym);
+        if (!natives[i]) ok = 0;
+    }
+    if (!ok) {
+        // The library (if any) stays loaded: nothing in it is referenced
+        __atomic_store_n(&hot->jit_state, JIT_FAILED, __ATOMIC_RELEASE);
+    } else {
+        for (int i = 0; i < job->count; i++) {
+            InterpreterFunction *f = job->funcs[i];
+            if (__atomic_load_n(&f->jit_state, __ATOMIC_ACQUIRE) == JIT_READY) continue;
+            __atomic_store_n(&f->native, natives[i], __ATOMIC_RELEASE);
+            __atomic_store_n(&f->jit_state, JIT_READY, __ATOMIC_RELEASE);
+        }
+    }
+    free(job->funcs);
+    free(job);
+    __atomic_store_n(&jit_busy, 0, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+int jit_submit(InterpreterFunction **funcs, int count, int wait) {
+    if (__atomic_exchange_n(&jit_busy, 1, __ATOMIC_ACQ_REL)) return 0;
+    if (jit_jobs++ == 0) atexit(jit_cleanup);
+    snprintf(jit_ll_path, sizeof(jit_ll_path), "/tmp/tiny_jit_%d_%d.ll", (int)getpid(), jit_jobs);
+    snprintf(jit_so_path, sizeof(jit_so_path), "/tmp/tiny_jit_%d_%d.so", (int)getpid(), jit_jobs);
+
+    JitJob *job = malloc(sizeof(JitJob));
+    job->funcs = malloc(count * sizeof(InterpreterFunction*));
+    memcpy(job->funcs, funcs, count * sizeof(InterpreterFunction*));
+    job->count = count;
+
+    pthread_t th;
+    if (pthread_create(&th, NULL, jit_main, job) != 0) {
+        __atomic_store_n(&funcs[0]->jit_state, JIT_FAILED, __ATOMIC_RELEASE);
+        free(job->funcs);
+        free(job);
+        __atomic_store_n(&jit_busy, 0, __ATOMIC_RELEASE);
+        return 1;
+    }
+    if (wait) pthread_join(th, NULL);
+    else pthread_detach(th);
+    return 1;
+}
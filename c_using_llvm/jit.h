@@ -0,0 +1,37 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "interpreter.h"
+
+// Tiered execution for the interpreter (--jit).
+//
+// The interpreter counts calls and loop back-edges per top-level function.
+// When a function gets hot and only uses what compiled code can do the same
+// way (its parameters and locals, builtins, other such functions), it is
+// handed to jit_submit() together with the functions it calls. A background
+// thread lowers them with codegen_llvm.c into one module, has clang build a
+// shared object from it and loads that into the process; from then on calls
+// go to the native code (jit_state JIT_READY, native set).
+//
+// Compiled code shares the interpreter's Value layout, runtime and per-thread
+// GC heap: the shared object resolves runtime symbols against the interpreter
+// executable (linked with -rdynamic), and its frames live on the same stack
+// the conservative scan covers. Each function is reached through the
+// FuncRef (@__fn_NAME) the module exports.
+
+#define JIT_DEFAULT_THRESHOLD 1000  // --jit without =N
+
+#define JIT_NONE 0      // Interpreted, may be submitted
+#define JIT_QUEUED 1    // Being compiled
+#define JIT_FAILED 2    // Not compilable; stays interpreted
+#define JIT_READY 3     // native is set
+
+// Compile funcs[0] (the hot function) and funcs[1..count-1] (its callees) in
+// the background. funcs[0] must already be JIT_QUEUED; every function gets
+// native code on success, funcs[0] becomes JIT_FAILED on failure. Only one
+// compilation runs at a time: returns 0 without doing anything while another
+// is in progress (main thread only). With wait set it returns once the
+// functions are compiled (or failed), so the next call runs native code.
+int jit_submit(InterpreterFunction **funcs, int count, int wait);
+
+#endif /* JIT_H */
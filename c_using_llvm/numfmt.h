@@ -0,0 +1,40 @@
+#ifndef NUMFMT_H
+#define NUMFMT_H
+
+// Numbers to and from text. Formatting is shared by str(), print,
+// json_encode, str_join, str_format and the file writers; parsing by
+// int(), float() and json_decode.
+//
+// Doubles are written with the fewest significant digits that read back
+// (strtod) as the same value, found with Grisu2 (Loitsch, "Printing
+// Floating-Point Numbers Quickly and Accurately with Integers", 2010) and
+// laid out like printf "%.17g": exponent form below 1e-4 and from 1e17
+// ("1e+17", "2.5e-07"), no trailing zeros, "inf", "-inf", "nan". Grisu2
+// always round-trips; in rare cases it keeps a digit more than needed.
+// Integers are written two digits at a time from a table of digit pairs.
+
+// Buffer size that fits any formatted double or long, with the NUL
+#define NUMFMT_MAX 32
+
+// Write d/v and a NUL to buf; return the length
+int format_double(double d, char *buf);
+int format_long(long v, char *buf);
+
+// Parsing reads a decimal number the way strtod does (leading spaces, a
+// sign, digits, fraction, exponent) with the digits taken eight at a time.
+// Up to 19 significant digits are converted exactly: integers directly,
+// floats by the Clinger fast path or Eisel-Lemire (Lemire, "Number Parsing
+// at a Gigabyte per Second", 2021); longer inputs, subnormals, hex, inf
+// and nan, and the rare undecided halfway cases go to strtod.
+
+// Number at s: returns 1 (float, *dval) when it has a fraction or exponent
+// or does not fit a long, else 0 (int, *ival; *dval holds it as a double,
+// keeping the sign of "-0").
+// *end (if not NULL) is set past the number, or to s if there is none.
+int parse_number(const char *s, const char **end, long *ival, double *dval);
+// atof: the number at s as a double, 0 if none
+double parse_double(const char *s);
+// atol: the integer prefix of s, saturating at LONG_MIN/LONG_MAX
+long parse_long(const char *s);
+
+#endif // NUMFMT_H
@@ -0,0 +1,82 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT static probes (provider "tiny") for SystemTap / bpftrace, e.g.
+//
+//   bpftrace -e 'usdt:./interpreter:tiny:gc_end { @pause_us = hist(arg1 / 1000); }'
+//
+// A probe is a single nop plus an ELF note (.note.stapsdt) telling the tracer
+// where the nop is and where its arguments live; nothing else runs unless a
+// tracer attaches. <sys/sdt.h> is used when installed, otherwise the same
+// note is emitted here for x86-64 and AArch64 (arguments are passed as
+// signed 64-bit values). Build with -DTINY_NO_PROBES to compile them out.
+//
+// Probes:
+//   gc_start(objects, heap_bytes)             gc_end(objects_freed, pause_ns)
+//   gc_alloc_large(type, size)                raise(message, line, file)
+//   call_entry(name, file, line)              call_return(name)   (interpreter)
+//   func_entry(name)                          (LLVM-compiled functions)
+
+#if !defined(TINY_NO_PROBES) && (defined(__x86_64__) || defined(__aarch64__))
+// Note layout as produced by <sys/sdt.h>: nop address, base address (for
+// prelink adjustment), semaphore (none), provider, name, argument string.
+// Also used by codegen_llvm to emit func_entry as inline asm.
+#define TINY_SDT_ASM(name, args) \
+    "990: nop\n" \
+    ".pushsection .note.stapsdt,\"\",\"note\"\n" \
+    ".balign 4\n" \
+    ".4byte 992f-991f, 994f-993f, 3\n" \
+    "991: .asciz \"stapsdt\"\n" \
+    "992: .balign 4\n" \
+    "993: .8byte 990b\n" \
+    ".8byte _.stapsdt.base\n" \
+    ".8byte 0\n" \
+    ".asciz \"tiny\"\n" \
+    ".asciz \"" #name "\"\n" \
+    ".asciz \"" args "\"\n" \
+    "994: .balign 4\n" \
+    ".popsection\n" \
+    ".ifndef _.stapsdt.base\n" \
+    ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+    ".weak _.stapsdt.base\n" \
+    ".hidden _.stapsdt.base\n" \
+    "_.stapsdt.base: .space 1\n" \
+    ".size _.stapsdt.base, 1\n" \
+    ".popsection\n" \
+    ".endif\n"
+#endif
+
+#if defined(TINY_NO_PROBES)
+
+#define TINY_PROBE1(name, a1) do { } while (0)
+#define TINY_PROBE2(name, a1, a2) do { } while (0)
+#define TINY_PROBE3(name, a1, a2, a3) do { } while (0)
+
+#elif defined(__has_include) && __has_include(<sys/sdt.h>)
+
+#include <sys/sdt.h>
+#define TINY_PROBE1(name, a1) DTRACE_PROBE1(tiny, name, a1)
+#define TINY_PROBE2(name, a1, a2) DTRACE_PROBE2(tiny, name, a1, a2)
+#define TINY_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(tiny, name, a1, a2, a3)
+
+#elif defined(TINY_SDT_ASM)
+
+#define TINY_PROBE1(name, a1) \
+    __asm__ __volatile__(TINY_SDT_ASM(name, "-8@%0") \
+                         :: "nor"((long)(a1)))
+#define TINY_PROBE2(name, a1, a2) \
+    __asm__ __volatile__(TINY_SDT_ASM(name, "-8@%0 -8@%1") \
+                         :: "nor"((long)(a1)), "nor"((long)(a2)))
+#define TINY_PROBE3(name, a1, a2, a3) \
+    __asm__ __volatile__(TINY_SDT_ASM(name, "-8@%0 -8@%1 -8@%2") \
+                         :: "nor"((long)(a1)), "nor"((long)(a2)), "nor"((long)(a3)))
+
+#else
+
+#define TINY_PROBE1(name, a1) do { } while (0)
+#define TINY_PROBE2(name, a1, a2) do { } while (0)
+#define TINY_PROBE3(name, a1, a2, a3) do { } while (0)
+
+#endif
+
+#endif // PROBES_H
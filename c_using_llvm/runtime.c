@@ -1,28 +1,51 @@
 #include "runtime.h"
 #include "gc.h"
+#include "task.h"
+#include "numfmt.h"
 #include <regex.h>
 #include <math.h>
 #include <ctype.h>
 #include <setjmp.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "type_check_common.h"
+#include "probes.h"
 #include "gc.h"
 
 // Global storage for command line arguments
 static int g_argc = 0;
 static char **g_argv = NULL;
-static jmp_buf try_stack[256];
-static int try_top = 0;
-static Value current_exception = {TYPE_NULL, 0};
-static int current_err_line = 0;
-static const char *current_err_file = NULL;
+// Exception and source context are per thread (task workers, see task.c)
+static __thread jmp_buf try_stack[256];
+static __thread int try_top = 0;
+static __thread Value current_exception = {TYPE_NULL, 0};
+static __thread int current_err_line = 0;
+static __thread const char *current_err_file = NULL;
 static double value_to_double(Value v);
+static Bytes *new_bytes(long len);
+static Value slice_bytes(Bytes *b, long start, long end);
+static char *bytes_repr(Bytes *b);
 
 void set_source_ctx(int line, const char *file) {
     current_err_line = line;
     current_err_file = file;
 }
 
+// Allocation site for the GC trace; compiled code only keeps the source
+// context up to date when built with --instrument
+void gc_alloc_site(int *line, const char **file) __attribute__((weak));
+void gc_alloc_site(int *line, const char **file) {
+    *line = current_err_line;
+    *file = current_err_file;
+}
+
 static __attribute__((noreturn)) void type_error_ctx(int line, const char *file, const char *fmt, ...) {
     fprintf(stderr, "Error");
     if (file) fprintf(stderr, " at %s", file);
@@ -73,15 +96,15 @@ static __attribute__((noreturn)) void type_error(const char *fmt, ...) {
 // Structures now defined in runtime.h
 
 // Track current method call stack for privacy checks
-static Instance *this_stack[256];
-static int this_stack_top = 0;
+static __thread Instance *this_stack[256];
+static __thread int this_stack_top = 0;
 
 // Helper to create array
 static Array* new_array() {
     Array *a = gc_alloc(TYPE_ARRAY, sizeof(Array));
     a->size = 0;
     a->capacity = 8;
-    a->data = gc_alloc(TYPE_ARRAY, 8 * sizeof(Value));
+    a->data = gc_alloc(GC_TYPE_BUFFER, 8 * sizeof(Value));
     return a;
 }
 
@@ -98,6 +121,26 @@ static int is_internal_access(Instance *inst) {
     return this_stack_top > 0 && this_stack[this_stack_top - 1] == inst;
 }
 
+// Inside a parallel for body, containers outside this thread's heap are
+// shared with the other threads running the loop (see task.h): they must
+// not change shape or take references into this heap.
+static void check_shared_write(void *container, const char *what) {
+    if (!gc_owns(container) && !gc_on_stack(container)) {
+        fprintf(stderr, "Error: parallel for: cannot %s created outside the loop\n", what);
+        exit(1);
+    }
+}
+
+static void check_shared_store(void *container, Value val) {
+    if (gc_owns(container) || gc_on_stack(container)) return;
+    if ((val.type == TYPE_STRING || val.type == TYPE_ARRAY || val.type == TYPE_DICT ||
+         val.type == TYPE_INSTANCE || val.type == TYPE_BYTES) && gc_owns((void*)val.data)) {
+        fprintf(stderr, "Error: parallel for: a value created inside the loop cannot be stored "
+                "into an array from outside it\n");
+        exit(1);
+    }
+}
+
 // Create empty array
 Value make_array(void) {
     Array *a = new_array();
@@ -117,10 +160,11 @@ Value append(Value arr, Value val) {
         exit(1);
     }
     Array *a = (Array*)(arr.data);
+    if (parallel_for_depth) check_shared_write(a, "append to an array");
     if (a->size >= a->capacity) {
         // Allocate new buffer with GC
         int new_capacity = a->capacity * 2;
-        void *new_data = gc_alloc(TYPE_ARRAY, new_capacity * sizeof(Value));
+        void *new_data = gc_alloc(GC_TYPE_BUFFER, new_capacity * sizeof(Value));
         // Copy old data
         memcpy(new_data, a->data, a->size * sizeof(Value));
         // Update array (old data will be collected by GC)
@@ -160,6 +204,14 @@ Value index_get(Value obj, Value index) {
             Value result = {TYPE_STRING, (long)result_str};
             return result;
         }
+    } else if (obj.type == TYPE_BYTES) {
+        Bytes *b = (Bytes*)(obj.data);
+        long idx = index.data;
+        if (idx < 0) idx += b->len;
+        if (idx >= 0 && idx < b->len) {
+            Value result = {TYPE_INT, b->data[idx]};
+            return result;
+        }
     }
     Value result = {TYPE_INT, 0};
     return result;
@@ -169,6 +221,7 @@ Value index_get(Value obj, Value index) {
 Value array_set(Value arr, Value index, Value val) {
     Array *a = (Array*)(arr.data);
     long idx = index.data;
+    if (parallel_for_depth) check_shared_store(a, val);
     if (idx >= 0 && idx < a->size) {
         ((Value*)a->data)[idx] = val;
     }
@@ -181,8 +234,18 @@ Value index_set(Value obj, Value index, Value val) {
         return array_set(obj, index, val);
     } else if (obj.type == TYPE_DICT) {
         return dict_set(obj, index, val);
+    } else if (obj.type == TYPE_BYTES) {
+        // Slices share storage, so the byte changes in all of them
+        Bytes *b = (Bytes*)(obj.data);
+        long idx = index.data;
+        if (val.type != TYPE_INT || val.data < 0 || val.data > 255) {
+            type_error("bytes elements must be ints from 0 to 255");
+        }
+        if (idx < 0) idx += b->len;
+        if (idx >= 0 && idx < b->len) b->data[idx] = (unsigned char)val.data;
+        return val;
     } else {
-        fprintf(stderr, "Error: Can only assign to array or dict indices\n");
+        fprintf(stderr, "Error: Can only assign to array, dict or bytes indices\n");
         exit(1);
     }
 }
@@ -201,8 +264,11 @@ Value len(Value v) {
         Dict *d = (Dict*)(v.data);
         Value result = {TYPE_INT, d->size};
         return result;
+    } else if (v.type == TYPE_BYTES) {
+        Value result = {TYPE_INT, ((Bytes*)v.data)->len};
+        return result;
     }
-    type_error("len() requires array, string, or dict");
+    type_error("len() requires array, string, bytes or dict");
 }
 
 // Type conversion functions
@@ -219,7 +285,7 @@ Value to_int(Value v) {
     }
     if (v.type == TYPE_STRING) {
         char *str = (char*)v.data;
-        long val = atol(str);  // Use atol for long conversion
+        long val = parse_long(str);
         Value result = {TYPE_INT, val};
         return result;
     }
@@ -240,7 +306,7 @@ Value to_float(Value v) {
     }
     if (v.type == TYPE_STRING) {
         char *str = (char*)v.data;
-        double f = atof(str);
+        double f = parse_double(str);
         Value result = {TYPE_FLOAT, *(long*)&f};
         return result;
     }
@@ -248,16 +314,18 @@ Value to_float(Value v) {
 }
 
 Value to_string(Value v) {
-    char buf[64];
+    char buf[NUMFMT_MAX];
     if (v.type == TYPE_INT) {
-        snprintf(buf, sizeof(buf), "%ld", v.data);
-        char *s = strdup(buf);
+        int n = format_long(v.data, buf);
+        char *s = malloc(n + 1);
+        memcpy(s, buf, n + 1);
         Value result = {TYPE_STRING, (long)s};
         return result;
     } else if (v.type == TYPE_FLOAT) {
         double f = *(double*)&v.data;
-        snprintf(buf, sizeof(buf), "%g", f);
-        char *s = strdup(buf);
+        int n = format_double(f, buf);
+        char *s = malloc(n + 1);
+        memcpy(s, buf, n + 1);
         Value result = {TYPE_STRING, (long)s};
         return result;
     } else if (v.type == TYPE_STRING) {
@@ -271,8 +339,11 @@ Value to_string(Value v) {
         char *dup = strdup("null");
         Value result = {TYPE_STRING, (long)dup};
         return result;
+    } else if (v.type == TYPE_BYTES) {
+        Value result = {TYPE_STRING, (long)bytes_repr((Bytes*)v.data)};
+        return result;
     }
-    type_error("str() requires int/float/string/bool/null");
+    type_error("str() requires int/float/string/bool/null/bytes");
 }
 
 // Convert value to string representation (like str() in Python)
@@ -302,6 +373,14 @@ Value type(Value v) {
         type_name = inst && inst->cls && inst->cls->name ? inst->cls->name : "instance";
     } else if (v.type == TYPE_NULL) {
         type_name = "null";
+    } else if (v.type == TYPE_FUNCTION) {
+        type_name = "function";
+    } else if (v.type == TYPE_TASK) {
+        type_name = "task";
+    } else if (v.type == TYPE_ITERATOR) {
+        type_name = "iterator";
+    } else if (v.type == TYPE_BYTES) {
+        type_name = "bytes";
     } else {
         type_name = "unknown";
     }
@@ -310,38 +389,35 @@ Value type(Value v) {
     return result;
 }
 
+// Copy a[start:end] (negative indices count from the end, bounds are
+// clamped) into dst, whose element buffer is allocated to fit
+static void slice_array_into(Array *a, long start, long end, Array *dst) {
+    long size = a->size;
+
+    // Handle negative indices
+    if (start < 0) start += size;
+    if (end < 0) end += size;
+
+    // Clamp to bounds
+    if (start < 0) start = 0;
+    if (end > size) end = size;
+    if (start > end) start = end;
+
+    long n = end - start;
+    dst->capacity = n > 0 ? n : 1;   // append() doubles the capacity
+    dst->data = gc_alloc(GC_TYPE_BUFFER, dst->capacity * sizeof(Value));
+    memcpy(dst->data, (Value*)a->data + start, n * sizeof(Value));
+    dst->size = n;
+}
+
 // Slice array or string
 Value slice_access(Value obj, Value start_v, Value end_v) {
     long start = start_v.data;
     long end = end_v.data;
 
     if (obj.type == TYPE_ARRAY) {
-        Array *a = (Array*)(obj.data);
-        long size = a->size;
-
-        // Handle negative indices
-        if (start < 0) start += size;
-        if (end < 0) end += size;
-
-        // Clamp to bounds
-        if (start < 0) start = 0;
-        if (end > size) end = size;
-        if (start > end) start = end;
-
-        // Create new array with slice
-        Array *new_a = new_array();
-        for (long i = start; i < end; i++) {
-            Value elem = ((Value*)a->data)[i];
-            if (new_a->size >= new_a->capacity) {
-                int old_capacity = new_a->capacity;
-                new_a->capacity *= 2;
-                new_a->data = gc_realloc(new_a->data, TYPE_ARRAY,
-                                         old_capacity * sizeof(Value),
-                                         new_a->capacity * sizeof(Value));
-            }
-            ((Value*)new_a->data)[new_a->size++] = elem;
-        }
-
+        Array *new_a = gc_alloc(TYPE_ARRAY, sizeof(Array));
+        slice_array_into((Array*)(obj.data), start, end, new_a);
         Value result = {TYPE_ARRAY, (long)new_a};
         return result;
     } else if (obj.type == TYPE_STRING) {
@@ -365,12 +441,23 @@ Value slice_access(Value obj, Value start_v, Value end_v) {
 
         Value result = {TYPE_STRING, (long)new_s};
         return result;
+    } else if (obj.type == TYPE_BYTES) {
+        return slice_bytes((Bytes*)(obj.data), start, end);
     }
 
     Value result = {TYPE_STRING, (long)strdup("")};
     return result;
 }
 
+// Array slice into a header in the caller's frame (codegen_llvm's escape
+// analysis); anything else is sliced as usual
+Value slice_access_into(Value obj, Value start_v, Value end_v, Array *dst) {
+    if (obj.type != TYPE_ARRAY) return slice_access(obj, start_v, end_v);
+    slice_array_into((Array*)(obj.data), start_v.data, end_v.data, dst);
+    Value result = {TYPE_ARRAY, (long)dst};
+    return result;
+}
+
 // Read input from user
 Value input(Value prompt) {
     if (prompt.type == TYPE_STRING) {
@@ -440,11 +527,14 @@ Value file_write(Value content, Value filename) {
     if (content.type == TYPE_STRING) {
         char *s = (char*)(content.data);
         fprintf(f, "%s", s);
+    } else if (content.type == TYPE_BYTES) {
+        fwrite(((Bytes*)content.data)->data, 1, ((Bytes*)content.data)->len, f);
     } else if (content.type == TYPE_INT) {
-        fprintf(f, "%ld", content.data);
+        char buf[NUMFMT_MAX];
+        fwrite(buf, 1, format_long(content.data, buf), f);
     } else if (content.type == TYPE_FLOAT) {
-        double d = *(double*)&content.data;
-        fprintf(f, "%g", d);
+        char buf[NUMFMT_MAX];
+        fwrite(buf, 1, format_double(*(double*)&content.data, buf), f);
     }
 
     fclose(f);
@@ -465,11 +555,14 @@ Value file_append(Value content, Value filename) {
     }
     if (content.type == TYPE_STRING) {
         fprintf(f, "%s", (char*)content.data);
+    } else if (content.type == TYPE_BYTES) {
+        fwrite(((Bytes*)content.data)->data, 1, ((Bytes*)content.data)->len, f);
     } else if (content.type == TYPE_INT) {
-        fprintf(f, "%ld", content.data);
+        char buf[NUMFMT_MAX];
+        fwrite(buf, 1, format_long(content.data, buf), f);
     } else if (content.type == TYPE_FLOAT) {
-        double d = *(double*)&content.data;
-        fprintf(f, "%g", d);
+        char buf[NUMFMT_MAX];
+        fwrite(buf, 1, format_double(*(double*)&content.data, buf), f);
     }
     fclose(f);
     Value result = {TYPE_BOOL, 1};
@@ -510,104 +603,1054 @@ Value file_exist(Value filename) {
     return result;
 }
 
-// backward-compatible aliases
-Value read(Value filename) { return file_read(filename); }
-Value write(Value content, Value filename) { return file_write(content, filename); }
+// ===== Bytes =====
+// A bytes value and its data are one GC object; slices only point into it.
 
-// ===== Dict Functions =====
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_BIG_ENDIAN 1
+#else
+#define HOST_BIG_ENDIAN 0
+#endif
 
-// Hash function for dict keys
-static unsigned int hash(const char *key) {
-    unsigned int h = 0;
-    while (*key) {
-        h = h * 31 + *key++;
-    }
-    return h % HASH_SIZE;
+static Bytes *new_bytes(long len) {
+    Bytes *b = gc_alloc(TYPE_BYTES, sizeof(Bytes) + len);
+    b->data = (unsigned char*)(b + 1);
+    b->len = len;
+    b->owner = NULL;
+    return b;
 }
 
-// Create empty dict
-Value make_dict(void) {
-    Dict *d = gc_alloc(TYPE_DICT, sizeof(Dict));
-    d->buckets = gc_alloc(TYPE_DICT, HASH_SIZE * sizeof(DictEntry*));
-    d->size = 0;
+Value make_bytes(const void *data, long len) {
+    Bytes *b = new_bytes(len);
+    memcpy(b->data, data, len);
+    Value result = {TYPE_BYTES, (long)b};
+    return result;
+}
 
-    Value result = {TYPE_DICT, (long)d};
+Value to_bytes(Value v) {
+    if (v.type == TYPE_STRING) {
+        const char *s = (const char*)v.data;
+        return make_bytes(s, strlen(s));
+    } else if (v.type == TYPE_BYTES) {
+        // A copy that no longer shares storage with what it was sliced from
+        Bytes *src = (Bytes*)v.data;
+        return make_bytes(src->data, src->len);
+    } else if (v.type == TYPE_INT) {
+        if (v.data < 0) type_error("bytes() length must not be negative");
+        Bytes *b = new_bytes(v.data);
+        memset(b->data, 0, v.data);
+        Value result = {TYPE_BYTES, (long)b};
+        return result;
+    } else if (v.type == TYPE_ARRAY) {
+        Array *a = (Array*)v.data;
+        Bytes *b = new_bytes(a->size);
+        for (int i = 0; i < a->size; i++) {
+            Value e = ((Value*)a->data)[i];
+            if (e.type != TYPE_INT || e.data < 0 || e.data > 255) {
+                type_error("bytes() array elements must be ints from 0 to 255");
+            }
+            b->data[i] = (unsigned char)e.data;
+        }
+        Value result = {TYPE_BYTES, (long)b};
+        return result;
+    }
+    type_error("bytes() requires a string, bytes, an array of ints or a length");
+}
+
+// b[start:end] without copying (bounds as for strings)
+static Value slice_bytes(Bytes *b, long start, long end) {
+    if (start < 0) start += b->len;
+    if (end < 0) end += b->len;
+    if (start < 0) start = 0;
+    if (end > b->len) end = b->len;
+    if (start > end) start = end;
+    Bytes *s = gc_alloc(TYPE_BYTES, sizeof(Bytes));
+    s->data = b->data + start;
+    s->len = end - start;
+    s->owner = b->owner ? b->owner : b;
+    Value result = {TYPE_BYTES, (long)s};
     return result;
 }
 
-// Set key-value pair in dict
-Value dict_set(Value dict, Value key, Value val) {
-    Dict *d = (Dict*)(dict.data);
+static int bytes_equal(Bytes *a, Bytes *b) {
+    return a->len == b->len && memcmp(a->data, b->data, a->len) == 0;
+}
 
-    // Convert key to string
-    char *key_str;
-    if (key.type == TYPE_STRING) {
-        key_str = (char*)(key.data);
-    } else if (key.type == TYPE_INT) {
-        // Convert int key to string
-        char buf[32];
-        snprintf(buf, sizeof(buf), "%ld", key.data);
-        key_str = strdup(buf);
+// b"..." with \xNN for bytes that are not printable ASCII
+static char *bytes_repr(Bytes *b) {
+    static const char hex[] = "0123456789abcdef";
+    char *s = malloc(b->len * 4 + 4), *p = s;
+    *p++ = 'b';
+    *p++ = '"';
+    for (long i = 0; i < b->len; i++) {
+        unsigned char c = b->data[i];
+        if (c == '"' || c == '\\') {
+            *p++ = '\\';
+            *p++ = c;
+        } else if (c >= 32 && c < 127) {
+            *p++ = c;
+        } else {
+            *p++ = '\\';
+            *p++ = 'x';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 15];
+        }
+    }
+    *p++ = '"';
+    *p = '\0';
+    return s;
+}
+
+Value file_read_bytes(Value filename) {
+    if (filename.type != TYPE_STRING) {
+        fprintf(stderr, "file_read_bytes requires filename string\n");
+        exit(1);
+    }
+    char *fname = (char*)(filename.data);
+    FILE *f = fopen(fname, "rb");
+    if (f == NULL) {
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "FileNotFoundError: Cannot open file '%s'", fname);
+        Value msg = {TYPE_STRING, (long)strdup(error_msg)};
+        __raise(msg, 0, "file_read_bytes");
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    Bytes *b = new_bytes(size);
+    b->len = fread(b->data, 1, size, f);
+    fclose(f);
+    Value result = {TYPE_BYTES, (long)b};
+    return result;
+}
+
+// Offset of the first m-byte needle s in the n bytes at h, or -1
+static long bytes_search(const unsigned char *h, long n, const unsigned char *s, long m) {
+    if (m == 0) return 0;
+    if (m > n) return -1;
+    if (m == 1) {
+        const unsigned char *p = memchr(h, s[0], n);
+        return p ? p - h : -1;
+    }
+    long i = 0;
+#ifdef __SSE2__
+    // Test 16 positions at once for the needle's first and last byte, and
+    // compare the rest only where both match
+    __m128i first = _mm_set1_epi8(s[0]), last = _mm_set1_epi8(s[m - 1]);
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i at_first = _mm_loadu_si128((const __m128i*)(h + i));
+        __m128i at_last = _mm_loadu_si128((const __m128i*)(h + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_first, first),
+                                                        _mm_cmpeq_epi8(at_last, last)));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(h + i + bit + 1, s + 1, m - 2) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + m <= n; i++) {
+        if (h[i] == s[0] && h[i + m - 1] == s[m - 1] && memcmp(h + i, s, m) == 0) return i;
+    }
+    return -1;
+}
+
+Value bytes_find(Value b, Value needle, Value start) {
+    if (b.type != TYPE_BYTES) type_error("bytes_find requires bytes");
+    Bytes *h = (Bytes*)b.data;
+    const unsigned char *s;
+    long m;
+    unsigned char one;
+    if (needle.type == TYPE_BYTES) {
+        s = ((Bytes*)needle.data)->data;
+        m = ((Bytes*)needle.data)->len;
+    } else if (needle.type == TYPE_STRING) {
+        s = (const unsigned char*)needle.data;
+        m = strlen((const char*)s);
+    } else if (needle.type == TYPE_INT && needle.data >= 0 && needle.data <= 255) {
+        one = (unsigned char)needle.data;
+        s = &one;
+        m = 1;
     } else {
-        // Unsupported key type, return val as-is
-        return val;
+        type_error("bytes_find needle must be bytes, a string or an int from 0 to 255");
     }
+    long from = start.type == TYPE_INT ? start.data : 0;
+    if (from < 0) from += h->len;
+    if (from < 0) from = 0;
+    long pos = from > h->len ? -1 : bytes_search(h->data + from, h->len - from, s, m);
+    Value result = {TYPE_INT, pos < 0 ? -1 : from + pos};
+    return result;
+}
 
-    unsigned int idx = hash(key_str);
-    DictEntry *entry = d->buckets[idx];
+// "u8", "i16le", "u32be", "f64le", ...: kind (u, i or f), size in bytes and
+// byte order
+static void bytes_format(Value fmt, const char *fn, char *kind, int *size, int *big) {
+    const char *s = fmt.type == TYPE_STRING ? (const char*)fmt.data : "";
+    char *rest;
+    long bits = s[0] ? strtol(s + 1, &rest, 10) : 0;
+    *kind = s[0];
+    *size = bits / 8;
+    int ok = (*kind == 'u' || *kind == 'i') ? (bits == 8 || bits == 16 || bits == 32 || bits == 64)
+                                            : *kind == 'f' && (bits == 32 || bits == 64);
+    if (ok && bits == 8) {
+        ok = *rest == '\0';
+        *big = 0;
+    } else if (ok) {
+        ok = strcmp(rest, "le") == 0 || strcmp(rest, "be") == 0;
+        *big = rest[0] == 'b';
+    }
+    if (!ok) type_error("%s: unknown format '%s' (e.g. \"u8\", \"i32le\", \"f64be\")", fn, s);
+}
+
+static uint64_t load_uint(const unsigned char *p, int size, int big) {
+    switch (size) {
+        case 1:
+            return p[0];
+        case 2: {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return big != HOST_BIG_ENDIAN ? __builtin_bswap16(v) : v;
+        }
+        case 4: {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return big != HOST_BIG_ENDIAN ? __builtin_bswap32(v) : v;
+        }
+        default: {
+            uint64_t v;
+            memcpy(&v, p, 8);
+            return big != HOST_BIG_ENDIAN ? __builtin_bswap64(v) : v;
+        }
+    }
+}
 
-    // Check if key already exists
-    while (entry != NULL) {
-        if (strcmp(entry->key, key_str) == 0) {
-            entry->value = val;  // Update existing value
-            if (key.type == TYPE_INT) free(key_str);  // Free temp string if int key
-            return dict;
+static void store_uint(unsigned char *p, int size, int big, uint64_t v) {
+    switch (size) {
+        case 1:
+            p[0] = (unsigned char)v;
+            break;
+        case 2: {
+            uint16_t x = big != HOST_BIG_ENDIAN ? __builtin_bswap16((uint16_t)v) : (uint16_t)v;
+            memcpy(p, &x, 2);
+            break;
+        }
+        case 4: {
+            uint32_t x = big != HOST_BIG_ENDIAN ? __builtin_bswap32((uint32_t)v) : (uint32_t)v;
+            memcpy(p, &x, 4);
+            break;
+        }
+        default: {
+            uint64_t x = big != HOST_BIG_ENDIAN ? __builtin_bswap64(v) : v;
+            memcpy(p, &x, 8);
+            break;
         }
-        entry = entry->next;
     }
+}
 
-    // Insert new entry
-    entry = malloc(sizeof(DictEntry));
-    if (key.type == TYPE_STRING) {
-        entry->key = strdup(key_str);
+// The fixed-width number at offset; u64 values past 2^63 come out negative
+Value bytes_decode(Value b, Value offset, Value fmt) {
+    if (b.type != TYPE_BYTES || offset.type != TYPE_INT) {
+        type_error("bytes_decode requires bytes and an int offset");
+    }
+    char kind;
+    int size, big;
+    bytes_format(fmt, "bytes_decode", &kind, &size, &big);
+    Bytes *bs = (Bytes*)b.data;
+    if (offset.data < 0 || offset.data > bs->len - size) {
+        char error_msg[128];
+        snprintf(error_msg, sizeof(error_msg), "IndexError: bytes_decode: %d bytes at offset %ld, length is %ld",
+                 size, offset.data, bs->len);
+        Value msg = {TYPE_STRING, (long)strdup(error_msg)};
+        __raise(msg, 0, "bytes_decode");
+    }
+    uint64_t raw = load_uint(bs->data + offset.data, size, big);
+    Value result;
+    if (kind == 'f') {
+        double d;
+        if (size == 4) {
+            uint32_t bits = (uint32_t)raw;
+            float f;
+            memcpy(&f, &bits, 4);
+            d = f;
+        } else {
+            memcpy(&d, &raw, 8);
+        }
+        result.type = TYPE_FLOAT;
+        memcpy(&result.data, &d, sizeof(double));
     } else {
-        entry->key = key_str;  // Already allocated for int keys
+        int shift = 64 - size * 8;
+        result.type = TYPE_INT;
+        result.data = kind == 'i' ? (long)((int64_t)(raw << shift) >> shift) : (long)raw;
     }
-    entry->value = val;
-    entry->next = d->buckets[idx];
-    d->buckets[idx] = entry;
-    d->size++;
+    return result;
+}
 
-    return dict;
+// The bytes of v in a fixed-width format (ints keep their low bits)
+Value bytes_encode(Value fmt, Value v) {
+    char kind;
+    int size, big;
+    bytes_format(fmt, "bytes_encode", &kind, &size, &big);
+    uint64_t raw;
+    if (kind == 'f') {
+        if (v.type != TYPE_INT && v.type != TYPE_FLOAT) type_error("bytes_encode: '%s' requires a number", (char*)fmt.data);
+        double d = value_to_double(v);
+        if (size == 4) {
+            float f = (float)d;
+            uint32_t bits;
+            memcpy(&bits, &f, 4);
+            raw = bits;
+        } else {
+            memcpy(&raw, &d, 8);
+        }
+    } else {
+        if (v.type != TYPE_INT && v.type != TYPE_BOOL) type_error("bytes_encode: '%s' requires an int", (char*)fmt.data);
+        raw = (uint64_t)v.data;
+    }
+    Bytes *b = new_bytes(size);
+    store_uint(b->data, size, big, raw);
+    Value result = {TYPE_BYTES, (long)b};
+    return result;
 }
 
-// Get value from dict by key
-Value dict_get(Value dict, Value key) {
-    Dict *d = (Dict*)(dict.data);
+// The bytes as a string (which ends at the first zero byte)
+Value bytes_str(Value b) {
+    if (b.type != TYPE_BYTES) type_error("bytes_str requires bytes");
+    Bytes *bs = (Bytes*)b.data;
+    char *s = malloc(bs->len + 1);
+    memcpy(s, bs->data, bs->len);
+    s[bs->len] = '\0';
+    Value result = {TYPE_STRING, (long)s};
+    return result;
+}
+
+// ===== Iterators =====
+
+Value make_iterator(int (*next)(Iterator*, Value*), void (*close)(Iterator*), void *state) {
+    Iterator *it = gc_alloc(TYPE_ITERATOR, sizeof(Iterator));
+    it->next = next;
+    it->close = close;
+    it->roots = NULL;
+    it->state = state;
+    it->count = 0;
+    Value result = {TYPE_ITERATOR, (long)it};
+    return result;
+}
+
+int iterator_next(Iterator *it, Value *out) {
+    if (!it->next) return 0;
+    if (parallel_for_depth) check_shared_write(it, "advance an iterator");
+    if (!it->next(it, out)) {
+        iterator_close(it);
+        return 0;
+    }
+    it->count++;
+    return 1;
+}
+
+void iterator_close(Iterator *it) {
+    void (*close)(Iterator*) = it->close;
+    it->next = NULL;
+    it->close = NULL;
+    it->roots = NULL;
+    if (close) close(it);
+}
+
+void iter_begin(Value coll, IterState *st) {
+    memset(st, 0, sizeof(IterState));
+    st->coll = coll;
+    if (coll.type == TYPE_ARRAY) {
+        Array *a = (Array*)coll.data;
+        st->base = st->pos = (Value*)a->data;
+        st->end = st->base + a->size;
+        st->count = a->size;
+    } else if (coll.type == TYPE_STRING) {
+        st->count = strlen((char*)coll.data);
+    } else if (coll.type != TYPE_DICT && coll.type != TYPE_ITERATOR) {
+        type_error("foreach requires an array, dict, string or iterator");
+    }
+}
+
+// Place of e in the chain of a bucket, or -1
+static int bucket_place(Dict *d, int bucket, DictEntry *e) {
+    int place = 0;
+    for (DictEntry *at = d->buckets[bucket]; at; at = at->next, place++) {
+        if (at == e) return place;
+    }
+    return -1;
+}
+
+// The entry after st->entry. If the body added or removed entries since,
+// st->entry is looked up again in its bucket; if it was removed the walk
+// goes on with the entry that followed it (or from its place, if that one
+// is gone too)
+static DictEntry *dict_iter_next(Dict *d, IterState *st) {
+    int bucket = st->bucket, place = 0;
+    DictEntry *e = NULL;
+    if (st->entry) {
+        int p = d->changes == st->changes ? st->place : bucket_place(d, bucket, st->entry);
+        if (p >= 0) {
+            e = st->entry->next;
+            place = p + 1;
+        } else if (st->after && (p = bucket_place(d, bucket, st->after)) >= 0) {
+            e = st->after;
+            place = p;
+        } else if (st->after) {
+            for (e = d->buckets[bucket]; e && place < st->place; e = e->next) place++;
+        }
+        if (!e) bucket++;
+    }
+    for (; !e && bucket < HASH_SIZE; bucket++) {
+        e = d->buckets[bucket];
+        place = 0;
+        if (e) break;
+    }
+    st->entry = e;
+    st->after = e ? e->next : NULL;
+    st->bucket = bucket;
+    st->place = place;
+    st->changes = d->changes;
+    return e;
+}
+
+// Store the next key and value; 0 once the collection is exhausted. The key
+// of an iterator's value is its position.
+int iter_next(IterState *st, Value *key, Value *value) {
+    switch (st->coll.type) {
+        case TYPE_ARRAY: {
+            Array *a = (Array*)st->coll.data;
+            long i = st->pos - st->base;
+            if ((Value*)a->data != st->base || i >= a->size) {
+                // append moved the elements, or remove dropped some
+                long n = a->size < st->count ? a->size : st->count;
+                st->base = (Value*)a->data;
+                st->pos = st->base + i;
+                st->end = st->base + (i > n ? i : n);
+            }
+            if (st->pos >= st->end) return 0;
+            key->type = TYPE_INT;
+            key->data = i;
+            *value = *st->pos++;
+            return 1;
+        }
+        case TYPE_DICT: {
+            DictEntry *e = dict_iter_next((Dict*)st->coll.data, st);
+            if (!e) return 0;
+            key->type = TYPE_STRING;
+            key->data = (long)e->key;
+            *value = e->value;
+            return 1;
+        }
+        case TYPE_STRING: {
+            if (st->index >= st->count) return 0;
+            char c[2] = {((char*)st->coll.data)[st->index], '\0'};
+            key->type = TYPE_INT;
+            key->data = st->index++;
+            value->type = TYPE_STRING;
+            value->data = (long)strdup(c);
+            return 1;
+        }
+        default: {
+            Iterator *it = (Iterator*)st->coll.data;
+            key->type = TYPE_INT;
+            key->data = it->count;
+            return iterator_next(it, value);
+        }
+    }
+}
+
+// ===== Generators =====
+// A generator's body runs on a stack of its own, entered with swapcontext:
+// gen_yield suspends it in the middle of the body and the consumer's next
+// call resumes it there. While the body runs, the handlers it pushed sit
+// on top of the consumer's in try_stack; while it is suspended they are
+// kept in the Generator, so a raise in the consumer never lands in a
+// suspended frame. The collector scans the consumer's stack while the body
+// runs (gc_stack_switch) and a suspended body's stack when the iterator is
+// marked (Iterator.roots).
+
+#define GEN_STACK_SIZE (1024 * 1024)  // Reserved; pages are touched on demand
+#define GEN_STACK_CACHE 16            // Released stacks kept for new generators
+
+enum { GEN_NEW, GEN_SUSPENDED, GEN_RUNNING, GEN_DONE };
+
+typedef struct Generator {
+    GeneratorBody body;
+    void *ctx;
+    void (*ctx_roots)(void *ctx, RootVisitor *v);
+    void (*ctx_free)(void *ctx);
+    Value *args;
+    int nargs;
+    int state;
+    Value value;              // Handed over by gen_yield
+    char *error;              // Message of a raise that left the body
+    char *stack;              // Lowest address (a guard page)
+    void *sp;                 // Lowest live address of the suspended stack
+    ucontext_t start;         // Entry of a body that has not run yet
+    ucontext_t *self;         // The suspended body's registers (on its stack)
+    ucontext_t *caller;       // The consumer's (on the consumer's stack)
+    jmp_buf *tries;           // The body's try_stack entries while suspended
+    int ntries, tries_cap;
+    int try_base;             // try_top when the body was resumed
+    int this_base;            // this_stack_top then
+    GCStackLink link;
+} Generator;
+
+static __thread Generator *current_gen = NULL;  // Innermost running body
+
+static pthread_mutex_t gen_stack_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *gen_stack_cache[GEN_STACK_CACHE];
+static int gen_stack_cached = 0;
+static int gen_stacks_live = 0;      // Handed out and not yet released
+static int gen_stacks_limit = 1024;  // Collect when this many are live
+
+static char *gen_stack_map(void) {
+    char *stack = mmap(NULL, GEN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) return NULL;
+    // Running off the end faults instead of overwriting other memory
+    mprotect(stack, getpagesize(), PROT_NONE);
+    return stack;
+}
+
+static char *gen_stack_alloc(void) {
+    char *stack = NULL;
+    pthread_mutex_lock(&gen_stack_lock);
+    int crowded = gen_stacks_live >= gen_stacks_limit;
+    pthread_mutex_unlock(&gen_stack_lock);
+    // Stacks are not on the heap, so abandoned generators would not make
+    // the collector run on their own
+    if (crowded) {
+        gc_collect();
+        pthread_mutex_lock(&gen_stack_lock);
+        gen_stacks_limit = gen_stacks_live * 2 > 1024 ? gen_stacks_live * 2 : 1024;
+        pthread_mutex_unlock(&gen_stack_lock);
+    }
+
+    pthread_mutex_lock(&gen_stack_lock);
+    if (gen_stack_cached > 0) stack = gen_stack_cache[--gen_stack_cached];
+    gen_stacks_live++;
+    pthread_mutex_unlock(&gen_stack_lock);
+    if (stack) return stack;
+
+    stack = gen_stack_map();
+    if (!stack) {
+        gc_collect();
+        stack = gen_stack_map();
+    }
+    if (!stack) {
+        fprintf(stderr, "Error: cannot allocate a generator stack\n");
+        exit(1);
+    }
+    return stack;
+}
+
+// Closed generators may be collected on a marker thread, so the cache is
+// shared by all threads
+static void gen_stack_free(char *stack) {
+    pthread_mutex_lock(&gen_stack_lock);
+    gen_stacks_live--;
+    if (gen_stack_cached < GEN_STACK_CACHE) {
+        gen_stack_cache[gen_stack_cached++] = stack;
+        stack = NULL;
+    }
+    pthread_mutex_unlock(&gen_stack_lock);
+    if (stack) munmap(stack, GEN_STACK_SIZE);
+}
 
-    // Convert key to string
-    char *key_str;
-    char buf[32];
-    if (key.type == TYPE_STRING) {
-        key_str = (char*)(key.data);
-    } else if (key.type == TYPE_INT) {
-        snprintf(buf, sizeof(buf), "%ld", key.data);
-        key_str = buf;
+// First code on a generator's stack
+static void gen_start(void) {
+    Generator *g = current_gen;
+    if (setjmp(*(jmp_buf*)__try_push_buf()) == 0) {
+        g->body(g->args, g->ctx);
     } else {
-        // Unsupported key type, return 0
-        Value result = {TYPE_INT, 0};
+        Value msg = current_exception.type == TYPE_STRING ? current_exception : to_string(current_exception);
+        g->error = strdup((char*)msg.data);
+        this_stack_top = g->this_base;
+    }
+    try_top = g->try_base;
+    g->state = GEN_DONE;
+    setcontext(g->caller);
+}
+
+static int gen_next(Iterator *it, Value *out) {
+    Generator *g = (Generator*)it->state;
+    if (g->state == GEN_RUNNING) {
+        Value msg = {TYPE_STRING, (long)"ValueError: generator already running"};
+        __raise(msg, 0, "generator");
+    }
+    if (g->state == GEN_DONE) return 0;
+    if (g->state == GEN_NEW) {
+        g->stack = gen_stack_alloc();
+        getcontext(&g->start);
+        g->start.uc_stack.ss_sp = g->stack;
+        g->start.uc_stack.ss_size = GEN_STACK_SIZE;
+        g->start.uc_link = NULL;
+        makecontext(&g->start, gen_start, 0);
+        g->self = &g->start;
+    }
+
+    // The body's handlers go back on top of the consumer's
+    if (try_top + g->ntries > 256) {
+        fprintf(stderr, "Exception stack overflow\n");
+        exit(1);
+    }
+    memcpy(&try_stack[try_top], g->tries, g->ntries * sizeof(jmp_buf));
+    g->try_base = try_top;
+    try_top += g->ntries;
+    g->this_base = this_stack_top;
+
+    ucontext_t caller;
+    Generator *outer = current_gen;
+    g->caller = &caller;
+    g->state = GEN_RUNNING;
+    current_gen = g;
+    gc_stack_switch(&g->link, g->stack + GEN_STACK_SIZE);
+    swapcontext(&caller, g->self);
+    gc_stack_return(&g->link);
+    current_gen = outer;
+
+    if (g->error) {
+        char full[1024];
+        snprintf(full, sizeof(full), "%s", g->error);
+        free(g->error);
+        g->error = NULL;
+        __raise_message(full);
+    }
+    if (g->state == GEN_DONE) return 0;
+    *out = g->value;
+    g->value = make_null();
+    return 1;
+}
+
+void gen_yield(Value v) {
+    Generator *g = current_gen;
+    if (!g) type_error("yield outside a generator");
+    g->value = v;
+
+    // Set the body's handlers aside until it is resumed
+    int n = try_top - g->try_base;
+    if (n > g->tries_cap) {
+        g->tries_cap = n;
+        g->tries = realloc(g->tries, n * sizeof(jmp_buf));
+    }
+    memcpy(g->tries, &try_stack[g->try_base], n * sizeof(jmp_buf));
+    g->ntries = n;
+    try_top = g->try_base;
+
+    ucontext_t self;
+    g->self = &self;
+    g->sp = &self;
+    g->state = GEN_SUSPENDED;
+    swapcontext(&self, g->caller);
+}
+
+static void gen_roots(Iterator *it, RootVisitor *v) {
+    Generator *g = (Generator*)it->state;
+    v->mark(v, g->value);
+    for (int i = 0; i < g->nargs; i++) v->mark(v, g->args[i]);
+    // A running body's stack is scanned as the thread's (or a suspended) stack
+    if (g->state == GEN_SUSPENDED) v->scan(v, g->sp, g->stack + GEN_STACK_SIZE);
+    if (g->ctx_roots) g->ctx_roots(g->ctx, v);
+}
+
+static void gen_close(Iterator *it) {
+    Generator *g = (Generator*)it->state;
+    if (g->stack) gen_stack_free(g->stack);
+    if (g->ctx_free) g->ctx_free(g->ctx);
+    free(g->args);
+    free(g->tries);
+    free(g->error);
+    free(g);
+}
+
+Value make_generator(GeneratorBody body, void *ctx, Value *args, int nargs,
+                     void (*ctx_roots)(void *ctx, RootVisitor *v), void (*ctx_free)(void *ctx)) {
+    Generator *g = calloc(1, sizeof(Generator));
+    g->body = body;
+    g->ctx = ctx;
+    g->ctx_roots = ctx_roots;
+    g->ctx_free = ctx_free;
+    g->value = make_null();
+    g->state = GEN_NEW;
+    Value result = make_iterator(gen_next, gen_close, g);
+    // args stay reachable through the caller until they are copied
+    if (nargs > 0) {
+        g->args = malloc(nargs * sizeof(Value));
+        memcpy(g->args, args, nargs * sizeof(Value));
+        g->nargs = nargs;
+    }
+    ((Iterator*)result.data)->roots = gen_roots;
+    return result;
+}
+
+// ===== CSV =====
+// The file is read in CSV_CHUNK blocks into a buffer that only ever loses
+// whole rows from its front: a row cut off by the end of the data is parsed
+// again once the next block has been appended. Field boundaries are found
+// 16 bytes at a time with SSE2, and int/float columns are converted straight
+// from the buffer.
+
+#define CSV_CHUNK (64 * 1024)
+#define CSV_PAD 16  // Zero bytes after the data, so vector loads may overrun it
+
+enum { CSV_STR, CSV_INT, CSV_FLOAT };
+
+typedef struct {
+    const char *start;
+    long len;
+    int escaped;  // Quoted field containing "" pairs
+} CsvField;
+
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t pos, len, cap;  // cap excludes the padding
+    int eof;
+    char sep;
+    int skip_header;
+    unsigned char *types;
+    int ntypes;
+    CsvField *fields;
+    int nfields, fields_cap;
+} CsvReader;
+
+// Move the unparsed tail to the front and append the next block
+static void csv_fill(CsvReader *r) {
+    size_t rest = r->len - r->pos;
+    memmove(r->buf, r->buf + r->pos, rest);
+    r->pos = 0;
+    r->len = rest;
+    if (r->cap - r->len < CSV_CHUNK) {
+        while (r->cap - r->len < CSV_CHUNK) r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap + CSV_PAD);
+    }
+    size_t want = r->cap - r->len;
+    size_t got = fread(r->buf + r->len, 1, want, r->f);
+    r->len += got;
+    memset(r->buf + r->len, 0, CSV_PAD);
+    if (got < want) r->eof = 1;  // fread only comes up short at the end
+}
+
+// First separator, quote, CR or LF in [p, end), or end
+static const char *csv_scan(const char *p, const char *end, char sep) {
+#ifdef __SSE2__
+    __m128i vsep = _mm_set1_epi8(sep), vquote = _mm_set1_epi8('"');
+    __m128i vcr = _mm_set1_epi8('\r'), vlf = _mm_set1_epi8('\n');
+    for (; p < end; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, vsep), _mm_cmpeq_epi8(v, vquote)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(v, vcr), _mm_cmpeq_epi8(v, vlf)));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask) {
+            p += __builtin_ctz(mask);
+            return p < end ? p : end;
+        }
+    }
+    return end;
+#else
+    while (p < end && *p != sep && *p != '"' && *p != '\r' && *p != '\n') p++;
+    return p;
+#endif
+}
+
+static void csv_push_field(CsvReader *r, const char *start, long len, int escaped) {
+    if (r->nfields == r->fields_cap) {
+        r->fields_cap *= 2;
+        r->fields = realloc(r->fields, r->fields_cap * sizeof(CsvField));
+    }
+    CsvField *f = &r->fields[r->nfields++];
+    f->start = start;
+    f->len = len;
+    f->escaped = escaped;
+}
+
+// Locate the fields of the next row. Returns 1 for a row, 0 when the row
+// may continue past the data read so far, -1 when there are no rows left.
+static int csv_parse_row(CsvReader *r) {
+    const char *p = r->buf + r->pos, *end = r->buf + r->len;
+    char sep = r->sep;
+
+    // Blank lines are skipped
+    while (p < end && (*p == '\n' || *p == '\r')) p++;
+    r->pos = p - r->buf;
+    if (p == end) return r->eof ? -1 : 0;
+
+    r->nfields = 0;
+    for (;;) {
+        if (*p == '"') {
+            const char *q = p + 1;
+            int escaped = 0;
+            for (;;) {
+                q = memchr(q, '"', end - q);
+                if (!q) {
+                    if (!r->eof) return 0;
+                    q = end;  // Unterminated: the field runs to the end
+                    break;
+                }
+                if (q + 1 == end && !r->eof) return 0;
+                if (q + 1 < end && q[1] == '"') {
+                    escaped = 1;
+                    q += 2;
+                    continue;
+                }
+                break;
+            }
+            csv_push_field(r, p + 1, q - (p + 1), escaped);
+            p = q < end ? q + 1 : end;
+            // Text between the closing quote and the separator is dropped
+            while (p < end && *p != sep && *p != '\r' && *p != '\n') p++;
+        } else {
+            // A quote inside an unquoted field is an ordinary character
+            const char *q = p;
+            while ((q = csv_scan(q, end, sep)) < end && *q == '"') q++;
+            csv_push_field(r, p, q - p, 0);
+            p = q;
+        }
+
+        if (p == end) {
+            if (!r->eof) return 0;
+            break;
+        }
+        if (*p == sep) {
+            p++;
+            if (p == end) {
+                if (!r->eof) return 0;
+                csv_push_field(r, p, 0, 0);
+                break;
+            }
+            continue;
+        }
+        // CR, LF or CRLF ends the row (an LF left for the next block is
+        // skipped as a blank line)
+        if (*p == '\r' && p + 1 < end && p[1] == '\n') p++;
+        p++;
+        break;
+    }
+    r->pos = p - r->buf;
+    return 1;
+}
+
+static Value csv_field_value(CsvReader *r, CsvField *f, int col) {
+    int type = col < r->ntypes ? r->types[col] : CSV_STR;
+    Value result;
+    if (type != CSV_STR) {
+        // The byte after the field is a separator, quote, newline or the
+        // padding, none of which continues a number
+        const char *s = f->start, *e = s + f->len;
+        while (s < e && (*s == ' ' || *s == '\t')) s++;
+        if (s == e) return make_null();
+        if (type == CSV_INT) {
+            result.type = TYPE_INT;
+            result.data = parse_long(s);
+        } else {
+            double d = parse_double(s);
+            result.type = TYPE_FLOAT;
+            memcpy(&result.data, &d, sizeof(double));
+        }
         return result;
     }
+    char *str = malloc(f->len + 1);
+    if (f->escaped) {
+        long n = 0;
+        for (long i = 0; i < f->len; i++) {
+            str[n++] = f->start[i];
+            if (f->start[i] == '"') i++;  // "" stands for one quote
+        }
+        str[n] = '\0';
+    } else {
+        memcpy(str, f->start, f->len);
+        str[f->len] = '\0';
+    }
+    result.type = TYPE_STRING;
+    result.data = (long)str;
+    return result;
+}
+
+static int csv_next(Iterator *it, Value *out) {
+    CsvReader *r = (CsvReader*)it->state;
+    for (;;) {
+        int got;
+        while ((got = csv_parse_row(r)) == 0) csv_fill(r);
+        if (got < 0) return 0;
+        if (r->skip_header) {
+            r->skip_header = 0;
+            continue;
+        }
+        break;
+    }
+    // Sized for the row up front (fields are strings or scalars, so
+    // nothing below allocates from the GC heap)
+    Array *a = gc_alloc(TYPE_ARRAY, sizeof(Array));
+    a->size = 0;
+    a->capacity = r->nfields;
+    a->data = NULL;
+    a->data = gc_alloc(GC_TYPE_BUFFER, r->nfields * sizeof(Value));
+    Value *elements = (Value*)a->data;
+    for (int i = 0; i < r->nfields; i++) {
+        elements[i] = csv_field_value(r, &r->fields[i], i);
+        a->size++;
+    }
+    out->type = TYPE_ARRAY;
+    out->data = (long)a;
+    return 1;
+}
 
-    unsigned int idx = hash(key_str);
-    DictEntry *entry = d->buckets[idx];
+static void csv_close(Iterator *it) {
+    CsvReader *r = (CsvReader*)it->state;
+    fclose(r->f);
+    free(r->buf);
+    free(r->types);
+    free(r->fields);
+    free(r);
+}
 
-    while (entry != NULL) {
-        if (strcmp(entry->key, key_str) == 0) {
-            return entry->value;
+static Value csv_option(Value opts, const char *name) {
+    Value key = {TYPE_STRING, (long)name};
+    if (opts.type != TYPE_DICT || !dict_has(opts, key).data) return make_null();
+    return dict_get(opts, key);
+}
+
+static void csv_read_options(CsvReader *r, Value opts) {
+    if (opts.type != TYPE_DICT && opts.type != TYPE_NULL) {
+        type_error("csv_rows options must be a dict");
+    }
+    Value sep = csv_option(opts, "sep");
+    if (sep.type != TYPE_NULL) {
+        const char *s = sep.type == TYPE_STRING ? (const char*)sep.data : "";
+        // Numbers are parsed in place, so the separator must not be able
+        // to continue one
+        if (strlen(s) != 1 || s[0] == '"' || s[0] == '\r' || s[0] == '\n' ||
+            isalnum((unsigned char)s[0]) || strchr(".+-", s[0])) {
+            type_error("csv_rows: sep must be a single punctuation or whitespace character");
+        }
+        r->sep = s[0];
+    }
+    r->skip_header = is_truthy_rt(csv_option(opts, "header"));
+    Value types = csv_option(opts, "types");
+    if (types.type == TYPE_NULL) return;
+    if (types.type != TYPE_ARRAY) type_error("csv_rows: types must be an array");
+    Array *a = (Array*)types.data;
+    r->ntypes = a->size;
+    r->types = malloc(a->size > 0 ? a->size : 1);
+    for (int i = 0; i < a->size; i++) {
+        Value t = ((Value*)a->data)[i];
+        const char *name = t.type == TYPE_STRING ? (const char*)t.data : "";
+        if (strcmp(name, "str") == 0 || strcmp(name, "string") == 0) {
+            r->types[i] = CSV_STR;
+        } else if (strcmp(name, "int") == 0) {
+            r->types[i] = CSV_INT;
+        } else if (strcmp(name, "float") == 0) {
+            r->types[i] = CSV_FLOAT;
+        } else {
+            type_error("csv_rows: column type must be \"str\", \"int\" or \"float\"");
         }
+    }
+}
+
+Value csv_rows(Value path, Value opts) {
+    if (path.type != TYPE_STRING) {
+        fprintf(stderr, "csv_rows requires filename string\n");
+        exit(1);
+    }
+    CsvReader *r = calloc(1, sizeof(CsvReader));
+    r->sep = ',';
+    csv_read_options(r, opts);
+    char *fname = (char*)(path.data);
+    r->f = fopen(fname, "rb");
+    if (r->f == NULL) {
+        free(r->types);
+        free(r);
+        char error_msg[512];
+        snprintf(error_msg, sizeof(error_msg), "FileNotFoundError: Cannot open file '%s'", fname);
+        Value msg = {TYPE_STRING, (long)strdup(error_msg)};
+        __raise(msg, 0, "csv_rows");
+    }
+    r->cap = CSV_CHUNK;
+    r->buf = malloc(r->cap + CSV_PAD);
+    memset(r->buf, 0, CSV_PAD);
+    r->fields_cap = 16;
+    r->fields = malloc(r->fields_cap * sizeof(CsvField));
+    return make_iterator(csv_next, csv_close, r);
+}
+
+Value csv_read(Value path, Value opts) {
+    Value it = csv_rows(path, opts);
+    Value rows = make_array();
+    Value row;
+    while (iterator_next((Iterator*)it.data, &row)) {
+        append(rows, row);
+    }
+    return rows;
+}
+
+// ===== Dict Functions =====
+
+// Create empty dict
+Value make_dict(void) {
+    Dict *d = gc_alloc(TYPE_DICT, sizeof(Dict));
+    d->buckets = gc_alloc(GC_TYPE_BUFFER, HASH_SIZE * sizeof(DictEntry*));
+    d->size = 0;
+
+    Value result = {TYPE_DICT, (long)d};
+    return result;
+}
+
+// Entry of key (hash = dict_hash(key)), or NULL
+static DictEntry *dict_find(Dict *d, const char *key, unsigned int hash) {
+    DictEntry *entry = d->buckets[hash % HASH_SIZE];
+    long probes = 0;
+    while (entry != NULL) {
+        probes++;
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) break;
         entry = entry->next;
     }
+    RT_STAT_INC(dict_lookups);
+    RT_STAT_ADD(dict_probes, probes);
+    return entry;
+}
+
+static void dict_store(Dict *d, const char *key, unsigned int hash, Value val) {
+    if (parallel_for_depth) check_shared_write(d, "modify a dict");
+    DictEntry *entry = dict_find(d, key, hash);
+    if (entry != NULL) {
+        entry->value = val;  // Update existing value
+        return;
+    }
+    entry = malloc(sizeof(DictEntry));
+    entry->key = strdup(key);
+    entry->hash = hash;
+    entry->value = val;
+    entry->next = d->buckets[hash % HASH_SIZE];
+    d->buckets[hash % HASH_SIZE] = entry;
+    d->size++;
+    d->changes++;
+}
+
+// Key as a string: int keys are formatted into buf; NULL for other types
+static const char *dict_key(Value key, char *buf) {
+    if (key.type == TYPE_STRING) return (char*)(key.data);
+    if (key.type == TYPE_INT) {
+        format_long(key.data, buf);
+        return buf;
+    }
+    return NULL;
+}
+
+// Set key-value pair in dict
+Value dict_set(Value dict, Value key, Value val) {
+    char buf[NUMFMT_MAX];
+    const char *key_str = dict_key(key, buf);
+    if (key_str == NULL) return val;  // Unsupported key type, return val as-is
+    dict_store((Dict*)(dict.data), key_str, dict_hash(key_str), val);
+    return dict;
+}
+
+// Get value from dict by key
+Value dict_get(Value dict, Value key) {
+    char buf[NUMFMT_MAX];
+    const char *key_str = dict_key(key, buf);
+    DictEntry *entry = key_str ? dict_find((Dict*)(dict.data), key_str, dict_hash(key_str)) : NULL;
+    if (entry != NULL) return entry->value;
 
     // Key not found, return 0
     Value result = {TYPE_INT, 0};
@@ -616,36 +1659,30 @@ Value dict_get(Value dict, Value key) {
 
 // Check if key exists in dict
 Value dict_has(Value dict, Value key) {
-    Dict *d = (Dict*)(dict.data);
-
-    // Convert key to string
-    char *key_str;
-    char buf[32];
-    if (key.type == TYPE_STRING) {
-        key_str = (char*)(key.data);
-    } else if (key.type == TYPE_INT) {
-        snprintf(buf, sizeof(buf), "%ld", key.data);
-        key_str = buf;
-    } else {
+    char buf[NUMFMT_MAX];
+    const char *key_str = dict_key(key, buf);
+    if (key_str == NULL) {
         Value result = {TYPE_INT, 0};
         return result;
     }
+    Value result = {TYPE_BOOL, dict_find((Dict*)(dict.data), key_str, dict_hash(key_str)) != NULL};
+    return result;
+}
 
-    unsigned int idx = hash(key_str);
-    DictEntry *entry = d->buckets[idx];
-
-    while (entry != NULL) {
-        if (strcmp(entry->key, key_str) == 0) {
-            Value result = {TYPE_BOOL, 1};  // true
-            return result;
-        }
-        entry = entry->next;
-    }
-
-    Value result = {TYPE_BOOL, 0};  // false
+Value dict_get_h(Value obj, char *key, unsigned int hash) {
+    if (obj.type != TYPE_DICT) return index_get(obj, (Value){TYPE_STRING, (long)key});
+    DictEntry *entry = dict_find((Dict*)(obj.data), key, hash);
+    if (entry != NULL) return entry->value;
+    Value result = {TYPE_INT, 0};
     return result;
 }
 
+Value dict_set_h(Value obj, char *key, unsigned int hash, Value val) {
+    if (obj.type != TYPE_DICT) return index_set(obj, (Value){TYPE_STRING, (long)key}, val);
+    dict_store((Dict*)(obj.data), key, hash, val);
+    return obj;
+}
+
 // Get all keys from dict as an array
 Value dict_keys(Value dict) {
     Dict *d = (Dict*)(dict.data);
@@ -672,7 +1709,7 @@ Value keys(Value dict) {
     return dict_keys(dict);
 }
 
-static int is_truthy_rt(Value v) {
+int is_truthy_rt(Value v) {
     switch (v.type) {
         case TYPE_BOOL: return v.data != 0;
         case TYPE_INT: return v.data != 0;
@@ -683,6 +1720,7 @@ static int is_truthy_rt(Value v) {
         case TYPE_STRING: return ((char*)v.data)[0] != '\0';
         case TYPE_ARRAY: return ((Array*)v.data)->size > 0;
         case TYPE_DICT: return ((Dict*)v.data)->size > 0;
+        case TYPE_BYTES: return ((Bytes*)v.data)->len > 0;
         case TYPE_NULL: return 0;
         default: return 1;
     }
@@ -790,23 +1828,27 @@ Value binary_op(Value left, int op, Value right, int line, const char *file) {
                 return arr_val;
             }
 
+            // Bytes concatenation
+            if (left.type == TYPE_BYTES && right.type == TYPE_BYTES) {
+                Bytes *lb = (Bytes*)left.data;
+                Bytes *rb = (Bytes*)right.data;
+                Bytes *nb = new_bytes(lb->len + rb->len);
+                memcpy(nb->data, lb->data, lb->len);
+                memcpy(nb->data + lb->len, rb->data, rb->len);
+                Value result = {TYPE_BYTES, (long)nb};
+                return result;
+            }
+
             // String concatenation
             if (left.type == TYPE_STRING || right.type == TYPE_STRING) {
                 REQUIRE_BOTH_STRING();
-                char buf[1024];
-                char left_str[512], right_str[512];
-                
-                // Convert left to string
-                strncpy(left_str, (char*)left.data, sizeof(left_str) - 1);
-                left_str[sizeof(left_str) - 1] = '\0';
-                
-                // Convert right to string
-                strncpy(right_str, (char*)right.data, sizeof(right_str) - 1);
-                right_str[sizeof(right_str) - 1] = '\0';
-                
+                size_t left_len = strlen((char*)left.data);
+                size_t right_len = strlen((char*)right.data);
+
                 // Concatenate
-                snprintf(buf, sizeof(buf), "%s%s", left_str, right_str);
-                char *result_str = strdup(buf);
+                char *result_str = malloc(left_len + right_len + 1);
+                memcpy(result_str, (char*)left.data, left_len);
+                memcpy(result_str + left_len, (char*)right.data, right_len + 1);
                 Value result = {TYPE_STRING, (long)result_str};
                 return result;
             }
@@ -913,6 +1955,10 @@ Value binary_op(Value left, int op, Value right, int line, const char *file) {
                 Value result = {TYPE_INT, eq};
                 return result;
             }
+            if (left.type == right.type && left.type == TYPE_BYTES) {
+                Value result = {TYPE_INT, bytes_equal((Bytes*)left.data, (Bytes*)right.data)};
+                return result;
+            }
             if (left.type == right.type) {
                 int eq = (left.data == right.data);
                 Value result = {TYPE_INT, eq};
@@ -934,6 +1980,10 @@ Value binary_op(Value left, int op, Value right, int line, const char *file) {
                 Value result = {TYPE_INT, ne};
                 return result;
             }
+            if (left.type == right.type && left.type == TYPE_BYTES) {
+                Value result = {TYPE_INT, !bytes_equal((Bytes*)left.data, (Bytes*)right.data)};
+                return result;
+            }
             if (left.type == right.type) {
                 int ne = (left.data != right.data);
                 Value result = {TYPE_INT, ne};
@@ -1062,6 +2112,42 @@ Value binary_op(Value left, int op, Value right, int line, const char *file) {
 
 // Regular expression functions
 
+// Compiled patterns are cached per thread: scripts tend to apply a few fixed
+// patterns in a loop, where regcomp costs far more than the match itself
+#define REGEX_CACHE_SIZE 16
+
+typedef struct {
+    char *pattern;
+    regex_t regex;
+} RegexCacheEntry;
+
+static __thread RegexCacheEntry regex_cache[REGEX_CACHE_SIZE];
+static __thread int regex_cache_next = 0;
+
+static regex_t* regex_compile_cached(const char *pattern) {
+    for (int i = 0; i < REGEX_CACHE_SIZE; i++) {
+        if (regex_cache[i].pattern && strcmp(regex_cache[i].pattern, pattern) == 0) {
+            RT_STAT_INC(regex_cache_hits);
+            return &regex_cache[i].regex;
+        }
+    }
+    RT_STAT_INC(regex_cache_misses);
+
+    // Round-robin replacement
+    RegexCacheEntry *e = &regex_cache[regex_cache_next];
+    regex_cache_next = (regex_cache_next + 1) % REGEX_CACHE_SIZE;
+    if (e->pattern) {
+        free(e->pattern);
+        e->pattern = NULL;
+        regfree(&e->regex);
+    }
+    if (regcomp(&e->regex, pattern, REG_EXTENDED) != 0) {
+        return NULL;
+    }
+    e->pattern = strdup(pattern);
+    return &e->regex;
+}
+
 // regexp_match(pattern, str) -> returns 1 if match, 0 otherwise
 Value regexp_match(Value pattern_val, Value str_val) {
     if (pattern_val.type != TYPE_STRING || str_val.type != TYPE_STRING) {
@@ -1072,17 +2158,14 @@ Value regexp_match(Value pattern_val, Value str_val) {
     char *pattern = (char*)pattern_val.data;
     char *str = (char*)str_val.data;
 
-    regex_t regex;
-    int ret = regcomp(&regex, pattern, REG_EXTENDED);
-    if (ret != 0) {
+    regex_t *regex = regex_compile_cached(pattern);
+    if (regex == NULL) {
         fprintf(stderr, "Failed to compile regex: %s\n", pattern);
-        regfree(&regex);
         Value result = {TYPE_INT, 0};
         return result;
     }
 
-    ret = regexec(&regex, str, 0, NULL, 0);
-    regfree(&regex);
+    int ret = regexec(regex, str, 0, NULL, 0);
 
     Value result = {TYPE_INT, (ret == 0) ? 1 : 0};
     return result;
@@ -1098,28 +2181,23 @@ Value regexp_find(Value pattern_val, Value str_val) {
     char *pattern = (char*)pattern_val.data;
     char *str = (char*)str_val.data;
 
-    regex_t regex;
-    int ret = regcomp(&regex, pattern, REG_EXTENDED);
-    if (ret != 0) {
+    regex_t *regex = regex_compile_cached(pattern);
+    if (regex == NULL) {
         fprintf(stderr, "Failed to compile regex: %s\n", pattern);
-        regfree(&regex);
         // Return empty array
         return make_array();
     }
 
     // Get number of capture groups
-    size_t num_groups = regex.re_nsub + 1;  // +1 for the whole match
+    size_t num_groups = regex->re_nsub + 1;  // +1 for the whole match
     regmatch_t *matches = (regmatch_t*)malloc(num_groups * sizeof(regmatch_t));
 
     // Find all matches
-    Array *result_arr = (Array*)calloc(1, sizeof(Array));
-    result_arr->size = 0;
-    result_arr->capacity = 10;
-    result_arr->data = calloc(result_arr->capacity, sizeof(Value));
+    Array *result_arr = new_array();
 
     char *search_str = str;
 
-    while (regexec(&regex, search_str, num_groups, matches, 0) == 0) {
+    while (regexec(regex, search_str, num_groups, matches, 0) == 0) {
         // If there are capture groups, return only the captured parts
         // Otherwise return the whole match
         int start_idx = (num_groups > 1) ? 1 : 0;  // Skip whole match if we have groups
@@ -1136,7 +2214,7 @@ Value regexp_find(Value pattern_val, Value str_val) {
             if (result_arr->size >= result_arr->capacity) {
                 int old_capacity = result_arr->capacity;
                 result_arr->capacity *= 2;
-                result_arr->data = gc_realloc(result_arr->data, TYPE_ARRAY,
+                result_arr->data = gc_realloc(result_arr->data, GC_TYPE_BUFFER,
                                               old_capacity * sizeof(Value),
                                               result_arr->capacity * sizeof(Value));
             }
@@ -1156,7 +2234,6 @@ Value regexp_find(Value pattern_val, Value str_val) {
     }
 
     free(matches);
-    regfree(&regex);
 
     Value result = {TYPE_ARRAY, (long)result_arr};
     return result;
@@ -1172,20 +2249,18 @@ Value regexp_replace(Value pattern_val, Value str_val, Value replacement_val) {
     char *str = (char*)str_val.data;
     char *replacement = (char*)replacement_val.data;
 
-    regex_t regex;
-    int ret = regcomp(&regex, pattern, REG_EXTENDED);
-    if (ret != 0) {
+    regex_t *regex = regex_compile_cached(pattern);
+    if (regex == NULL) {
         fprintf(stderr, "Error");
         if (current_err_file) fprintf(stderr, " at %s", current_err_file);
         if (current_err_line > 0) fprintf(stderr, ":%d", current_err_line);
         fprintf(stderr, ": Failed to compile regex: %s\n", pattern);
-        regfree(&regex);
         // Return original string
         Value result = {TYPE_STRING, (long)strdup(str)};
         return result;
     }
 
-    size_t num_groups = regex.re_nsub + 1;
+    size_t num_groups = regex->re_nsub + 1;
     regmatch_t *matches = malloc(sizeof(regmatch_t) * num_groups);
 
     // Build result string (dynamic buffer)
@@ -1196,7 +2271,7 @@ Value regexp_replace(Value pattern_val, Value str_val, Value replacement_val) {
 
     char *search_str = str;
 
-    while (regexec(&regex, search_str, num_groups, matches, 0) == 0) {
+    while (regexec(regex, search_str, num_groups, matches, 0) == 0) {
         // Copy text before match
         int pre_len = matches[0].rm_so;
         if (result_pos + pre_len + 1 >= cap) {
@@ -1256,7 +2331,6 @@ Value regexp_replace(Value pattern_val, Value str_val, Value replacement_val) {
 
     free(matches);
 
-    regfree(&regex);
 
     Value result = {TYPE_STRING, (long)result_str};
     return result;
@@ -1281,10 +2355,7 @@ Value str_split(Value str_val, Value sep_val) {
     }
 
     // Create result array
-    Array *result_arr = (Array*)calloc(1, sizeof(Array));
-    result_arr->size = 0;
-    result_arr->capacity = 10;
-    result_arr->data = calloc(result_arr->capacity, sizeof(Value));
+    Array *result_arr = new_array();
 
     char *current = str;
     char *next;
@@ -1300,7 +2371,7 @@ Value str_split(Value str_val, Value sep_val) {
         if (result_arr->size >= result_arr->capacity) {
             int old_capacity = result_arr->capacity;
             result_arr->capacity *= 2;
-            result_arr->data = gc_realloc(result_arr->data, TYPE_ARRAY,
+            result_arr->data = gc_realloc(result_arr->data, GC_TYPE_BUFFER,
                                           old_capacity * sizeof(Value),
                                           result_arr->capacity * sizeof(Value));
         }
@@ -1317,7 +2388,7 @@ Value str_split(Value str_val, Value sep_val) {
     if (result_arr->size >= result_arr->capacity) {
         int old_capacity = result_arr->capacity;
         result_arr->capacity *= 2;
-        result_arr->data = gc_realloc(result_arr->data, TYPE_ARRAY,
+        result_arr->data = gc_realloc(result_arr->data, GC_TYPE_BUFFER,
                                       old_capacity * sizeof(Value),
                                       result_arr->capacity * sizeof(Value));
     }
@@ -1366,11 +2437,10 @@ Value str_join(Value arr_val, Value sep_val) {
         if (elements[i].type == TYPE_STRING) {
             strcat(result_str, (char*)elements[i].data);
         } else if (elements[i].type == TYPE_INT) {
-            sprintf(temp, "%ld", elements[i].data);
+            format_long(elements[i].data, temp);
             strcat(result_str, temp);
         } else if (elements[i].type == TYPE_FLOAT) {
-            double f = *(double*)&elements[i].data;
-            sprintf(temp, "%g", f);
+            format_double(*(double*)&elements[i].data, temp);
             strcat(result_str, temp);
         } else {
             strcat(result_str, "<object>");
@@ -1437,7 +2507,7 @@ Value str_format(Value fmt_val, Value *args, int arg_count) {
         char tmp[256];
         if (*p == 'd') {
             long iv = (v.type == TYPE_INT) ? v.data : (long)value_to_double(v);
-            snprintf(tmp, sizeof(tmp), "%ld", iv);
+            format_long(iv, tmp);
         } else if (*p == 'f') {
             double dv = value_to_double(v);
             if (precision >= 0) {
@@ -1474,7 +2544,7 @@ static double value_to_double(Value v) {
     switch (v.type) {
         case TYPE_INT: return (double)v.data;
         case TYPE_FLOAT: return *(double*)&v.data;
-        case TYPE_STRING: return atof((char*)v.data);
+        case TYPE_STRING: return parse_double((char*)v.data);
         default:
             fprintf(stderr, "Math functions require numeric/string convertible types\n");
             exit(1);
@@ -1537,7 +2607,7 @@ Value remove_entry(Value obj, Value key_or_index) {
             return r;
         }
         const char *key = (char*)key_or_index.data;
-        unsigned int idx = hash(key);
+        unsigned int idx = dict_hash(key) % HASH_SIZE;
         Dict *dict = (Dict*)obj.data;
         DictEntry *entry = dict->buckets[idx];
         DictEntry *prev = NULL;
@@ -1548,9 +2618,13 @@ Value remove_entry(Value obj, Value key_or_index) {
                 } else {
                     prev->next = entry->next;
                 }
-                free(entry->key);
-                free(entry);
+                // The key is left alone: a foreach over the dict may still
+                // hold it in its key variable
+                if (!gc_is_static(entry)) {  // Static tables' entries are not malloc'ed
+                    free(entry);
+                }
                 dict->size--;
+                dict->changes++;
                 Value r = {TYPE_INT, 1};
                 return r;
             }
@@ -1675,19 +2749,15 @@ static Value parse_json_string_rt(const char **p) {
     return v;
 }
 
+// Integers that do not fit a long become floats
 static Value parse_json_number_rt(const char **p) {
-    char *endptr;
-    double d = strtod(*p, &endptr);
-    int is_float = 0;
-    for (const char *q = *p; q < endptr; q++) {
-        if (*q == '.' || *q == 'e' || *q == 'E') { is_float = 1; break; }
-    }
-    *p = endptr;
-    if (is_float) {
+    long i;
+    double d;
+    if (parse_number(*p, p, &i, &d)) {
         Value v = {TYPE_FLOAT, *(long*)&d};
         return v;
     } else {
-        Value v = {TYPE_INT, (long)d};
+        Value v = {TYPE_INT, i};
         return v;
     }
 }
@@ -1801,13 +2871,12 @@ static void json_serialize_string_rt(const char *s, char **buf, int *len, int *c
 static void json_serialize_value_rt(Value v, char **buf, int *len, int *cap) {
     switch (v.type) {
         case TYPE_INT: {
-            char tmp[64]; snprintf(tmp, sizeof(tmp), "%ld", v.data);
+            char tmp[NUMFMT_MAX]; format_long(v.data, tmp);
             sb_rt_append(buf, len, cap, tmp);
             break;
         }
         case TYPE_FLOAT: {
-            double d = *(double*)&v.data;
-            char tmp[64]; snprintf(tmp, sizeof(tmp), "%g", d);
+            char tmp[NUMFMT_MAX]; format_double(*(double*)&v.data, tmp);
             sb_rt_append(buf, len, cap, tmp);
             break;
         }
@@ -1909,6 +2978,7 @@ void __raise(Value msg, int line, char *file) {
     char *full = strdup(buf);
     Value v = {TYPE_STRING, (long)full};
     current_exception = v;
+    TINY_PROBE3(raise, full, line, file);
     if (try_top > 0) {
         longjmp(try_stack[try_top - 1], 1);
     }
@@ -1920,6 +2990,53 @@ Value __get_exception(void) {
     return current_exception;
 }
 
+// Raise an already formatted message (e.g. one carried over from a task)
+void __raise_message(const char *full) {
+    Value v = {TYPE_STRING, (long)strdup(full)};
+    current_exception = v;
+    if (try_top > 0) {
+        longjmp(try_stack[try_top - 1], 1);
+    }
+    fprintf(stderr, "%s\n", full);
+    exit(1);
+}
+
+// Run a task's function on the current thread (see task.h). Compiled code
+// passes FuncRef values; the interpreter links its own version.
+int task_call(Value fn, Value *args, int argc, void *ctx, Value *result, char **error) __attribute__((weak));
+int task_call(Value fn, Value *args, int argc, void *ctx, Value *result, char **error) {
+    (void)ctx;
+    FuncRef *f = (FuncRef*)fn.data;
+    int saved_try = try_top;
+    int saved_this = this_stack_top;
+    if (setjmp(*(jmp_buf*)__try_push_buf()) == 0) {
+        *result = f->call(args, argc);
+        try_top = saved_try;
+        return 0;
+    }
+    // Uncaught raise inside the task
+    try_top = saved_try;
+    this_stack_top = saved_this;
+    Value msg = current_exception.type == TYPE_STRING ? current_exception : to_string(current_exception);
+    *error = strdup((char*)msg.data);
+    return 1;
+}
+
+int parallel_for_call(ParallelBody body, long lo, long hi, Value **env, char **error) {
+    int saved_try = try_top;
+    int saved_this = this_stack_top;
+    if (setjmp(*(jmp_buf*)__try_push_buf()) == 0) {
+        body(lo, hi, env);
+        try_top = saved_try;
+        return 0;
+    }
+    try_top = saved_try;
+    this_stack_top = saved_this;
+    Value msg = current_exception.type == TYPE_STRING ? current_exception : to_string(current_exception);
+    *error = strdup((char*)msg.data);
+    return 1;
+}
+
 // ===== Class/Object Runtime =====
 
 static MethodEntry* find_method_entry(Class *cls, const char *name) {
@@ -2011,6 +3128,10 @@ Value instantiate_class(Value class_val, Value *args, int arg_count) {
 }
 
 Value member_get(Value instance, char *name) {
+    return member_get_h(instance, name, dict_hash(name));
+}
+
+Value member_get_h(Value instance, char *name, unsigned int hash) {
     if (instance.type != TYPE_INSTANCE) {
         Value result = {TYPE_INT, 0};
         return result;
@@ -2023,10 +3144,9 @@ Value member_get(Value instance, char *name) {
         exit(1);
     }
 
-    Value key = {TYPE_STRING, (long)name};
-    Value has = dict_has(inst->fields, key);
-    if ((has.type == TYPE_INT || has.type == TYPE_BOOL) && has.data == 1) {
-        return dict_get(inst->fields, key);
+    DictEntry *entry = dict_find((Dict*)inst->fields.data, name, hash);
+    if (entry != NULL) {
+        return entry->value;
     }
 
     MethodEntry *m = find_method_entry(inst->cls, name);
@@ -2041,6 +3161,10 @@ Value member_get(Value instance, char *name) {
 }
 
 Value member_set(Value instance, char *name, Value val) {
+    return member_set_h(instance, name, dict_hash(name), val);
+}
+
+Value member_set_h(Value instance, char *name, unsigned int hash, Value val) {
     if (instance.type != TYPE_INSTANCE) {
         Value result = {TYPE_INT, 0};
         return result;
@@ -2053,8 +3177,8 @@ Value member_set(Value instance, char *name, Value val) {
         exit(1);
     }
 
-    Value key = {TYPE_STRING, (long)name};
-    dict_set(inst->fields, key, val);
+    if (parallel_for_depth) check_shared_write(inst, "set a field of an object");
+    dict_store((Dict*)inst->fields.data, name, hash, val);
     return val;
 }
 
@@ -2081,23 +3205,43 @@ Value method_call(Value instance, char *name, Value *args, int arg_count) {
         exit(1);
     }
 
+    RT_STAT_INC(calls);
     push_this(inst);
     Value result = m->fn(instance, args, arg_count);
     pop_this();
     return result;
 }
 
+// Around a method call that codegen_llvm dispatched statically: keep the
+// privacy checks' view of the current instance as method_call does
+void method_enter(Value instance) {
+    RT_STAT_INC(calls);
+    push_this((Instance*)instance.data);
+}
+
+void method_leave(void) {
+    pop_this();
+}
+
+static void print_number(Value v) {
+    char buf[NUMFMT_MAX];
+    int n = v.type == TYPE_INT ? format_long(v.data, buf) : format_double(*(double*)&v.data, buf);
+    fwrite(buf, 1, n, stdout);
+}
+
 // Recursive print helper for arrays and dicts
+static void print_bytes(Bytes *b) {
+    char *s = bytes_repr(b);
+    fputs(s, stdout);
+    free(s);
+}
+
 static void print_value_recursive(Value v) {
     switch (v.type) {
         case TYPE_INT:
-            printf("%ld", v.data);
-            break;
-        case TYPE_FLOAT: {
-            double *fp = (double*)&v.data;
-            printf("%g", *fp);
+        case TYPE_FLOAT:
+            print_number(v);
             break;
-        }
         case TYPE_BOOL:
             printf("%s", v.data ? "true" : "false");
             break;
@@ -2135,6 +3279,9 @@ static void print_value_recursive(Value v) {
         case TYPE_NULL:
             printf("null");
             break;
+        case TYPE_BYTES:
+            print_bytes((Bytes*)v.data);
+            break;
         default:
             printf("<object>");
     }
@@ -2150,19 +3297,21 @@ void print_value(Value v) {
     } else {
         switch (v.type) {
             case TYPE_INT:
-                printf("%ld", v.data);
-                break;
-            case TYPE_FLOAT: {
-                double *fp = (double*)&v.data;
-                printf("%g", *fp);
+            case TYPE_FLOAT:
+                print_number(v);
                 break;
-            }
             case TYPE_BOOL:
                 printf("%s", v.data ? "true" : "false");
                 break;
             case TYPE_NULL:
                 printf("null");
                 break;
+            case TYPE_FUNCTION:
+                printf("<function %s>", ((FuncRef*)v.data)->name);
+                break;
+            case TYPE_BYTES:
+                print_bytes((Bytes*)v.data);
+                break;
             default:
                 printf("<object>");
         }
@@ -2190,7 +3339,7 @@ Value cmd_args(void) {
         if (arr->size >= arr->capacity) {
             int old_capacity = arr->capacity;
             arr->capacity *= 2;
-            arr->data = gc_realloc(arr->data, TYPE_ARRAY,
+            arr->data = gc_realloc(arr->data, GC_TYPE_BUFFER,
                                    old_capacity * sizeof(Value),
                                    arr->capacity * sizeof(Value));
             elements = (Value*)arr->data;
@@ -2208,9 +3357,347 @@ Value gc_stat(void) {
     return result;
 }
 
+// ===== runtime_stats() =====
+__thread RuntimeCounters rt_counters;
+
+// Registered blocks, plus the totals of threads that have already exited
+static RuntimeCounters *rt_counter_list = NULL;
+static RuntimeCounters rt_retired;
+static int rt_counter_lock = 0;
+
+static void rt_lock(void) {
+    while (__atomic_exchange_n(&rt_counter_lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&rt_counter_lock, __ATOMIC_RELAXED)) { }
+    }
+}
+
+static void rt_unlock(void) {
+    __atomic_store_n(&rt_counter_lock, 0, __ATOMIC_RELEASE);
+}
+
+static void rt_counters_add(RuntimeCounters *dst, RuntimeCounters *src) {
+    for (int i = 0; i < RT_STAT_TYPES; i++) {
+        dst->alloc_count[i] += __atomic_load_n(&src->alloc_count[i], __ATOMIC_RELAXED);
+        dst->alloc_bytes[i] += __atomic_load_n(&src->alloc_bytes[i], __ATOMIC_RELAXED);
+    }
+    dst->dict_lookups += __atomic_load_n(&src->dict_lookups, __ATOMIC_RELAXED);
+    dst->dict_probes += __atomic_load_n(&src->dict_probes, __ATOMIC_RELAXED);
+    dst->regex_cache_hits += __atomic_load_n(&src->regex_cache_hits, __ATOMIC_RELAXED);
+    dst->regex_cache_misses += __atomic_load_n(&src->regex_cache_misses, __ATOMIC_RELAXED);
+    dst->calls += __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+}
+
+// Called by each thread that runs script code (the main thread from gc_init)
+void runtime_stats_register_thread(void) {
+    rt_lock();
+    RuntimeCounters *c = rt_counter_list;
+    while (c != NULL && c != &rt_counters) c = c->next;
+    if (c == NULL) {
+        rt_counters.next = rt_counter_list;
+        rt_counter_list = &rt_counters;
+    }
+    rt_unlock();
+}
+
+// Folds the calling thread's counts into the retired totals before exit
+void runtime_stats_unregister_thread(void) {
+    rt_lock();
+    RuntimeCounters **link = &rt_counter_list;
+    while (*link != NULL && *link != &rt_counters) link = &(*link)->next;
+    if (*link != NULL) {
+        *link = rt_counters.next;
+        rt_counters_add(&rt_retired, &rt_counters);
+    }
+    rt_unlock();
+}
+
+static void stats_put(Value dict, const char *key, long n) {
+    Value k = {TYPE_STRING, (long)key};
+    Value v = {TYPE_INT, n};
+    dict_set(dict, k, v);
+}
+
+static const char *stats_type_names[] = {
+    "buffer", "int", "float", "string", "array", "dict", "class", "instance", "null", "bool",
+    "function", "task", "iterator", "bytes", "other"
+};
+_Static_assert(sizeof(stats_type_names) / sizeof(stats_type_names[0]) == RT_STAT_TYPES,
+               "stats_type_names needs a name for every TYPE_ tag");
+
+// Snapshot of GC and runtime counters as a dict - callable from TL scripts
+Value runtime_stats(void) {
+    RuntimeCounters total;
+    memset(&total, 0, sizeof(total));
+    rt_lock();
+    rt_counters_add(&total, &rt_retired);
+    for (RuntimeCounters *c = rt_counter_list; c != NULL; c = c->next) {
+        rt_counters_add(&total, c);
+    }
+    rt_unlock();
+
+    Value result = make_dict();
+    stats_put(result, "heap_bytes", (long)gc.heap_size);
+    stats_put(result, "objects", gc.num_objects);
+    stats_put(result, "gc_threshold", gc.max_objects);
+    stats_put(result, "collections", gc.total_collections);
+    stats_put(result, "gc_pause_us", (long)gc.total_pause_us);
+    stats_put(result, "gc_max_pause_us", (long)gc.max_pause_us);
+    stats_put(result, "objects_freed", gc.total_objects_freed);
+    stats_put(result, "bytes_freed", (long)gc.total_bytes_freed);
+
+    Value by_count = make_dict();
+    Value by_bytes = make_dict();
+    for (int i = 0; i < RT_STAT_TYPES; i++) {
+        if (total.alloc_count[i] == 0) continue;
+        stats_put(by_count, stats_type_names[i], total.alloc_count[i]);
+        stats_put(by_bytes, stats_type_names[i], total.alloc_bytes[i]);
+    }
+    Value k_count = {TYPE_STRING, (long)"alloc_count"};
+    Value k_bytes = {TYPE_STRING, (long)"alloc_bytes"};
+    dict_set(result, k_count, by_count);
+    dict_set(result, k_bytes, by_bytes);
+
+    stats_put(result, "dict_lookups", total.dict_lookups);
+    stats_put(result, "dict_probes", total.dict_probes);
+    stats_put(result, "regex_cache_hits", total.regex_cache_hits);
+    stats_put(result, "regex_cache_misses", total.regex_cache_misses);
+    stats_put(result, "calls", total.calls);
+    return result;
+}
+
 // Force garbage collection - callable from TL scripts
 Value gc_run(void) {
     gc_collect();
     Value result = {TYPE_NULL, 0};
     return result;
 }
+
+// ===== --instrument hotness report =====
+// Sites are registered by a module constructor (one table per object module
+// with --cache-dir); every table's sites are appended to one list, and a
+// single report covering all of them is written at exit to stderr, or to
+// $TINY_INSTR_OUT. $TINY_INSTR_TOP limits the line list.
+static InstrSite **instr_sites = NULL;
+static int instr_site_count = 0;
+static int instr_hooked = 0;  // instr_report is registered with atexit
+
+typedef struct {
+    const char *func;
+    const char *file;
+    int line;
+    long count;
+} InstrLine;
+
+static int instr_site_cmp(const void *a, const void *b) {
+    const InstrLine *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    int c = strcmp(x->file, y->file);
+    if (c != 0) return c;
+    return x->line - y->line;
+}
+
+static int instr_line_key_cmp(const void *a, const void *b) {
+    const InstrLine *x = a, *y = b;
+    int c = strcmp(x->file, y->file);
+    if (c != 0) return c;
+    return x->line - y->line;
+}
+
+static const char *instr_base(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static void instr_report(void) {
+    FILE *out = stderr;
+    const char *path = getenv("TINY_INSTR_OUT");
+    if (path && *path) {
+        out = fopen(path, "w");
+        if (!out) {
+            fprintf(stderr, "instrument: cannot write %s\n", path);
+            return;
+        }
+    }
+    int top = 20;
+    const char *top_env = getenv("TINY_INSTR_TOP");
+    if (top_env && *top_env) top = atoi(top_env);
+    fflush(stdout);
+
+    InstrLine *funcs = malloc(sizeof(InstrLine) * (instr_site_count + 1));
+    InstrLine *lines = malloc(sizeof(InstrLine) * (instr_site_count + 1));
+    int nfuncs = 0, nlines = 0;
+    long total = 0;
+    for (int i = 0; i < instr_site_count; i++) {
+        InstrSite *s = instr_sites[i];
+        InstrLine entry = {s->func, s->file, s->line, *s->count};
+        if (s->is_entry) {
+            if (entry.count > 0) funcs[nfuncs++] = entry;
+        } else {
+            lines[nlines++] = entry;
+            total += entry.count;
+        }
+    }
+
+    // Several statements can share a source line: merge them
+    qsort(lines, nlines, sizeof(InstrLine), instr_line_key_cmp);
+    int merged = 0;
+    for (int i = 0; i < nlines; i++) {
+        if (merged > 0 && instr_line_key_cmp(&lines[merged - 1], &lines[i]) == 0) {
+            lines[merged - 1].count += lines[i].count;
+        } else {
+            lines[merged++] = lines[i];
+        }
+    }
+    nlines = merged;
+
+    qsort(funcs, nfuncs, sizeof(InstrLine), instr_site_cmp);
+    qsort(lines, nlines, sizeof(InstrLine), instr_site_cmp);
+
+    fprintf(out, "=== Function calls ===\n");
+    for (int i = 0; i < nfuncs; i++) {
+        fprintf(out, "%12ld  %s (%s:%d)\n", funcs[i].count, funcs[i].func,
+                instr_base(funcs[i].file), funcs[i].line);
+    }
+    fprintf(out, "=== Hot lines (%ld statements executed) ===\n", total);
+    for (int i = 0; i < nlines && (top <= 0 || i < top); i++) {
+        if (lines[i].count == 0) break;
+        fprintf(out, "%12ld  %5.1f%%  %s:%d  %s\n", lines[i].count,
+                total > 0 ? 100.0 * lines[i].count / total : 0.0,
+                instr_base(lines[i].file), lines[i].line, lines[i].func);
+    }
+
+    free(funcs);
+    free(lines);
+    if (out != stderr) fclose(out);
+}
+
+void instr_register(InstrSite *sites, int count) {
+    if (!instr_hooked) {
+        atexit(instr_report);
+        instr_hooked = 1;
+    }
+    instr_sites = realloc(instr_sites, (instr_site_count + count + 1) * sizeof(InstrSite*));
+    for (int i = 0; i < count; i++) instr_sites[instr_site_count++] = &sites[i];
+}
+
+// ===== --profile-gen type feedback =====
+// Sites are registered by module constructors, like --instrument's. At exit
+// their counts are added to the profile file ($TINY_PROFILE_OUT, default
+// profile.data), so several runs accumulate into one profile for
+// codegen_llvm --profile-use.
+// One site per line: "kind line ordinal count0 count1 count2 count3 file".
+static ProfSite **prof_sites = NULL;
+static int prof_site_count = 0;
+static const char *prof_kind_names[] = {"binop", "index"};
+
+static inline void prof_bump(long *counts, int bucket) {
+    // Outlined parallel for bodies bump from several threads; counts may
+    // lose an update there but never tear
+    __atomic_store_n(&counts[bucket], __atomic_load_n(&counts[bucket], __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+}
+
+void prof_binop(long *counts, Value left, Value right) {
+    int bucket = PROF_OTHER;
+    if (left.type == right.type) {
+        if (left.type == TYPE_INT) bucket = PROF_INT_INT;
+        else if (left.type == TYPE_FLOAT) bucket = PROF_FLOAT_FLOAT;
+        else if (left.type == TYPE_STRING) bucket = PROF_STR_STR;
+    }
+    prof_bump(counts, bucket);
+}
+
+void prof_index(long *counts, Value obj, Value index) {
+    int bucket = PROF_OTHER;
+    if (obj.type == TYPE_ARRAY && index.type == TYPE_INT) bucket = PROF_ARRAY_INT;
+    else if (obj.type == TYPE_DICT && index.type == TYPE_STRING) bucket = PROF_DICT_STR;
+    else if (obj.type == TYPE_STRING && index.type == TYPE_INT) bucket = PROF_STR_INT;
+    prof_bump(counts, bucket);
+}
+
+int prof_record_cmp(const void *a, const void *b) {
+    const ProfRecord *x = a, *y = b;
+    if (x->kind != y->kind) return x->kind - y->kind;
+    if (x->line != y->line) return x->line - y->line;
+    if (x->ordinal != y->ordinal) return x->ordinal - y->ordinal;
+    return strcmp(x->file, y->file);
+}
+
+int prof_read(const char *path, ProfRecord **records) {
+    FILE *in = fopen(path, "r");
+    if (!in) return -1;
+    int n = 0, cap = 64;
+    ProfRecord *recs = malloc(cap * sizeof(ProfRecord));
+    char line[4096];
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') continue;
+        ProfRecord r;
+        char kind[16];
+        int file_at = 0;
+        if (sscanf(line, "%15s %d %d %ld %ld %ld %ld %n", kind, &r.line, &r.ordinal,
+                   &r.counts[0], &r.counts[1], &r.counts[2], &r.counts[3], &file_at) != 7 ||
+            file_at == 0 || line[file_at] == '\0') {
+            continue;
+        }
+        r.kind = -1;
+        for (int k = 0; k < 2; k++) {
+            if (strcmp(kind, prof_kind_names[k]) == 0) r.kind = k;
+        }
+        if (r.kind < 0) continue;
+        line[strcspn(line, "\n")] = '\0';
+        r.file = strdup(line + file_at);
+        if (n == cap) {
+            cap *= 2;
+            recs = realloc(recs, cap * sizeof(ProfRecord));
+        }
+        recs[n++] = r;
+    }
+    fclose(in);
+    qsort(recs, n, sizeof(ProfRecord), prof_record_cmp);
+    *records = recs;
+    return n;
+}
+
+static void prof_write(void) {
+    const char *path = getenv("TINY_PROFILE_OUT");
+    if (!path || !*path) path = "profile.data";
+
+    ProfRecord *recs = NULL;
+    int n = prof_read(path, &recs);
+    if (n < 0) n = 0;
+    int old = n;
+    recs = realloc(recs, (n + prof_site_count + 1) * sizeof(ProfRecord));
+    for (int i = 0; i < prof_site_count; i++) {
+        ProfSite *s = prof_sites[i];
+        ProfRecord key = {s->kind, (char*)s->file, s->line, s->ordinal, {0}};
+        ProfRecord *hit = bsearch(&key, recs, old, sizeof(ProfRecord), prof_record_cmp);
+        if (!hit) {
+            hit = &recs[n++];
+            *hit = key;
+        }
+        for (int b = 0; b < PROF_BUCKETS; b++) {
+            hit->counts[b] += __atomic_load_n(&s->counts[b], __ATOMIC_RELAXED);
+        }
+    }
+    qsort(recs, n, sizeof(ProfRecord), prof_record_cmp);
+
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "profile: cannot write %s\n", path);
+        return;
+    }
+    fprintf(out, "# tiny type profile: kind line ordinal int/array float/dict string other file\n");
+    for (int i = 0; i < n; i++) {
+        ProfRecord *r = &recs[i];
+        fprintf(out, "%s %d %d %ld %ld %ld %ld %s\n", prof_kind_names[r->kind], r->line, r->ordinal,
+                r->counts[0], r->counts[1], r->counts[2], r->counts[3], r->file);
+    }
+    fclose(out);
+    free(recs);
+}
+
+void prof_register(ProfSite *sites, int count) {
+    if (prof_sites == NULL) atexit(prof_write);
+    prof_sites = realloc(prof_sites, (prof_site_count + count + 1) * sizeof(ProfSite*));
+    for (int i = 0; i < count; i++) prof_sites[prof_site_count++] = &sites[i];
+}
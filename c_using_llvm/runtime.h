@@ -15,6 +15,11 @@
 #define TYPE_INSTANCE 6
 #define TYPE_NULL 7
 #define TYPE_BOOL 8
+#define TYPE_FUNCTION 9   // FuncRef* (function used as a value, compiled code)
+#define TYPE_TASK 10      // Task handle returned by spawn() (its id, see task.c)
+#define TYPE_ITERATOR 11  // Iterator* (csv_rows, generators): values produced on demand
+#define TYPE_BYTES 12     // Bytes*: binary data with an explicit length
+#define TYPE_COUNT 13     // One past the highest tag above
 
 // Value structure matching LLVM IR
 typedef struct {
@@ -34,6 +39,7 @@ typedef struct Array {
 
 typedef struct DictEntry {
     char *key;
+    unsigned int hash;     // dict_hash(key)
     Value value;
     struct DictEntry *next;
 } DictEntry;
@@ -41,8 +47,20 @@ typedef struct DictEntry {
 typedef struct Dict {
     DictEntry **buckets;
     int size;
+    int changes;  // Bumped when an entry is added or removed (foreach)
 } Dict;
 
+// Hash of a dict key (its bucket is hash % HASH_SIZE). The hash of a string
+// literal key or member name is computed once, at compile or parse time,
+// and passed to the *_h entry points. Must match ast_string_hash (ast.h).
+static inline unsigned int dict_hash(const char *key) {
+    unsigned int h = 0;
+    while (*key) {
+        h = h * 31 + *key++;
+    }
+    return h;
+}
+
 // Class/instance helpers
 typedef Value (*MethodFn)(Value this_val, Value *args, int arg_count);
 typedef Value (*FieldInitFn)(Value this_val);
@@ -75,6 +93,62 @@ typedef struct Instance {
     Value fields; // dict value storing member fields
 } Instance;
 
+// A user function referenced as a value in compiled code: `call` unpacks the
+// argument vector and calls the function (codegen emits one per function)
+typedef struct FuncRef {
+    Value (*call)(Value *args, int arg_count);
+    int arity;
+    const char *name;
+} FuncRef;
+
+// Binary data (bytes values), which may contain zero bytes. A slice shares
+// the storage of what it was cut from: data points into it and owner keeps
+// it alive. Otherwise owner is NULL and the bytes follow the header.
+typedef struct Bytes {
+    unsigned char *data;
+    long len;
+    struct Bytes *owner;
+} Bytes;
+
+// Handed to an iterator's roots hook by the collector: scan conservatively
+// marks what the words in [start, end) point to, mark marks one value
+typedef struct RootVisitor {
+    void (*scan)(struct RootVisitor *v, void *start, void *end);
+    void (*mark)(struct RootVisitor *v, Value val);
+} RootVisitor;
+
+// A lazy sequence consumed by foreach: next stores the next value in *out
+// and returns 1, or returns 0 once exhausted; close (may be NULL) releases
+// what state holds, roots (may be NULL) visits the values it keeps alive.
+// Iterators are GC objects, and an abandoned one is closed when it is
+// collected.
+typedef struct Iterator {
+    int (*next)(struct Iterator *it, Value *out);
+    void (*close)(struct Iterator *it);
+    void (*roots)(struct Iterator *it, RootVisitor *v);
+    void *state;
+    long count;  // Values produced so far (the foreach key of the next one)
+} Iterator;
+
+// Position of a foreach over an array, dict, string or iterator (codegen_llvm
+// keeps it in the loop's frame as %IterState and steps arrays itself while
+// pos < end and the array's storage is still at base). An array yields the
+// elements it had when the loop started; a dict is walked bucket by bucket,
+// and entries may be added or removed by the loop body.
+typedef struct IterState {
+    Value coll;
+    Value *pos;         // Array: next element
+    Value *end;         // Array: end of the elements being walked
+    Value *base;        // Array: its storage when pos and end were set
+    long count;         // Array: elements when the loop started; string: length
+    long index;         // String: next position
+    DictEntry *entry;   // Dict: the entry visited last (NULL before the first)
+    DictEntry *after;   // Dict: the entry that followed it then
+    int bucket;         // Dict: its bucket,
+    int place;          //   how many entries precede it there,
+    int changes;        //   and the dict's changes then
+} IterState;
+
 // Runtime functions
 Value make_array(void);
 Value append(Value arr, Value val);
@@ -90,6 +164,7 @@ Value str(Value v);
 Value make_null(void);
 Value type(Value v);
 Value slice_access(Value obj, Value start_v, Value end_v);
+Value slice_access_into(Value obj, Value start_v, Value end_v, Array *dst);
 Value input(Value prompt);
 Value file_read(Value filename);
 Value file_write(Value content, Value filename);
@@ -97,11 +172,49 @@ Value file_append(Value content, Value filename);
 Value file_size(Value filename);
 Value file_exist(Value filename);
 
+// Bytes
+Value make_bytes(const void *data, long len);
+Value to_bytes(Value v);  // bytes(): from a string, an array of ints or a length
+Value file_read_bytes(Value filename);
+Value bytes_find(Value b, Value needle, Value start);
+Value bytes_decode(Value b, Value offset, Value fmt);
+Value bytes_encode(Value fmt, Value v);
+Value bytes_str(Value b);
+
+// Iterators
+Value make_iterator(int (*next)(Iterator*, Value*), void (*close)(Iterator*), void *state);
+int iterator_next(Iterator *it, Value *out);  // Closes the iterator at the end
+void iterator_close(Iterator *it);
+void iter_begin(Value coll, IterState *st);
+int iter_next(IterState *st, Value *key, Value *value);
+
+// Generators (functions whose body contains yield). A call returns an
+// iterator; its first next runs body(args, ctx) on a stack of its own, and
+// every gen_yield in it hands a value to the consumer and suspends the body
+// there until the next one. A raise that leaves the body is raised again in
+// the consumer. args are copied; ctx_roots (may be NULL) visits what ctx
+// keeps alive and ctx_free (may be NULL) releases it with the iterator.
+typedef void (*GeneratorBody)(Value *args, void *ctx);
+Value make_generator(GeneratorBody body, void *ctx, Value *args, int nargs,
+                     void (*ctx_roots)(void *ctx, RootVisitor *v), void (*ctx_free)(void *ctx));
+void gen_yield(Value v);
+
+// CSV: csv_rows iterates over the rows of a file (arrays of fields),
+// csv_read returns them all. opts (a dict or null): "sep" (one character,
+// default ","), "header" (skip the first row), "types" (per column "str",
+// "int" or "float"; empty numeric fields are null)
+Value csv_rows(Value path, Value opts);
+Value csv_read(Value path, Value opts);
+
 // Dict functions
 Value make_dict(void);
 Value dict_set(Value dict, Value key, Value val);
 Value dict_get(Value dict, Value key);
 Value dict_has(Value dict, Value key);
+// obj[key] and obj[key] = val for a literal string key, hash = dict_hash(key);
+// like index_get/index_set when obj is not a dict
+Value dict_get_h(Value obj, char *key, unsigned int hash);
+Value dict_set_h(Value obj, char *key, unsigned int hash, Value val);
 Value dict_keys(Value dict);
 Value keys(Value dict);  // Alias for dict_keys (matches builtin name)
 
@@ -147,6 +260,7 @@ Value json_decode(Value v);
 void* __try_push_buf(void);
 void __try_pop(void);
 void __raise(Value msg, int line, char *file);
+void __raise_message(const char *full);
 Value __get_exception(void);
 
 // Print function (for LLVM codegen)
@@ -154,6 +268,7 @@ void print_value(Value v);
 
 // Misc helpers
 Value remove_entry(Value obj, Value key_or_index);
+int is_truthy_rt(Value v);
 
 // Class/object runtime
 Value make_class(char *name);
@@ -162,7 +277,11 @@ void class_add_method(Value class_val, char *name, MethodFn fn, int arity, int i
 Value instantiate_class(Value class_val, Value *args, int arg_count);
 Value member_get(Value instance, char *name);
 Value member_set(Value instance, char *name, Value val);
+Value member_get_h(Value instance, char *name, unsigned int hash);  // hash = dict_hash(name)
+Value member_set_h(Value instance, char *name, unsigned int hash, Value val);
 Value method_call(Value instance, char *name, Value *args, int arg_count);
+void method_enter(Value instance);
+void method_leave(void);
 
 // Command line arguments
 void set_cmd_args(int argc, char **argv);
@@ -172,4 +291,80 @@ Value cmd_args(void);
 Value gc_stat(void);
 Value gc_run(void);
 
+// Runtime counters behind runtime_stats(). Every thread owns a block and
+// bumps it with relaxed atomics (a plain load/add/store, no lock prefix);
+// runtime_stats() sums the blocks of all registered threads.
+// gc_alloc types, indexed by type + 1 (buffer = -1); any other type (the
+// interpreter's own tags) is counted in the last slot, "other"
+#define RT_STAT_TYPES (TYPE_COUNT + 2)
+#define RT_STAT_INDEX(type) ((type) >= -1 && (type) < TYPE_COUNT ? (type) + 1 : RT_STAT_TYPES - 1)
+
+typedef struct RuntimeCounters {
+    long alloc_count[RT_STAT_TYPES];
+    long alloc_bytes[RT_STAT_TYPES];
+    long dict_lookups;
+    long dict_probes;        // chain entries compared
+    long regex_cache_hits;
+    long regex_cache_misses;
+    long calls;              // interpreted calls / dynamic method dispatches
+    struct RuntimeCounters *next;
+} RuntimeCounters;
+
+extern __thread RuntimeCounters rt_counters;
+
+#define RT_STAT_ADD(field, n) \
+    __atomic_store_n(&rt_counters.field, \
+                     __atomic_load_n(&rt_counters.field, __ATOMIC_RELAXED) + (n), \
+                     __ATOMIC_RELAXED)
+#define RT_STAT_INC(field) RT_STAT_ADD(field, 1)
+
+void runtime_stats_register_thread(void);
+void runtime_stats_unregister_thread(void);
+Value runtime_stats(void);
+
+// Execution counters emitted by codegen_llvm --instrument
+typedef struct {
+    const char *func;   // enclosing function ("Class.method", "<main>")
+    const char *file;
+    int line;
+    int is_entry;       // 1 = function entry, 0 = statement
+    long *count;
+} InstrSite;
+void instr_register(InstrSite *sites, int count);
+
+// Type feedback recorded by codegen_llvm --profile-gen: every binary_op and
+// index_get site counts which operand types reach it, in PROF_BUCKETS buckets
+#define PROF_SITE_BINOP 0
+#define PROF_SITE_INDEX 1
+#define PROF_BUCKETS 4
+#define PROF_INT_INT 0      // binop: int, int
+#define PROF_FLOAT_FLOAT 1  // binop: float, float
+#define PROF_STR_STR 2      // binop: string, string
+#define PROF_ARRAY_INT 0    // index: array[int]
+#define PROF_DICT_STR 1     // index: dict[string]
+#define PROF_STR_INT 2      // index: string[int]
+#define PROF_OTHER 3
+
+typedef struct {
+    int kind;           // PROF_SITE_*
+    const char *file;
+    int line;
+    int ordinal;        // Among the sites of this kind on the line
+    long *counts;       // PROF_BUCKETS counters
+} ProfSite;
+void prof_register(ProfSite *sites, int count);
+void prof_binop(long *counts, Value left, Value right);
+void prof_index(long *counts, Value obj, Value index);
+
+// One site of a profile file, as read back by codegen_llvm --profile-use
+typedef struct ProfRecord {
+    int kind;
+    char *file;
+    int line;
+    int ordinal;
+    long counts[PROF_BUCKETS];
+} ProfRecord;
+int prof_read(const char *path, ProfRecord **records);  // Sorted by prof_record_cmp; -1 if unreadable
+int prof_record_cmp(const void *a, const void *b);
+
 #endif
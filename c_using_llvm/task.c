@@ -0,0 +1,908 @@
+#include "task.h"
+#include "gc.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+
+// ===== Transfer arena =====
+// Values crossing between threads are first copied into malloc'd memory that
+// no GC owns (the "transfer" copy), then into the receiving thread's heap.
+// The transfer copy lives in an arena so it can be dropped in one go.
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+#define ARENA_BLOCK_SIZE 4096
+
+static void *arena_alloc(Arena *a, size_t n) {
+    n = (n + 15) & ~(size_t)15;
+    ArenaBlock *b = a->head;
+    if (!b || b->used + n > b->cap) {
+        size_t cap = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(ArenaBlock) + cap);
+        if (!b) {
+            fprintf(stderr, "Error: task: out of memory\n");
+            exit(1);
+        }
+        b->used = 0;
+        b->cap = cap;
+        b->next = a->head;
+        a->head = b;
+    }
+    void *p = b->data + b->used;
+    b->used += n;
+    memset(p, 0, n);
+    return p;
+}
+
+static void arena_free(Arena *a) {
+    ArenaBlock *b = a->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
+
+// ===== Deep copy =====
+// Copies a value graph either into an arena (to = arena) or into the calling
+// thread's GC heap (to = NULL). Already copied arrays/dicts/instances are
+// remembered so shared references and cycles survive the copy.
+
+typedef struct {
+    void **keys;
+    void **vals;
+    size_t cap;
+    size_t count;
+} CopyMap;
+
+typedef struct {
+    Arena *to;
+    CopyMap seen;
+} Copier;
+
+static size_t copymap_slot(CopyMap *m, void *key) {
+    size_t i = ((uintptr_t)key >> 4) * 11400714819323198485UL;
+    for (i &= m->cap - 1; m->keys[i] && m->keys[i] != key; i = (i + 1) & (m->cap - 1)) {
+    }
+    return i;
+}
+
+static void *copymap_get(CopyMap *m, void *key) {
+    if (m->count == 0) return NULL;
+    return m->vals[copymap_slot(m, key)];
+}
+
+static void copymap_put(CopyMap *m, void *key, void *val) {
+    if ((m->count + 1) * 2 > m->cap) {
+        CopyMap old = *m;
+        m->cap = old.cap ? old.cap * 2 : 64;
+        m->keys = calloc(m->cap, sizeof(void*));
+        m->vals = calloc(m->cap, sizeof(void*));
+        for (size_t i = 0; i < old.cap; i++) {
+            if (old.keys[i]) {
+                size_t j = copymap_slot(m, old.keys[i]);
+                m->keys[j] = old.keys[i];
+                m->vals[j] = old.vals[i];
+            }
+        }
+        free(old.keys);
+        free(old.vals);
+    }
+    size_t i = copymap_slot(m, key);
+    m->keys[i] = key;
+    m->vals[i] = val;
+    m->count++;
+}
+
+static void *copy_alloc(Copier *c, int type, size_t size) {
+    return c->to ? arena_alloc(c->to, size) : gc_alloc(type, size);
+}
+
+static Value copy_value(Copier *c, Value v) {
+    if (!v.data) return v;
+    switch (v.type) {
+        case TYPE_STRING: {
+            const char *src = (const char*)v.data;
+            size_t len = strlen(src) + 1;
+            char *dst = copy_alloc(c, TYPE_STRING, len);
+            memcpy(dst, src, len);
+            return (Value){TYPE_STRING, (long)dst};
+        }
+        case TYPE_ARRAY: {
+            Array *src = (Array*)v.data;
+            Array *dst = copymap_get(&c->seen, src);
+            if (dst) return (Value){TYPE_ARRAY, (long)dst};
+            dst = copy_alloc(c, TYPE_ARRAY, sizeof(Array));
+            copymap_put(&c->seen, src, dst);
+            dst->capacity = src->size > 8 ? src->size : 8;
+            dst->data = copy_alloc(c, GC_TYPE_BUFFER, dst->capacity * sizeof(Value));
+            // size grows with the copy so a collection triggered by a nested
+            // allocation only sees initialized elements
+            for (int i = 0; i < src->size; i++) {
+                Value elem = copy_value(c, ((Value*)src->data)[i]);
+                ((Value*)dst->data)[i] = elem;
+                dst->size = i + 1;
+            }
+            return (Value){TYPE_ARRAY, (long)dst};
+        }
+        case TYPE_DICT: {
+            Dict *src = (Dict*)v.data;
+            Dict *dst = copymap_get(&c->seen, src);
+            if (dst) return (Value){TYPE_DICT, (long)dst};
+            dst = copy_alloc(c, TYPE_DICT, sizeof(Dict));
+            copymap_put(&c->seen, src, dst);
+            dst->buckets = copy_alloc(c, GC_TYPE_BUFFER, HASH_SIZE * sizeof(DictEntry*));
+            if (!src->buckets) return (Value){TYPE_DICT, (long)dst};
+            // Same bucket and chain order, so keys() order is unchanged
+            for (int i = 0; i < HASH_SIZE; i++) {
+                DictEntry **tail = &dst->buckets[i];
+                for (DictEntry *e = src->buckets[i]; e; e = e->next) {
+                    DictEntry *ne;
+                    if (c->to) {
+                        size_t klen = strlen(e->key) + 1;
+                        ne = arena_alloc(c->to, sizeof(DictEntry));
+                        ne->key = arena_alloc(c->to, klen);
+                        memcpy(ne->key, e->key, klen);
+                    } else {
+                        // Entries and keys are malloc'd, as in dict_set
+                        ne = calloc(1, sizeof(DictEntry));
+                        ne->key = strdup(e->key);
+                    }
+                    ne->hash = e->hash;
+                    ne->value = (Value){TYPE_NULL, 0};
+                    *tail = ne;
+                    tail = &ne->next;
+                    dst->size++;
+                    Value val = copy_value(c, e->value);
+                    ne->value = val;
+                }
+            }
+            return (Value){TYPE_DICT, (long)dst};
+        }
+        case TYPE_INSTANCE: {
+            Instance *src = (Instance*)v.data;
+            Instance *dst = copymap_get(&c->seen, src);
+            if (dst) return (Value){TYPE_INSTANCE, (long)dst};
+            dst = copy_alloc(c, TYPE_INSTANCE, sizeof(Instance));
+            copymap_put(&c->seen, src, dst);
+            dst->cls = src->cls;  // Class definitions are shared
+            dst->fields = (Value){TYPE_NULL, 0};
+            Value fields = copy_value(c, src->fields);
+            dst->fields = fields;
+            return (Value){TYPE_INSTANCE, (long)dst};
+        }
+        case TYPE_BYTES: {
+            // Only the viewed bytes; a slice's copy owns its data
+            Bytes *src = (Bytes*)v.data;
+            Bytes *dst = copy_alloc(c, TYPE_BYTES, sizeof(Bytes) + src->len);
+            dst->data = (unsigned char*)(dst + 1);
+            dst->len = src->len;
+            dst->owner = NULL;
+            memcpy(dst->data, src->data, src->len);
+            return (Value){TYPE_BYTES, (long)dst};
+        }
+        case TYPE_ITERATOR:
+            // Its state (e.g. an open file) belongs to this thread
+            fprintf(stderr, "Error: an iterator cannot be passed to or returned from a task\n");
+            exit(1);
+        default:
+            // Scalars, classes, functions and task handles
+            return v;
+    }
+}
+
+static Value copy_graph(Value v, Arena *to) {
+    Copier c = {to, {NULL, NULL, 0, 0}};
+    Value result = copy_value(&c, v);
+    free(c.seen.keys);
+    free(c.seen.vals);
+    return result;
+}
+
+// ===== Tasks and the worker pool =====
+
+enum { TASK_QUEUED, TASK_RUNNING, TASK_DONE };
+
+typedef struct ParallelLoop ParallelLoop;
+
+struct Task {
+    ParallelLoop *loop;   // Set for parallel_for helpers, which only run chunks
+    Value fn;
+    void *ctx;
+    int arg_count;
+    Value *args;          // Transfer copies (in arena)
+    Arena arena;          // Holds the arguments, later the result
+    Value result;         // Transfer copy of the result
+    char *error;          // Message of an uncaught raise, or NULL
+    int state;
+    long id;              // What the TYPE_TASK handle holds
+    Task *next_handle;    // Chain in the handle table
+};
+
+// Deque of queued tasks. The owner pushes and pops at the bottom, thieves
+// take from the top. A mutex per deque keeps it simple; tasks are coarse
+// (a whole function call) so the lock is not the bottleneck.
+typedef struct {
+    pthread_mutex_t lock;
+    Task **items;         // Ring buffer
+    int head;             // Top (oldest)
+    int count;
+    int cap;
+} TaskDeque;
+
+static struct {
+    int nworkers;
+    TaskDeque *deques;    // One per worker
+    TaskDeque shared;     // Submissions from threads outside the pool
+    int queued;           // Tasks sitting in any deque
+    int sleepers;         // Threads waiting on wake
+    pthread_mutex_t lock;
+    pthread_cond_t wake;  // New work queued or a task finished
+} pool;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static __thread int worker_id = -1;  // Index into pool.deques, -1 outside the pool
+
+static void deque_init(TaskDeque *d) {
+    pthread_mutex_init(&d->lock, NULL);
+    d->cap = 64;
+    d->items = malloc(d->cap * sizeof(Task*));
+    d->head = 0;
+    d->count = 0;
+}
+
+static void deque_push(TaskDeque *d, Task *t) {
+    pthread_mutex_lock(&d->lock);
+    if (d->count == d->cap) {
+        Task **items = malloc(d->cap * 2 * sizeof(Task*));
+        for (int i = 0; i < d->count; i++) {
+            items[i] = d->items[(d->head + i) % d->cap];
+        }
+        free(d->items);
+        d->items = items;
+        d->head = 0;
+        d->cap *= 2;
+    }
+    d->items[(d->head + d->count) % d->cap] = t;
+    __atomic_store_n(&d->count, d->count + 1, __ATOMIC_RELAXED);  // Peeked by deque_steal
+    pthread_mutex_unlock(&d->lock);
+}
+
+static Task *deque_pop(TaskDeque *d) {
+    Task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        __atomic_store_n(&d->count, d->count - 1, __ATOMIC_RELAXED);
+        t = d->items[(d->head + d->count) % d->cap];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+static Task *deque_steal(TaskDeque *d) {
+    if (__atomic_load_n(&d->count, __ATOMIC_RELAXED) == 0) return NULL;
+    Task *t = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->count > 0) {
+        t = d->items[d->head];
+        d->head = (d->head + 1) % d->cap;
+        __atomic_store_n(&d->count, d->count - 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&d->lock);
+    return t;
+}
+
+static void pool_wake(void) {
+    if (__atomic_load_n(&pool.sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_broadcast(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+// Own deque first (most recently spawned, still warm), then the shared
+// queue, then steal the oldest task of another worker
+static Task *take_task(void) {
+    if (__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0) return NULL;
+    Task *t = NULL;
+    if (worker_id >= 0) t = deque_pop(&pool.deques[worker_id]);
+    if (!t) t = deque_steal(&pool.shared);
+    for (int i = 1; !t && i <= pool.nworkers; i++) {
+        int victim = ((worker_id < 0 ? 0 : worker_id) + i) % pool.nworkers;
+        t = deque_steal(&pool.deques[victim]);
+    }
+    if (t) __atomic_sub_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static void loop_help(Task *t);
+
+static void run_task(Task *t) {
+    if (t->loop) {
+        loop_help(t);
+        return;
+    }
+    __atomic_store_n(&t->state, TASK_RUNNING, __ATOMIC_RELAXED);
+
+    // The argument vector is a GC buffer on this thread's stack, so the
+    // imported arguments stay reachable while the rest are copied
+    Value *args = NULL;
+    if (t->arg_count > 0) {
+        args = gc_alloc(GC_TYPE_BUFFER, t->arg_count * sizeof(Value));
+        for (int i = 0; i < t->arg_count; i++) {
+            Value arg = copy_graph(t->args[i], NULL);
+            args[i] = arg;
+        }
+    }
+    arena_free(&t->arena);
+    t->args = NULL;
+
+    Value result = {TYPE_NULL, 0};
+    char *error = NULL;
+    task_globals_hidden++;
+    int failed = task_call(t->fn, args, t->arg_count, t->ctx, &result, &error);
+    task_globals_hidden--;
+    if (!failed) {
+        t->result = copy_graph(result, &t->arena);
+    } else {
+        t->error = error;
+    }
+
+    __atomic_store_n(&t->state, TASK_DONE, __ATOMIC_SEQ_CST);
+    pool_wake();
+}
+
+static void *worker_main(void *arg) {
+    int stack_anchor;
+    worker_id = (int)(long)arg;
+    gc_thread_init(&stack_anchor);
+    for (;;) {
+        Task *t = take_task();
+        if (t) {
+            run_task(t);
+            continue;
+        }
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        __atomic_sub_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    const char *env = getenv("TINY_THREADS");
+    long n = env && *env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > 256) n = 256;
+
+    pool.nworkers = (int)n;
+    pool.deques = malloc(n * sizeof(TaskDeque));
+    for (int i = 0; i < n; i++) deque_init(&pool.deques[i]);
+    deque_init(&pool.shared);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+
+    for (int i = 0; i < n; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, (void*)(long)i) != 0) {
+            fprintf(stderr, "Error: spawn: cannot start worker thread\n");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+}
+
+// ===== Task handles =====
+// A handle holds the task's id, not its address: the first join takes the
+// task out of this table and frees it, so joining a copy of the handle
+// again finds nothing and raises instead of touching freed memory.
+static struct {
+    pthread_mutex_t lock;
+    Task **buckets;
+    long size;            // Buckets (a power of two)
+    long count;
+    long next_id;
+} handles = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 1};
+
+static void handle_add(Task *t) {
+    pthread_mutex_lock(&handles.lock);
+    if (handles.count >= handles.size) {
+        long size = handles.size ? handles.size * 2 : 64;
+        Task **buckets = calloc(size, sizeof(Task*));
+        for (long i = 0; i < handles.size; i++) {
+            while (handles.buckets[i]) {
+                Task *h = handles.buckets[i];
+                handles.buckets[i] = h->next_handle;
+                h->next_handle = buckets[h->id & (size - 1)];
+                buckets[h->id & (size - 1)] = h;
+            }
+        }
+        free(handles.buckets);
+        handles.buckets = buckets;
+        handles.size = size;
+    }
+    t->id = handles.next_id++;
+    Task **bucket = &handles.buckets[t->id & (handles.size - 1)];
+    t->next_handle = *bucket;
+    *bucket = t;
+    handles.count++;
+    pthread_mutex_unlock(&handles.lock);
+}
+
+// The task with this id, removed from the table; NULL if it was joined
+static Task *handle_take(long id) {
+    Task *t = NULL;
+    pthread_mutex_lock(&handles.lock);
+    if (handles.size > 0) {
+        for (Task **link = &handles.buckets[id & (handles.size - 1)]; *link; link = &(*link)->next_handle) {
+            if ((*link)->id == id) {
+                t = *link;
+                *link = t->next_handle;
+                handles.count--;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&handles.lock);
+    return t;
+}
+
+Value task_spawn(Value fn, Value *args, int arg_count, void *ctx) {
+    if (!ctx) {
+        if (fn.type != TYPE_FUNCTION) {
+            fprintf(stderr, "Error: spawn() requires a function as its first argument\n");
+            exit(1);
+        }
+        FuncRef *f = (FuncRef*)fn.data;
+        if (f->arity != arg_count) {
+            fprintf(stderr, "Error: spawn: function '%s' expects %d arguments, got %d\n",
+                    f->name, f->arity, arg_count);
+            exit(1);
+        }
+    }
+    pthread_once(&pool_once, pool_start);
+
+    Task *t = calloc(1, sizeof(Task));
+    t->fn = fn;
+    t->ctx = ctx;
+    t->arg_count = arg_count;
+    if (arg_count > 0) {
+        t->args = arena_alloc(&t->arena, arg_count * sizeof(Value));
+        for (int i = 0; i < arg_count; i++) {
+            t->args[i] = copy_graph(args[i], &t->arena);
+        }
+    }
+    t->state = TASK_QUEUED;
+    handle_add(t);
+    long id = t->id;  // t may be joined and freed by another thread once queued
+
+    deque_push(worker_id >= 0 ? &pool.deques[worker_id] : &pool.shared, t);
+    __atomic_add_fetch(&pool.queued, 1, __ATOMIC_SEQ_CST);
+    pool_wake();
+    return (Value){TYPE_TASK, id};
+}
+
+// Block until t is done, running other queued tasks in the meantime. Such
+// a task gets a heap of its own: its GC cannot see our roots (the
+// interpreter's environments are swapped out while it runs) and must not
+// collect our objects.
+static void task_wait(Task *t) {
+    while (__atomic_load_n(&t->state, __ATOMIC_SEQ_CST) != TASK_DONE) {
+        Task *other = take_task();
+        if (other) {
+            GC *saved = malloc(sizeof(GC));
+            gc_heap_push(saved);
+            run_task(other);
+            gc_heap_merge(saved);
+            free(saved);
+            continue;
+        }
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&t->state, __ATOMIC_SEQ_CST) != TASK_DONE &&
+               __atomic_load_n(&pool.queued, __ATOMIC_SEQ_CST) == 0) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        __atomic_sub_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+// Message of the last failed join on this thread (see task_join_result)
+static __thread char *join_error = NULL;
+
+int task_join_result(Value task, Value *result, const char **error) {
+    if (task.type != TYPE_TASK || !task.data) {
+        fprintf(stderr, "Error: join() requires a task returned by spawn()\n");
+        exit(1);
+    }
+    Task *t = handle_take(task.data);
+    if (!t) {
+        *error = "join: the task was already joined";
+        return 1;
+    }
+    task_wait(t);
+    int failed = t->error != NULL;
+    if (failed) {
+        free(join_error);
+        join_error = t->error;
+        *error = join_error;
+    } else {
+        *result = copy_graph(t->result, NULL);
+    }
+    // Only the copy in this thread's heap is left
+    arena_free(&t->arena);
+    free(t);
+    return failed;
+}
+
+Value task_join(Value task) {
+    Value result;
+    const char *error;
+    if (task_join_result(task, &result, &error) != 0) {
+        __raise_message(error);
+    }
+    return result;
+}
+
+// ===== parallel for =====
+
+__thread int parallel_for_depth;
+__thread int task_globals_hidden;
+
+void task_global_used(const char *name, Value v, int line, const char *file) {
+    if (v.type == TYPE_FUNCTION || v.type == TYPE_CLASS) return;
+    fprintf(stderr, "Error at %s:%d: Global variable '%s' is not visible inside a task; "
+            "pass it as an argument\n", file, line, name);
+    exit(1);
+}
+
+struct ParallelLoop {
+    ParallelBody body;
+    int hidden;           // The caller's task_globals_hidden, for the chunks
+    Value **env;
+    long next;            // First unclaimed index
+    long end;             // Last index (inclusive)
+    long chunk;           // Iterations per claim
+    long pending;         // Chunks not finished yet
+    int refs;             // The caller plus queued helper tasks
+    char *error;          // First uncaught raise
+};
+
+static void loop_release(ParallelLoop *l) {
+    if (__atomic_sub_fetch(&l->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(l->error);
+        free(l);
+    }
+}
+
+// Claim and run chunks until none are left. After a raise the remaining
+// chunks are only counted off.
+static void loop_run_chunks(ParallelLoop *l) {
+    for (;;) {
+        long lo = __atomic_fetch_add(&l->next, l->chunk, __ATOMIC_RELAXED);
+        if (lo > l->end) break;
+        long hi = lo + l->chunk - 1 > l->end ? l->end : lo + l->chunk - 1;
+        if (!__atomic_load_n(&l->error, __ATOMIC_ACQUIRE)) {
+            char *error = NULL;
+            int hidden = task_globals_hidden;
+            task_globals_hidden = l->hidden;
+            parallel_for_depth++;
+            if (parallel_for_call(l->body, lo, hi, l->env, &error) != 0) {
+                char *none = NULL;
+                if (!__atomic_compare_exchange_n(&l->error, &none, error, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    free(error);
+                }
+            }
+            parallel_for_depth--;
+            task_globals_hidden = hidden;
+        }
+        if (__atomic_sub_fetch(&l->pending, 1, __ATOMIC_SEQ_CST) == 0) pool_wake();
+    }
+}
+
+// Helpers that start after every chunk was claimed just drop their reference
+static void loop_help(Task *t) {
+    ParallelLoop *l = t->loop;
+    free(t);
+    loop_run_chunks(l);
+    loop_release(l);
+}
+
+// Runs the loop and returns the first uncaught raise (malloc'd), or NULL
+static char *loop_run(ParallelBody body, long start, long end, Value **env) {
+    if (start > end) {
+        long tmp = start;
+        start = end;
+        end = tmp;
+    }
+    pthread_once(&pool_once, pool_start);
+
+    // A few chunks per thread, so uneven iterations still spread out
+    long n = end - start + 1;
+    long nchunks = (long)(pool.nworkers + 1) * 4;
+    if (nchunks > n) nchunks = n;
+    long chunk = (n + nchunks - 1) / nchunks;
+    nchunks = (n + chunk - 1) / chunk;
+    int helpers = nchunks - 1 < pool.nworkers ? (int)(nchunks - 1) : pool.nworkers;
+
+    ParallelLoop *l = calloc(1, sizeof(ParallelLoop));
+    l->body = body;
+    l->hidden = task_globals_hidden;
+    l->env = env;
+    l->next = start;
+    l->end = end;
+    l->chunk = chunk;
+    l->pending = nchunks;
+    l->refs = 1 + helpers;
+    for (int i = 0; i < helpers; i++) {
+        Task *t = calloc(1, sizeof(Task));
+        t->loop = l;
+        deque_push(worker_id >= 0 ? &pool.deques[worker_id] : &pool.shared, t);
+    }
+    if (helpers > 0) {
+        __atomic_add_fetch(&pool.queued, helpers, __ATOMIC_SEQ_CST);
+        pool_wake();
+    }
+
+    // Run our share in a fresh heap (see task.h), then wait for the chunks
+    // still running elsewhere. Nothing else runs here meanwhile: those
+    // chunks never wait on this thread.
+    GC *saved = malloc(sizeof(GC));
+    gc_heap_push(saved);
+    loop_run_chunks(l);
+    if (__atomic_load_n(&l->pending, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        __atomic_add_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&l->pending, __ATOMIC_SEQ_CST) > 0) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        __atomic_sub_fetch(&pool.sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    gc_heap_merge(saved);
+    free(saved);
+
+    char *error = __atomic_exchange_n(&l->error, NULL, __ATOMIC_ACQ_REL);
+    loop_release(l);
+    return error;
+}
+
+// Re-raise a malloc'd message in the calling thread
+static void raise_owned(char *error) {
+    char msg[strlen(error) + 1];
+    memcpy(msg, error, sizeof(msg));
+    free(error);
+    __raise_message(msg);
+}
+
+void parallel_for(ParallelBody body, long start, long end, Value **env) {
+    char *error = loop_run(body, start, end, env);
+    if (error) raise_owned(error);
+}
+
+// ===== map / filter / reduce =====
+
+typedef struct ArenaNode {
+    Arena arena;
+    struct ArenaNode *next;
+} ArenaNode;
+
+typedef struct {
+    int op;
+    Value *items;         // The input array's elements (caller's heap, read-only)
+    Value fn;
+    Value init;
+    void *ctx;
+    Value *out;           // Transfer copies: map results, reduce chunk results at
+                          // the chunk's first index
+    char *keep;           // filter: element passes; reduce: out[i] is set
+    ArenaNode *arenas;    // One per chunk, holding its transfer copies
+} ApplyJob;
+
+// Call fn inside a chunk; a raise ends the chunk (see loop_run_chunks)
+static Value apply_call(ApplyJob *job, Value *args, int argc) {
+    Value result;
+    char *error;
+    if (task_call(job->fn, args, argc, job->ctx, &result, &error) != 0) {
+        raise_owned(error);
+    }
+    return result;
+}
+
+static void apply_chunk(long lo, long hi, Value **env) {
+    ApplyJob *job = (ApplyJob*)env;  // parallel_for passes the job through
+    ArenaNode *node = calloc(1, sizeof(ArenaNode));
+    node->next = __atomic_load_n(&job->arenas, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&job->arenas, &node->next, node, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+
+    int kind = job->op & ~APPLY_PARALLEL;
+    Value args[2];
+    for (long i = lo; i <= hi; i++) {
+        // A private copy of the element, as spawn() would pass it
+        Value item = copy_graph(job->items[i], NULL);
+        if (kind == APPLY_MAP) {
+            args[0] = item;
+            Value r = apply_call(job, args, 1);
+            job->out[i] = copy_graph(r, &node->arena);
+        } else if (kind == APPLY_FILTER) {
+            args[0] = item;
+            job->keep[i] = is_truthy_rt(apply_call(job, args, 1));
+        } else {
+            if (i == lo) args[0] = copy_graph(job->init, NULL);  // Every chunk starts from init
+            args[1] = item;
+            args[0] = apply_call(job, args, 2);
+        }
+    }
+    if (kind == APPLY_REDUCE) {
+        job->out[lo] = copy_graph(args[0], &node->arena);
+        job->keep[lo] = 1;
+    }
+}
+
+static int apply_run(int op, Value arr, Value fn, Value init, Value combine, void *ctx,
+                     Value *result, char **error);
+
+// The p* variants hide the global variables from fn (see task.h) whether
+// or not the array is long enough to be split, and while the chunk results
+// are merged
+int array_apply(int op, Value arr, Value fn, Value init, Value combine, void *ctx,
+                Value *result, char **error) {
+    int parallel = (op & APPLY_PARALLEL) != 0;
+    task_globals_hidden += parallel;
+    int failed = apply_run(op, arr, fn, init, combine, ctx, result, error);
+    task_globals_hidden -= parallel;
+    return failed;
+}
+
+static int apply_run(int op, Value arr, Value fn, Value init, Value combine, void *ctx,
+                     Value *result, char **error) {
+    Array *a = (Array*)arr.data;
+    Value *items = (Value*)a->data;
+    long n = a->size;
+    int kind = op & ~APPLY_PARALLEL;
+
+    if (!(op & APPLY_PARALLEL) || n < APPLY_MIN_PARALLEL) {
+        Value out = kind == APPLY_REDUCE ? init : make_array();
+        Value args[2];
+        for (long i = 0; i < n; i++) {
+            Value r;
+            if (kind == APPLY_REDUCE) {
+                args[0] = out;
+                args[1] = items[i];
+                if (task_call(fn, args, 2, ctx, &out, error) != 0) return 1;
+                continue;
+            }
+            args[0] = items[i];
+            if (task_call(fn, args, 1, ctx, &r, error) != 0) return 1;
+            if (kind == APPLY_MAP) {
+                append(out, r);
+            } else if (is_truthy_rt(r)) {
+                append(out, items[i]);
+            }
+        }
+        *result = out;
+        return 0;
+    }
+
+    ApplyJob job = {op, items, fn, init, ctx, NULL, NULL, NULL};
+    job.out = calloc(n, sizeof(Value));
+    job.keep = calloc(n, 1);
+    *error = loop_run(apply_chunk, 0, n - 1, (Value**)&job);
+
+    // Ordered merge into the caller's heap
+    if (!*error) {
+        if (kind == APPLY_REDUCE) {
+            if (combine.type == TYPE_NULL) combine = fn;
+            Value args[2] = {{TYPE_NULL, 0}, {TYPE_NULL, 0}};
+            int first = 1;
+            for (long i = 0; i < n && !*error; i++) {
+                if (!job.keep[i]) continue;
+                Value part = copy_graph(job.out[i], NULL);
+                if (first) {
+                    args[0] = part;
+                    first = 0;
+                } else {
+                    args[1] = part;
+                    if (task_call(combine, args, 2, ctx, &args[0], error) != 0) break;
+                }
+            }
+            *result = args[0];
+        } else {
+            Value out = make_array();
+            for (long i = 0; i < n; i++) {
+                if (kind == APPLY_MAP) {
+                    append(out, copy_graph(job.out[i], NULL));
+                } else if (job.keep[i]) {
+                    append(out, items[i]);
+                }
+            }
+            *result = out;
+        }
+    }
+
+    while (job.arenas) {
+        ArenaNode *next = job.arenas->next;
+        arena_free(&job.arenas->arena);
+        free(job.arenas);
+        job.arenas = next;
+    }
+    free(job.out);
+    free(job.keep);
+    return *error ? 1 : 0;
+}
+
+// combine is preduce's function for the chunk results, or null
+static Value apply_builtin(const char *name, int op, Value arr, Value fn, Value init, Value combine) {
+    int arity = (op & ~APPLY_PARALLEL) == APPLY_REDUCE ? 2 : 1;
+    if (arr.type != TYPE_ARRAY) {
+        fprintf(stderr, "Error: %s() requires an array as its first argument\n", name);
+        exit(1);
+    }
+    if (fn.type != TYPE_FUNCTION) {
+        fprintf(stderr, "Error: %s() requires a function as its second argument\n", name);
+        exit(1);
+    }
+    if (combine.type != TYPE_NULL && combine.type != TYPE_FUNCTION) {
+        fprintf(stderr, "Error: %s() requires a function as its fourth argument\n", name);
+        exit(1);
+    }
+    Value fns[2] = {fn, combine};
+    for (int i = 0; i < 2 && fns[i].type == TYPE_FUNCTION; i++) {
+        FuncRef *f = (FuncRef*)fns[i].data;
+        if (f->arity != arity) {
+            fprintf(stderr, "Error: %s: function '%s' must take %d argument%s\n",
+                    name, f->name, arity, arity == 1 ? "" : "s");
+            exit(1);
+        }
+    }
+    Value result;
+    char *error;
+    if (array_apply(op, arr, fn, init, combine, NULL, &result, &error) != 0) {
+        raise_owned(error);
+    }
+    return result;
+}
+
+static const Value none = {TYPE_NULL, 0};
+
+Value array_map(Value arr, Value fn) {
+    return apply_builtin("map", APPLY_MAP, arr, fn, none, none);
+}
+
+Value array_filter(Value arr, Value fn) {
+    return apply_builtin("filter", APPLY_FILTER, arr, fn, none, none);
+}
+
+Value array_reduce(Value arr, Value fn, Value init) {
+    return apply_builtin("reduce", APPLY_REDUCE, arr, fn, init, none);
+}
+
+Value array_pmap(Value arr, Value fn) {
+    return apply_builtin("pmap", APPLY_MAP | APPLY_PARALLEL, arr, fn, none, none);
+}
+
+Value array_pfilter(Value arr, Value fn) {
+    return apply_builtin("pfilter", APPLY_FILTER | APPLY_PARALLEL, arr, fn, none, none);
+}
+
+Value array_preduce(Value arr, Value fn, Value init, Value combine) {
+    return apply_builtin("preduce", APPLY_REDUCE | APPLY_PARALLEL, arr, fn, init, combine);
+}
@@ -0,0 +1,108 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "runtime.h"
+
+// Task parallelism: spawn(fun, args...) / join(task).
+//
+// Tasks run on a pool of worker threads (TINY_THREADS, default: one per
+// CPU) started on the first spawn. Each worker owns a private heap and GC
+// (gc.h), exception stack and source context, so no object is ever shared
+// between threads: arguments are deep-copied out of the spawning thread's
+// heap when the task is created and into the worker's heap when it starts;
+// the result travels back the same way at join. Strings, arrays, dicts and
+// instances are copied (cycles and shared references are preserved);
+// classes and functions are immutable and passed by reference.
+//
+// Scheduling is work-stealing: a worker pushes the tasks it spawns onto its
+// own deque and pops them LIFO; idle workers take from the shared queue
+// that other threads submit to, then steal FIFO from the other deques. A
+// thread blocked in join() runs queued tasks meanwhile, so nested
+// spawn/join cannot deadlock the pool.
+
+typedef struct Task Task;
+
+// spawn(): queue fn(args...) and return a TYPE_TASK handle. ctx is backend
+// data handed to task_call (NULL for compiled code, which passes FuncRef
+// values; the interpreter passes the global functions/classes to use).
+Value task_spawn(Value fn, Value *args, int arg_count, void *ctx);
+
+// join(): wait for the task and return a copy of its result in the calling
+// thread's heap. If the task raised, re-raise its message here. The first
+// join frees the task; joining its handle again raises.
+Value task_join(Value task);
+
+// Like task_join but reports failure instead of raising: returns 0 and sets
+// *result, or returns 1 and points *error at the message, which stays valid
+// until the calling thread's next join.
+int task_join_result(Value task, Value *result, const char **error);
+
+// Backend hook that runs fn(args) on the current thread. Returns 0 with
+// *result set, or 1 with *error set (malloc'd) when the call raised.
+// runtime.c provides the version for compiled code (weak symbol); the
+// interpreter overrides it.
+int task_call(Value fn, Value *args, int arg_count, void *ctx, Value *result, char **error);
+
+// parallel for (LLVM backend): the loop body is outlined into a function
+// that runs the iterations lo..hi (ascending, inclusive); env holds the
+// addresses of the enclosing function's variables.
+//
+// parallel_for() splits start..end into chunks that the calling thread and
+// pool workers claim until none are left, and returns when all of them are
+// done. If an iteration raises, the remaining chunks are skipped and the
+// first message is re-raised in the caller. While it runs, the caller
+// allocates from a fresh heap that is merged back into its own at the end,
+// so every thread executing the body follows the same rule: objects from
+// before the loop are shared and may be read, and array elements may be
+// overwritten with numbers, booleans, null or other shared values, but they
+// must not be resized or receive objects created inside the loop.
+typedef void (*ParallelBody)(long lo, long hi, Value **env);
+void parallel_for(ParallelBody body, long start, long end, Value **env);
+
+// Runs body(lo, hi, env) like task_call: returns 1 with *error set
+// (malloc'd) if an iteration raised
+int parallel_for_call(ParallelBody body, long lo, long hi, Value **env, char **error);
+
+// map/filter/reduce over an array. fn is called through task_call with
+// ctx as for spawn. The APPLY_PARALLEL variants (pmap/pfilter/preduce) run
+// chunks of the array through parallel_for: each call gets copies of its
+// arguments in the executing thread's heap, like spawn, and the results are
+// merged in array order. preduce folds every chunk on its own, each starting
+// from a copy of init, and then folds the chunk results in order with
+// combine (fn when combine is null). For the result to be the one reduce
+// gives, init must be an identity for combine and combine(fold(a), fold(b))
+// must equal fold(a + b): with combine == fn that means fn is associative and
+// takes its own results as elements. Arrays shorter than APPLY_MIN_PARALLEL
+// are folded sequentially on the calling thread, and combine is not called.
+#define APPLY_MAP 0
+#define APPLY_FILTER 1
+#define APPLY_REDUCE 2
+#define APPLY_PARALLEL 4
+#define APPLY_MIN_PARALLEL 64
+
+// Returns 0 with *result set, or 1 with *error set (malloc'd) if fn raised
+int array_apply(int op, Value arr, Value fn, Value init, Value combine, void *ctx,
+                Value *result, char **error);
+
+// Builtins for compiled code (fn is a FuncRef); they raise on error
+Value array_map(Value arr, Value fn);
+Value array_filter(Value arr, Value fn);
+Value array_reduce(Value arr, Value fn, Value init);
+Value array_pmap(Value arr, Value fn);
+Value array_pfilter(Value arr, Value fn);
+Value array_preduce(Value arr, Value fn, Value init, Value combine);
+
+// Non-zero while the calling thread executes a parallel for body; the
+// runtime then checks stores into objects outside its heap (see above)
+extern __thread int parallel_for_depth;
+
+// Non-zero while the calling thread runs a spawned task or a
+// pmap/pfilter/preduce call, including the parallel for chunks they start.
+// The program's top-level variables are hidden there, as in the
+// interpreter: compiled code checks this flag before using one inside a
+// function and calls task_global_used, which exits with the interpreter's
+// error unless the value is a function or a class.
+extern __thread int task_globals_hidden;
+void task_global_used(const char *name, Value v, int line, const char *file);
+
+#endif // TASK_H
@@ -53,7 +53,7 @@ def run_llvm(test_file: Path) -> bool:
             return True
 
         clang_proc = subprocess.run(
-            ["clang", "-O1", "-Wno-override-module", str(ll_path), "runtime.o", "-o", str(bin_path)],
+            ["clang", "-O1", "-Wno-override-module", str(ll_path), "runtime.o", "gc.o", "task.o", "numfmt.o", "-lpthread", "-o", str(bin_path)],
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
             text=True,
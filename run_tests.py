@@ -1,6 +1,8 @@
 #!/usr/bin/env python3
 import argparse
+import os
 import re
+import shlex
 import subprocess
 import sys
 import tempfile
@@ -48,6 +50,15 @@ def read_expectations(path: Path):
     return [{"num": num, "mode": mode, "text": text} for _, num, mode, text in items]
 
 
+def read_option(path: Path, key: str):
+    """Text of a `# <key>: ...` line (options for running the test), or None."""
+    with path.open() as f:
+        for line in f:
+            if line.startswith(f"# {key}:"):
+                return line.split(":", 1)[1].strip()
+    return None
+
+
 def ensure_built():
     """Build the C interpreter and LLVM compiler once before running tests."""
     if not (INTERPRETER.exists() and LLVM_COMPILER.exists()):
@@ -63,11 +74,12 @@ def ensure_built():
         sys.exit(result.returncode)
 
 
-def run_interpreter(test_file: Path):
+def run_interpreter(test_file: Path, options=None):
     test_path = test_file.resolve()
     exe = INTERPRETER.resolve()
+    extra = shlex.split(options) if options else []
     proc = subprocess.run(
-        [str(exe), str(test_path)],
+        [str(exe)] + extra + [str(test_path)],
         stdout=subprocess.PIPE,
         stderr=subprocess.PIPE,
         text=True,
@@ -76,6 +88,20 @@ def run_interpreter(test_file: Path):
     return proc.returncode, proc.stdout, proc.stderr
 
 
+def run_interpreter_twice(test_file: Path, options: str):
+    """
+    Run the interpreter plainly and again with the test's
+    `# interpreter_args:`; both runs must print exactly the same.
+    """
+    code, out, err = run_interpreter(test_file)
+    if code != 0 or err:
+        return code, out, err
+    code, opt_out, err = run_interpreter(test_file, options)
+    if code == 0 and not err and opt_out != out:
+        return 1, opt_out, f"output with {options} differs from the plain run:\n{out}"
+    return code, opt_out, err
+
+
 def run_llvm(test_file: Path):
     test_path = test_file.resolve()
     compiler_dir = LLVM_COMPILER.parent
@@ -94,7 +120,7 @@ def run_llvm(test_file: Path):
             return compile_proc.returncode, compile_proc.stdout, compile_proc.stderr
 
         clang_proc = subprocess.run(
-            ["clang", "-O1", "-Wno-override-module", str(ll_path), "runtime.o", "gc.o", "-o", str(bin_path)],
+            ["clang", "-O1", "-Wno-override-module", str(ll_path), "runtime.o", "gc.o", "task.o", "numfmt.o", "-lpthread", "-o", str(bin_path)],
             stdout=subprocess.PIPE,
             stderr=subprocess.PIPE,
             text=True,
@@ -113,13 +139,85 @@ def run_llvm(test_file: Path):
         return run_proc.returncode, run_proc.stdout, compile_proc.stderr + clang_proc.stderr + run_proc.stderr
 
 
+def build_and_run(test_file: Path, bin_path: Path, extra, run_args=(), env=None):
+    """Build with codegen_llvm itself (object code and link), then run."""
+    compiler_dir = LLVM_COMPILER.parent
+    compiler_path = LLVM_COMPILER.resolve()
+    compile_proc = subprocess.run(
+        [str(compiler_path), str(test_file.resolve()), "-o", str(bin_path)] + extra,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+        cwd=compiler_dir,
+    )
+    if compile_proc.returncode != 0:
+        return compile_proc.returncode, compile_proc.stdout, compile_proc.stderr
+
+    run_proc = subprocess.run(
+        [str(bin_path)] + list(run_args),
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+        cwd=compiler_dir,
+        env=env,
+    )
+    return run_proc.returncode, run_proc.stdout, compile_proc.stderr + run_proc.stderr
+
+
+def run_llvm_build(test_file: Path, options: str):
+    """
+    Build with the test's `# llvm_args:`, where `{tmp}` is a directory kept
+    for the whole test. The program is built and run twice, so state the
+    first build leaves behind (a --cache-dir) is checked too.
+    """
+    with tempfile.TemporaryDirectory() as tmpdir:
+        extra = [arg.replace("{tmp}", tmpdir) for arg in shlex.split(options)]
+        bin_path = Path(tmpdir) / "a.out"
+        outputs = []
+        for _ in range(2):
+            code, out, err = build_and_run(test_file, bin_path, extra)
+            if code != 0 or err:
+                return code, out, err
+            outputs.append(out)
+        if outputs[0] != outputs[1]:
+            return 1, outputs[1], f"second build printed different output:\n{outputs[0]}"
+        return 0, outputs[1], ""
+
+
+def run_llvm_profiled(test_file: Path, train_args: str):
+    """
+    Build with --profile-gen and run that with the test's `# llvm_train_args:`
+    to collect a profile, then rebuild with --profile-use and run without
+    arguments, on inputs the training run never saw.
+    """
+    with tempfile.TemporaryDirectory() as tmpdir:
+        profile = Path(tmpdir) / "profile.data"
+        bin_path = Path(tmpdir) / "a.out"
+        env = dict(os.environ, TINY_PROFILE_OUT=str(profile))
+        code, out, err = build_and_run(test_file, bin_path, ["--profile-gen"], shlex.split(train_args), env)
+        if code != 0 or err:
+            return code, out, err
+        if not profile.exists():
+            return 1, out, "training run wrote no profile"
+        return build_and_run(test_file, bin_path, [f"--profile-use={profile}"])
+
+
 def run_test(test_file: Path, backend: str):
     expected = read_expectations(test_file)
     if not expected:
         return None, "no expectations found"
 
-    if backend == "interpreter":
+    interpreter_args = read_option(test_file, "interpreter_args")
+    llvm_args = read_option(test_file, "llvm_args")
+    train_args = read_option(test_file, "llvm_train_args")
+    if backend == "interpreter" and interpreter_args is not None:
+        code, out, err = run_interpreter_twice(test_file, interpreter_args)
+    elif backend == "interpreter":
         code, out, err = run_interpreter(test_file)
+    elif llvm_args is not None:
+        code, out, err = run_llvm_build(test_file, llvm_args)
+    elif train_args is not None:
+        code, out, err = run_llvm_profiled(test_file, train_args)
     else:
         code, out, err = run_llvm(test_file)
 
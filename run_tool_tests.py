@@ -0,0 +1,253 @@
+#!/usr/bin/env python3
+"""
+Smoke tests for the profiling and tracing tools: each runs a program from
+examples/test with a tool turned on, checks the program prints exactly what
+it prints without the tool, and checks the tool wrote its output.
+"""
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+from pathlib import Path
+
+from run_tests import INTERPRETER, LLVM_COMPILER, TEST_DIR, ensure_built
+
+TESTS = []
+
+
+def tool_test(func):
+    TESTS.append(func)
+    return func
+
+
+def run(cmd, env=None, cwd=None):
+    return subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True, env=env, cwd=cwd)
+
+
+def interpret(program: Path, options=()):
+    return run([str(INTERPRETER.resolve())] + list(options) + [str(program.resolve())], cwd=INTERPRETER.parent)
+
+
+def build(program: Path, exe: Path, options=(), cwd=None):
+    """codegen_llvm program -o exe, linking the runtime objects in cwd (by
+    default the ones next to codegen_llvm); returns None, or the failure."""
+    proc = run([str(LLVM_COMPILER.resolve()), str(program.resolve()), "-o", str(exe)] + list(options),
+               cwd=cwd or LLVM_COMPILER.parent)
+    if proc.returncode != 0:
+        return f"codegen_llvm {' '.join(options)} failed (exit {proc.returncode}):\n{proc.stderr}"
+    return None
+
+
+def same_output(plain, tooled):
+    """None if both runs succeeded and printed the same, else what went wrong."""
+    if plain.returncode != 0:
+        return f"plain run failed (exit {plain.returncode}):\n{plain.stderr}"
+    if tooled.returncode != 0:
+        return f"exit {tooled.returncode}\nstderr:\n{tooled.stderr}"
+    if tooled.stdout != plain.stdout:
+        return f"output differs from the plain run:\n{tooled.stdout}\nexpected:\n{plain.stdout}"
+    return None
+
+
+@tool_test
+def sampling_profiler(tmp: Path):
+    """interpreter --profile=FILE writes folded stacks rooted at <main>."""
+    program = TEST_DIR / "gc.tl"
+    folded = tmp / "out.folded"
+    err = same_output(interpret(program), interpret(program, [f"--profile={folded}"]))
+    if err:
+        return err
+    if not folded.exists():
+        return "no profile written"
+    stack = re.compile(r"^<main> \(gc\.tl:\d+\)(;[^;]+ \([^;]+:\d+\))* (\d+)$")
+    samples = 0
+    for line in folded.read_text().splitlines():
+        m = stack.match(line)
+        if not m:
+            return f"malformed folded line:\n{line}"
+        samples += int(m.group(2))
+    if samples == 0:
+        return "profile has no samples"
+    return None
+
+
+@tool_test
+def instrument_report(tmp: Path):
+    """codegen_llvm --instrument: TINY_INSTR_OUT gets call counts and hot lines."""
+    program = TEST_DIR / "method_dispatch.tl"
+    report = tmp / "instr.txt"
+    err = build(program, tmp / "plain") or build(program, tmp / "instr", ["--instrument"])
+    if err:
+        return err
+    env = dict(os.environ, TINY_INSTR_OUT=str(report))
+    err = same_output(run([str(tmp / "plain")]), run([str(tmp / "instr")], env=env))
+    if err:
+        return err
+    if not report.exists():
+        return "no report written"
+    text = report.read_text()
+    for needle in ["=== Function calls ===", "Account.fib (method_dispatch.tl:", "=== Hot lines ("]:
+        if needle not in text:
+            return f"report lacks {needle!r}:\n{text}"
+    return None
+
+
+@tool_test
+def instrument_modules(tmp: Path):
+    """codegen_llvm --instrument --cache-dir: one report at exit, covering the
+    program and every include compiled as a separate module."""
+    program = TEST_DIR / "include_module.tl"
+    err = build(program, tmp / "plain") or \
+        build(program, tmp / "instr", ["--instrument", f"--cache-dir={tmp / 'cache'}"])
+    if err:
+        return err
+    plain, instr = run([str(tmp / "plain")]), run([str(tmp / "instr")])
+    err = same_output(plain, instr)
+    if err:
+        return err
+    reports = instr.stderr.count("=== Function calls ===")
+    if reports != 1:
+        return f"{reports} reports written, expected one:\n{instr.stderr}"
+    for needle in ["local_square (include_module.tl:", "square (include_module_math.tl:",
+                   "Counter.add (include_module_base.tl:"]:
+        if needle not in instr.stderr:
+            return f"report lacks {needle!r}:\n{instr.stderr}"
+    return None
+
+
+@tool_test
+def debug_line_table(tmp: Path):
+    """codegen_llvm -g: the executable's line table names the .tl file."""
+    program = TEST_DIR / "method_dispatch.tl"
+    err = build(program, tmp / "plain") or build(program, tmp / "debug", ["-g"])
+    if err:
+        return err
+    err = same_output(run([str(tmp / "plain")]), run([str(tmp / "debug")]))
+    if err:
+        return err
+    lines = run(["readelf", "--debug-dump=line", str(tmp / "debug")])
+    if lines.returncode != 0:
+        return f"readelf failed:\n{lines.stderr}"
+    if "method_dispatch.tl" not in lines.stdout:
+        return "line table does not name method_dispatch.tl"
+    return None
+
+
+@tool_test
+def gc_trace(tmp: Path):
+    """TINY_GC_TRACE=1: one JSON record per line, from both backends, and the
+    log reads with bench/gc_trace_summary.py."""
+    program = TEST_DIR / "gc.tl"
+    err = build(program, tmp / "plain")
+    if err:
+        return err
+    interpreter = [str(INTERPRETER.resolve()), str(program.resolve())]
+    for name, cmd in [("interpreter", interpreter), ("llvm", [str(tmp / "plain")])]:
+        log = tmp / f"{name}.log"
+        env = dict(os.environ, TINY_GC_TRACE="1", TINY_GC_TRACE_FILE=str(log))
+        err = same_output(run(cmd), run(cmd, env=env))
+        if err:
+            return f"{name}: {err}"
+        if not log.exists():
+            return f"{name}: no trace written"
+        events = set()
+        for line in log.read_text().splitlines():
+            try:
+                events.add(json.loads(line)["ev"])
+            except (ValueError, KeyError):
+                return f"{name}: malformed trace record:\n{line}"
+        if not {"init", "gc", "alloc", "exit"} <= events:
+            return f"{name}: trace has only {sorted(events)} records"
+        summary = run([sys.executable, "bench/gc_trace_summary.py", str(log)])
+        if summary.returncode != 0 or "=== GC pauses ===" not in summary.stdout:
+            return f"{name}: gc_trace_summary.py failed:\n{summary.stderr}"
+    return None
+
+
+def usdt_probes(exe: Path):
+    """{probe name: [argument count of each site]} for provider tiny."""
+    notes = run(["readelf", "-n", str(exe)]).stdout
+    probes = {}
+    provider = name = None
+    for line in notes.splitlines():
+        line = line.strip()
+        if line.startswith("Provider:"):
+            provider = line.split(":", 1)[1].strip()
+        elif line.startswith("Name:"):
+            name = line.split(":", 1)[1].strip()
+        elif line.startswith("Arguments:") and provider == "tiny":
+            probes.setdefault(name, []).append(len(line.split(":", 1)[1].split()))
+    return probes
+
+
+@tool_test
+def usdt_probes_build(tmp: Path):
+    """The probe notes are in the interpreter and in compiled programs, and a
+    program linked with a -DTINY_NO_PROBES runtime prints the same."""
+    runtime_probes = {"gc_start": 2, "gc_end": 2, "gc_alloc_large": 2, "raise": 3}
+    wanted = [
+        ("interpreter", INTERPRETER, dict(runtime_probes, call_entry=3, call_return=1)),
+        ("compiled", tmp / "probes", dict(runtime_probes, func_entry=1)),
+    ]
+    program = TEST_DIR / "method_dispatch.tl"
+    err = build(program, tmp / "probes")
+    if err:
+        return err
+    for label, exe, probes in wanted:
+        found = usdt_probes(exe)
+        for name, args in probes.items():
+            if name not in found:
+                return f"{label}: no tiny:{name} probe in {sorted(found)}"
+            if any(n != args for n in found[name]):
+                return f"{label}: tiny:{name} sites take {found[name]} arguments, expected {args}"
+        if "func_entry" in probes and len(found["func_entry"]) < 2:
+            return f"{label}: only {len(found['func_entry'])} func_entry site(s)"
+
+    compiler_dir = LLVM_COMPILER.parent
+    nop_dir = tmp / "no_probes"
+    nop_dir.mkdir()
+    for src in ["runtime", "gc", "task", "numfmt"]:
+        cc = run(["gcc", "-Wall", "-Icore", "-DTINY_NO_PROBES", "-c", f"{src}.c", "-o", str(nop_dir / f"{src}.o")],
+                 cwd=compiler_dir)
+        if cc.returncode != 0:
+            return f"{src}.c does not build with -DTINY_NO_PROBES:\n{cc.stderr}"
+    err = build(program, tmp / "no_probes.out", cwd=nop_dir)
+    if err:
+        return err
+    left = set(usdt_probes(tmp / "no_probes.out")) - {"func_entry"}
+    if left:
+        return f"-DTINY_NO_PROBES runtime still has probes {sorted(left)}"
+    return same_output(run([str(tmp / "no_probes.out")]), run([str(tmp / "probes")]))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run smoke tests for the profiling and tracing tools.")
+    parser.add_argument("--filter", help="Substring filter for test names", default="")
+    args = parser.parse_args()
+
+    ensure_built()
+
+    tests = [t for t in TESTS if args.filter in t.__name__]
+    failures = []
+    for test in tests:
+        with tempfile.TemporaryDirectory() as tmpdir:
+            msg = test(Path(tmpdir))
+        if msg is None:
+            print(f"[PASS] {test.__name__}")
+        else:
+            print(f"[FAIL] {test.__name__}")
+            print(msg)
+            failures.append(test)
+
+    if failures:
+        print(f"\n{len(failures)} test(s) failed.")
+        return 1
+    print(f"\nAll {len(tests)} test(s) passed.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())